@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include "NxArchive.h"
+
+NxArchive::NxArchive(const char *file)
+{
+    memset(&m_header, 0, sizeof(NxArchiveHeader));
+    m_file.open(file, std::ifstream::binary);
+    if (!m_file.is_open())
+        return;
+
+    if (!m_file.read((char *)&m_header, sizeof(NxArchiveHeader)) || memcmp(m_header.magic, NXA_MAGIC, 4)
+        || m_header.version != NXA_VERSION)
+        return;
+
+    // Region table
+    m_regions.resize(m_header.region_count);
+    if (m_header.region_count && !m_file.read((char *)&m_regions[0], sizeof(NxArchiveRegion) * m_header.region_count))
+        return;
+
+    // Regions must cover the whole storage
+    u64 offset = 0;
+    for (NxArchiveRegion &region : m_regions)
+    {
+        if (region.offset != offset || (region.map_size && region.map_size < (region.size / CLUSTER_SIZE + 7) / 8))
+            return;
+        offset += region.size;
+    }
+    b_valid = offset == m_header.size;
+}
+
+bool NxArchive::isArchive(const char *file)
+{
+    std::ifstream infile(file, std::ifstream::binary);
+    char magic[4];
+    return infile.read(magic, 4) && !memcmp(magic, NXA_MAGIC, 4);
+}
+
+bool NxArchive::seekRegion(const NxArchiveRegion &region, std::vector<bool> *cluster_map)
+{
+    cluster_map->clear();
+    m_file.clear();
+    if (!m_file.seekg(region.data_offset))
+        return false;
+
+    if (!region.map_size)
+        return true;
+
+    std::vector<u8> bytes(region.map_size);
+    if (!read(&bytes[0], region.map_size))
+        return false;
+
+    unpackMap(bytes, (size_t)((region.size + CLUSTER_SIZE - 1) / CLUSTER_SIZE), cluster_map);
+    return true;
+}
+
+bool NxArchive::read(void *buffer, DWORD length)
+{
+    return m_file.read((char *)buffer, length) && (DWORD)m_file.gcount() == length;
+}
+
+void NxArchive::packMap(const std::vector<bool> &cluster_map, std::vector<u8> *bytes)
+{
+    bytes->assign((cluster_map.size() + 7) / 8, 0);
+    for (size_t i(0); i < cluster_map.size(); i++)
+        if (cluster_map[i])
+            (*bytes)[i / 8] |= (u8)(1 << (i % 8));
+}
+
+void NxArchive::unpackMap(const std::vector<u8> &bytes, size_t clusters, std::vector<bool> *cluster_map)
+{
+    cluster_map->assign(clusters, false);
+    for (size_t i(0); i < clusters && i / 8 < bytes.size(); i++)
+        (*cluster_map)[i] = (bytes[i / 8] >> (i % 8)) & 1;
+}
+
+u64 NxArchive::storedSize(const NxArchiveRegion &region, const std::vector<bool> *cluster_map)
+{
+    if (nullptr == cluster_map || cluster_map->empty())
+        return region.size;
+
+    u64 size = 0;
+    for (size_t i(0); i < cluster_map->size(); i++)
+        if ((*cluster_map)[i])
+            size += std::min((u64)CLUSTER_SIZE, region.size - (u64)i * CLUSTER_SIZE);
+    return size;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NxArchive_h__
+#define __NxArchive_h__
+
+#include <fstream>
+#include <vector>
+#include "res/types.h"
+#include "res/utils.h"
+
+#define NXA_MAGIC "NXAR"
+#define NXA_VERSION 1
+#define NXA_PLAIN 0xFF // bis_key value for plain regions
+
+// Compact archive (.nxa) layout :
+// header | region table | for each region : [allocation map] data
+// Regions cover the whole storage in order (partitions & areas between them).
+// For FAT32 partitions, only allocated clusters are stored (raw, as in storage) and
+// free clusters are regenerated on restore (zero clusters, encrypted with BIS key).
+typedef struct NxArchiveHeader NxArchiveHeader;
+struct NxArchiveHeader {
+    char magic[4];      // NXA_MAGIC
+    u32 version;        // NXA_VERSION
+    u64 size;           // storage size
+    u32 type;           // storage type (RAWNAND)
+    u32 region_count;
+};
+
+typedef struct NxArchiveRegion NxArchiveRegion;
+struct NxArchiveRegion {
+    char name[32];      // partition name, empty for other areas (GPT...)
+    u64 offset;         // offset in storage
+    u64 size;
+    u64 data_offset;    // offset of map (if any) & data in archive
+    u32 map_size;       // allocation map size in bytes (1 bit per cluster), 0 if fully stored
+    u8 bis_key;         // BIS key index used to encrypt free clusters, NXA_PLAIN if not encrypted
+    u8 reserved[3];
+};
+
+class NxArchive
+{
+    // Constructors
+    public:
+        explicit NxArchive(const char *file);
+
+    // Member variables
+    private:
+        std::ifstream m_file;
+        NxArchiveHeader m_header;
+        std::vector<NxArchiveRegion> m_regions;
+        bool b_valid = false;
+
+    // Member methods
+    public:
+        bool isValid() { return b_valid; };
+        u64 size() { return m_header.size; };
+        int type() { return (int)m_header.type; };
+        std::vector<NxArchiveRegion>& regions() { return m_regions; };
+
+        // Position archive at region's data (map is read first, if any)
+        bool seekRegion(const NxArchiveRegion &region, std::vector<bool> *cluster_map);
+        bool read(void *buffer, DWORD length);
+
+        static bool isArchive(const char *file);
+        static void packMap(const std::vector<bool> &cluster_map, std::vector<u8> *bytes);
+        static void unpackMap(const std::vector<u8> &bytes, size_t clusters, std::vector<bool> *cluster_map);
+        // Bytes stored for region (allocated clusters only, last cluster may be partial)
+        static u64 storedSize(const NxArchiveRegion &region, const std::vector<bool> *cluster_map);
+};
+
+#endif
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+#include <openssl/evp.h>
+#include "NxChunkStore.h"
+
+NxChunkWriter::NxChunkWriter(const std::string &repository)
+{
+    m_repository = repository;
+    m_chunk.reserve(NXC_CHUNK_SIZE);
+
+    // One worker per core, four chunks in flight per worker
+    unsigned int workers = std::thread::hardware_concurrency();
+    if (!workers)
+        workers = 1;
+    m_max_jobs = workers * 4;
+
+    for (unsigned int i(0); i < workers; i++)
+        m_workers.push_back(std::thread(&NxChunkWriter::workerLoop, this));
+}
+
+NxChunkWriter::~NxChunkWriter()
+{
+    stop();
+    for (NxChunkJob *job : m_jobs)
+        delete job;
+}
+
+void NxChunkWriter::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        b_stop = true;
+    }
+    m_cv.notify_all();
+
+    for (std::thread &worker : m_workers)
+        if (worker.joinable())
+            worker.join();
+}
+
+void NxChunkWriter::workerLoop()
+{
+    for (;;)
+    {
+        NxChunkJob *job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] { return b_stop || !m_pending.empty(); });
+            if (b_stop)
+                break;
+            job = m_pending.front();
+            m_pending.pop_front();
+        }
+
+        // Chunk is only written if not in repository yet (temp file renamed when complete)
+        NxChunkIndex::sha256(&job->data[0], job->data.size(), job->hash);
+        std::string path = chunkPath(m_repository, job->hash);
+        bool stored = false;
+        if (!is_file(path.c_str()))
+        {
+            std::string tmp_path = path + "." + std::to_string((uintptr_t)job) + ".tmp";
+            std::ofstream out_file(tmp_path, std::ofstream::binary);
+            bool success = out_file.write((char *)&job->data[0], job->data.size()).good();
+            out_file.close();
+            if (success && !rename(tmp_path.c_str(), path.c_str()))
+                stored = true;
+            else
+            {
+                remove(tmp_path.c_str());
+                // Same chunk may have been stored by another worker
+                job->error = !is_file(path.c_str());
+            }
+        }
+        std::vector<u8>().swap(job->data);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (stored)
+                m_stored_count++;
+            job->done = true;
+        }
+        m_cv.notify_all();
+    }
+}
+
+bool NxChunkWriter::write(const u8 *buffer, DWORD length)
+{
+    while (length && !b_error)
+    {
+        DWORD chunk = std::min(length, (DWORD)(NXC_CHUNK_SIZE - m_chunk.size()));
+        m_chunk.insert(m_chunk.end(), buffer, buffer + chunk);
+        buffer += chunk;
+        length -= chunk;
+
+        if (m_chunk.size() == NXC_CHUNK_SIZE)
+            submit();
+    }
+    return !b_error;
+}
+
+bool NxChunkWriter::flush()
+{
+    if (!m_chunk.empty())
+        submit();
+    return !b_error;
+}
+
+void NxChunkWriter::submit()
+{
+    NxChunkJob *job = new NxChunkJob;
+    job->data.swap(m_chunk);
+    m_chunk.reserve(NXC_CHUNK_SIZE);
+    m_chunk_count++;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.push_back(job);
+        m_jobs.push_back(job);
+    }
+    m_cv.notify_all();
+    collect(false);
+}
+
+bool NxChunkWriter::collect(bool wait_all)
+{
+    for (;;)
+    {
+        NxChunkJob *job;
+        {
+            // Collect hashes in order, wait for the oldest job if too many are in flight
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_jobs.empty())
+                break;
+            job = m_jobs.front();
+            if (!job->done && !wait_all && m_jobs.size() <= m_max_jobs)
+                break;
+            m_cv.wait(lock, [job] { return job->done; });
+            m_jobs.pop_front();
+        }
+
+        if (job->error)
+            b_error = true;
+        m_hashes.insert(m_hashes.end(), job->hash, job->hash + NXC_HASH_SIZE);
+        delete job;
+    }
+    return !b_error;
+}
+
+bool NxChunkWriter::close()
+{
+    flush();
+    collect(true);
+    stop();
+    dbg_printf("NxChunkWriter::close() %I64d chunks, %I64d new\n", m_chunk_count, m_stored_count);
+    return !b_error;
+}
+
+bool NxChunkWriter::createRepository(const std::string &repository)
+{
+    if (!create_dir(repository.c_str()))
+        return false;
+
+    // One sub directory per first hash byte
+    for (int i(0); i < 0x100; i++)
+        if (!create_dir((repository + PATH_SEPARATOR + n2hexstr(i, 2)).c_str()))
+            return false;
+    return true;
+}
+
+std::string NxChunkWriter::chunkPath(const std::string &repository, const u8 *hash)
+{
+    std::string name = hexStr((unsigned char *)hash, NXC_HASH_SIZE);
+    return repository + PATH_SEPARATOR + name.substr(0, 2) + PATH_SEPARATOR + name;
+}
+
+NxChunkIndex::NxChunkIndex(const char *file)
+{
+    memset(&m_header, 0, sizeof(NxChunkHeader));
+    m_repository = repository(file);
+
+    std::ifstream in_file(file, std::ifstream::binary);
+    if (!in_file.read((char *)&m_header, sizeof(NxChunkHeader)) || memcmp(m_header.magic, NXC_MAGIC, 4)
+        || m_header.version != NXC_VERSION || !m_header.chunk_size || m_header.chunk_size % CLUSTER_SIZE)
+        return;
+
+    // Region table
+    m_regions.resize(m_header.region_count);
+    if (m_header.region_count && !in_file.read((char *)&m_regions[0], sizeof(NxChunkRegion) * m_header.region_count))
+        return;
+
+    // Regions must cover the whole storage
+    u64 offset = 0;
+    size_t chunks = 0;
+    for (NxChunkRegion &region : m_regions)
+    {
+        if (region.offset != offset)
+            return;
+        m_first_chunk.push_back(chunks);
+        chunks += (size_t)((region.size + m_header.chunk_size - 1) / m_header.chunk_size);
+        offset += region.size;
+    }
+    if (offset != m_header.size)
+        return;
+
+    // Chunk hashes
+    m_hashes.resize(chunks * NXC_HASH_SIZE);
+    b_valid = !chunks || in_file.read((char *)&m_hashes[0], m_hashes.size());
+}
+
+bool NxChunkIndex::isIndex(const char *file)
+{
+    std::ifstream infile(file, std::ifstream::binary);
+    char magic[4];
+    return infile.read(magic, 4) && !memcmp(magic, NXC_MAGIC, 4);
+}
+
+bool NxChunkIndex::readChunk(size_t region, size_t n, u8 *buffer, DWORD *length)
+{
+    NxChunkRegion &r = m_regions[region];
+    *length = (DWORD)std::min((u64)m_header.chunk_size, r.size - (u64)n * m_header.chunk_size);
+    const u8 *hash = &m_hashes[(m_first_chunk[region] + n) * NXC_HASH_SIZE];
+
+    // Chunk must have the expected length & hash
+    std::ifstream in_file(NxChunkWriter::chunkPath(m_repository, hash), std::ifstream::binary);
+    if (!in_file.read((char *)buffer, *length) || in_file.get() != EOF)
+    {
+        dbg_printf("NxChunkIndex::readChunk() missing or truncated chunk %s\n", hexStr((unsigned char *)hash, NXC_HASH_SIZE).c_str());
+        return false;
+    }
+
+    u8 check[NXC_HASH_SIZE];
+    sha256(buffer, *length, check);
+    return !memcmp(check, hash, NXC_HASH_SIZE);
+}
+
+bool NxChunkIndex::write(const char *file, NxChunkHeader *header, std::vector<NxChunkRegion> &regions, std::vector<u8> &hashes)
+{
+    std::ofstream out_file(file, std::ofstream::binary);
+    return out_file.write((char *)header, sizeof(NxChunkHeader))
+        && (regions.empty() || out_file.write((char *)&regions[0], sizeof(NxChunkRegion) * regions.size()))
+        && (hashes.empty() || out_file.write((char *)&hashes[0], hashes.size()));
+}
+
+std::string NxChunkIndex::repository(const char *file)
+{
+    std::string path(file);
+    size_t sep = path.find_last_of("\\/");
+    return (sep == std::string::npos ? std::string("") : path.substr(0, sep + 1)) + NXC_DIR;
+}
+
+void NxChunkIndex::sha256(const u8 *data, size_t length, u8 *hash)
+{
+    EVP_Digest(data, length, hash, nullptr, EVP_sha256(), nullptr);
+}
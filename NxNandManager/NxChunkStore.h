@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NxChunkStore_h__
+#define __NxChunkStore_h__
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include "res/types.h"
+#include "res/utils.h"
+
+#define NXC_MAGIC "NXCI"
+#define NXC_VERSION 1
+#define NXC_CHUNK_SIZE 0x10000  // 64 KB (4 clusters)
+#define NXC_HASH_SIZE 32        // SHA-256
+#define NXC_DIR "chunks"        // Repository, next to the index file
+#define NXC_PLAIN 0xFF          // bis_key value for regions stored as is
+
+// Deduplicated backup. Storage is cut into fixed size chunks, each chunk is stored
+// once in the repository (NXC_DIR/xx/<sha256>), shared by every index using it.
+// Index (.nxi) layout : header | region table | chunk hashes (region order)
+// Regions cover the whole storage in order (partitions & areas between them).
+// Encrypted partitions are stored decrypted (when keys are set) so that identical
+// content of different consoles is deduplicated, they are encrypted back on restore.
+typedef struct NxChunkHeader NxChunkHeader;
+struct NxChunkHeader {
+    char magic[4];      // NXC_MAGIC
+    u32 version;        // NXC_VERSION
+    u64 size;           // storage size
+    u32 type;           // storage type
+    u32 region_count;
+    u32 chunk_size;
+    u32 reserved;
+};
+
+typedef struct NxChunkRegion NxChunkRegion;
+struct NxChunkRegion {
+    char name[32];      // partition name, empty for other areas (GPT...)
+    u64 offset;         // offset in storage
+    u64 size;
+    u8 bis_key;         // BIS key index used to encrypt region back, NXC_PLAIN if stored as is
+    u8 reserved[7];
+    u8 check[NXC_HASH_SIZE]; // SHA-256 of first encrypted cluster (key validation)
+};
+
+// Chunk being hashed/stored by a worker
+typedef struct NxChunkJob NxChunkJob;
+struct NxChunkJob {
+    std::vector<u8> data;
+    u8 hash[NXC_HASH_SIZE];
+    bool done = false;
+    bool error = false;
+};
+
+// Chunk writer. Chunks are hashed & stored by a pool of workers (one per core)
+// while the caller keeps reading, hashes are collected in order.
+class NxChunkWriter
+{
+    // Constructors
+    public:
+        explicit NxChunkWriter(const std::string &repository);
+        ~NxChunkWriter();
+
+    // Member variables
+    private:
+        std::string m_repository;
+        std::vector<u8> m_chunk;        // current chunk (not full yet)
+        std::vector<u8> m_hashes;
+        std::vector<std::thread> m_workers;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::deque<NxChunkJob*> m_pending;  // jobs waiting for a worker
+        std::deque<NxChunkJob*> m_jobs;     // jobs in output order
+        size_t m_max_jobs;
+        u64 m_stored_count = 0;         // new chunks
+        u64 m_chunk_count = 0;
+        bool b_stop = false;
+        bool b_error = false;
+
+    // Member methods
+    private:
+        void workerLoop();
+        void submit();
+        bool collect(bool wait_all);
+        void stop();
+
+    public:
+        bool isValid() { return !b_error; };
+        u64 chunkCount() { return m_chunk_count; };
+        u64 storedCount() { return m_stored_count; };
+        std::vector<u8>& hashes() { return m_hashes; };
+        bool write(const u8 *buffer, DWORD length);
+        // Store current (partial) chunk, next write starts a new chunk
+        bool flush();
+        bool close();
+
+        static bool createRepository(const std::string &repository);
+        static std::string chunkPath(const std::string &repository, const u8 *hash);
+};
+
+// Backup index
+class NxChunkIndex
+{
+    // Constructors
+    public:
+        explicit NxChunkIndex(const char *file);
+
+    // Member variables
+    private:
+        std::string m_repository;
+        NxChunkHeader m_header;
+        std::vector<NxChunkRegion> m_regions;
+        std::vector<u8> m_hashes;
+        std::vector<size_t> m_first_chunk; // first chunk index for each region
+        bool b_valid = false;
+
+    public:
+        bool isValid() { return b_valid; };
+        u64 size() { return m_header.size; };
+        int type() { return (int)m_header.type; };
+        u32 chunkSize() { return m_header.chunk_size; };
+        std::vector<NxChunkRegion>& regions() { return m_regions; };
+
+        // Read & verify chunk n of region
+        bool readChunk(size_t region, size_t n, u8 *buffer, DWORD *length);
+
+        static bool isIndex(const char *file);
+        static bool write(const char *file, NxChunkHeader *header, std::vector<NxChunkRegion> &regions, std::vector<u8> &hashes);
+        static std::string repository(const char *file);
+        static void sha256(const u8 *data, size_t length, u8 *hash);
+};
+
+#endif
@@ -16,30 +16,141 @@
 
 #include "NxCrypto.h"
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NX_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+// Tweak stream is built with 64-bit lanes (little endian hosts only)
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define NX_TWEAK_STREAM 0
+#else
+#define NX_TWEAK_STREAM 1
+#endif
+
+typedef void (*xor_stream_t)(unsigned char* data, const unsigned char* stream, size_t len);
+
+static void xor_stream_u64(unsigned char* data, const unsigned char* stream, size_t len)
+{
+    for (size_t i = 0; i < len; i += 8)
+    {
+        u64 d, s;
+        memcpy(&d, data + i, 8);
+        memcpy(&s, stream + i, 8);
+        d ^= s;
+        memcpy(data + i, &d, 8);
+    }
+}
+
+#if defined(NX_X86)
+#if defined(__GNUC__) && !defined(__SSE2__)
+__attribute__((target("sse2")))
+#endif
+static void xor_stream_sse2(unsigned char* data, const unsigned char* stream, size_t len)
+{
+    for (size_t i = 0; i < len; i += 16)
+    {
+        __m128i d = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i s = _mm_loadu_si128((const __m128i*)(stream + i));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(d, s));
+    }
+}
+
+#if defined(__GNUC__)
+__attribute__((target("avx2")))
+static void xor_stream_avx2(unsigned char* data, const unsigned char* stream, size_t len)
+{
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i d = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i s = _mm256_loadu_si256((const __m256i*)(stream + i));
+        _mm256_storeu_si256((__m256i*)(data + i), _mm256_xor_si256(d, s));
+    }
+    if (i < len)
+        xor_stream_sse2(data + i, stream + i, len - i);
+}
+#endif
+#endif
+
+// Runtime CPU dispatch
+static xor_stream_t select_xor_stream()
+{
+#if defined(NX_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return xor_stream_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return xor_stream_sse2;
+#elif defined(NX_X86) && defined(_M_X64)
+    return xor_stream_sse2;
+#endif
+    return xor_stream_u64;
+}
+
+static xor_stream_t xor_stream = select_xor_stream();
+
 NxCrypto::NxCrypto(char* crypto, char* tweak)
 {
     sector_size = CLUSTER_SIZE;
-    ctx_crypto = EVP_CIPHER_CTX_new();
-    ctx_tweak = EVP_CIPHER_CTX_new();
-
     crypto_key = hex_string::decode(crypto);
     tweak_key = hex_string::decode(tweak);    
+    init_contexts();
+}
+
+NxCrypto::NxCrypto(const NxCrypto &other)
+{
+    sector_size = other.sector_size;
+    crypto_key = other.crypto_key;
+    tweak_key = other.tweak_key;
+
+    // Copy prepared key schedules
+    ctx_encrypt = EVP_CIPHER_CTX_new();
+    ctx_decrypt = EVP_CIPHER_CTX_new();
+    ctx_tweak = EVP_CIPHER_CTX_new();
+    EVP_CIPHER_CTX_copy(ctx_encrypt, other.ctx_encrypt);
+    EVP_CIPHER_CTX_copy(ctx_decrypt, other.ctx_decrypt);
+    EVP_CIPHER_CTX_copy(ctx_tweak, other.ctx_tweak);
+}
+
+NxCrypto::~NxCrypto()
+{
+    EVP_CIPHER_CTX_free(ctx_encrypt);
+    EVP_CIPHER_CTX_free(ctx_decrypt);
+    EVP_CIPHER_CTX_free(ctx_tweak);
+}
+
+void NxCrypto::init_contexts()
+{
+    ctx_encrypt = EVP_CIPHER_CTX_new();
+    ctx_decrypt = EVP_CIPHER_CTX_new();
+    ctx_tweak = EVP_CIPHER_CTX_new();
+
+    // ECB has no chaining state, contexts can be reused for every cluster
+    EVP_EncryptInit_ex(ctx_encrypt, EVP_aes_128_ecb(), nullptr, crypto_key.data(), nullptr);
+    EVP_CIPHER_CTX_set_padding(ctx_encrypt, 0);
+    EVP_DecryptInit_ex(ctx_decrypt, EVP_aes_128_ecb(), nullptr, crypto_key.data(), nullptr);
+    EVP_CIPHER_CTX_set_padding(ctx_decrypt, 0);
+    EVP_EncryptInit_ex(ctx_tweak, EVP_aes_128_ecb(), nullptr, tweak_key.data(), nullptr);
+    EVP_CIPHER_CTX_set_padding(ctx_tweak, 0);
 }
 
-// Create & encrypt tweak
-void NxCrypto::create_tweak(unsigned char* tweak, size_t offset) 
+// Create & encrypt tweaks for count clusters (16 bytes each)
+void NxCrypto::create_tweaks(unsigned char* tweak, size_t first_cluster, size_t count) 
 {
-    int outl, outl2;
+    int outl;
     
-    memset(tweak, 0, 16);
-    for (int i = 0; i < sizeof(size_t); i++)
-        tweak[15 - i] = ((unsigned char*)&offset)[i];
+    memset(tweak, 0, 16 * count);
+    for (size_t c = 0; c < count; c++)
+    {
+        size_t offset = first_cluster + c;
+        for (int i = 0; i < sizeof(size_t); i++)
+            tweak[c * 16 + 15 - i] = ((unsigned char*)&offset)[i];
+    }
 
-    assert(EVP_EncryptInit(ctx_tweak, EVP_aes_128_ecb(), tweak_key.data(), nullptr));
-    assert(EVP_CIPHER_CTX_set_padding(ctx_tweak, 0));
-    assert(EVP_EncryptUpdate(ctx_tweak, tweak, &outl, tweak, 16));
-    assert(EVP_EncryptFinal(ctx_tweak, &tweak[outl], &outl2));
-    assert(outl + outl2 == 16);
+    EVP_EncryptUpdate(ctx_tweak, tweak, &outl, tweak, (int)(16 * count));
+    assert(outl == 16 * count);
 }
 
 // Apply the tweak
@@ -61,49 +172,76 @@ void NxCrypto::apply_tweak(const unsigned char* tweak, unsigned char* data, size
     }
 }
 
-// XTS-AES decrypt cluster
-void NxCrypto::decrypt(unsigned char* data, size_t offset) 
+// Expand tweak into the full stream for a cluster: T(i) = T(0) * x^i in GF(2^128)
+void NxCrypto::expand_tweak(const unsigned char* tweak, unsigned char* stream, size_t data_len)
 {
-    int outl, outl2;
-    unsigned char tweak[16];
+    u64 lo, hi;
+    memcpy(&lo, tweak, 8);
+    memcpy(&hi, tweak + 8, 8);
 
-    create_tweak(tweak, offset);
-    apply_tweak(tweak, data, sector_size);
+    for (size_t i = 0; i < data_len; i += 16)
+    {
+        memcpy(stream + i, &lo, 8);
+        memcpy(stream + i + 8, &hi, 8);
 
-    assert(EVP_DecryptInit(ctx_crypto, EVP_aes_128_ecb(), crypto_key.data(), nullptr));
-    assert(EVP_CIPHER_CTX_set_padding(ctx_crypto, 0));
-    assert(EVP_DecryptUpdate(ctx_crypto, data, &outl, data, (int)sector_size));
-    assert(EVP_DecryptFinal(ctx_crypto, &data[outl], &outl2));
-    assert(outl + outl2 == sector_size);
+        u64 carry = (u64)0 - (hi >> 63);
+        hi = (hi << 1) | (lo >> 63);
+        lo = (lo << 1) ^ (carry & 0x87);
+    }
+}
 
-    apply_tweak(tweak, data, sector_size);
-    /*
-    std::string ck;
-    for (unsigned char c : crypto_key) ck.append(hexStr(&c, 1));
-    printf("NxCrypto::decrypt(%d) crypt = %s\n", offset, ck.c_str());
-    */
+// XTS-AES (encrypt or decrypt) a contiguous run of clusters
+void NxCrypto::crypt(EVP_CIPHER_CTX* ctx, unsigned char* data, size_t first_cluster, size_t count)
+{
+    int outl;
+    size_t len = sector_size * count;
+
+    if (tweaks.size() < 16 * count)
+        tweaks.resize(16 * count);
+    create_tweaks(tweaks.data(), first_cluster, count);
+
+#if NX_TWEAK_STREAM
+    // Tweak stream is computed once and applied before & after ECB with wide XORs
+    if (tweak_stream.size() < len)
+        tweak_stream.resize(len);
+    for (size_t c = 0; c < count; c++)
+        expand_tweak(&tweaks[c * 16], &tweak_stream[c * sector_size], sector_size);
+
+    xor_stream(data, tweak_stream.data(), len);
+    EVP_CipherUpdate(ctx, data, &outl, data, (int)len);
+    assert(outl == len);
+    xor_stream(data, tweak_stream.data(), len);
+#else
+    // Reference (scalar) implementation
+    for (size_t c = 0; c < count; c++)
+        apply_tweak(&tweaks[c * 16], data + c * sector_size, sector_size);
+
+    EVP_CipherUpdate(ctx, data, &outl, data, (int)len);
+    assert(outl == len);
+
+    for (size_t c = 0; c < count; c++)
+        apply_tweak(&tweaks[c * 16], data + c * sector_size, sector_size);
+#endif
+}
+
+// XTS-AES decrypt cluster
+void NxCrypto::decrypt(unsigned char* data, size_t offset) 
+{
+    crypt(ctx_decrypt, data, offset, 1);
 }
 
 // XTS-AES encrypt cluster
 void NxCrypto::encrypt(unsigned char* data, size_t offset) 
 {    
-    int outl, outl2;
-    unsigned char tweak[16];
-
-    create_tweak(tweak, offset);
-    apply_tweak(tweak, data, sector_size);
-
-    assert(EVP_EncryptInit(ctx_crypto, EVP_aes_128_ecb(), crypto_key.data(), nullptr));
-    assert(EVP_CIPHER_CTX_set_padding(ctx_crypto, 0));
-    assert(EVP_EncryptUpdate(ctx_crypto, data, &outl, data, (int)sector_size));
-    assert(EVP_EncryptFinal(ctx_crypto, &data[outl], &outl2));
-    assert(outl + outl2 == sector_size);
-
-    apply_tweak(tweak, data, sector_size);
-
-    /*
-    std::string ck;
-    for (unsigned char c : crypto_key) ck.append(hexStr(&c, 1));
-    printf("NxCrypto::encrypt(%d) crypt = %s\n", offset, ck.c_str());
-    */
-}
\ No newline at end of file
+    crypt(ctx_encrypt, data, offset, 1);
+}
+
+void NxCrypto::decrypt(unsigned char* data, size_t first_cluster, size_t count)
+{
+    crypt(ctx_decrypt, data, first_cluster, count);
+}
+
+void NxCrypto::encrypt(unsigned char* data, size_t first_cluster, size_t count)
+{
+    crypt(ctx_encrypt, data, first_cluster, count);
+}
@@ -35,23 +35,35 @@ class NxCrypto
     // Constructors
     public:
         NxCrypto(char* crypto, char* tweak);
+        NxCrypto(const NxCrypto &other); // Same keys, new cipher contexts (one per thread)
+        ~NxCrypto();
 
     // Member variables
     private:
         size_t sector_size;
-        EVP_CIPHER_CTX* ctx_crypto;
+        // Key schedules are set up once (constructor)
+        EVP_CIPHER_CTX* ctx_encrypt;
+        EVP_CIPHER_CTX* ctx_decrypt;
         EVP_CIPHER_CTX* ctx_tweak;
         std::vector<unsigned char> crypto_key;
         std::vector<unsigned char> tweak_key;
+        std::vector<unsigned char> tweaks;
+        std::vector<unsigned char> tweak_stream;
 
     // Member methods
     private:
-        void create_tweak(unsigned char* tweak, size_t offset);
+        void init_contexts();
+        void create_tweaks(unsigned char* tweak, size_t first_cluster, size_t count);
         void apply_tweak(const unsigned char* tweak, unsigned char* data, size_t data_len);
+        void expand_tweak(const unsigned char* tweak, unsigned char* stream, size_t data_len);
+        void crypt(EVP_CIPHER_CTX* ctx, unsigned char* data, size_t first_cluster, size_t count);
 
     public:        
         void decrypt(unsigned char* data, size_t offset);
         void encrypt(unsigned char* data, size_t offset);
+        // Contiguous run of clusters, starting at cluster index first_cluster
+        void decrypt(unsigned char* data, size_t first_cluster, size_t count);
+        void encrypt(unsigned char* data, size_t first_cluster, size_t count);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include "NxDelta.h"
+#include "NxStorage.h"
+
+NxDeltaWriter::NxDeltaWriter(const char *file, const char *base, u64 size, int type)
+{
+    memset(&m_header, 0, sizeof(NxDeltaHeader));
+    m_header.size = size;
+    m_header.type = (u32)type;
+    m_header.block_size = NXD_BLOCK_SIZE;
+    m_header.block_count = (size + NXD_BLOCK_SIZE - 1) / NXD_BLOCK_SIZE;
+    strncpy(m_header.base, base, NXD_PATH_LEN - 1);
+    m_map.assign((size_t)((m_header.block_count + 7) / 8), 0);
+    m_hashes.reserve((size_t)m_header.block_count * NXD_HASH_SIZE);
+
+    // Header is written on close, an incomplete delta is never valid
+    m_file.open(file, std::ofstream::binary);
+    if (!m_file.is_open() || strlen(base) >= NXD_PATH_LEN || !m_file.write((char *)&m_header, sizeof(NxDeltaHeader)))
+        b_error = true;
+}
+
+bool NxDeltaWriter::addBlock(const u8 *data, DWORD length, const u8 *hash, bool changed)
+{
+    if (b_error || m_block >= m_header.block_count)
+        return false;
+
+    if (changed)
+    {
+        if (!m_file.write((char *)data, length))
+            return !(b_error = true);
+        m_map[(size_t)(m_block / 8)] |= (u8)(1 << (m_block % 8));
+        m_header.changed_count++;
+        m_data_size += length;
+    }
+    m_hashes.insert(m_hashes.end(), hash, hash + NXD_HASH_SIZE);
+    m_block++;
+    return true;
+}
+
+bool NxDeltaWriter::close()
+{
+    if (!m_file.is_open())
+        return false;
+
+    // Every block must have been added
+    if (m_block != m_header.block_count)
+        b_error = true;
+
+    m_header.map_offset = sizeof(NxDeltaHeader) + m_data_size;
+    m_header.hash_offset = m_header.map_offset + m_map.size();
+    memcpy(m_header.magic, NXD_MAGIC, 4);
+    m_header.version = NXD_VERSION;
+
+    if (!b_error && (!m_file.write((char *)&m_map[0], m_map.size())
+        || !m_file.write((char *)&m_hashes[0], m_hashes.size())
+        || !m_file.seekp(0) || !m_file.write((char *)&m_header, sizeof(NxDeltaHeader))))
+        b_error = true;
+
+    m_file.close();
+    return !b_error;
+}
+
+void NxDeltaWriter::hash(const u8 *data, size_t length, u8 *hash)
+{
+    Blake3Hasher hasher;
+    hasher.update(data, length);
+    hasher.digest(hash);
+}
+
+NxDeltaReader::NxDeltaReader(const char *file, NxDeltaRawReader raw_read)
+{
+    m_raw_read = raw_read;
+    memset(&m_header, 0, sizeof(NxDeltaHeader));
+
+    if (!m_raw_read(0, &m_header, sizeof(NxDeltaHeader)) || memcmp(m_header.magic, NXD_MAGIC, 4)
+        || m_header.version != NXD_VERSION || !m_header.block_size
+        || m_header.block_count != (m_header.size + m_header.block_size - 1) / m_header.block_size
+        || m_header.changed_count > m_header.block_count || m_header.block_count >= NXD_NOT_STORED)
+        return;
+    m_header.base[NXD_PATH_LEN - 1] = '\0';
+
+    // Changed map => position of each stored block
+    std::vector<u8> map((size_t)((m_header.block_count + 7) / 8));
+    m_hashes.resize((size_t)m_header.block_count * NXD_HASH_SIZE);
+    if (!map.size() || !m_raw_read(m_header.map_offset, &map[0], (DWORD)map.size())
+        || !m_raw_read(m_header.hash_offset, &m_hashes[0], (DWORD)m_hashes.size()))
+        return;
+
+    u32 stored = 0;
+    m_data_index.resize((size_t)m_header.block_count);
+    for (size_t i(0); i < m_data_index.size(); i++)
+        m_data_index[i] = (map[i / 8] >> (i % 8)) & 1 ? stored++ : NXD_NOT_STORED;
+    if (stored != m_header.changed_count)
+        return;
+
+    // Base storage (raw, split, compressed or delta)
+    std::string base = resolveBase(file, m_header.base);
+    if (stored < m_header.block_count)
+    {
+        if (base.empty() || base == std::string(file))
+            return;
+        m_base = new NxStorage(base.c_str());
+        if (!m_base->isNxStorage() || m_base->type != (int)m_header.type || m_base->size() != m_header.size)
+        {
+            dbg_printf("NxDeltaReader::NxDeltaReader() invalid base %s\n", base.c_str());
+            return;
+        }
+        m_base->nxHandle->initHandle(NO_CRYPTO);
+    }
+    b_valid = true;
+}
+
+NxDeltaReader::~NxDeltaReader()
+{
+    delete m_base;
+}
+
+bool NxDeltaReader::read(u64 offset, void *buffer, DWORD length, DWORD *bytesRead)
+{
+    *bytesRead = 0;
+    while (*bytesRead < length && offset < m_header.size)
+    {
+        // Run of blocks from the same source (stored blocks are contiguous in delta)
+        u64 block = offset / m_header.block_size, last = block + 1;
+        u32 index = m_data_index[(size_t)block];
+        u64 end = std::min(offset + (length - *bytesRead), m_header.size);
+        while (last * m_header.block_size < end && (index == NXD_NOT_STORED
+            ? m_data_index[(size_t)last] == NXD_NOT_STORED : m_data_index[(size_t)last] == index + (last - block)))
+            last++;
+        DWORD chunk = (DWORD)(std::min(last * m_header.block_size, end) - offset), done = 0;
+
+        u8 *out = (u8*)buffer + *bytesRead;
+        if (index == NXD_NOT_STORED)
+        {
+            if (nullptr == m_base || !m_base->nxHandle->read(offset, out, &done, chunk) || done != chunk)
+                return false;
+        }
+        else if (!m_raw_read(sizeof(NxDeltaHeader) + (u64)index * m_header.block_size + offset % m_header.block_size, out, chunk))
+            return false;
+
+        *bytesRead += chunk;
+        offset += chunk;
+    }
+    return true;
+}
+
+std::string NxDeltaReader::resolveBase(const char *file, const char *base)
+{
+    std::string path(base);
+    if (path.empty() || path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'))
+        return path;
+
+    // Relative to delta directory, then to working directory
+    std::string dir(file);
+    size_t sep = dir.find_last_of("\\/");
+    if (sep != std::string::npos && is_file((dir.substr(0, sep + 1) + path).c_str()))
+        return dir.substr(0, sep + 1) + path;
+    return path;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NxDelta_h__
+#define __NxDelta_h__
+
+#include <functional>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "res/types.h"
+#include "res/utils.h"
+#include "res/blake3.h"
+
+#define NXD_MAGIC "NXDL"
+#define NXD_VERSION 1
+#define NXD_BLOCK_SIZE 0x10000    // 64 KB (4 clusters)
+#define NXD_HASH_SIZE BLAKE3_OUT_LEN
+#define NXD_PATH_LEN 512
+#define NXD_NOT_STORED 0xFFFFFFFF
+
+// Incremental/differential dump (.nxd) layout :
+// header | changed blocks | changed map (1 bit per block) | block hashes
+// Only blocks that differ from the base dump are stored. Hashes of every block
+// of the full image are kept, so that the next increment can be compared against
+// this one without reading it (the chain is resolved on read).
+typedef struct NxDeltaHeader NxDeltaHeader;
+struct NxDeltaHeader {
+    char magic[4];      // NXD_MAGIC
+    u32 version;        // NXD_VERSION
+    u64 size;           // full image size
+    u32 type;           // storage type
+    u32 block_size;
+    u64 block_count;
+    u64 changed_count;
+    u64 map_offset;
+    u64 hash_offset;
+    char base[NXD_PATH_LEN]; // base dump path (relative paths are resolved from delta directory first)
+};
+
+class NxStorage;
+
+// Delta writer, blocks are added in order
+class NxDeltaWriter
+{
+    // Constructors
+    public:
+        NxDeltaWriter(const char *file, const char *base, u64 size, int type);
+
+    // Member variables
+    private:
+        std::ofstream m_file;
+        NxDeltaHeader m_header;
+        std::vector<u8> m_map;
+        std::vector<u8> m_hashes;
+        u64 m_block = 0;
+        u64 m_data_size = 0;
+        bool b_error = false;
+
+    // Member methods
+    public:
+        bool isOpen() { return m_file.is_open() && !b_error; };
+        u64 changedCount() { return m_header.changed_count; };
+        bool addBlock(const u8 *data, DWORD length, const u8 *hash, bool changed);
+        bool close();
+
+        static void hash(const u8 *data, size_t length, u8 *hash);
+};
+
+// Delta reader, raw delta bytes are read with a callback (NxHandle backend),
+// unchanged blocks are read from base storage (which may be a delta too)
+typedef std::function<bool(u64 offset, void *buffer, DWORD length)> NxDeltaRawReader;
+
+class NxDeltaReader
+{
+    // Constructors
+    public:
+        NxDeltaReader(const char *file, NxDeltaRawReader raw_read);
+        ~NxDeltaReader();
+
+    // Member variables
+    private:
+        NxDeltaRawReader m_raw_read;
+        NxDeltaHeader m_header;
+        std::vector<u32> m_data_index;   // index of stored block, NXD_NOT_STORED if in base
+        std::vector<u8> m_hashes;
+        NxStorage *m_base = nullptr;
+        bool b_valid = false;
+
+    public:
+        bool isValid() { return b_valid; };
+        u64 size() { return m_header.size; };
+        int type() { return (int)m_header.type; };
+        u32 blockSize() { return m_header.block_size; };
+        u64 changedCount() { return m_header.changed_count; };
+        NxStorage* base() { return m_base; };
+        const char* basePath() { return m_header.base; };
+        const u8* blockHash(u64 block) { return &m_hashes[block * NXD_HASH_SIZE]; };
+        bool read(u64 offset, void *buffer, DWORD length, DWORD *bytesRead);
+
+        static std::string resolveBase(const char *file, const char *base);
+};
+
+#endif
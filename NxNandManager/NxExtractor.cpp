@@ -0,0 +1,357 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "NxExtractor.h"
+#include "NxPartition.h"
+
+NxExtractor::NxExtractor(NxPartition *partition, const std::string &out_dir)
+{
+    m_partition = partition;
+    m_out_dir = out_dir;
+}
+
+NxExtractor::~NxExtractor()
+{
+    stop();
+    for (NxExtractJob *job : m_free)
+    {
+        free_aligned(job->data);
+        delete job;
+    }
+    for (NxCrypto *crypto : m_cryptos)
+        delete crypto;
+}
+
+void NxExtractor::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        b_stop = true;
+    }
+    m_cv.notify_all();
+
+    for (std::thread &worker : m_workers)
+        if (worker.joinable())
+            worker.join();
+}
+
+// File names come from the partition, they must stay in output dir once joined to host path
+bool NxExtractor::isSafeName(const std::string &name)
+{
+    return !name.empty() && name != "." && name != ".." && name.find_first_of(std::string("/\\\0", 3)) == std::string::npos;
+}
+
+int NxExtractor::add(const char *path)
+{
+    if (is_file(m_out_dir.c_str()) || !create_dir(m_out_dir.c_str()))
+        return ERR_INVALID_OUTPUT;
+
+    // Root dir : every entry goes to output dir
+    const fat32::dir_entry *entry = m_partition->fat32_getEntry(path);
+    if (nullptr == entry)
+    {
+        const NxDirectory *root = m_partition->fat32_getDir(path);
+        if (nullptr == root)
+            return ERR_PATH_NOT_FOUND;
+
+        for (const fat32::dir_entry &child : root->entries)
+            if (int rc = addEntry("/" + child.filename, child, m_out_dir + PATH_SEPARATOR + child.filename))
+                return rc;
+        return SUCCESS;
+    }
+
+    return addEntry(path, *entry, m_out_dir + PATH_SEPARATOR + entry->filename);
+}
+
+int NxExtractor::addEntry(const std::string &path, const fat32::dir_entry &entry, const std::string &out_path)
+{
+    if (!isSafeName(entry.filename))
+    {
+        dbg_printf("NxExtractor::addEntry() invalid file name in %s\n", path.c_str());
+        return ERR_INVALID_OUTPUT;
+    }
+
+    std::vector<const fat32::dir_entry*> parts;
+    if (!entry.is_directory)
+        parts.push_back(&entry);
+    if (!parts.empty() || isConcatenationFile(path, entry, &parts))
+        return addFile(parts, out_path);
+
+    if (is_file(out_path.c_str()) || !create_dir(out_path.c_str()))
+        return ERR_INVALID_OUTPUT;
+
+    const NxDirectory *dir = m_partition->fat32_getDir(path.c_str());
+    if (nullptr == dir)
+        return ERR_PATH_NOT_FOUND;
+
+    for (const fat32::dir_entry &child : dir->entries)
+        if (int rc = addEntry(path + "/" + child.filename, child, out_path + PATH_SEPARATOR + child.filename))
+            return rc;
+    return SUCCESS;
+}
+
+// Directory with archive bit, only holding parts named 00, 01...
+bool NxExtractor::isConcatenationFile(const std::string &path, const fat32::dir_entry &entry, std::vector<const fat32::dir_entry*> *parts)
+{
+    if (!(entry.entry.attributes & 0x20))
+        return false;
+
+    const NxDirectory *dir = m_partition->fat32_getDir(path.c_str());
+    if (nullptr == dir || dir->entries.empty())
+        return false;
+
+    for (size_t i(0); i < dir->entries.size(); i++)
+    {
+        char name[0x10];
+        sprintf(name, "%02d", (int)i);
+        auto part = dir->index.find(name);
+        if (part == dir->index.end() || dir->entries[part->second].is_directory)
+            return false;
+        parts->push_back(&dir->entries[part->second]);
+    }
+    return true;
+}
+
+// Cut file data into segments, a segment never spans more than NXE_BATCH_SIZE (cluster aligned)
+int NxExtractor::addFile(const std::vector<const fat32::dir_entry*> &parts, const std::string &out_path)
+{
+    if (is_file(out_path.c_str()) || is_dir(out_path.c_str()))
+        return ERR_FILE_ALREADY_EXISTS;
+
+    m_files.push_back(std::unique_ptr<NxExtractFile>(new NxExtractFile));
+    NxExtractFile *file = m_files.back().get();
+    file->path = out_path;
+
+    u64 file_offset = 0;
+    std::vector<fat32::run> runs;
+    for (const fat32::dir_entry *part : parts)
+    {
+        if (!m_partition->fat32_getRuns(*part, &runs))
+            return ERR_PATH_NOT_FOUND;
+
+        for (const fat32::run &run : runs)
+        {
+            for (u64 offset = run.offset, end = run.offset + run.size; offset < end; )
+            {
+                u64 seg_end = std::min(end, offset / CLUSTER_SIZE * CLUSTER_SIZE + NXE_BATCH_SIZE);
+                m_segments.push_back({ file, file_offset, offset, seg_end - offset });
+                file_offset += seg_end - offset;
+                offset = seg_end;
+            }
+        }
+    }
+    file->remaining = file_offset;
+    m_bytes_total += file_offset;
+
+    // Empty file, created right away
+    if (!file_offset)
+    {
+        std::ofstream out_file(out_path, std::ofstream::binary);
+        if (!out_file.good())
+            return ERR_OUTPUT_HANDLE;
+    }
+    return SUCCESS;
+}
+
+void NxExtractor::workerLoop(NxCrypto *crypto)
+{
+    for (;;)
+    {
+        NxExtractJob *job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] { return b_stop || !m_pending.empty(); });
+            if (b_stop)
+                break;
+            job = m_pending.front();
+            m_pending.pop_front();
+        }
+
+        // Whole batch is decrypted (gaps between segments are small)
+        if (nullptr != crypto)
+            crypto->decrypt(job->data, job->offset / CLUSTER_SIZE, (job->length + CLUSTER_SIZE - 1) / CLUSTER_SIZE);
+
+        bool success = true;
+        u64 written = 0;
+        for (size_t i = job->first; success && i < job->first + job->count; i++)
+        {
+            const NxExtractSegment &segment = m_segments[i];
+            success = writeSegment(segment, job->data + (segment.offset - job->offset));
+            written += segment.size;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (success)
+                m_bytes_written += written;
+            else
+                b_error = true;
+            m_in_flight--;
+            m_free.push_back(job);
+        }
+        m_cv.notify_all();
+    }
+}
+
+// Segments of a file may be written by several workers, file is closed once complete
+bool NxExtractor::writeSegment(const NxExtractSegment &segment, const u8 *data)
+{
+    NxExtractFile *file = segment.file;
+    std::lock_guard<std::mutex> lock(file->mutex);
+    if (!file->out.is_open())
+        file->out.open(file->path, std::ofstream::binary | std::ofstream::trunc);
+
+    if (!file->out.seekp((std::streamoff)segment.file_offset).write((const char *)data, (std::streamsize)segment.size).good())
+    {
+        dbg_printf("NxExtractor::writeSegment() failed to write %s\n", file->path.c_str());
+        return false;
+    }
+
+    file->remaining -= segment.size;
+    if (!file->remaining)
+    {
+        file->out.close();
+        return !file->out.fail();
+    }
+    return true;
+}
+
+int NxExtractor::run(ProgressInfo *pi, void(*updateProgress)(ProgressInfo*), bool *stopWork)
+{
+    // Segments are read in a single pass over the partition
+    std::sort(m_segments.begin(), m_segments.end(), [](const NxExtractSegment &a, const NxExtractSegment &b) {
+        return a.offset < b.offset;
+    });
+
+    // One worker (and one cipher context) per core, two batches in flight per worker
+    unsigned int workers = std::thread::hardware_concurrency();
+    if (!workers)
+        workers = 1;
+    m_max_jobs = workers * 2;
+
+    NxHandle *handle = m_partition->nxHandle;
+    handle->initHandle(NO_CRYPTO, m_partition);
+    for (unsigned int i(0); i < workers; i++)
+    {
+        NxCrypto *crypto = nullptr;
+        if (m_partition->isEncryptedPartition())
+            m_cryptos.push_back(crypto = new NxCrypto(*m_partition->crypto()));
+        m_workers.push_back(std::thread(&NxExtractor::workerLoop, this, crypto));
+    }
+
+    int rc = SUCCESS;
+    size_t i = 0;
+    while (i < m_segments.size())
+    {
+        // Coalesce next segments while they fit in one batch
+        size_t first = i;
+        u64 start = m_segments[i].offset / CLUSTER_SIZE * CLUSTER_SIZE;
+        u64 end = m_segments[i].offset + m_segments[i].size;
+        for (i++; i < m_segments.size(); i++)
+        {
+            const NxExtractSegment &next = m_segments[i];
+            u64 next_end = std::max(end, next.offset + next.size);
+            if (next.offset > end + NXE_MAX_GAP || (next_end + CLUSTER_SIZE - 1) / CLUSTER_SIZE * CLUSTER_SIZE - start > NXE_BATCH_SIZE)
+                break;
+            end = next_end;
+        }
+        u64 length = std::min((end + CLUSTER_SIZE - 1) / CLUSTER_SIZE * CLUSTER_SIZE, m_partition->size()) - start;
+
+        // Wait for a free batch buffer
+        NxExtractJob *job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] { return b_error || !m_free.empty() || m_job_count < m_max_jobs; });
+            if (b_error)
+                break;
+            if (!m_free.empty())
+            {
+                job = m_free.front();
+                m_free.pop_front();
+            }
+            else
+            {
+                job = new NxExtractJob;
+                job->data = (u8*)malloc_aligned(NXE_BATCH_SIZE);
+                m_job_count++;
+            }
+        }
+
+        job->offset = start;
+        job->first = first;
+        job->count = i - first;
+        job->length = (DWORD)length;
+        DWORD bytesRead = 0;
+        bool success = handle->read(start, job->data, &bytesRead, job->length) && bytesRead >= end - start;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (success)
+            {
+                m_pending.push_back(job);
+                m_in_flight++;
+            }
+            else
+                m_free.push_back(job);
+            pi->bytesCount = m_bytes_written;
+        }
+        m_cv.notify_all();
+
+        if (!success)
+        {
+            dbg_printf("NxExtractor::run() failed to read %s at %s\n", m_partition->partitionName().c_str(), n2hexstr(start, 10).c_str());
+            rc = ERR_WHILE_COPY;
+            break;
+        }
+        if (nullptr != updateProgress && pi->bytesCount)
+            updateProgress(pi);
+        if (*stopWork)
+        {
+            rc = ERR_USER_ABORT;
+            break;
+        }
+    }
+
+    // Wait for batches in flight
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this] { return !m_in_flight; });
+        pi->bytesCount = m_bytes_written;
+        if (b_error && rc == SUCCESS)
+            rc = ERR_WHILE_WRITE;
+    }
+    stop();
+
+    // Aborted : incomplete files are removed (workers are done)
+    if (rc == ERR_WHILE_COPY || rc == ERR_WHILE_WRITE || rc == ERR_USER_ABORT)
+    {
+        for (std::unique_ptr<NxExtractFile> &file : m_files)
+        {
+            if (!file->remaining)
+                continue;
+            if (file->out.is_open())
+                file->out.close();
+            remove(file->path.c_str());
+        }
+    }
+
+    if (rc == SUCCESS && nullptr != updateProgress && pi->bytesTotal)
+        updateProgress(pi);
+    dbg_printf("NxExtractor::run() %I64d files, %I64d segments, %I64d batch buffers\n", (u64)m_files.size(), (u64)m_segments.size(), (u64)m_job_count);
+    return rc;
+}
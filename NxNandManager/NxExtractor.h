@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NxExtractor_h__
+#define __NxExtractor_h__
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+#include "res/types.h"
+#include "res/utils.h"
+#include "res/fat32.h"
+
+class NxPartition;
+class NxCrypto;
+
+#define NXE_BATCH_SIZE DEFAULT_BUFF_SIZE    // max read size (coalesced segments)
+#define NXE_MAX_GAP 0x40000                 // unused bytes read between segments rather than seeking (256 KB)
+
+// File being extracted
+typedef struct NxExtractFile NxExtractFile;
+struct NxExtractFile {
+    std::string path;       // host path
+    u64 remaining;          // bytes not written yet
+    std::ofstream out;      // open from first write until complete
+    std::mutex mutex;
+};
+
+// Contiguous file data in partition
+typedef struct NxExtractSegment NxExtractSegment;
+struct NxExtractSegment {
+    NxExtractFile *file;
+    u64 file_offset;
+    u64 offset;             // offset in partition
+    u64 size;
+};
+
+// Coalesced read, decrypted & written by a worker
+typedef struct NxExtractJob NxExtractJob;
+struct NxExtractJob {
+    u64 offset;             // offset in partition (cluster aligned)
+    size_t first;           // segments [first, first + count)
+    size_t count;
+    DWORD length;
+    u8 *data;               // NXE_BATCH_SIZE bytes (page aligned)
+};
+
+// Bulk file extraction from a FAT32 partition (SAFE, SYSTEM, USER) to a host directory.
+// Tree is walked first, data of every file is cut into segments (cluster runs) which are
+// sorted by offset in partition and coalesced into large reads. The caller reads batches
+// in order while a pool of workers (one per core) decrypts them and writes segments to files.
+// Concatenation files (directory with archive bit, parts 00, 01...) are extracted as one file.
+class NxExtractor
+{
+    // Constructors
+    public:
+        NxExtractor(NxPartition *partition, const std::string &out_dir);
+        ~NxExtractor();
+
+    // Member variables
+    private:
+        NxPartition *m_partition;
+        std::string m_out_dir;
+        std::vector<std::unique_ptr<NxExtractFile>> m_files;
+        std::vector<NxExtractSegment> m_segments;
+        u64 m_bytes_total = 0;
+        u64 m_bytes_written = 0;
+
+        // Workers
+        std::vector<std::thread> m_workers;
+        std::vector<NxCrypto*> m_cryptos;      // one per worker (encrypted partition)
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::deque<NxExtractJob*> m_pending;    // jobs waiting for a worker
+        std::deque<NxExtractJob*> m_free;       // batch buffers, reused
+        size_t m_max_jobs = 0;
+        size_t m_job_count = 0;                 // jobs allocated
+        size_t m_in_flight = 0;
+        bool b_stop = false;
+        bool b_error = false;
+
+    // Member methods
+    private:
+        int addEntry(const std::string &path, const fat32::dir_entry &entry, const std::string &out_path);
+        int addFile(const std::vector<const fat32::dir_entry*> &parts, const std::string &out_path);
+        bool isConcatenationFile(const std::string &path, const fat32::dir_entry &entry, std::vector<const fat32::dir_entry*> *parts);
+        void workerLoop(NxCrypto *crypto);
+        bool writeSegment(const NxExtractSegment &segment, const u8 *data);
+        void stop();
+        static bool isSafeName(const std::string &name);
+
+    public:
+        // Add file or directory tree (path in partition), error code is returned
+        int add(const char *path);
+        u64 fileCount() { return m_files.size(); };
+        u64 bytesTotal() { return m_bytes_total; };
+        int run(ProgressInfo *pi, void(*updateProgress)(ProgressInfo*), bool *stopWork);
+};
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include "NxFile.h"
+#include "NxPartition.h"
+
+NxFile::NxFile(NxPartition *partition, const fat32::dir_entry &entry)
+{
+    m_partition = partition;
+    m_entry = entry;
+    if (!m_partition->fat32_getRuns(m_entry, &m_runs))
+        return;
+
+    for (fat32::run &run : m_runs)
+    {
+        m_run_offsets.push_back(m_size);
+        m_size += run.size;
+    }
+    b_open = true;
+}
+
+// Get decrypted cluster (CLUSTER_SIZE bytes at offset in partition)
+const u8* NxFile::getCluster(u64 offset)
+{
+    for (NxFileCluster &cluster : m_cache)
+    {
+        if (cluster.offset == offset)
+        {
+            cluster.last_use = ++m_use_count;
+            return cluster.data.data();
+        }
+    }
+
+    // Least recently used cluster is replaced
+    NxFileCluster *cluster;
+    if (m_cache.size() < NXFILE_CACHE_SIZE)
+    {
+        m_cache.push_back(NxFileCluster());
+        cluster = &m_cache.back();
+        cluster->data.resize(CLUSTER_SIZE);
+    }
+    else cluster = &*std::min_element(m_cache.begin(), m_cache.end(), [](const NxFileCluster &a, const NxFileCluster &b) {
+        return a.last_use < b.last_use;
+    });
+
+    cluster->offset = offset;
+    cluster->last_use = ++m_use_count;
+    if (!m_partition->fat32_read(offset, cluster->data.data(), CLUSTER_SIZE))
+    {
+        cluster->offset = (u64)-1;
+        return nullptr;
+    }
+    return cluster->data.data();
+}
+
+bool NxFile::read(u64 offset, void *buffer, DWORD *bytesRead, DWORD length)
+{
+    if (nullptr != bytesRead)
+        *bytesRead = 0;
+
+    if (!b_open || offset >= m_size)
+        return false;
+
+    u8 *out = (u8*)buffer;
+    u64 remaining = std::min((u64)length, m_size - offset);
+    size_t run = std::upper_bound(m_run_offsets.begin(), m_run_offsets.end(), offset) - m_run_offsets.begin() - 1;
+    while (remaining)
+    {
+        // Position in partition, contiguous bytes left in run
+        u64 run_off = offset - m_run_offsets[run];
+        u64 part_off = m_runs[run].offset + run_off;
+        u64 chunk = std::min(remaining, m_runs[run].size - run_off);
+        u64 head = part_off % CLUSTER_SIZE;
+
+        if (!head && chunk >= CLUSTER_SIZE)
+        {
+            // Whole clusters
+            chunk = chunk / CLUSTER_SIZE * CLUSTER_SIZE;
+            if (!m_partition->fat32_read(part_off, out, chunk))
+                return false;
+        }
+        else
+        {
+            // Partial cluster (cached)
+            const u8 *cluster = getCluster(part_off - head);
+            if (nullptr == cluster)
+                return false;
+            chunk = std::min(chunk, (u64)CLUSTER_SIZE - head);
+            memcpy(out, cluster + head, chunk);
+        }
+
+        out += chunk;
+        offset += chunk;
+        remaining -= chunk;
+        if (nullptr != bytesRead)
+            *bytesRead += (DWORD)chunk;
+        if (offset == m_run_offsets[run] + m_runs[run].size)
+            run++;
+    }
+    return true;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NxFile_h__
+#define __NxFile_h__
+
+#include <string>
+#include <vector>
+#include "res/types.h"
+#include "res/utils.h"
+#include "res/fat32.h"
+
+class NxPartition;
+
+// Decrypted clusters kept by an open file (unaligned reads)
+#define NXFILE_CACHE_SIZE 8
+
+typedef struct NxFileCluster NxFileCluster;
+struct NxFileCluster {
+    u64 offset;             // offset in partition (cluster aligned)
+    u64 last_use;
+    std::vector<u8> data;
+};
+
+// File (or directory) in a FAT32 partition, opened with NxPartition::fat32_open().
+// Data is read at any offset by following the cluster chain, only clusters that are
+// touched are read & decrypted. Whole clusters are read straight into the caller's
+// buffer (contiguous clusters at once), partial clusters go through a small cache.
+class NxFile
+{
+    // Constructors
+    public:
+        NxFile(NxPartition *partition, const fat32::dir_entry &entry);
+
+    // Member variables
+    private:
+        NxPartition *m_partition;
+        fat32::dir_entry m_entry;
+        std::vector<fat32::run> m_runs;     // cluster chain
+        std::vector<u64> m_run_offsets;     // offset of each run in file
+        u64 m_size = 0;
+        std::vector<NxFileCluster> m_cache;
+        u64 m_use_count = 0;
+        bool b_open = false;
+
+    // Member methods
+    private:
+        const u8* getCluster(u64 offset);
+
+    public:
+        bool isOpen() { return b_open; };
+        u64 size() { return m_size; };
+        const fat32::dir_entry& stat() { return m_entry; };
+        // Read up to length bytes at offset, bytesRead is shorter at end of file
+        bool read(u64 offset, void *buffer, DWORD *bytesRead, DWORD length);
+};
+
+#endif
@@ -14,8 +14,23 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <map>
 #include "NxHandle.h"
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/statvfs.h>
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <linux/hdreg.h>
+#endif
+#define DIRECT_IO_ALIGN 0x1000 // O_DIRECT buffer, length & offset alignment
+#endif
+
 NxHandle::NxHandle(NxStorage *p)
 {
     if (nullptr == p)
@@ -23,6 +38,7 @@ NxHandle::NxHandle(NxStorage *p)
 
     parent = p;    
 
+#if defined(_WIN32)
     // Create new file
     m_h = CreateFileW(parent->m_path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
 
@@ -40,18 +56,76 @@ NxHandle::NxHandle(NxStorage *p)
         }
     }
     CloseHandle(m_h);    
+#endif
 
     // Open file/disk
     if (!createFile(parent->m_path, GENERIC_READ))
         return;
 
+#if !defined(_WIN32)
+    // Get size & geometry for block device (physical drive, partition, loop device)
+    struct stat st;
+    if (!fstat(m_h, &st) && S_ISBLK(st.st_mode) && sysFileSize(&m_totalSize))
+    {
+        b_isDrive = true;
+        m_size = m_totalSize;
+        exists = true;
+
+        memset(&pdg, 0, sizeof(pdg));
+        pdg.BytesPerSector = NX_BLOCKSIZE;
+        pdg.TracksPerCylinder = 255;
+        pdg.SectorsPerTrack = 63;
+#if defined(__linux__)
+        int sector_size;
+        if (!ioctl(m_h, BLKSSZGET, &sector_size) && sector_size > 0)
+            pdg.BytesPerSector = (DWORD)sector_size;
+
+        struct hd_geometry geo;
+        if (!ioctl(m_h, HDIO_GETGEO, &geo) && geo.heads && geo.sectors)
+        {
+            pdg.TracksPerCylinder = geo.heads;
+            pdg.SectorsPerTrack = geo.sectors;
+        }
+#endif
+        pdg.Cylinders.QuadPart = m_totalSize / ((u64)pdg.TracksPerCylinder * pdg.SectorsPerTrack * pdg.BytesPerSector);
+    }
+#endif
+
     // Get size for file
-    LARGE_INTEGER Lsize;
-    if (!b_isDrive && GetFileSizeEx(m_h, &Lsize))
+    u64 file_size;
+    if (!b_isDrive && sysFileSize(&file_size))
     {
-        m_size = Lsize.QuadPart;
+        m_size = file_size;
         m_totalSize = m_size;
         exists = true;
+
+        // Compressed container, handle exposes uncompressed storage
+        NxZReader *z_reader = new NxZReader([this](u64 offset, void *buffer, DWORD length) {
+            DWORD bytesRead;
+            return sysSeek(offset) && sysRead(buffer, length, &bytesRead) && bytesRead == length;
+        });
+        if (z_reader->isValid())
+        {
+            m_zReader = z_reader;
+            m_size = m_zReader->size();
+            m_totalSize = m_size;
+        }
+        else delete z_reader;
+
+        // Incremental dump, handle exposes full image (changed blocks + base chain)
+        char c_path[MAX_PATH] = { 0 };
+        wcstombs(c_path, parent->m_path, MAX_PATH - 1);
+        NxDeltaReader *delta_reader = isCompressed() ? nullptr : new NxDeltaReader(c_path, [this](u64 offset, void *buffer, DWORD length) {
+            DWORD bytesRead;
+            return sysSeek(offset) && sysRead(buffer, length, &bytesRead) && bytesRead == length;
+        });
+        if (nullptr != delta_reader && delta_reader->isValid())
+        {
+            m_deltaReader = delta_reader;
+            m_size = m_deltaReader->size();
+            m_totalSize = m_size;
+        }
+        else delete delta_reader;
     }
 
     // Get available space on disk for file
@@ -60,6 +134,7 @@ NxHandle::NxHandle(NxStorage *p)
         std::wstring path_str = std::wstring(parent->m_path);
         std::size_t pos = path_str.find(base_nameW(path_str));
         std::wstring dir = path_str.substr(0, pos);
+#if defined(_WIN32)
         if (dir.length() == 0)
         {
             wchar_t buffer[MAX_PATH];
@@ -74,6 +149,19 @@ NxHandle::NxHandle(NxStorage *p)
             m_fileDiskTotalBytes = (u64)dwTotalClusters * dwSectPerClust * dwBytesPerSect;
             m_fileDiskFreeBytes = (u64)dwFreeClusters * dwSectPerClust * dwBytesPerSect;
         }
+#else
+        if (dir.length() == 0)
+            dir = L".";
+
+        char c_dir[MAX_PATH] = { 0 };
+        wcstombs(c_dir, dir.c_str(), MAX_PATH - 1);
+        struct statvfs vfs;
+        if (!statvfs(c_dir, &vfs))
+        {
+            m_fileDiskTotalBytes = (u64)vfs.f_blocks * vfs.f_frsize;
+            m_fileDiskFreeBytes = (u64)vfs.f_bavail * vfs.f_frsize;
+        }
+#endif
     }
 
     initHandle();
@@ -82,13 +170,9 @@ NxHandle::NxHandle(NxStorage *p)
 NxHandle::~NxHandle()
 {
     clearHandle();
-    NxSplitFile *current = m_lastSplitFile, *next;
-    while (nullptr != current)
-    {
-        next = current->next;
-        delete current;
-        current = next;
-    }
+    delete m_hash;
+    delete m_zReader;
+    delete m_deltaReader;
 }
 
 void NxHandle::initHandle(int crypto_mode, NxPartition *partition)
@@ -115,10 +199,9 @@ void NxHandle::initHandle(int crypto_mode, NxPartition *partition)
 
     if (m_crypto == MD5_HASH)
     {
-        // Get handle to the crypto provider
-        CryptAcquireContext(&h_WinCryptProv, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT);
-        // Create new hash
-        CryptCreateHash(h_WinCryptProv, CALG_MD5, 0, 0, &m_md5_hash);
+        // Create new hash (algorithm is set by parent storage)
+        delete m_hash;
+        m_hash = new NxHash(nullptr != parent ? parent->hashAlgorithm() : HASH_MD5);
     }
 
     // Set pointer at start
@@ -131,8 +214,66 @@ void NxHandle::initHandle(int crypto_mode, NxPartition *partition)
     */
 }
 
+// File names are case insensitive on Windows
+static wstring normalizeFileName(wstring name)
+{
+#if defined(_WIN32)
+    for (wchar_t &c : name)
+        c = towlower(c);
+#endif
+    return name;
+}
+
+// List regular files in dir starting with prefix (name => size)
+static bool listDirectory(const wstring &dir, const wstring &prefix, std::map<wstring, u64> &files)
+{
+#if defined(_WIN32)
+    WIN32_FIND_DATAW fd;
+    HANDLE hFind = FindFirstFileW((dir + prefix + L"*").c_str(), &fd);
+    if (hFind == INVALID_HANDLE_VALUE)
+        return false;
+
+    do {
+        if (!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            files[normalizeFileName(fd.cFileName)] = ((u64)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+    } while (FindNextFileW(hFind, &fd));
+
+    FindClose(hFind);
+#else
+    char c_dir[MAX_PATH] = { 0 }, c_prefix[MAX_PATH] = { 0 };
+    wcstombs(c_dir, dir.empty() ? L"./" : dir.c_str(), MAX_PATH - 1);
+    wcstombs(c_prefix, prefix.c_str(), MAX_PATH - 1);
+
+    DIR *d = opendir(c_dir);
+    if (nullptr == d)
+        return false;
+
+    struct dirent *entry;
+    struct stat st;
+    size_t prefix_len = strlen(c_prefix);
+    while (nullptr != (entry = readdir(d)))
+    {
+        if (strncmp(entry->d_name, c_prefix, prefix_len))
+            continue;
+
+        string path = string(c_dir) + entry->d_name;
+        if (stat(path.c_str(), &st) || !S_ISREG(st.st_mode))
+            continue;
+
+        wchar_t name[MAX_PATH] = { 0 };
+        mbstowcs(name, entry->d_name, MAX_PATH - 1);
+        files[name] = (u64)st.st_size;
+    }
+    closedir(d);
+#endif
+    return true;
+}
+
 bool NxHandle::detectSplittedStorage()
 {
+    if (isReadOnly())
+        return false;
+
     wstring Lfilename(parent->m_path);
     wstring extension(get_extensionW((Lfilename)));
     wstring basename(remove_extensionW(Lfilename));
@@ -157,9 +298,9 @@ bool NxHandle::detectSplittedStorage()
         }
     }
     // Look for an integer in base name (2 digits max)
-    if (f_type == 0)
+    if (f_type == 0 && wcslen(basename.c_str()))
     {
-        wstring number = basename.substr(wcslen(basename.c_str()) - 2, wcslen(basename.c_str()));
+        wstring number = basename.substr(wcslen(basename.c_str()) > 1 ? wcslen(basename.c_str()) - 2 : 0, wcslen(basename.c_str()));
         if (std::string::npos != number.substr(0, 1).find_first_of(L"0123456789") && std::stoi(number) >= 0)
         {            
             f_number = std::stoi(number);
@@ -181,64 +322,65 @@ bool NxHandle::detectSplittedStorage()
     if (f_type > 0)
     {
         int i = f_number;
-        m_splitFileCount = 0;
-        LARGE_INTEGER Lsize;
         u64 s_size = 0;
         wstring path = Lfilename;
-        string mask("%0" + to_string(f_digits) + "d");                
+        string mask("%0" + to_string(f_digits) + "d");
+
+        // Read directory once, only keep files matching the split pattern
+        size_t sep = Lfilename.find_last_of(L"\\/");
+        wstring dir = sep == wstring::npos ? L"" : Lfilename.substr(0, sep + 1);
+        wstring prefix = f_type == 1 ? basename + L"." : basename.substr(0, wcslen(basename.c_str()) - f_digits);
+        std::map<wstring, u64> files;
+        if (!listDirectory(dir, prefix.substr(dir.length()), files))
+            return false;
 
-        clearHandle();
+        m_splitFiles.clear();
 
         // For each splitted file
-        do {
-            // Get handle 
-            createFile(&path[0]);
-
-            if (!GetFileSizeEx(m_h, &Lsize))
-                break;            
+        for (;;)
+        {
+            auto entry = files.find(normalizeFileName(path.substr(dir.length())));
+            if (entry == files.end())
+                break;
 
             // New NxSplitFile
-            NxSplitFile *splitfile = reinterpret_cast<NxSplitFile *>(malloc(sizeof(NxSplitFile)));
-            wcscpy(splitfile->file_path, path.c_str());
-            splitfile->offset = s_size;
-            splitfile->size = static_cast<u64>(Lsize.QuadPart);
-            splitfile->next = m_lastSplitFile;
-            m_lastSplitFile = splitfile;
-
-            // First split file is current split file
-            if (!m_splitFileCount)
-                m_curSplitFile = splitfile;
-
-            s_size += splitfile->size;
-
-            ++m_splitFileCount;
-            clearHandle();            
+            NxSplitFile splitfile;
+            wcsncpy(splitfile.file_path, path.c_str(), MAX_PATH - 1);
+            splitfile.file_path[MAX_PATH - 1] = L'\0';
+            splitfile.offset = s_size;
+            splitfile.size = entry->second;
+            m_splitFiles.push_back(splitfile);
+            s_size += splitfile.size;
 
             // Format path to next file
             char new_number[10];
             sprintf_s(new_number, 10, mask.c_str(), ++i);
-            wstring wn_number = convertCharArrayToLPWSTR(new_number);
+            wchar_t wn_number[10] = { 0 };
+            mbstowcs(wn_number, new_number, 9);
             if (f_type == 1)
                 path = basename + L"." + wn_number;
             else
                 path = basename.substr(0, wcslen(basename.c_str()) - f_digits) + wn_number + extension;
-
-        } while (file_exists(path.c_str()));
-
-        clearHandle();
-
-        // Get handle for original file
-        createFile(parent->m_path, GENERIC_READ);        
+        }
 
         // If more than one file found
-        if (m_splitFileCount > 1)
+        if (m_splitFiles.size() > 1)
         {
+            // First split file is the original file, its handle is already opened
+            m_curSplitFile = &m_splitFiles[0];
+            m_curSplitFile->h = m_h;
+#if !defined(_WIN32)
+            m_curSplitFile->fd_direct = m_fd_direct;
+#endif
+            m_curSplitFile->last_use = ++m_splitUseCount;
+
             // New handle size
             m_size = s_size;
             b_isSplitted = true;
             initHandle();
             return true;
         }
+        m_splitFiles.clear();
     }
     return false;
 }
@@ -248,6 +390,7 @@ bool NxHandle::createFile(wchar_t *path, int io_mode)
     if (io_mode != GENERIC_READ && io_mode != GENERIC_WRITE)
         return false;
 
+#if defined(_WIN32)
     if (io_mode == GENERIC_READ)
         m_h = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
     else
@@ -259,6 +402,32 @@ bool NxHandle::createFile(wchar_t *path, int io_mode)
         CloseHandle(m_h);
         return false;
     }    
+#else
+    // Release previous descriptor(s) (switching split file)
+    sysClose();
+
+    char c_path[MAX_PATH] = { 0 };
+    wcstombs(c_path, path, MAX_PATH - 1);
+
+    // Read-only media/images are opened read-only
+    int flags = O_RDWR;
+    m_h = open(c_path, flags);
+    if (m_h == INVALID_HANDLE_VALUE && (errno == EACCES || errno == EROFS))
+        m_h = open(c_path, flags = O_RDONLY);
+
+    if (m_h == INVALID_HANDLE_VALUE)
+    {
+        dbg_printf("NxHandle::createFile() for %s ERROR %s\n", c_path, GetLastErrorAsString().c_str());
+        return false;
+    }
+    m_sys_offset = 0;
+
+#if defined(O_DIRECT)
+    // Second descriptor for aligned requests, page cache is bypassed
+    if (b_directIO && (m_fd_direct = open(c_path, flags | O_DIRECT)) < 0)
+        dbg_printf("NxHandle::createFile() O_DIRECT not supported for %s\n", c_path);
+#endif
+#endif
     
     //if (b_isDrive && !dismountVolume())
     //    dbg_printf("failed to dismount volume\n");
@@ -270,38 +439,37 @@ bool NxHandle::setPointer(u64 offset)
 {
     if (b_isSplitted)
     {
-        u64 real_offset = m_off_start + offset - m_curSplitFile->offset;;
         NxSplitFile *file = getSplitFile(m_off_start + offset);
         if (nullptr == file)
             return false;
 
-        if (wcscmp(file->file_path, m_curSplitFile->file_path))
-        {            
-            // Switch to next split file
-            createFile(file->file_path);
-            real_offset = m_off_start + offset - file->offset;
-            m_curSplitFile = file;
-
-           // dbg_printf("NxHandle::setPointer Switch to split, real offset = %s \n", n2hexstr(real_offset, 12).c_str());           
-        }
+        // Switch to split file (cached handle)
+        if (!switchSplitFile(file))
+            return false;
 
-        li_DistanceToMove.QuadPart = real_offset;
-        if (SetFilePointerEx(m_h, li_DistanceToMove, nullptr, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
+        u64 real_offset = m_off_start + offset - file->offset;
+        if (!sysSeek(real_offset))
             return false;
 
-        
-        lp_CurrentPointer.QuadPart = m_curSplitFile->offset + real_offset;
+        lp_CurrentPointer.QuadPart = file->offset + real_offset;
         //dbg_printf("NxHandle::setPointer - lp_CurrentPointer = %s (real = %s)\n", n2hexstr(lp_CurrentPointer.QuadPart, 12).c_str(),
         //    n2hexstr(real_offset, 12).c_str());
     }
+    else if (isReadOnly())
+    {
+        // Frames/blocks are read on demand
+        if (m_off_start + offset > m_size)
+            return false;
+        lp_CurrentPointer.QuadPart = m_off_start + offset;
+    }
     else
     {
-        li_DistanceToMove.QuadPart = m_off_start + offset;
-        if (SetFilePointerEx(m_h, li_DistanceToMove, &lp_CurrentPointer, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
+        if (!sysSeek(m_off_start + offset))
         {
             dbg_printf("INVALID POINTER\n");
             return false;
         }
+        lp_CurrentPointer.QuadPart = m_off_start + offset;
     }
 
     dbg_printf("NxHandle::setPointer(%s) real offset = %s\n", n2hexstr(offset, 12).c_str(), n2hexstr(m_off_start + offset, 12).c_str());
@@ -318,20 +486,6 @@ bool NxHandle::read(void *buffer, DWORD* br, DWORD length)
     if (!length) 
         length = getDefaultBuffSize();
 
-    // TO-DO : Resize buffer if there's not enough bytes in split file
-    if (b_isSplitted)
-    {
-        NxSplitFile *file = getSplitFile((u64)lp_CurrentPointer.QuadPart);
-        if (nullptr == file)
-            return false;
-
-        // Switch to next split file (in setPointer(u64 off))
-        if (wcscmp(file->file_path, m_curSplitFile->file_path)) 
-        {            
-            setPointer(lp_CurrentPointer.QuadPart - m_off_start);
-        }
-    }
-    
     /*
     dbg_printf("NxHandle::read(buffer, bytesRead=%I64d, length=%s) at offset %s crypto mode = %d\n",
     nullptr != br ? *br : 0, n2hexstr(length, 6).c_str(), n2hexstr(lp_CurrentPointer.QuadPart, 10).c_str(), 
@@ -348,7 +502,13 @@ bool NxHandle::read(void *buffer, DWORD* br, DWORD length)
         return false;
     }
 
-    if (!ReadFile(m_h, buffer, length, &bytesRead, NULL)) {
+    // Splitted storage: request is spread over consecutive split files
+    // Compressed storage: request is inflated from one or more frames
+    // Incremental storage: request is read from delta or base storage
+    bool success = isCompressed() ? m_zReader->read(lp_CurrentPointer.QuadPart, buffer, length, &bytesRead)
+                 : isDelta() ? m_deltaReader->read(lp_CurrentPointer.QuadPart, buffer, length, &bytesRead)
+                 : b_isSplitted ? splitIO(buffer, length, &bytesRead, false) : sysRead(buffer, length, &bytesRead);
+    if (!success) {
         dbg_printf("NxHandle::read ReadFile error\n");
         return false;
     }
@@ -361,14 +521,16 @@ bool NxHandle::read(void *buffer, DWORD* br, DWORD length)
 
     // Encrypt/Decrypt buffer
     //printf("READ CRYPTO %d, LENGTH %s\n", m_crypto, n2hexstr(length, 10).c_str());
-    if (is_in(m_crypto, { ENCRYPT, DECRYPT }) && nxCrypto != nullptr && length == CLUSTER_SIZE)
+    // Any cluster aligned buffer is processed, each cluster with its own index
+    if (is_in(m_crypto, { ENCRYPT, DECRYPT }) && nxCrypto != nullptr && isClusterAligned(length))
     {
         m_cur_block = (lp_CurrentPointer.QuadPart - m_off_start) / CLUSTER_SIZE;
+        size_t count = (bytesRead + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
         if (m_crypto == ENCRYPT) {            
-            nxCrypto->encrypt((unsigned char*)buffer, m_cur_block);
+            nxCrypto->encrypt((unsigned char*)buffer, m_cur_block, count);
         }
         else
-            nxCrypto->decrypt((unsigned char*)buffer, m_cur_block);
+            nxCrypto->decrypt((unsigned char*)buffer, m_cur_block, count);
     }
 
     //dbg_printf("NxHandle::read done, %I32d bytes\n", bytesRead);
@@ -389,10 +551,8 @@ bool NxHandle::read(void *buffer, DWORD* br, DWORD length)
     }
 
     // Hash buffer
-    if (m_crypto == MD5_HASH)
-    {
-        CryptHashData(m_md5_hash, (BYTE*)buffer, nullptr != br ? *br : bytesRead, 0);
-    }
+    if (m_crypto == MD5_HASH && nullptr != m_hash)
+        m_hash->update(buffer, nullptr != br ? *br : bytesRead);
 
     //dbg_printf("NxHandle::read returns %I64d bytes\n", bytesRead);
     return true;
@@ -424,16 +584,10 @@ bool NxHandle::write(void *buffer, DWORD* bw, DWORD length)
     if (!length) length = getDefaultBuffSize();
     DWORD bytesWrite;
 
-    // TO-DO : Resize buffer if there's not enough bytes in split file
-    if (b_isSplitted)
-    {
-        NxSplitFile *file = getSplitFile((u64)lp_CurrentPointer.QuadPart);
-        if (nullptr == file)
-            return false;
-
-        // Switch to next split file (in setPointer(u64 off))
-        if (wcscmp(file->file_path, m_curSplitFile->file_path))
-            setPointer(lp_CurrentPointer.QuadPart - m_off_start);
+    // Compressed & incremental storages are read-only
+    if (isReadOnly()) {
+        dbg_printf("NxHandle::write - storage is read-only\n");
+        return false;
     }
 
     // eof
@@ -457,17 +611,15 @@ bool NxHandle::write(void *buffer, DWORD* bw, DWORD length)
     }
 
     // Encrypt buffer
-    if (m_crypto == ENCRYPT && nxCrypto != nullptr && length == CLUSTER_SIZE)
+    if (m_crypto == ENCRYPT && nxCrypto != nullptr && isClusterAligned(length))
     {
         m_cur_block = (lp_CurrentPointer.QuadPart - m_off_start) / CLUSTER_SIZE;
-        nxCrypto->encrypt((unsigned char*)buffer, m_cur_block);
-
+        nxCrypto->encrypt((unsigned char*)buffer, m_cur_block, length / CLUSTER_SIZE);
     }
 
-    if (!WriteFile(m_h, buffer, length, &bytesWrite, NULL))
+    if (!(b_isSplitted ? splitIO(buffer, length, &bytesWrite, true) : sysWrite(buffer, length, &bytesWrite)))
     {
-        DWORD errorMessageID = ::GetLastError();
-        dbg_printf("NxHandle::write - FAILED WriteFile - %I32d : %s", errorMessageID, GetLastErrorAsString().c_str());
+        dbg_printf("NxHandle::write - FAILED WriteFile : %s", GetLastErrorAsString().c_str());
         return false;
     }
     if (bytesWrite == 0) {
@@ -501,66 +653,442 @@ bool NxHandle::write(u32 sector, void *buffer, DWORD* bw, DWORD length)
     return write(offset, buffer, bw, length);
 }
 
-bool NxHandle::hash(u64* bytesCount)
+bool NxHandle::hash(u64* bytesCount, u64 bytesTotal, NxPartition *partition)
 {
     if (!*bytesCount)
     {
-        initHandle(MD5_HASH);
-        memset(m_md5_buffer, 0, DEFAULT_BUFF_SIZE);
+        initHandle(MD5_HASH, partition);
+        memset(m_hash_buffer, 0, DEFAULT_BUFF_SIZE);
     }
 
+    // Hash up to bytesTotal (if provided) or eof
+    DWORD length = DEFAULT_BUFF_SIZE;
+    if (bytesTotal && bytesTotal - *bytesCount < length)
+        length = (DWORD)(bytesTotal - *bytesCount);
+
     DWORD bytesRead = 0;
     bool success = false;
-    if (!(read(m_md5_buffer, &bytesRead, DEFAULT_BUFF_SIZE)))
+    if (!length || !(read(m_hash_buffer, &bytesRead, length)))
         success = true;
 
     *bytesCount += bytesRead;
-    return success;
+    return success || (bytesTotal && *bytesCount >= bytesTotal);
 }
 
 NxSplitFile* NxHandle::getSplitFile(u64 offset)
 {
-    if (!b_isSplitted)
+    if (!b_isSplitted || m_splitFiles.empty())
         return nullptr;
 
-    NxSplitFile *file = m_lastSplitFile;
-    while (nullptr != file)
+    // Sequential I/O, most likely in current file
+    NxSplitFile *file = m_curSplitFile;
+    if (nullptr != file && offset >= file->offset && offset < file->offset + file->size)
+        return file;
+
+    // Binary search (last file starting at or before offset)
+    auto it = std::upper_bound(m_splitFiles.begin(), m_splitFiles.end(), offset,
+        [](u64 off, const NxSplitFile &f) { return off < f.offset; });
+    if (it == m_splitFiles.begin())
+        return nullptr;
+
+    file = &*(--it);
+    return offset < file->offset + file->size ? file : nullptr;
+}
+
+bool NxHandle::switchSplitFile(NxSplitFile *file)
+{
+    file->last_use = ++m_splitUseCount;
+    if (file == m_curSplitFile)
+        return true;
+
+    // Current handle (and mapping) stays opened in cache (m_curSplitFile->h)
+    if (nullptr != m_curSplitFile)
+        m_curSplitFile->map = m_map;
+    m_curSplitFile = file;
+    m_h = file->h;
+    m_map = file->map;
+#if !defined(_WIN32)
+    m_fd_direct = file->fd_direct;
+#endif
+    if (m_h != INVALID_HANDLE_VALUE)
+        return true;
+
+    // Close least recently used handle if cache is full
+    NxSplitFile *lru = nullptr;
+    int opened = 0;
+    for (NxSplitFile &f : m_splitFiles)
+    {
+        if (f.h == INVALID_HANDLE_VALUE)
+            continue;
+        opened++;
+        if (nullptr == lru || f.last_use < lru->last_use)
+            lru = &f;
+    }
+    if (opened >= SPLIT_HANDLE_CACHE)
+        closeSplitFile(lru);
+
+    if (!createFile(file->file_path))
+        return false;
+
+    file->h = m_h;
+#if !defined(_WIN32)
+    file->fd_direct = m_fd_direct;
+#endif
+    return true;
+}
+
+bool NxHandle::splitIO(void *buffer, DWORD length, DWORD *bytes, bool write)
+{
+    *bytes = 0;
+    while (*bytes < length)
     {
-        if (offset >= file->offset && offset < file->offset + file->size) 
-            return file;
+        // Split files are only read/written in place (never extended)
+        u64 offset = (u64)lp_CurrentPointer.QuadPart + *bytes;
+        NxSplitFile *file = getSplitFile(offset);
+        if (nullptr == file)
+            break; // eof
+
+        if (!switchSplitFile(file) || !sysSeek(offset - file->offset))
+            return false;
+
+        DWORD chunk = (DWORD)std::min((u64)(length - *bytes), file->offset + file->size - offset), done;
+        if (!(write ? sysWrite((u8*)buffer + *bytes, chunk, &done) : sysRead((u8*)buffer + *bytes, chunk, &done)))
+            return false;
 
-        file = file->next;
+        *bytes += done;
+        if (write && done)
+            file->dirty = true;
+        if (done < chunk)
+            break;
     }
+    return true;
+}
+
+void NxHandle::closeSplitFile(NxSplitFile *file)
+{
+    if (file->h == INVALID_HANDLE_VALUE)
+        return;
 
-    return nullptr;
+    // Written data is synced before handle leaves the cache (reported by next flush())
+    if (file->dirty && !sysFlush(file->h))
+        b_syncError = true;
+    file->dirty = false;
+
+    // Swap with current handle to close it
+    bool current = file->h == m_h;
+    sysUnmap(current ? &m_map : &file->map);
+    HANDLE h = m_h;
+    m_h = file->h;
+#if !defined(_WIN32)
+    int fd_direct = m_fd_direct;
+    m_fd_direct = file->fd_direct;
+#endif
+    sysClose();
+    m_h = current ? INVALID_HANDLE_VALUE : h;
+#if !defined(_WIN32)
+    m_fd_direct = current ? -1 : fd_direct;
+    file->fd_direct = -1;
+#endif
+    file->h = INVALID_HANDLE_VALUE;
+}
+
+bool NxHandle::flush()
+{
+    if (!b_isSplitted || m_splitFiles.empty())
+        return sysFlush(m_h);
+
+    // A sync error is sticky, data may be lost whatever comes next
+    bool success = !b_syncError;
+    for (NxSplitFile &file : m_splitFiles)
+    {
+        if (!file.dirty || file.h == INVALID_HANDLE_VALUE)
+            continue;
+        if (sysFlush(file.h))
+            file.dirty = false;
+        else
+            success = false;
+    }
+    return success;
+}
+
+void NxHandle::closeSplitFiles()
+{
+    for (NxSplitFile &file : m_splitFiles)
+        closeSplitFile(&file);
 }
 
 void NxHandle::clearHandle()
 {
     //dbg_printf("NxHandle::clearHandle()\n");
+    closeSplitFiles();
+    sysClose();
+    initHandle();
+}
+
+int NxHandle::getDefaultBuffSize()
+{
+    // DEFAULT_BUFF_SIZE is a multiple of CLUSTER_SIZE, crypto modes can use it too
+    return DEFAULT_BUFF_SIZE;
+}
+
+bool NxHandle::isClusterAligned(DWORD length)
+{
+    return length && !(length % CLUSTER_SIZE) && !((lp_CurrentPointer.QuadPart - m_off_start) % CLUSTER_SIZE);
+}
+
+void NxHandle::closeHandle()
+{
+    closeSplitFiles();
+    sysClose();
+}
+
+void NxHandle::setDirectIO(bool b)
+{
+    if (b_directIO == b)
+        return;
+
+    b_directIO = b;
+#if !defined(_WIN32)
+    // Reopen current file to get (or release) O_DIRECT descriptor
+    if (m_h != INVALID_HANDLE_VALUE)
+    {
+        u64 cur_off = m_sys_offset;
+        if (!b_isSplitted)
+            createFile(parent->m_path);
+        else
+        {
+            // Other split files are reopened on demand
+            for (NxSplitFile &file : m_splitFiles)
+                if (&file != m_curSplitFile)
+                    closeSplitFile(&file);
+
+            createFile(m_curSplitFile->file_path);
+            m_curSplitFile->h = m_h;
+            m_curSplitFile->fd_direct = m_fd_direct;
+        }
+        m_sys_offset = cur_off;
+    }
+#endif
+}
+
+void NxHandle::setMemoryMap(bool b)
+{
+    b_memoryMap = b;
+    if (b)
+        return; // files are mapped on first read
+
+    sysUnmap(&m_map);
+    for (NxSplitFile &file : m_splitFiles)
+        if (&file != m_curSplitFile)
+            sysUnmap(&file.map);
+}
+
+bool NxHandle::mapFile()
+{
+    if (!b_memoryMap || b_directIO || b_isDrive || m_h == INVALID_HANDLE_VALUE)
+        return false;
+
+    // Map once per opened file, reads fall back to native I/O on failure
+    if (!m_map.tried)
+    {
+        m_map.tried = true;
+        u64 size;
+        if (sysFileSize(&size) && size && size <= (u64)SIZE_MAX && !sysMap(size))
+            dbg_printf("NxHandle::mapFile() failed to map file (%s)\n", GetLastErrorAsString().c_str());
+    }
+    return nullptr != m_map.data;
+}
+
+#if defined(_WIN32)
+
+void NxHandle::sysClose()
+{
+    sysUnmap(&m_map);
     DWORD lpdwFlags[100];
     if (GetHandleInformation(m_h, lpdwFlags))
-    {
         CloseHandle(m_h);
+}
+
+bool NxHandle::sysSeek(u64 offset)
+{
+    li_DistanceToMove.QuadPart = offset;
+    return SetFilePointerEx(m_h, li_DistanceToMove, nullptr, FILE_BEGIN) != INVALID_SET_FILE_POINTER;
+}
+
+bool NxHandle::sysRead(void *buffer, DWORD length, DWORD *bytesRead)
+{
+    // Mapped file, read is a copy from page cache
+    LARGE_INTEGER pos, move;
+    move.QuadPart = 0;
+    if (mapFile() && SetFilePointerEx(m_h, move, &pos, FILE_CURRENT) && (u64)pos.QuadPart + length <= m_map.size)
+    {
+        memcpy(buffer, m_map.data + pos.QuadPart, length);
+        move.QuadPart = length;
+        *bytesRead = length;
+        return SetFilePointerEx(m_h, move, nullptr, FILE_CURRENT);
     }
-    initHandle();
+    return ReadFile(m_h, buffer, length, bytesRead, NULL);
 }
 
-int NxHandle::getDefaultBuffSize()
+bool NxHandle::sysWrite(void *buffer, DWORD length, DWORD *bytesWrite)
+{
+    return WriteFile(m_h, buffer, length, bytesWrite, NULL);
+}
+
+bool NxHandle::sysFileSize(u64 *size)
 {
-    int size = DEFAULT_BUFF_SIZE;
-    if (is_in(m_crypto, {ENCRYPT, DECRYPT}))
-        size = CLUSTER_SIZE;
+    LARGE_INTEGER Lsize;
+    if (!GetFileSizeEx(m_h, &Lsize))
+        return false;
 
-    //printf("getDefaultBuffSize crypto_mode = %d, returns %s\n", m_crypto, n2hexstr(size, 10).c_str());
-    return size;
+    *size = (u64)Lsize.QuadPart;
+    return true;
 }
 
-void NxHandle::closeHandle()
+bool NxHandle::sysFlush(HANDLE h)
 {
-    CloseHandle(m_h);
+    return FlushFileBuffers(h);
 }
 
+bool NxHandle::sysMap(u64 size)
+{
+    HANDLE h_map = CreateFileMappingW(m_h, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (nullptr == h_map)
+        return false;
+
+    // View keeps the mapping object alive
+    m_map.data = (u8*)MapViewOfFile(h_map, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(h_map);
+    if (nullptr == m_map.data)
+        return false;
+
+    m_map.size = size;
+    return true;
+}
+
+void NxHandle::sysUnmap(NxFileMap *map)
+{
+    if (nullptr != map->data)
+        UnmapViewOfFile(map->data);
+    *map = NxFileMap();
+}
+
+#else
+
+void NxHandle::sysClose()
+{
+    sysUnmap(&m_map);
+    if (m_fd_direct >= 0)
+        close(m_fd_direct);
+    if (m_h != INVALID_HANDLE_VALUE)
+        close(m_h);
+
+    m_fd_direct = -1;
+    m_h = INVALID_HANDLE_VALUE;
+}
+
+bool NxHandle::sysSeek(u64 offset)
+{
+    if (m_h == INVALID_HANDLE_VALUE)
+        return false;
+
+    // pread/pwrite are positional, only keep track of the offset
+    m_sys_offset = offset;
+    return true;
+}
+
+bool NxHandle::sysRead(void *buffer, DWORD length, DWORD *bytesRead)
+{
+    // Mapped file, read is a copy from page cache
+    if (mapFile() && m_sys_offset + length <= m_map.size)
+    {
+        memcpy(buffer, m_map.data + m_sys_offset, length);
+        m_sys_offset += length;
+        *bytesRead = length;
+        return true;
+    }
+
+    *bytesRead = 0;
+    bool aligned = !((uintptr_t)buffer % DIRECT_IO_ALIGN) && !(length % DIRECT_IO_ALIGN) && !(m_sys_offset % DIRECT_IO_ALIGN);
+    int fd = m_fd_direct >= 0 && aligned ? m_fd_direct : m_h;
+
+    while (*bytesRead < length)
+    {
+        ssize_t n = pread(fd, (u8*)buffer + *bytesRead, length - *bytesRead, (off_t)(m_sys_offset + *bytesRead));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return false;
+        if (n == 0) // eof
+            break;
+        *bytesRead += (DWORD)n;
+    }
+    m_sys_offset += *bytesRead;
+    return true;
+}
+
+bool NxHandle::sysWrite(void *buffer, DWORD length, DWORD *bytesWrite)
+{
+    *bytesWrite = 0;
+    bool aligned = !((uintptr_t)buffer % DIRECT_IO_ALIGN) && !(length % DIRECT_IO_ALIGN) && !(m_sys_offset % DIRECT_IO_ALIGN);
+    int fd = m_fd_direct >= 0 && aligned ? m_fd_direct : m_h;
+
+    while (*bytesWrite < length)
+    {
+        ssize_t n = pwrite(fd, (u8*)buffer + *bytesWrite, length - *bytesWrite, (off_t)(m_sys_offset + *bytesWrite));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        *bytesWrite += (DWORD)n;
+    }
+    m_sys_offset += *bytesWrite;
+    return true;
+}
+
+bool NxHandle::sysFileSize(u64 *size)
+{
+    struct stat st;
+    if (m_h == INVALID_HANDLE_VALUE || fstat(m_h, &st))
+        return false;
+
+#if defined(BLKGETSIZE64)
+    if (S_ISBLK(st.st_mode))
+        return !ioctl(m_h, BLKGETSIZE64, size);
+#endif
+
+    *size = (u64)st.st_size;
+    return true;
+}
+
+bool NxHandle::sysFlush(HANDLE h)
+{
+    return h != INVALID_HANDLE_VALUE && !fsync(h);
+}
+
+bool NxHandle::sysMap(u64 size)
+{
+    // Shared mapping stays coherent with pwrite() on the same file
+    void *data = mmap(nullptr, (size_t)size, PROT_READ, MAP_SHARED, m_h, 0);
+    if (data == MAP_FAILED)
+        return false;
+
+    m_map.data = (u8*)data;
+    m_map.size = size;
+    return true;
+}
+
+void NxHandle::sysUnmap(NxFileMap *map)
+{
+    if (nullptr != map->data)
+        munmap(map->data, (size_t)map->size);
+    *map = NxFileMap();
+}
+
+#endif
+
+#if defined(_WIN32)
+
 bool NxHandle::dismountVolume()
 {
     DWORD dwBytesReturned;
@@ -880,3 +1408,16 @@ bool NxHandle::getDisksProperty(PSTORAGE_DEVICE_DESCRIPTOR pDevDesc, HANDLE hDev
 
     return bResult;
 }
+
+#else
+
+// Volume locking/mounting is handled by the OS (umount) on POSIX systems
+bool NxHandle::dismountVolume() { return true; }
+bool NxHandle::lockVolume() { return true; }
+bool NxHandle::unlockVolume() { return true; }
+bool NxHandle::lockFile() { return true; }
+bool NxHandle::ejectVolume() { return false; }
+bool NxHandle::dismountAllVolumes() { return false; }
+bool NxHandle::getVolumeName(WCHAR *pVolumeName, u32 start_sector) { return false; }
+
+#endif
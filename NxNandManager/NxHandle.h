@@ -17,26 +17,45 @@
 #ifndef __NxHandle_h__
 #define __NxHandle_h__
 
-#include <windows.h>
-#include <winioctl.h>
-#include <Wincrypt.h>
+#include "res/platform.h"
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include <string.h> 
 #include "res/types.h"
 #include "NxPartition.h"
 #include "NxStorage.h"
+#include "NxHash.h"
+#include "NxZFile.h"
+#include "NxDelta.h"
 #include "res/utils.h"
 
 using namespace std;
 
+#define SPLIT_HANDLE_CACHE 8 // Max. opened split files
+
+// Read-only file mapping (created on first read)
+typedef struct NxFileMap NxFileMap;
+struct NxFileMap {
+    u8 *data = nullptr;
+    u64 size = 0;
+    bool tried = false;
+};
+
 typedef struct NxSplitFile NxSplitFile;
 struct NxSplitFile {
     u64 offset;
     u64 size;
     wchar_t file_path[MAX_PATH];
-    NxSplitFile *next = NULL;
+    // Cached handle (INVALID_HANDLE_VALUE when closed)
+    HANDLE h = INVALID_HANDLE_VALUE;
+#if !defined(_WIN32)
+    int fd_direct = -1;
+#endif
+    NxFileMap map;
+    u64 last_use = 0;
+    bool dirty = false;     // written since last sync
 };
 
 class NxStorage;
@@ -54,7 +73,15 @@ class NxHandle {
     private:
 
         NxStorage *parent;
-        HANDLE m_h;
+        HANDLE m_h = INVALID_HANDLE_VALUE;
+#if !defined(_WIN32)
+        // POSIX backend
+        int m_fd_direct = -1;
+        u64 m_sys_offset = 0;
+#endif
+        bool b_directIO = false;
+        bool b_memoryMap = false;
+        NxFileMap m_map; // current file
 
         // Offsets & I/O member variables
         u64 m_off_start = 0;
@@ -71,24 +98,44 @@ class NxHandle {
         u64 m_fileDiskTotalBytes;
         u64 m_fileDiskFreeBytes;
 
-        // Splitted storage
-        NxSplitFile *m_lastSplitFile;
-        NxSplitFile *m_curSplitFile;
-        int m_splitFileCount = 0;
+        // Splitted storage (parts sorted by offset)
+        vector<NxSplitFile> m_splitFiles;
+        NxSplitFile *m_curSplitFile = nullptr;
+        u64 m_splitUseCount = 0;
+        bool b_syncError = false;   // a dirty split file failed to sync before being closed
         bool b_isSplitted = false;
 
+        // Compressed container & incremental dump (read-only)
+        NxZReader *m_zReader = nullptr;
+        NxDeltaReader *m_deltaReader = nullptr;
+
         // Crypto
-        HCRYPTPROV h_WinCryptProv;
-        HCRYPTHASH m_md5_hash;
-        BYTE m_md5_buffer[DEFAULT_BUFF_SIZE];
-        NxCrypto *nxCrypto;
+        NxHash *m_hash = nullptr;
+        BYTE m_hash_buffer[DEFAULT_BUFF_SIZE];
+        NxCrypto *nxCrypto = nullptr;
         int m_crypto = NO_CRYPTO;
     
         // Boolean
         bool b_isDrive = false;
 
         // Methods
-        NxSplitFile* getSplitFile(u64 offset);        
+        NxSplitFile* getSplitFile(u64 offset);
+        bool switchSplitFile(NxSplitFile *file);
+        bool splitIO(void *buffer, DWORD length, DWORD *bytes, bool write);
+        void closeSplitFile(NxSplitFile *file);
+        void closeSplitFiles();
+        bool isClusterAligned(DWORD length);
+        bool mapFile();
+
+        // Native I/O (Win32 or POSIX backend)
+        void sysClose();
+        bool sysSeek(u64 offset);
+        bool sysRead(void *buffer, DWORD length, DWORD *bytesRead);
+        bool sysWrite(void *buffer, DWORD length, DWORD *bytesWrite);
+        bool sysFileSize(u64 *size);
+        bool sysFlush(HANDLE h);
+        bool sysMap(u64 size);
+        void sysUnmap(NxFileMap *map);
 
     public:
 
@@ -100,18 +147,27 @@ class NxHandle {
         bool isDrive() { return b_isDrive; };
         u64  size() { return m_size; };
         bool isSplitted() { return b_isSplitted; };
+        bool isCompressed() { return nullptr != m_zReader; };
+        bool isDelta() { return nullptr != m_deltaReader; };
+        bool isReadOnly() { return isCompressed() || isDelta(); };
+        NxDeltaReader* deltaReader() { return m_deltaReader; };
         int getCryptoMode() { return m_crypto; };
-        HCRYPTHASH md5Hash() { return m_md5_hash; };
-        int getSplitCount() { return m_splitFileCount; };
+        NxHash* hasher() { return m_hash; };
+        int getSplitCount() { return (int)m_splitFiles.size(); };
         int getDefaultBuffSize();
+        u64 getCurrentOffset() { return lp_CurrentPointer.QuadPart - m_off_start; };
         u64 getDiskFreeSpace() { return m_fileDiskFreeBytes; };
         NxCrypto* crypto() { return nxCrypto; };
+        bool directIO() { return b_directIO; };
+        bool memoryMap() { return b_memoryMap; };
 
         // Setters
         void setSplitted(bool b) { b_isSplitted = b; };
         void setSize(u64 u_size) { m_size = u_size; };
         void setOffMax(u64 off) { m_off_max = m_off_start + off; };
         void setCrypto(int crypto_mode = NO_CRYPTO) { m_crypto = crypto_mode; };
+        void setDirectIO(bool b);
+        void setMemoryMap(bool b);
 
         // Public methods
         void initHandle(int crypto_mode = NO_CRYPTO, NxPartition *partition = nullptr);
@@ -124,8 +180,10 @@ class NxHandle {
         bool write(void *buffer, DWORD* bytesWrite, DWORD length = 0);
         bool write(u64 offset, void *buffer, DWORD* bytesWrite, DWORD length = 0);
         bool write(u32 sector, void *buffer, DWORD* bw, DWORD length);
+        // Written data is committed to disk (every split file written since last flush)
+        bool flush();
         bool createFile(wchar_t *path, int io_mode = GENERIC_READ);
-        bool hash(u64* bytesCount);
+        bool hash(u64* bytesCount, u64 bytesTotal = 0, NxPartition *partition = nullptr);
         bool setPointer(u64 offset);
         bool dismountVolume();
         bool dismountAllVolumes();
@@ -134,7 +192,9 @@ class NxHandle {
         bool lockFile();
         bool ejectVolume();
         bool getVolumeName(WCHAR *pVolumeName, u32 start_sector);
+#if defined(_WIN32)
         bool getDisksProperty(PSTORAGE_DEVICE_DESCRIPTOR pDevDesc, HANDLE hDevice = nullptr);
+#endif
 };
 
 #endif
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <ctype.h>
+#include "NxHash.h"
+
+static const char* hash_names[] = { "md5", "sha256", "xxh3", "blake3" };
+
+NxHash::NxHash(int algorithm)
+{
+    m_algorithm = algorithm;
+    switch (m_algorithm)
+    {
+    case HASH_SHA256:
+        m_evp = EVP_MD_CTX_new();
+        EVP_DigestInit_ex(m_evp, EVP_sha256(), nullptr);
+        break;
+    case HASH_XXH3:
+        m_xxh3 = new XXH3Hasher();
+        break;
+    case HASH_BLAKE3:
+        m_blake3 = new Blake3Hasher();
+        break;
+    default:
+        m_algorithm = HASH_MD5;
+        m_evp = EVP_MD_CTX_new();
+        EVP_DigestInit_ex(m_evp, EVP_md5(), nullptr);
+    }
+}
+
+NxHash::~NxHash()
+{
+    if (nullptr != m_evp)
+        EVP_MD_CTX_free(m_evp);
+    delete m_xxh3;
+    delete m_blake3;
+}
+
+void NxHash::update(const void *data, size_t length)
+{
+    if (b_final)
+        return;
+
+    if (nullptr != m_evp)
+        EVP_DigestUpdate(m_evp, data, length);
+    else if (nullptr != m_xxh3)
+        m_xxh3->update(data, length);
+    else if (nullptr != m_blake3)
+        m_blake3->update(data, length);
+}
+
+std::string NxHash::checksum()
+{
+    if (b_final)
+        return m_checksum;
+
+    u8 digest[EVP_MAX_MD_SIZE];
+    unsigned int size = 0;
+    if (nullptr != m_evp)
+    {
+        if (!EVP_DigestFinal_ex(m_evp, digest, &size))
+            size = 0;
+    }
+    else if (nullptr != m_xxh3)
+    {
+        // Canonical (big endian) representation, as xxhsum
+        u64 h = m_xxh3->digest();
+        for (size = 0; size < 8; size++)
+            digest[size] = (u8)(h >> (56 - 8 * size));
+    }
+    else if (nullptr != m_blake3)
+    {
+        m_blake3->digest(digest);
+        size = BLAKE3_OUT_LEN;
+    }
+
+    const char digits[] = "0123456789abcdef";
+    for (unsigned int i(0); i < size; i++)
+    {
+        m_checksum.push_back(digits[digest[i] >> 4]);
+        m_checksum.push_back(digits[digest[i] & 0xf]);
+    }
+    b_final = true;
+    return m_checksum;
+}
+
+int NxHash::getAlgorithm(const char *name)
+{
+    std::string lname(name);
+    for (char &c : lname)
+        c = (char)tolower(c);
+
+    for (int i(0); i < (int)(sizeof(hash_names) / sizeof(hash_names[0])); i++)
+        if (lname == hash_names[i])
+            return i;
+
+    return -1;
+}
+
+const char* NxHash::getAlgorithmName(int algorithm)
+{
+    if (algorithm < 0 || algorithm >= (int)(sizeof(hash_names) / sizeof(hash_names[0])))
+        return "";
+
+    return hash_names[algorithm];
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NxHash_h__
+#define __NxHash_h__
+
+#include <string>
+#include <openssl/evp.h>
+#include "res/types.h"
+#include "res/xxh3.h"
+#include "res/blake3.h"
+
+// Hash algorithms
+#define HASH_MD5    0 // hekate compatible
+#define HASH_SHA256 1
+#define HASH_XXH3   2
+#define HASH_BLAKE3 3
+
+// Portable hash engine used for integrity checks (dump, restore, verify).
+// MD5 & SHA-256 are computed by OpenSSL (SHA extensions used when available)
+class NxHash
+{
+    // Constructors
+    public:
+        explicit NxHash(int algorithm = HASH_MD5);
+        ~NxHash();
+
+    // Member variables
+    private:
+        int m_algorithm;
+        EVP_MD_CTX *m_evp = nullptr;
+        XXH3Hasher *m_xxh3 = nullptr;
+        Blake3Hasher *m_blake3 = nullptr;
+        std::string m_checksum;
+        bool b_final = false;
+
+    // Member methods
+    public:
+        int algorithm() { return m_algorithm; };
+        void update(const void *data, size_t length);
+        // Hex digest (hash is finalized on first call)
+        std::string checksum();
+
+        static int getAlgorithm(const char *name);
+        static const char* getAlgorithmName(int algorithm);
+};
+
+#endif
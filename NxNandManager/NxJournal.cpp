@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "NxJournal.h"
+
+NxJournal::NxJournal(const char *file, const NxJournalInfo &info, u64 interval)
+{
+    m_file = std::string(file);
+    m_info = info;
+    m_interval = interval;
+    b_valid = true;
+}
+
+NxJournal::NxJournal(const char *file)
+{
+    m_file = std::string(file);
+    std::ifstream in_file(file);
+    std::string line, key, magic;
+    int version = 0;
+    if (!std::getline(in_file, line) || !(std::istringstream(line) >> magic >> version) || magic != NXJ_MAGIC || version != NXJ_VERSION)
+        return;
+
+    while (std::getline(in_file, line))
+    {
+        std::istringstream values(line);
+        if (!(values >> key))
+            continue;
+
+        bool ok = true;
+        if (key == "operation")
+            ok = (bool)(values >> m_info.operation);
+        else if (key == "input")
+            m_info.input = line.length() > key.length() + 1 ? line.substr(key.length() + 1) : "";
+        else if (key == "type") // Type may contain spaces ("FULL NAND")
+            ok = (m_info.type = line.length() > key.length() + 1 ? line.substr(key.length() + 1) : "").length() > 0;
+        else if (key == "size")
+            ok = (bool)(values >> m_info.size);
+        else if (key == "crypto")
+            ok = (bool)(values >> m_info.crypto_mode);
+        else if (key == "hash")
+        {
+            std::string name;
+            ok = (values >> name) && (m_info.hash_algorithm = NxHash::getAlgorithm(name.c_str())) >= 0;
+        }
+        else if (key == "split_size")
+            ok = (bool)(values >> m_info.split_size);
+        else if (key == "interval")
+            ok = (bool)(values >> m_interval);
+        else if (key == "checkpoint")
+        {
+            // Checkpoints are listed in order
+            NxCheckpoint checkpoint;
+            ok = (values >> checkpoint.offset >> checkpoint.digest) && checkpoint.offset <= m_info.size
+                 && (m_checkpoints.empty() || checkpoint.offset > m_checkpoints.back().offset);
+            m_checkpoints.push_back(checkpoint);
+        }
+        if (!ok)
+        {
+            dbg_printf("NxJournal::NxJournal() invalid line : %s\n", line.c_str());
+            return;
+        }
+    }
+
+    b_valid = !m_info.operation.empty() && m_info.size && m_interval;
+}
+
+NxJournal::~NxJournal()
+{
+    stop();
+}
+
+bool NxJournal::matches(const NxJournalInfo &info)
+{
+    if (info.input != m_info.input)
+        dbg_printf("NxJournal::matches() input was %s\n", m_info.input.c_str());
+
+    return info.operation == m_info.operation && info.type == m_info.type && info.size == m_info.size
+        && info.crypto_mode == m_info.crypto_mode && info.hash_algorithm == m_info.hash_algorithm
+        && info.split_size == m_info.split_size;
+}
+
+void NxJournal::update(const u8 *data, DWORD length)
+{
+    static const u8 zeros[CLUSTER_SIZE] = { 0 };
+    m_offset += length;
+    if (nullptr != data)
+        m_hash.update(data, length);
+    else for (DWORD chunk; length; length -= chunk)
+        m_hash.update(zeros, chunk = std::min(length, (DWORD)CLUSTER_SIZE));
+}
+
+void NxJournal::checkpoint()
+{
+    // Digest is computed on a copy of the state (hashing goes on)
+    NxCheckpoint checkpoint;
+    checkpoint.offset = m_offset;
+    checkpoint.digest = n2hexstr(m_hash.digest());
+    m_last = m_offset;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_checkpoints.push_back(checkpoint);
+        b_dirty = true;
+    }
+    m_cv.notify_all();
+}
+
+u64 NxJournal::replay(u64 limit, NxJournalReader read, NxJournalConsumer consume)
+{
+    m_hash.reset();
+    m_offset = 0;
+    m_last = 0;
+
+    std::vector<u8> buffer(DEFAULT_BUFF_SIZE);
+    size_t valid = 0;
+    for (const NxCheckpoint &checkpoint : m_checkpoints)
+    {
+        if (checkpoint.offset > limit)
+            break;
+
+        bool success = true;
+        while (success && m_offset < checkpoint.offset)
+        {
+            DWORD chunk = (DWORD)std::min((u64)DEFAULT_BUFF_SIZE, checkpoint.offset - m_offset);
+            if ((success = read(buffer.data(), chunk)))
+            {
+                m_hash.update(buffer.data(), chunk);
+                consume(buffer.data(), chunk);
+                m_offset += chunk;
+            }
+        }
+        if (!success || n2hexstr(m_hash.digest()) != checkpoint.digest)
+        {
+            dbg_printf("NxJournal::replay() checkpoint at %s doesn't match output\n", n2hexstr(checkpoint.offset, 10).c_str());
+            break;
+        }
+        m_last = checkpoint.offset;
+        valid++;
+    }
+
+    // Checkpoints past resume offset are dropped
+    m_checkpoints.resize(valid);
+    return m_last;
+}
+
+void NxJournal::start()
+{
+    // Header (and checkpoints kept when resuming) written right away
+    b_dirty = true;
+    m_thread = std::thread(&NxJournal::threadLoop, this);
+}
+
+void NxJournal::threadLoop()
+{
+    for (;;)
+    {
+        std::vector<NxCheckpoint> checkpoints;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] { return b_stop || b_dirty; });
+            if (!b_dirty)
+                break;
+            checkpoints = m_checkpoints;
+            b_dirty = false;
+        }
+
+        if (!write(checkpoints))
+            dbg_printf("NxJournal::threadLoop() failed to write %s\n", m_file.c_str());
+    }
+}
+
+bool NxJournal::write(const std::vector<NxCheckpoint> &checkpoints)
+{
+    // Written aside then renamed, journal is never left half written
+    std::string tmp = m_file + ".tmp";
+    std::ofstream out_file(tmp);
+    out_file << NXJ_MAGIC << " " << NXJ_VERSION << "\n"
+             << "operation " << m_info.operation << "\n"
+             << "input " << m_info.input << "\n"
+             << "type " << m_info.type << "\n"
+             << "size " << m_info.size << "\n"
+             << "crypto " << m_info.crypto_mode << "\n"
+             << "hash " << NxHash::getAlgorithmName(m_info.hash_algorithm) << "\n"
+             << "split_size " << m_info.split_size << "\n"
+             << "interval " << m_interval << "\n";
+    for (const NxCheckpoint &checkpoint : checkpoints)
+        out_file << "checkpoint " << checkpoint.offset << " " << checkpoint.digest << "\n";
+    out_file.close();
+    if (out_file.fail())
+        return false;
+
+#if defined(_WIN32)
+    return MoveFileExA(tmp.c_str(), m_file.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    return !rename(tmp.c_str(), m_file.c_str());
+#endif
+}
+
+void NxJournal::stop()
+{
+    // Pending checkpoint is written before thread exits
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        b_stop = true;
+    }
+    m_cv.notify_all();
+
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+void NxJournal::close(bool done)
+{
+    stop();
+    if (done)
+        remove(m_file.c_str());
+}
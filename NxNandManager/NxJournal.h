@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NxJournal_h__
+#define __NxJournal_h__
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <string>
+#include <vector>
+#include "res/types.h"
+#include "res/utils.h"
+#include "res/xxh3.h"
+#include "NxHash.h"
+
+#define NXJ_MAGIC "NXJOURNAL"
+#define NXJ_VERSION 1
+#define NXJ_EXT ".journal"      // <output (first part)>.journal, <input>.journal when restoring to a drive
+
+// Operation parameters, must match when resuming
+typedef struct NxJournalInfo NxJournalInfo;
+struct NxJournalInfo {
+    std::string operation;  // dump, restore
+    std::string input;      // informative only (drive path may change after a reset)
+    std::string type;
+    u64 size = 0;
+    int crypto_mode = 0;
+    int hash_algorithm = HASH_MD5;
+    u64 split_size = 0;
+};
+
+typedef struct NxCheckpoint NxCheckpoint;
+struct NxCheckpoint {
+    u64 offset;             // bytes committed to output
+    std::string digest;     // XXH3 of data [0, offset)
+};
+
+// Next length bytes of already copied data (read back from output)
+typedef std::function<bool(u8 *buffer, DWORD length)> NxJournalReader;
+typedef std::function<void(const u8 *data, DWORD length)> NxJournalConsumer;
+
+// Checkpoint journal (text file) :
+//   NXJOURNAL 1
+//   operation <dump|restore>
+//   input <path>
+//   type RAWNAND
+//   size <bytes>
+//   crypto <crypto mode>
+//   hash <verification algorithm>
+//   split_size <bytes>
+//   interval <bytes>
+//   checkpoint <offset> <digest>   (one line per checkpoint)
+// Copied data is hashed with XXH3 by the writer, every interval bytes the writer syncs
+// output and adds a checkpoint, the journal is then rewritten by a background thread.
+class NxJournal
+{
+    // Constructors
+    public:
+        // New journal (written once started)
+        NxJournal(const char *file, const NxJournalInfo &info, u64 interval);
+        // Load journal (resume)
+        explicit NxJournal(const char *file);
+        ~NxJournal();
+
+    // Member variables
+    private:
+        std::string m_file;
+        NxJournalInfo m_info;
+        u64 m_interval = 0;
+        std::vector<NxCheckpoint> m_checkpoints;
+        XXH3Hasher m_hash;
+        u64 m_offset = 0;
+        u64 m_last = 0;             // last checkpoint offset
+        bool b_valid = false;
+
+        // Journal thread
+        std::thread m_thread;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        bool b_dirty = false;
+        bool b_stop = false;
+
+    // Member methods
+    private:
+        void threadLoop();
+        bool write(const std::vector<NxCheckpoint> &checkpoints);
+        void stop();
+
+    public:
+        bool isValid() { return b_valid; };
+        const NxJournalInfo& info() { return m_info; };
+        bool matches(const NxJournalInfo &info);
+        u64 offset() { return m_offset; };
+        u64 lastCheckpoint() { return m_last; };
+
+        // Data committed to output (zeros if nullptr)
+        void update(const u8 *data, DWORD length);
+        // Checkpoint is due
+        bool due() { return m_interval && m_offset - m_last >= m_interval; };
+        // Data is committed up to offset(), output must be synced (by the writer) before
+        bool pending() { return m_offset > m_last; };
+        void checkpoint();
+        // Resume : copied data is read back (up to limit) and passed to consume, checkpoints are
+        // checked as they're reached. Returns offset of last matching checkpoint (0 if none)
+        u64 replay(u64 limit, NxJournalReader read, NxJournalConsumer consume);
+        // Start journal thread (only writes checkpoints already synced by the writer)
+        void start();
+        // Copy done (journal is removed) or interrupted (journal is kept as last written)
+        void close(bool done);
+
+        static std::string path(const char *file) { return std::string(file) + NXJ_EXT; };
+};
+
+#endif
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "NxManifest.h"
+
+NxManifest::NxManifest(const char *type, u64 size, int algorithm)
+{
+    m_type = std::string(type);
+    m_size = size;
+    m_algorithm = algorithm;
+    m_hashes.reserve((size_t)((size + m_block_size - 1) / m_block_size));
+    b_valid = true;
+}
+
+NxManifest::NxManifest(const char *file)
+{
+    std::ifstream in_file(file);
+    std::string line, key, magic;
+    int version = 0;
+    if (!std::getline(in_file, line) || !(std::istringstream(line) >> magic >> version) || magic != NXM_MAGIC || version != NXM_VERSION)
+        return;
+
+    while (std::getline(in_file, line))
+    {
+        std::istringstream values(line);
+        if (!(values >> key))
+            continue;
+
+        bool ok = true;
+        if (key == "type") // Type may contain spaces ("FULL NAND")
+            ok = (m_type = line.length() > key.length() + 1 ? line.substr(key.length() + 1) : "").length() > 0;
+        else if (key == "size")
+            ok = (bool)(values >> m_size);
+        else if (key == "hash")
+        {
+            std::string name;
+            ok = (values >> name) && (m_algorithm = NxHash::getAlgorithm(name.c_str())) >= 0;
+        }
+        else if (key == "digest")
+            ok = (bool)(values >> m_digest);
+        else if (key == "block_size")
+            ok = (values >> m_block_size) && m_block_size;
+        else if (key == "part")
+        {
+            NxManifestPart part;
+            ok = (bool)(values >> part.name >> part.offset >> part.size);
+            m_parts.push_back(part);
+        }
+        else if (key == "block")
+        {
+            // Blocks are listed in order
+            u64 n;
+            std::string hash;
+            ok = (values >> n >> hash) && n == m_hashes.size();
+            m_hashes.push_back(hash);
+        }
+        if (!ok)
+        {
+            dbg_printf("NxManifest::NxManifest() invalid line : %s\n", line.c_str());
+            return;
+        }
+    }
+
+    b_valid = m_size && m_hashes.size() == (m_size + m_block_size - 1) / m_block_size;
+}
+
+NxManifestPart* NxManifest::getPart(const char *name)
+{
+    for (NxManifestPart &part : m_parts)
+        if (!strcmp(part.name.c_str(), name))
+            return &part;
+    return nullptr;
+}
+
+void NxManifest::addPart(const std::string &name, u64 offset, u64 size)
+{
+    NxManifestPart part;
+    part.name = name;
+    part.offset = offset;
+    part.size = size;
+    m_parts.push_back(part);
+}
+
+void NxManifest::update(const u8 *data, DWORD length)
+{
+    static const u8 zeros[CLUSTER_SIZE] = { 0 };
+    while (length)
+    {
+        if (nullptr == m_block_hash)
+            m_block_hash = std::unique_ptr<NxHash>(new NxHash(m_algorithm));
+
+        DWORD chunk = (DWORD)std::min((u64)length, (u64)m_block_size - m_block_bytes);
+        if (nullptr == data)
+            chunk = std::min(chunk, (DWORD)CLUSTER_SIZE);
+        m_block_hash->update(nullptr != data ? data : zeros, chunk);
+        m_block_bytes += chunk;
+        length -= chunk;
+        if (nullptr != data)
+            data += chunk;
+
+        // Block complete (last block may be shorter)
+        u64 offset = (u64)m_hashes.size() * m_block_size + m_block_bytes;
+        if (m_block_bytes == m_block_size || offset == m_size)
+        {
+            m_hashes.push_back(m_block_hash->checksum());
+            m_block_hash.reset();
+            m_block_bytes = 0;
+        }
+    }
+}
+
+void NxManifest::rewind()
+{
+    m_hashes.clear();
+    m_block_hash.reset();
+    m_block_bytes = 0;
+}
+
+bool NxManifest::write(const char *file)
+{
+    if (m_hashes.size() != (m_size + m_block_size - 1) / m_block_size)
+        return false;
+
+    std::ofstream out_file(file);
+    out_file << NXM_MAGIC << " " << NXM_VERSION << "\n"
+             << "type " << m_type << "\n"
+             << "size " << m_size << "\n"
+             << "hash " << NxHash::getAlgorithmName(m_algorithm) << "\n"
+             << "digest " << m_digest << "\n"
+             << "block_size " << m_block_size << "\n";
+    for (NxManifestPart &part : m_parts)
+        out_file << "part " << part.name << " " << part.offset << " " << part.size << "\n";
+    for (size_t i(0); i < m_hashes.size(); i++)
+        out_file << "block " << i << " " << m_hashes[i] << "\n";
+    out_file.close();
+    return !out_file.fail();
+}
+
+NxManifestVerifier::NxManifestVerifier(NxManifest *manifest)
+{
+    m_manifest = manifest;
+
+    // One worker per core, two blocks in flight per worker
+    unsigned int workers = std::thread::hardware_concurrency();
+    if (!workers)
+        workers = 1;
+    m_max_jobs = workers * 2;
+
+    for (unsigned int i(0); i < workers; i++)
+        m_workers.push_back(std::thread(&NxManifestVerifier::workerLoop, this));
+}
+
+NxManifestVerifier::~NxManifestVerifier()
+{
+    stop();
+    for (NxManifestJob *job : m_jobs)
+        delete job;
+}
+
+void NxManifestVerifier::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        b_stop = true;
+    }
+    m_cv.notify_all();
+
+    for (std::thread &worker : m_workers)
+        if (worker.joinable())
+            worker.join();
+}
+
+void NxManifestVerifier::workerLoop()
+{
+    for (;;)
+    {
+        NxManifestJob *job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] { return b_stop || !m_pending.empty(); });
+            if (b_stop)
+                break;
+            job = m_pending.front();
+            m_pending.pop_front();
+        }
+
+        NxHash hash(m_manifest->algorithm());
+        hash.update(job->data.data(), job->data.size());
+        bool damaged = hash.checksum() != m_manifest->blockHash(job->block);
+        std::vector<u8>().swap(job->data);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            job->damaged = damaged;
+            job->done = true;
+        }
+        m_cv.notify_all();
+    }
+}
+
+void NxManifestVerifier::submit(u64 block, std::vector<u8> &data)
+{
+    NxManifestJob *job = new NxManifestJob;
+    job->block = block;
+    job->data.swap(data);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.push_back(job);
+        m_jobs.push_back(job);
+    }
+    m_cv.notify_all();
+    collect(false);
+}
+
+void NxManifestVerifier::collect(bool wait_all)
+{
+    for (;;)
+    {
+        NxManifestJob *job;
+        {
+            // Collect in order, wait for the oldest job if too many are in flight
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_jobs.empty())
+                break;
+            job = m_jobs.front();
+            if (!job->done && !wait_all && m_jobs.size() <= m_max_jobs)
+                break;
+            m_cv.wait(lock, [job] { return job->done; });
+            m_jobs.pop_front();
+        }
+
+        if (job->damaged)
+            m_damaged.push_back(job->block);
+        delete job;
+    }
+}
+
+std::vector<u64>& NxManifestVerifier::close()
+{
+    collect(true);
+    stop();
+    return m_damaged;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NxManifest_h__
+#define __NxManifest_h__
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+#include "res/types.h"
+#include "res/utils.h"
+#include "NxHash.h"
+
+#define NXM_MAGIC "NXMANIFEST"
+#define NXM_VERSION 1
+#define NXM_BLOCK_SIZE 0x400000     // 4 MB
+#define NXM_EXT ".manifest"         // Sidecar : <dump (first part)>.manifest
+
+// Dump manifest (text sidecar) :
+//   NXMANIFEST 1
+//   type RAWNAND
+//   size <bytes>
+//   hash <algorithm>
+//   digest <whole image digest or "none">
+//   block_size <bytes>
+//   part <name> <offset> <size>    (one line per partition, offsets in dump)
+//   block <n> <digest>             (one line per block)
+typedef struct NxManifestPart NxManifestPart;
+struct NxManifestPart {
+    std::string name;
+    u64 offset;
+    u64 size;
+};
+
+class NxManifest
+{
+    // Constructors
+    public:
+        // New manifest, blocks are hashed as data is added
+        NxManifest(const char *type, u64 size, int algorithm);
+        // Load manifest from file
+        explicit NxManifest(const char *file);
+
+    // Member variables
+    private:
+        std::string m_type;
+        u64 m_size = 0;
+        int m_algorithm = HASH_MD5;
+        u32 m_block_size = NXM_BLOCK_SIZE;
+        std::string m_digest = "none";
+        std::vector<NxManifestPart> m_parts;
+        std::vector<std::string> m_hashes;
+        std::unique_ptr<NxHash> m_block_hash;   // current block
+        u64 m_block_bytes = 0;
+        bool b_valid = false;
+
+    // Member methods
+    public:
+        bool isValid() { return b_valid; };
+        const std::string& type() { return m_type; };
+        u64 size() { return m_size; };
+        int algorithm() { return m_algorithm; };
+        u32 blockSize() { return m_block_size; };
+        u64 blockCount() { return m_hashes.size(); };
+        const std::string& digest() { return m_digest; };
+        const std::string& blockHash(u64 block) { return m_hashes[(size_t)block]; };
+        std::vector<NxManifestPart>& parts() { return m_parts; };
+        NxManifestPart* getPart(const char *name);
+
+        void addPart(const std::string &name, u64 offset, u64 size);
+        // Add data (zeros if nullptr)
+        void update(const u8 *data, DWORD length);
+        // Drop hashed blocks (data is added again from start)
+        void rewind();
+        void setDigest(const std::string &digest) { m_digest = digest.empty() ? "none" : digest; };
+        bool write(const char *file);
+
+        static std::string path(const char *file) { return std::string(file) + NXM_EXT; };
+};
+
+// Block being hashed by a verifier worker
+typedef struct NxManifestJob NxManifestJob;
+struct NxManifestJob {
+    u64 block;
+    std::vector<u8> data;
+    bool done = false;
+    bool damaged = false;
+};
+
+// Manifest verifier. Blocks are read in order by the caller and hashed by a
+// pool of workers (one per core), damaged blocks are collected in order.
+class NxManifestVerifier
+{
+    // Constructors
+    public:
+        explicit NxManifestVerifier(NxManifest *manifest);
+        ~NxManifestVerifier();
+
+    // Member variables
+    private:
+        NxManifest *m_manifest;
+        std::vector<std::thread> m_workers;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::deque<NxManifestJob*> m_pending;  // jobs waiting for a worker
+        std::deque<NxManifestJob*> m_jobs;     // jobs in block order
+        std::vector<u64> m_damaged;
+        size_t m_max_jobs;
+        bool b_stop = false;
+
+    // Member methods
+    private:
+        void workerLoop();
+        void collect(bool wait_all);
+        void stop();
+
+    public:
+        // Submit block (data is moved)
+        void submit(u64 block, std::vector<u8> &data);
+        // Wait for every job, return damaged blocks
+        std::vector<u64>& close();
+};
+
+#endif
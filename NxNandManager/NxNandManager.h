@@ -10,8 +10,7 @@
 #include <QtCore>
 #endif
 
-#include <windows.h>
-#include <winioctl.h>
+#include "res/platform.h"
 #include <stdio.h>
 #include <ctime>
 #include <clocale>
@@ -19,7 +18,6 @@
 #include <fstream>
 #include <iostream>
 
-#include <Wincrypt.h>
 #include <sys/types.h>
 #include "res/types.h"
 #include "res/utils.h"
@@ -14,6 +14,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <sstream>
+#include <algorithm>
 #include "NxPartition.h"
 
 // Constructor
@@ -36,7 +38,6 @@ NxPartition::NxPartition(NxStorage *p, const char* p_name, u32 lba_start, u32 lb
     m_bad_crypto = false;
     m_isValidPartition = false;
     m_type = UNKNOWN;
-    nxCrypto = nullptr;
 
     for( NxPart part : NxPartArr )
     {
@@ -75,36 +76,32 @@ NxPartition::NxPartition(NxStorage *p, const char* p_name, u32 lba_start, u32 lb
 
 NxPartition::~NxPartition()
 {
-    if (nullptr != nxCrypto)
-        delete nxCrypto;
 }
 
 bool NxPartition::setCrypto(char* crypto, char* tweak)
+{
+    return setCrypto(std::make_shared<NxCrypto>(crypto, tweak));
+}
+
+bool NxPartition::setCrypto(std::shared_ptr<NxCrypto> crypto)
 {
     if (!nxPart_info.isEncrypted)
         return false;
 
-    if (nullptr != nxCrypto)
-        delete nxCrypto;
-
     //dbg_printf("NxPartition::setCrypto() for %s\n", partitionName().c_str());
     
     m_bad_crypto = false;
-    nxCrypto = new NxCrypto(crypto, tweak);   
+    nxCrypto = crypto;
+    fat32_invalidate();
     nxHandle->initHandle(isEncryptedPartition() ? DECRYPT : NO_CRYPTO, this);
 
     // Validate first cluster
     unsigned char first_cluster[CLUSTER_SIZE];
     if (nxPart_info.magic != nullptr && nxHandle->read(first_cluster, nullptr, CLUSTER_SIZE))
     {
-        // Do magic
+        // Do magic (FAT & free space are loaded when first needed)
         if (memcmp(&first_cluster[nxPart_info.magic_off], nxPart_info.magic, strlen(nxPart_info.magic)))
             m_bad_crypto = true;
-        else if(is_in(m_type, {USER, SYSTEM}))
-        {
-            freeSpace = fat32_getFreeSpace();
-        }
-
     }
     
     //dbg_printf("NxPartition::setCrypto() ends %s %s\n", partitionName().c_str(), m_bad_crypto ? "BAD CRYPTO" : "GOOD CRYPTO");
@@ -116,6 +113,11 @@ std::string NxPartition::partitionName()
     return std::string(m_name);
 }
 
+u64 NxPartition::freeSpace()
+{
+    return is_in(m_type, {USER, SYSTEM}) ? fat32_getFreeSpace() : 0;
+}
+
 u32 NxPartition::lbaStart()
 {
     return m_lba_start;
@@ -152,16 +154,47 @@ int NxPartition::dumpToFile(const char *file, int crypto_mode, void(*updateProgr
     if (crypto_mode == ENCRYPT && m_isEncrypted)
         return ERR_CRYPTO_ENCRYPTED_YET;
 
+    // Verify output inline (read back while copying) or with a full re-read (paranoid)
+    bool full_verify = crypto_mode == MD5_HASH_FULL;
+    if (full_verify)
+        crypto_mode = MD5_HASH;
+
+    // Split output : first part name
+    std::string out_path = parent->splitSize() ? NxSplitWriter::firstPart(file) : std::string(file);
+
     // Test if file already exists
-    std::ifstream infile(file);
+    std::ifstream infile(out_path);
     if (infile.good())
     {
         infile.close();
         return ERR_FILE_ALREADY_EXISTS;
     }
 
-    // Open new stream for output file
-    std::ofstream out_file = std::ofstream(file, std::ofstream::binary);
+    // Sparse output (plain FAT32 only): free clusters are not copied and left as holes
+    std::vector<bool> cluster_map;
+    bool sparse = parent->sparseOutput() && (crypto_mode == DECRYPT || (!m_isEncrypted && crypto_mode != ENCRYPT))
+        && fat32_getClusterMap(&cluster_map);
+
+    // Open new file for output (split in parts if needed)
+    NxSplitWriter out_file(file, size(), parent->splitSize(), sparse);
+    if (!out_file.isOpen())
+        return ERR_OUTPUT_HANDLE;
+
+    // Read back what is written to the output
+    std::unique_ptr<NxReadBack> read_back;
+    if (crypto_mode == MD5_HASH && !full_verify)
+    {
+        read_back = std::unique_ptr<NxReadBack>(new NxReadBack(out_path.c_str(), parent->hashAlgorithm()));
+        out_file.setReadBack(read_back.get());
+    }
+
+    // Per block hashes (sidecar manifest)
+    std::unique_ptr<NxManifest> manifest;
+    if (parent->manifestOutput())
+    {
+        manifest = std::unique_ptr<NxManifest>(new NxManifest(partitionName().c_str(), size(), parent->hashAlgorithm()));
+        manifest->addPart(partitionName(), 0, size());
+    }
 
     // Lock volume (drive only)
     if (parent->isDrive())
@@ -170,12 +203,6 @@ int NxPartition::dumpToFile(const char *file, int crypto_mode, void(*updateProgr
     // Init input handle
     nxHandle->initHandle(crypto_mode, this);
 
-    // Set new buffer
-    int buff_size = nxHandle->getDefaultBuffSize();
-    BYTE* buffer = new BYTE[buff_size];
-    memset(buffer, 0, buff_size);
-    DWORD bytesRead = 0;
-
     // Init progress info        
     ProgressInfo pi;
     pi.mode = COPY;
@@ -185,66 +212,61 @@ int NxPartition::dumpToFile(const char *file, int crypto_mode, void(*updateProgr
     pi.bytesTotal = size();
     if(nullptr != updateProgress) updateProgress(&pi);
 
-    // Copy
-    while (nxHandle->read(buffer, &bytesRead, buff_size))
-    {
-        if(stopWork) return userAbort();
-
-        if (!out_file.write((char *)&buffer[0], bytesRead))
-            break;
-
-        pi.bytesCount += bytesRead;
-        if(nullptr != updateProgress) updateProgress(&pi);
-    }
+    // Copy (overlapped read/write)
+    NxPipeline pipeline(nxHandle);
+    if (sparse)
+        pipeline.setClusterMap(&cluster_map);
+    int rc = pipeline.run([&](u8 *buffer, DWORD length, DWORD *bytesWrite) {
+        *bytesWrite = length;
+        if (nullptr != manifest)
+            manifest->update(buffer, length);
+        // Hole (free clusters), output parts are already sized
+        return out_file.write(buffer, length);
+    }, &pi, updateProgress, &stopWork);
 
     // Clean & unlock volume
-    out_file.close();
-    delete[] buffer;
+    if (!out_file.close() && rc == SUCCESS)
+        rc = ERR_WHILE_WRITE;
     if (parent->isDrive())
         nxHandle->unlockVolume();
 
+    if (rc == ERR_USER_ABORT)
+        return userAbort();
+
+    if (rc == ERR_WHILE_WRITE)
+        return rc;
+
     // Check completeness
     if (pi.bytesCount != pi.bytesTotal)
         return ERR_WHILE_COPY;
 
-    // Compute & compare md5 hashes
+    // Compute & compare hashes
     if (crypto_mode == MD5_HASH)
     {
         // Get checksum for input
-        HCRYPTHASH in_hash = nxHandle->md5Hash();
-        std::string in_sum = BuildChecksum(in_hash);
+        std::string in_sum = nxHandle->hasher()->checksum();
         
-        // Set new NxStorage for output
-        NxStorage out_storage = NxStorage(file);
-
-        // Init Progress Info
-        pi.mode = MD5_HASH;
-        pi.begin_time = std::chrono::system_clock::now();
-        pi.bytesCount = 0;
-        pi.bytesTotal = out_storage.size();
-        pi.elapsed_seconds = 0;
-        if(nullptr != updateProgress) updateProgress(&pi);
-
-        // Hash output file
-        while (!out_storage.nxHandle->hash(&pi.bytesCount))
+        // Output was read back & hashed while copying
+        if (nullptr != read_back)
         {
-            if(stopWork) return userAbort();
+            if (read_back->bytesCount() != pi.bytesTotal || in_sum.compare(read_back->checksum()))
+                return ERR_MD5_COMPARE;
+
+            pi.mode = MD5_HASH;
             if(nullptr != updateProgress) updateProgress(&pi);
         }
+        // Re-read output (all parts) & compare checksums
+        else if ((rc = parent->verifyDump(out_path.c_str(), in_sum, &pi, updateProgress, &stopWork)) != SUCCESS)
+            return rc == ERR_USER_ABORT ? userAbort() : rc;
 
-        // Check completeness
-        if (pi.bytesCount != pi.bytesTotal)
-            return ERR_MD5_COMPARE;
-
-        // Get checksum for output
-        HCRYPTHASH out_hash = out_storage.nxHandle->md5Hash();
-        std::string out_sum = BuildChecksum(out_hash);
-
-        // Compare checksums
-        if (in_sum.compare(out_sum))
-            return ERR_MD5_COMPARE;
+        if (nullptr != manifest)
+            manifest->setDigest(in_sum);
     }
 
+    // Write manifest next to output (first part)
+    if (nullptr != manifest && !manifest->write(NxManifest::path(out_path.c_str()).c_str()))
+        return ERR_WHILE_WRITE;
+
     return SUCCESS;
 }
 
@@ -272,6 +294,18 @@ int NxPartition::restoreFromStorage(NxStorage* input, int crypto_mode, void(*upd
     if (input_part->size() > size())
         return ERR_IO_MISMATCH;
 
+    // Restored data is read back & compared only on request (FULL_MD5SUM)
+    bool full_verify = crypto_mode == MD5_HASH_FULL;
+    if (full_verify)
+        crypto_mode = MD5_HASH;
+
+    // Delta restore : output is read ahead with its own handle
+    std::unique_ptr<NxStorage> reader;
+    std::unique_ptr<NxDiffWriter> diff_writer;
+    NxPartition *reader_part = nullptr;
+    if (parent->deltaRestore() && (nullptr == (reader = parent->reopen()) || nullptr == (reader_part = reader->getNxPartition(m_type))))
+        return ERR_OUTPUT_HANDLE;
+
     // Lock output volume
     if (parent->isDrive())
         nxHandle->lockVolume();
@@ -280,16 +314,14 @@ int NxPartition::restoreFromStorage(NxStorage* input, int crypto_mode, void(*upd
     if (input->isDrive())
         input->nxHandle->lockVolume();
     
+    // Input is hashed with output's algorithm (restore verification)
+    if (crypto_mode == MD5_HASH)
+        input->setHashAlgorithm(parent->hashAlgorithm());
+
     // Init handles for both input & output
     input->nxHandle->initHandle(crypto_mode, input_part);
     this->nxHandle->initHandle(NO_CRYPTO, this);
 
-    // Set new buffer
-    int buff_size = nxHandle->getDefaultBuffSize();
-    BYTE* buffer = new BYTE[buff_size];
-    memset(buffer, 0, buff_size);
-    DWORD bytesRead = 0, bytesWrite = 0;
-
     // Init progress info    
     ProgressInfo pi;
     pi.mode = RESTORE;
@@ -299,190 +331,447 @@ int NxPartition::restoreFromStorage(NxStorage* input, int crypto_mode, void(*upd
     pi.bytesTotal = input_part->size();
     if(nullptr != updateProgress) updateProgress(&pi);
 
-    while(input->nxHandle->read(buffer, &bytesRead, buff_size))
+    // Only clusters that differ from output are written (delta restore)
+    if (nullptr != reader)
     {
-        if(stopWork) return userAbort();
-
-        if (!this->nxHandle->write(buffer, &bytesWrite, bytesRead))
-            break;
-
-        pi.bytesCount += bytesWrite;
-        if(nullptr != updateProgress) updateProgress(&pi);
+        reader->nxHandle->initHandle(NO_CRYPTO, reader_part);
+        diff_writer = std::unique_ptr<NxDiffWriter>(new NxDiffWriter(nxHandle, reader->nxHandle));
     }
 
+    // Copy (overlapped read/write)
+    NxPipeline pipeline(input->nxHandle);
+    int rc = pipeline.run([&](u8 *buffer, DWORD length, DWORD *bytesWrite) {
+        if (nullptr != diff_writer)
+            return diff_writer->write(buffer, length, bytesWrite);
+        return this->nxHandle->write(buffer, bytesWrite, length);
+    }, &pi, updateProgress, &stopWork);
+    if (nullptr != diff_writer)
+        dbg_printf("NxPartition::restoreFromStorage() delta restore, %s written\n", GetReadableSize(diff_writer->bytesWritten()).c_str());
+    diff_writer.reset();
+    fat32_invalidate();
+
     // Clean & unlock volume
-    delete[] buffer;
     if (parent->isDrive())
         nxHandle->unlockVolume();
     if (input->isDrive())
         input->nxHandle->unlockVolume();
 
+    if (rc == ERR_USER_ABORT)
+        return userAbort();
+
     // Check completeness
     if (pi.bytesCount != pi.bytesTotal)
         return ERR_WHILE_COPY;
 
+    // Read back restored data & compare hashes
+    if (full_verify)
+    {
+        std::string in_sum = input->nxHandle->hasher()->checksum();
+
+        // Init Progress Info
+        pi.mode = MD5_HASH;
+        pi.begin_time = std::chrono::system_clock::now();
+        pi.bytesCount = 0;
+        pi.elapsed_seconds = 0;
+        if(nullptr != updateProgress) updateProgress(&pi);
+
+        // Hash output (same length as input)
+        while (!nxHandle->hash(&pi.bytesCount, pi.bytesTotal, this))
+        {
+            if (stopWork) return userAbort();
+            if(nullptr != updateProgress) updateProgress(&pi);
+        }
+
+        // Check completeness
+        if (pi.bytesCount != pi.bytesTotal)
+            return ERR_MD5_COMPARE;
+
+        if (in_sum.compare(nxHandle->hasher()->checksum()))
+            return ERR_MD5_COMPARE;
+
+        if(nullptr != updateProgress) updateProgress(&pi);
+    }
+
     return SUCCESS;
 }
 
-// Get fat32 entries for given path
-// If path is a file, only one entry is pushed back to entries vector
-// Returns false when directory or file does not exist
-bool NxPartition::fat32_dir(std::vector<fat32::dir_entry> *entries, const char *path)
+// Extract file or directory tree (path in partition) to host directory
+int NxPartition::extractFiles(const char *path, const char *dir, void(*updateProgress)(ProgressInfo*))
 {
-    entries->clear();
-    
+    if (not_in(m_type, { SAFE, SYSTEM, USER }))
+        return ERR_INVALID_PART;
+
+    if (m_isEncrypted && nullptr == nxCrypto)
+        return ERR_CRYPTO_KEY_MISSING;
+
+    if (m_isEncrypted && m_bad_crypto)
+        return ERROR_DECRYPT_FAILED;
+
+    // Lock volume (drive only)
+    if (parent->isDrive())
+        nxHandle->lockVolume();
+
+    // Walk tree, then extract every file in a single pass over the partition
+    NxExtractor extractor(this, std::string(dir));
+    int rc = extractor.add(path);
+    if (rc == SUCCESS)
+    {
+        ProgressInfo pi;
+        pi.mode = EXTRACT;
+        pi.storage_name = partitionName();
+        pi.begin_time = std::chrono::system_clock::now();
+        pi.bytesCount = 0;
+        pi.bytesTotal = extractor.bytesTotal();
+        if(nullptr != updateProgress && pi.bytesTotal) updateProgress(&pi);
+
+        rc = extractor.run(&pi, updateProgress, &stopWork);
+    }
+
+    if (parent->isDrive())
+        nxHandle->unlockVolume();
+
+    if (rc == ERR_USER_ABORT)
+        return userAbort();
+
+    return rc;
+}
+
+// Load FAT (decrypted) in memory, once
+bool NxPartition::fat32_loadFat()
+{
+    std::lock_guard<std::mutex> lock(m_fat_mutex);
+    if (!m_fat.empty())
+        return true;
+
     if (not_in(m_type, { SAFE, SYSTEM, USER }))
         return false;
 
     if (m_isEncrypted && (m_bad_crypto || nullptr == nxCrypto))
         return false;
 
-    NxHandle *nxHandle = parent->nxHandle;
-    nxHandle->initHandle(isEncryptedPartition() ? DECRYPT : NO_CRYPTO, this);
-    BYTE buff[CLUSTER_SIZE];
-
     // Read first cluster
-    if (!nxHandle->read(buff, nullptr, CLUSTER_SIZE))
+    BYTE buff[CLUSTER_SIZE];
+    if (!fat32_read(0, buff, CLUSTER_SIZE))
         return false;
-    
-    // Get root address
-    fat32::fs_attr fs;
-    fat32::read_boot_sector(buff, &fs);
-    u64 root_addr = (fs.num_fats * fs.fat_size * fs.bytes_per_sector) + (fs.reserved_sector_count * fs.bytes_per_sector);
-    
 
-    // TEST
-    /*
-    fat32::boot_sector *bs = (fat32::boot_sector*)(buff); 
-    dbg_printf("fs = \n%s\n", hexStr((u8*)buff, 0x60).c_str());
-    dbg_printf("bs = \n%s\n", hexStr((u8*)bs, 0x60).c_str());     
-    dbg_printf("fs.bytes_per_sector = %d\n", fs.bytes_per_sector);
-    dbg_printf("bs->bytes_per_sector = %d\n", *(u16*)&bs->bytes_per_sector);
-    dbg_printf("bs->bytes_per_sector = %s, sizeof %I32d / u16 %I32d\n", hexStr((u8*)&bs->bytes_per_sector, 
-        sizeof(bs->bytes_per_sector)).c_str(), sizeof(bs->bytes_per_sector), sizeof(unsigned short));
-    dbg_printf("bs = \n%s\n", hexStr((u8*)&bs + 0xB, 0x10).c_str());
-    dbg_printf("fs.sectors_per_cluster = %d\n", fs.sectors_per_cluster);
-    dbg_printf("bs->sectors_per_cluster = %d\n", bs->sectors_per_cluster);
-    dbg_printf("fs.reserved_sector_count = %d\n", fs.reserved_sector_count);    
-    dbg_printf("bs->reserved_sector_count = %d\n", bs->reserved_sector_count);
-    bs->reserved_sector_count = 3;
-    fat32::read_boot_sector(buff, &fs);
-    dbg_printf("fs.reserved_sector_count(2) = %d\n", fs.reserved_sector_count);
-    dbg_printf("bs->reserved_sector_count(2) = %d\n", bs->reserved_sector_count);
-    dbg_printf("fs.num_fats = %d\n", fs.num_fats);
-    dbg_printf("bs->num_fats = %d\n", bs->num_fats);
-    dbg_printf("fs.sectors_count = %I32d\n", fs.sectors_count);
-    dbg_printf("bs->sectors_count = %I32d\n", bs->sectors_count);
-    dbg_printf("fs.label = %s\n", fs.label);
-    dbg_printf("bs->label = %s\n", bs->label);
-    */
-
-    // Read root cluster
-    if (!nxHandle->read(root_addr, buff, nullptr, CLUSTER_SIZE))
+    // Get fs attributes from boot sector
+    fat32::read_boot_sector(buff, &m_fs);
+    m_fat32_cluster_size = (u64)m_fs.bytes_per_sector * m_fs.sectors_per_cluster;
+    u64 fat_off = (u64)m_fs.reserved_sector_count * m_fs.bytes_per_sector;
+    m_fat32_data_off = fat_off + (u64)m_fs.num_fats * m_fs.fat_size * m_fs.bytes_per_sector;
+    if (!m_fat32_cluster_size || !m_fs.fat_size || m_fs.bytes_per_sector % 4 || m_fat32_data_off >= size())
         return false;
-    
-    // Get root entries    
-    fat32::parse_dir_table(buff, entries);
 
-    // path param is root dir
-    if (entries->size() > 0 && (nullptr == path || (path[0] == '/' && strlen(path) == 1)))
-        return true;
+    // Data clusters addressed by FAT (entries #0 & #1 are reserved)
+    u64 clusters = std::min((size() - m_fat32_data_off) / m_fat32_cluster_size, (u64)m_fs.fat_size * m_fs.bytes_per_sector / 4 - 2);
 
-    // Explore path, one directory (*dir) after each other, from root
-    char *cdir = strdup(path), *dir;
-    while ((dir = strtok(cdir, "/")) != nullptr)
+    // FAT is read in large batches, decrypted by a pool of workers (pipeline)
+    std::vector<u32> fat((size_t)clusters + 2);
+    u64 fat_start = fat_off / CLUSTER_SIZE * CLUSTER_SIZE, head = fat_off - fat_start;
+    u64 fat_length = (u64)fat.size() * 4;
+    nxHandle->initHandle(isEncryptedPartition() ? DECRYPT : NO_CRYPTO, this);
+    if (!nxHandle->setPointer(fat_start))
+        return false;
     {
-        cdir = nullptr;
-        bool found = false;
-        for (fat32::dir_entry dir_entry : *entries)
-        {
-            // current dir found in entries
-            if (!strcmp(dir, dir_entry.filename.c_str()))
-            {
-                // path is a file
-                if (!dir_entry.is_directory)
-                {
-                    dir_entry.data_offset = fs.bytes_per_sector * ((dir_entry.entry.first_cluster - 2) * fs.sectors_per_cluster) + (fs.num_fats * fs.fat_size * fs.bytes_per_sector) + (fs.reserved_sector_count * fs.bytes_per_sector);                    
-                    entries->clear();
-                    entries->push_back(dir_entry);
-                    return true;
-                }
+        NxPipeline pipeline(nxHandle);
+        pipeline.setReadLimit((head + fat_length + CLUSTER_SIZE - 1) / CLUSTER_SIZE * CLUSTER_SIZE);
+        DWORD bytesRead;
+        if (head && !pipeline.read(buff, (DWORD)head, &bytesRead))
+            return false;
+        if (!pipeline.read((u8*)fat.data(), (DWORD)fat_length, &bytesRead))
+            return false;
+    }
 
-                // Read cluster for directory
-                u64 next_cluster_off = fs.bytes_per_sector * ((dir_entry.entry.first_cluster - 2) * fs.sectors_per_cluster) + root_addr;
-                if (!nxHandle->read(next_cluster_off, buff, nullptr, CLUSTER_SIZE))
-                    return false;
+    for (u32 &value : fat)
+        value &= FAT32_ENTRY_MASK;
 
-                // Get next (or last) fat entries
-                fat32::parse_dir_table(buff, entries);
-                found = true;
-                break;
-            }
+    // Allocation bitmap & free clusters count (vectorized)
+    std::vector<u64> bitmap((size_t)(clusters + 63) / 64);
+    m_fat32_free = clusters - fat32::alloc_bitmap(&fat[2], (size_t)clusters, bitmap.data());
+
+    m_fat.swap(fat);
+    m_fat32_bitmap.swap(bitmap);
+    dbg_printf("NxPartition::fat32_loadFat() %s, %I64d clusters (%I64d free)\n", m_name, clusters, m_fat32_free);
+    return true;
+}
+
+// Get allocation bitmap, one bit per data cluster (set if allocated)
+const std::vector<u64>* NxPartition::fat32_getBitmap()
+{
+    return fat32_loadFat() ? &m_fat32_bitmap : nullptr;
+}
+
+// Drop FAT & directory cache (partition was overwritten)
+void NxPartition::fat32_invalidate()
+{
+    std::lock_guard<std::mutex> lock(m_fat_mutex);
+    std::vector<u32>().swap(m_fat);
+    std::vector<u64>().swap(m_fat32_bitmap);
+    m_fat32_free = 0;
+    m_dir_cache.clear();
+}
+
+// Read decrypted data at any offset
+// Cluster aligned spans are read straight into buffer, partial clusters are decrypted aside
+bool NxPartition::fat32_read(u64 offset, u8 *buffer, u64 length)
+{
+    if (offset + length > size())
+        return false;
+
+    nxHandle->initHandle(isEncryptedPartition() ? DECRYPT : NO_CRYPTO, this);
+    std::vector<BYTE> cluster;
+    while (length)
+    {
+        DWORD chunk, bytesRead = 0;
+        u64 head = offset % CLUSTER_SIZE;
+        if (!head && length >= CLUSTER_SIZE)
+        {
+            chunk = (DWORD)std::min((u64)DEFAULT_BUFF_SIZE, length / CLUSTER_SIZE * CLUSTER_SIZE);
+            if (!nxHandle->read(offset, buffer, &bytesRead, chunk) || bytesRead != chunk)
+                return false;
         }
-        if (!found)
-            return false;
+        else
+        {
+            cluster.resize(CLUSTER_SIZE);
+            chunk = (DWORD)std::min((u64)CLUSTER_SIZE - head, length);
+            if (!nxHandle->read(offset - head, cluster.data(), &bytesRead, CLUSTER_SIZE) || bytesRead < head + chunk)
+                return false;
+            memcpy(buffer, &cluster[head], chunk);
+        }
+        offset += chunk;
+        buffer += chunk;
+        length -= chunk;
     }
     return true;
 }
 
-// Get free space from free clusters count in FAT
-u64 NxPartition::fat32_getFreeSpace()
+// Get runs of contiguous clusters for the chain starting at cluster
+// Whole chain is followed if length is 0, otherwise runs are trimmed to length bytes
+bool NxPartition::fat32_getRuns(u32 cluster, std::vector<fat32::run> *runs, u64 length)
 {
-    nxHandle->initHandle(isEncryptedPartition() ? DECRYPT : NO_CRYPTO, this);
-    BYTE buff[CLUSTER_SIZE];
+    runs->clear();
 
-    // Read first cluster
-    if (!nxHandle->read(buff, nullptr, CLUSTER_SIZE))
-        return 0;
-    
-    // Get fs attributes from boot sector
-    fat32::fs_attr fs;
-    fat32::read_boot_sector(buff, &fs);
+    if (!fat32_loadFat())
+        return false;
 
-    u32 cluster_free_count = 0, cluster_count = 0, first_empty_cluster = 0;
-    int cluster_num = fs.fat_size * fs.bytes_per_sector / CLUSTER_SIZE;
-    unsigned char free_cluster[4] = { 0x00,0x00,0x00,0x00 };
+    // Empty file
+    if (!cluster && length == 0)
+        return true;
 
-    // Iterate cluster map
-    for (int i(0); i < cluster_num; i++)
+    u64 remaining = length;
+    size_t count = 0;
+    while (cluster >= 2 && cluster < m_fat.size())
     {
-        nxHandle->read(buff, nullptr, CLUSTER_SIZE);
-        int count = 0;
-        while (count < CLUSTER_SIZE)
+        // Loop in chain
+        if (++count > m_fat.size())
+            return false;
+
+        u64 offset = m_fat32_data_off + (u64)(cluster - 2) * m_fat32_cluster_size;
+        if (!runs->empty() && runs->back().offset + runs->back().size == offset)
+            runs->back().size += m_fat32_cluster_size;
+        else
+            runs->push_back({ offset, m_fat32_cluster_size });
+
+        if (length)
         {
-            cluster_count++;
-            if (!memcmp(&buff[count], free_cluster, 4)) 
+            if (remaining <= m_fat32_cluster_size)
             {
-                cluster_free_count++;
-                if (!first_empty_cluster) first_empty_cluster = cluster_count;
+                runs->back().size -= m_fat32_cluster_size - remaining;
+                return true;
             }
-            else first_empty_cluster = 0;
-            count += 4;
+            remaining -= m_fat32_cluster_size;
         }
+        cluster = m_fat[cluster];
     }
 
-    
-    dbg_printf("fs.bytes_per_sector = %I32d\n", fs.bytes_per_sector);
-    dbg_printf("fs.sectors_per_cluster = %I32d\n", fs.sectors_per_cluster);
-    dbg_printf("fs.sectors_count = %I32d (%s)\n", fs.sectors_count, GetReadableSize((u64)fs.sectors_count * NX_BLOCKSIZE).c_str());
-    dbg_printf("fs.info_sector = %I32d\n", fs.info_sector);
-    dbg_printf("fs.num_fats = %I32d\n", fs.num_fats);
-    dbg_printf("fs.reserved_sector_count = %I32d\n", fs.reserved_sector_count);
-    dbg_printf("fs.fat_size = %I32d (%s)\n", fs.fat_size, GetReadableSize((u64)fs.fat_size * 0x200).c_str());
-    dbg_printf("clusters size for fs.fat_size = %I32d\n", fs.fat_size / 0x20);
-    //u32 cl_add = fs.fat_size / 0x20 * 0x1000;
-    u32 cl_add = fs.fat_size / 0x200 * 0x4000;
-    u32 u_size = (m_lba_end - m_lba_start + 1);
-    dbg_printf("clusters adresses for fs.fat_size = %I32d (%s)\n", n2hexstr(cl_add, 10).c_str(), GetReadableSize((u64)cl_add * 0x4000).c_str());
-    dbg_printf("%s size is %I32d sectors (%s)\n", partitionName().c_str(), u_size, GetReadableSize((u64)u_size * 0x200).c_str());
-    dbg_printf("clusters to address %I32d (%s)\n", u_size / 0x20, GetReadableSize((u64)u_size / 0x20 * 0x4000).c_str());
-    dbg_printf("size of fat in clusters %I32d (%s)\n", u_size / 0x20 / 0x1000, GetReadableSize((u64)u_size / 0x20 / 0x1000 * 0x4000).c_str());
-    dbg_printf("size of fat in sectors %I32d (%s)\n", u_size / 0x1000, GetReadableSize((u64)u_size / 0x1000 * 0x200).c_str());
-    
-    u32 free_cluster_count = cluster_count - first_empty_cluster;
-    dbg_printf("%s first_empty_cluster is %I32d / %I32d (%s available)\n", m_name, first_empty_cluster, cluster_count, GetReadableSize((u64)free_cluster_count * CLUSTER_SIZE).c_str());
+    // Chain must end properly (and cover length)
+    if (length || cluster < FAT32_EOC)
+    {
+        dbg_printf("NxPartition::fat32_getRuns() broken chain in %s\n", m_name);
+        return false;
+    }
+    return true;
+}
+
+bool NxPartition::fat32_getRuns(const fat32::dir_entry &entry, std::vector<fat32::run> *runs)
+{
+    return fat32_getRuns(fat32::first_cluster(entry.entry), runs, entry.is_directory ? 0 : entry.entry.file_size);
+}
+
+// Read runs (in order) into buffer
+bool NxPartition::fat32_readRuns(const std::vector<fat32::run> &runs, u8 *buffer)
+{
+    for (const fat32::run &run : runs)
+    {
+        if (!fat32_read(run.offset, buffer, run.size))
+            return false;
+        buffer += run.size;
+    }
+    return true;
+}
+
+// Read & parse directory table (whole cluster chain)
+bool NxPartition::fat32_readDir(u32 cluster, std::vector<fat32::dir_entry> *entries)
+{
+    entries->clear();
+
+    std::vector<fat32::run> runs;
+    if (!fat32_getRuns(cluster, &runs))
+        return false;
+
+    u64 length = 0;
+    for (fat32::run &run : runs)
+        length += run.size;
+
+    // Directory can't exceed 65536 entries
+    if (length > 0x200000)
+        return false;
 
-    return (u64)cluster_free_count * CLUSTER_SIZE;
+    std::vector<BYTE> buff((size_t)length);
+    if (!fat32_readRuns(runs, buff.data()))
+        return false;
+
+    fat32::parse_dir_table(buff.data(), entries, buff.size());
+    for (fat32::dir_entry &entry : *entries)
+    {
+        u32 first = fat32::first_cluster(entry.entry);
+        entry.data_offset = first >= 2 ? m_fat32_data_off + (u64)(first - 2) * m_fat32_cluster_size : 0;
+    }
+    return true;
+}
+
+// "dir//sub/" => "/dir/sub"
+static std::string normalizePath(const char *path)
+{
+    std::string normalized, dir;
+    std::istringstream dirs(nullptr != path ? path : "");
+    while (std::getline(dirs, dir, '/'))
+        if (!dir.empty() && dir != ".")
+            normalized += "/" + dir;
+    return normalized.empty() ? "/" : normalized;
+}
+
+// Get directory for given path (parsed once, cached until fat32_invalidate())
+// Returns nullptr when directory does not exist
+const NxDirectory* NxPartition::fat32_getDir(const char *path)
+{
+    std::string dir_path = normalizePath(path);
+    auto cached = m_dir_cache.find(dir_path);
+    if (cached != m_dir_cache.end())
+        return &cached->second;
+
+    // Get first cluster from parent directory
+    u32 cluster;
+    if (dir_path == "/")
+    {
+        if (!fat32_loadFat())
+            return nullptr;
+        cluster = m_fs.root_cluster;
+    }
+    else
+    {
+        const fat32::dir_entry *entry = fat32_getEntry(dir_path.c_str());
+        if (nullptr == entry || !entry->is_directory)
+            return nullptr;
+        cluster = fat32::first_cluster(entry->entry);
+    }
+
+    NxDirectory dir;
+    if (!fat32_readDir(cluster, &dir.entries))
+        return nullptr;
+    for (size_t i(0); i < dir.entries.size(); i++)
+        dir.index.emplace(dir.entries[i].filename, i);
+
+    return &(m_dir_cache[dir_path] = std::move(dir));
+}
+
+// Get entry for given path (file or directory)
+// Returns nullptr when entry does not exist (or path is root dir)
+const fat32::dir_entry* NxPartition::fat32_getEntry(const char *path)
+{
+    std::string entry_path = normalizePath(path);
+    if (entry_path == "/")
+        return nullptr;
+
+    size_t sep = entry_path.find_last_of('/');
+    const NxDirectory *dir = fat32_getDir(entry_path.substr(0, sep).c_str());
+    if (nullptr == dir)
+        return nullptr;
+
+    auto entry = dir->index.find(entry_path.substr(sep + 1));
+    return entry != dir->index.end() ? &dir->entries[entry->second] : nullptr;
+}
+
+// Open file (or directory) for given path
+// Returns nullptr when entry does not exist or cluster chain is broken
+std::unique_ptr<NxFile> NxPartition::fat32_open(const char *path)
+{
+    const fat32::dir_entry *entry = fat32_getEntry(path);
+    if (nullptr == entry)
+        return nullptr;
+
+    std::unique_ptr<NxFile> file(new NxFile(this, *entry));
+    if (!file->isOpen())
+        return nullptr;
+
+    return file;
+}
+
+// Get fat32 entries for given path
+// If path is a file, only one entry is pushed back to entries vector
+// Returns false when directory or file does not exist
+bool NxPartition::fat32_dir(std::vector<fat32::dir_entry> *entries, const char *path)
+{
+    entries->clear();
+
+    // path is a file
+    const fat32::dir_entry *entry = fat32_getEntry(path);
+    if (nullptr != entry && !entry->is_directory)
+    {
+        entries->push_back(*entry);
+        return true;
+    }
+
+    const NxDirectory *dir = fat32_getDir(path);
+    if (nullptr == dir)
+        return false;
+
+    *entries = dir->entries;
+    return true;
+}
+
+// Get free space from free clusters count in FAT
+u64 NxPartition::fat32_getFreeSpace()
+{
+    if (!fat32_loadFat())
+        return 0;
+
+    return m_fat32_free * m_fat32_cluster_size;
+}
+
+// Get allocation map from FAT, one entry per CLUSTER_SIZE bytes (true if allocated)
+// FAT area, reserved sectors & any trailing bytes are flagged as allocated
+bool NxPartition::fat32_getClusterMap(std::vector<bool> *cluster_map)
+{
+    cluster_map->clear();
+
+    if (!fat32_loadFat())
+        return false;
+
+    u64 clusters = m_fat.size() - 2;
+    cluster_map->assign((size() + CLUSTER_SIZE - 1) / CLUSTER_SIZE, false);
+    auto setAllocated = [&](u64 start, u64 end) {
+        for (u64 i = start / CLUSTER_SIZE; i < (end + CLUSTER_SIZE - 1) / CLUSTER_SIZE && i < cluster_map->size(); i++)
+            (*cluster_map)[i] = true;
+    };
+    setAllocated(0, m_fat32_data_off);
+    setAllocated(m_fat32_data_off + clusters * m_fat32_cluster_size, size());
+
+    for (u64 cluster = 0; cluster < clusters; cluster++)
+        if (m_fat32_bitmap[cluster / 64] >> (cluster % 64) & 1)
+            setAllocated(m_fat32_data_off + cluster * m_fat32_cluster_size, m_fat32_data_off + (cluster + 1) * m_fat32_cluster_size);
+
+    return true;
 }
 
 void NxPartition::clearHandles()
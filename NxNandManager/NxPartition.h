@@ -20,6 +20,10 @@
 #include <stdio.h>
 #include <string>
 #include <string.h> 
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
 #include "res/types.h"
 #include "res/fat32.h"
 #include "NxHandle.h"
@@ -38,6 +42,13 @@ struct NxPart {
 };
 
 
+// Parsed directory table (cached by normalized path)
+typedef struct NxDirectory NxDirectory;
+struct NxDirectory {
+    std::vector<fat32::dir_entry> entries;
+    std::unordered_map<std::string, size_t> index;  // filename => entry
+};
+
 static NxPart NxPartArr[] =
 {
     { "BOOT0",                   BOOT0    ,0x00400000 , false , NULL, 0},
@@ -58,6 +69,7 @@ static NxPart NxPartArr[] =
 class NxStorage;
 class NxCrypto;
 class NxHandle;
+class NxFile;
 #if defined(ENABLE_GUI)
 class Worker;
 typedef  void (Worker::*PtrFunc)(ProgressInfo*);
@@ -82,16 +94,27 @@ class NxPartition
         bool m_isEncrypted = false;
         bool m_bad_crypto = false;    
         bool m_isValidPartition = false;
-        NxCrypto *nxCrypto;
+        std::shared_ptr<NxCrypto> nxCrypto; // may be shared by partitions using the same key
         std::ofstream p_ofstream;
         BYTE *m_buffer;
         int m_buff_size;
         u64 bytes_count;
 
-    public:
-        u64 freeSpace = 0;
+        // FAT32 (decrypted FAT is loaded once, on first use)
+        std::mutex m_fat_mutex;             // concurrent users wait for load
+        fat32::fs_attr m_fs;
+        std::vector<u32> m_fat;
+        std::vector<u64> m_fat32_bitmap;    // one bit per data cluster (set if allocated)
+        u64 m_fat32_free = 0;               // free clusters count
+        u64 m_fat32_data_off = 0;
+        u64 m_fat32_cluster_size = 0;
+        std::unordered_map<std::string, NxDirectory> m_dir_cache;  // "/Contents/registered" => entries
 
     // Member methods
+    private:
+        bool fat32_loadFat();
+        bool fat32_readDir(u32 cluster, std::vector<fat32::dir_entry> *entries);
+
     public:
         NxHandle *nxHandle;
         bool stopWork = false;
@@ -103,8 +126,10 @@ class NxPartition
         u32 lbaEnd();
         u64 size();
         bool badCrypto() { return m_bad_crypto; };
+        // Free space in USER & SYSTEM (FAT is loaded on first call)
+        u64 freeSpace();
         int type() { return m_type; };
-        NxCrypto* crypto() { return nxCrypto; };
+        NxCrypto* crypto() { return nxCrypto.get(); };
         
         // Setters
         void setBadCrypto(bool bad = true) { m_bad_crypto = bad; };
@@ -115,12 +140,24 @@ class NxPartition
 
         //Methods
         bool fat32_dir(std::vector<fat32::dir_entry> *entries, const char *dir);
-        u64 fat32_getFreeSpace();   
+        const NxDirectory* fat32_getDir(const char *path);
+        const fat32::dir_entry* fat32_getEntry(const char *path);
+        std::unique_ptr<NxFile> fat32_open(const char *path);
+        u64 fat32_getFreeSpace();
+        bool fat32_getClusterMap(std::vector<bool> *cluster_map);   
+        const std::vector<u64>* fat32_getBitmap();
+        bool fat32_getRuns(u32 cluster, std::vector<fat32::run> *runs, u64 length = 0);
+        bool fat32_getRuns(const fat32::dir_entry &entry, std::vector<fat32::run> *runs);
+        bool fat32_read(u64 offset, u8 *buffer, u64 length);
+        bool fat32_readRuns(const std::vector<fat32::run> &runs, u8 *buffer);
+        void fat32_invalidate();
         bool setCrypto(char* crypto, char* tweak);
+        bool setCrypto(std::shared_ptr<NxCrypto> crypto);
         int compare(NxPartition *partition);
         ProgressInfo pi;
         int dumpToFile(const char *file, int crypto_mode, void(*updateProgress)(ProgressInfo*) = nullptr);
         int restoreFromStorage(NxStorage* input, int crypto_mode, void(*updateProgress)(ProgressInfo*) = nullptr);
+        int extractFiles(const char *path, const char *dir, void(*updateProgress)(ProgressInfo*) = nullptr);
         void clearHandles();
         int userAbort(){stopWork = false; return ERR_USER_ABORT;}
 };
@@ -0,0 +1,433 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "NxPipeline.h"
+
+NxPipeline::NxPipeline(NxHandle *input, int buff_size, int buff_count)
+{
+    m_input = input;
+    m_buff_size = buff_size ? buff_size : input->getDefaultBuffSize();
+
+    // Crypto is moved out of NxHandle::read to the crypto stage (input is read raw)
+    if (is_in(input->getCryptoMode(), { ENCRYPT, DECRYPT }) && nullptr != input->crypto())
+    {
+        m_crypto = input->getCryptoMode();
+        m_input->setCrypto(NO_CRYPTO);
+        m_buff_size = m_buff_size / CLUSTER_SIZE * CLUSTER_SIZE;
+        if (!m_buff_size)
+            m_buff_size = CLUSTER_SIZE;
+    }
+
+    if (buff_count < 2)
+        buff_count = 2;
+
+    // Page aligned buffers so that O_DIRECT can be used by the handles
+    for (int i(0); i < buff_count; i++)
+    {
+        NxPipeBuffer buffer;
+        buffer.data = (u8*)malloc_aligned(m_buff_size);
+        if (nullptr == buffer.data)
+            break;
+        memset(buffer.data, 0, m_buff_size);
+        m_buffers.push_back(buffer);
+    }
+
+    if (m_buffers.size() < 2)
+    {
+        b_eof = true;
+        return;
+    }
+
+    // One worker (and one cipher context) per core
+    if (m_crypto != NO_CRYPTO)
+    {
+        unsigned int workers = std::thread::hardware_concurrency();
+        if (!workers)
+            workers = 1;
+
+        for (unsigned int i(0); i < workers; i++)
+        {
+            NxCrypto *crypto = new NxCrypto(*m_input->crypto());
+            m_cryptos.push_back(crypto);
+            m_workers.push_back(std::thread(&NxPipeline::cryptoLoop, this, crypto));
+        }
+    }
+}
+
+NxPipeline::~NxPipeline()
+{
+    stop();
+    for (NxPipeBuffer &buffer : m_buffers)
+        free_aligned(buffer.data);
+
+    for (NxCrypto *crypto : m_cryptos)
+        delete crypto;
+
+    // Restore crypto mode for input handle
+    if (m_crypto != NO_CRYPTO)
+        m_input->setCrypto(m_crypto);
+}
+
+void NxPipeline::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        b_stop = true;
+    }
+    m_cv.notify_all();
+
+    if (m_reader.joinable())
+        m_reader.join();
+
+    for (std::thread &worker : m_workers)
+        if (worker.joinable())
+            worker.join();
+}
+
+void NxPipeline::readerLoop()
+{
+    for (;;)
+    {
+        size_t index;
+        {
+            // Wait for a free buffer
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] { return b_stop || m_filled < m_buffers.size(); });
+            if (b_stop)
+                break;
+            index = m_head;
+        }
+
+        DWORD bytesRead = 0;
+        u64 offset = m_input->getCurrentOffset();
+        bool hole = false, success;
+        DWORD length = nextRun(offset, &hole);
+
+        // Stop at read limit
+        if (m_limit)
+            length = (DWORD)std::min((u64)length, m_limit - m_bytesRead);
+        if (!length)
+            success = false;
+        else if (hole)
+        {
+            // Skip free clusters, hash them as zeros
+            success = m_input->setPointer(offset + length);
+            bytesRead = length;
+            if (m_input->getCryptoMode() == MD5_HASH && nullptr != m_input->hasher())
+            {
+                memset(m_buffers[index].data, 0, length);
+                m_input->hasher()->update(m_buffers[index].data, length);
+            }
+        }
+        else success = m_input->read(m_buffers[index].data, &bytesRead, length);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!success || !bytesRead)
+            {
+                // eof (or read error, caller checks completeness)
+                b_eof = true;
+                m_cv.notify_all();
+                break;
+            }
+            NxPipeBuffer &buffer = m_buffers[index];
+            buffer.length = bytesRead;
+            buffer.offset = offset;
+            buffer.pending = 0;
+            buffer.hole = hole;
+            m_bytesRead += bytesRead;
+
+            // Fan clusters out to crypto workers (last cluster may be partial)
+            if (m_crypto != NO_CRYPTO && !hole)
+            {
+                u32 clusters = (bytesRead + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+                for (u32 first = 0; first < clusters; first += PIPELINE_CRYPTO_JOB)
+                {
+                    NxCryptoJob job;
+                    job.index = index;
+                    job.first = first;
+                    job.count = first + PIPELINE_CRYPTO_JOB > clusters ? clusters - first : PIPELINE_CRYPTO_JOB;
+                    m_jobs.push_back(job);
+                    buffer.pending++;
+                }
+            }
+
+            m_head = (m_head + 1) % m_buffers.size();
+            m_filled++;
+        }
+        m_cv.notify_all();
+    }
+}
+
+// Length of next read: clusters at offset that are all allocated or all free (hole)
+DWORD NxPipeline::nextRun(u64 offset, bool *hole)
+{
+    *hole = false;
+    if (nullptr == m_cluster_map || offset % CLUSTER_SIZE || m_buff_size < CLUSTER_SIZE)
+        return m_buff_size;
+
+    const std::vector<bool> &map = *m_cluster_map;
+    size_t first = offset / CLUSTER_SIZE, last = first;
+    size_t max = first + m_buff_size / CLUSTER_SIZE;
+    if (first >= map.size())
+        return m_buff_size;
+
+    while (last < max && last < map.size() && map[last] == map[first])
+        last++;
+
+    *hole = !map[first];
+    return (DWORD)(last - first) * CLUSTER_SIZE;
+}
+
+void NxPipeline::cryptoLoop(NxCrypto *crypto)
+{
+    for (;;)
+    {
+        NxCryptoJob job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] { return b_stop || !m_jobs.empty(); });
+            if (b_stop)
+                break;
+            job = m_jobs.front();
+            m_jobs.pop_front();
+        }
+
+        NxPipeBuffer &buffer = m_buffers[job.index];
+        size_t first_cluster = buffer.offset / CLUSTER_SIZE + job.first;
+        u8 *data = buffer.data + (size_t)job.first * CLUSTER_SIZE;
+        if (m_crypto == ENCRYPT)
+            crypto->encrypt(data, first_cluster, job.count);
+        else
+            crypto->decrypt(data, first_cluster, job.count);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            buffer.pending--;
+        }
+        m_cv.notify_all();
+    }
+}
+
+int NxPipeline::run(NxPipeWriter writer, ProgressInfo *pi, void(*updateProgress)(ProgressInfo*), bool *stopWork)
+{
+    if (!b_eof && !m_reader.joinable())
+        m_reader = std::thread(&NxPipeline::readerLoop, this);
+
+    for (;;)
+    {
+        size_t index;
+        {
+            // Wait for next buffer to be read & processed (in order)
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] { return (m_filled > 0 && !m_buffers[m_tail].pending) || (b_eof && !m_filled); });
+            if (!m_filled)
+                break;
+            index = m_tail;
+        }
+
+        if (nullptr != stopWork && *stopWork)
+        {
+            stop();
+            return ERR_USER_ABORT;
+        }
+
+        DWORD bytesWrite = 0;
+        NxPipeBuffer &buffer = m_buffers[index];
+        if (!writer(buffer.hole ? nullptr : buffer.data, buffer.length, &bytesWrite))
+        {
+            stop();
+            return ERR_WHILE_COPY;
+        }
+
+        if (nullptr != pi)
+        {
+            pi->bytesCount += bytesWrite;
+            if (nullptr != updateProgress) updateProgress(pi);
+        }
+
+        {
+            // Give buffer back to reader
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tail = (m_tail + 1) % m_buffers.size();
+            m_filled--;
+        }
+        m_cv.notify_all();
+    }
+
+    stop();
+    return SUCCESS;
+}
+
+bool NxPipeline::read(u8 *buffer, DWORD length, DWORD *bytesRead)
+{
+    if (!b_eof && !m_reader.joinable())
+        m_reader = std::thread(&NxPipeline::readerLoop, this);
+
+    *bytesRead = 0;
+    while (*bytesRead < length)
+    {
+        size_t index;
+        {
+            // Wait for next buffer (in order)
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] { return (m_filled > 0 && !m_buffers[m_tail].pending) || (b_eof && !m_filled); });
+            if (!m_filled)
+                break;
+            index = m_tail;
+        }
+
+        NxPipeBuffer &in = m_buffers[index];
+        DWORD chunk = std::min(length - *bytesRead, in.length - m_tail_offset);
+        if (in.hole)
+            memset(buffer + *bytesRead, 0, chunk);
+        else
+            memcpy(buffer + *bytesRead, in.data + m_tail_offset, chunk);
+        *bytesRead += chunk;
+        m_tail_offset += chunk;
+
+        // Give buffer back to reader
+        if (m_tail_offset == in.length)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_tail = (m_tail + 1) % m_buffers.size();
+                m_filled--;
+                m_tail_offset = 0;
+            }
+            m_cv.notify_all();
+        }
+    }
+    return *bytesRead == length;
+}
+
+NxDiffWriter::NxDiffWriter(NxHandle *output, NxHandle *reader) : m_target(reader)
+{
+    // Both handles are set at the same offset (resumed restore)
+    m_output = output;
+    m_offset = output->getCurrentOffset();
+}
+
+NxDiffWriter::~NxDiffWriter()
+{
+    free_aligned(m_buffer);
+}
+
+bool NxDiffWriter::write(u8 *buffer, DWORD length, DWORD *bytesWrite)
+{
+    *bytesWrite = 0;
+    if (length > m_buff_size)
+    {
+        free_aligned(m_buffer);
+        m_buffer = (u8*)malloc_aligned(length);
+        m_buff_size = nullptr != m_buffer ? length : 0;
+        if (nullptr == m_buffer)
+            return false;
+    }
+
+    // Current output data (short read at end of output : remaining bytes are written)
+    DWORD target_length = 0;
+    m_target.read(m_buffer, length, &target_length);
+
+    // Runs of identical/differing clusters
+    auto identical = [&](DWORD off) {
+        DWORD len = std::min((DWORD)CLUSTER_SIZE, length - off);
+        return off + len <= target_length && !memcmp(buffer + off, m_buffer + off, len);
+    };
+    for (DWORD off = 0; off < length;)
+    {
+        bool same = identical(off);
+        DWORD end = off + CLUSTER_SIZE;
+        while (end < length && identical(end) == same)
+            end += CLUSTER_SIZE;
+        end = std::min(end, length);
+
+        if (same)
+            b_seek = true;
+        else
+        {
+            DWORD bw = 0;
+            if ((b_seek && !m_output->setPointer(m_offset + off)) || !m_output->write(buffer + off, &bw, end - off) || bw != end - off)
+                return false;
+            m_written += bw;
+            b_seek = false;
+        }
+        off = end;
+    }
+
+    m_offset += length;
+    *bytesWrite = length;
+    return true;
+}
+
+NxReadBack::NxReadBack(const char *file, int hash_algorithm) : m_hash(hash_algorithm)
+{
+    m_file.open(file, std::ifstream::binary);
+    b_error = !m_file.is_open();
+}
+
+NxReadBack::~NxReadBack()
+{
+    free_aligned(m_buffer);
+}
+
+bool NxReadBack::update(DWORD length)
+{
+    if (b_error)
+        return false;
+
+    if (length > m_buff_size)
+    {
+        free_aligned(m_buffer);
+        m_buffer = (u8*)malloc_aligned(length);
+        m_buff_size = nullptr != m_buffer ? length : 0;
+        if (nullptr == m_buffer)
+            return !(b_error = true);
+    }
+
+    // Read back what was just written
+    m_file.seekg(m_fileOffset);
+    if (!m_file.read((char *)m_buffer, length) || (DWORD)m_file.gcount() != length)
+    {
+        dbg_printf("NxReadBack::update failed to read back %I32d bytes at %s\n", length, n2hexstr(m_bytesCount, 10).c_str());
+        return !(b_error = true);
+    }
+
+    m_hash.update(m_buffer, length);
+    m_bytesCount += length;
+    m_fileOffset += length;
+    return true;
+}
+
+bool NxReadBack::nextFile(const char *file)
+{
+    if (b_error)
+        return false;
+
+    m_file.close();
+    m_file.clear();
+    m_file.open(file, std::ifstream::binary);
+    m_fileOffset = 0;
+    return !(b_error = !m_file.is_open());
+}
+
+std::string NxReadBack::checksum()
+{
+    if (b_error)
+        return "";
+
+    return m_hash.checksum();
+}
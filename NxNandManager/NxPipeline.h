@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NxPipeline_h__
+#define __NxPipeline_h__
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <string>
+#include "res/types.h"
+#include "res/utils.h"
+#include "NxHandle.h"
+#include "NxCrypto.h"
+#include "NxHash.h"
+
+// Number of in-flight buffers between reader & writer
+#define PIPELINE_BUFF_COUNT 4
+// Clusters per crypto job (256 KB)
+#define PIPELINE_CRYPTO_JOB 16
+
+class NxHandle;
+class NxCrypto;
+
+// Output callback. Must write length bytes from buffer and set bytesWrite.
+// buffer is nullptr for free clusters skipped with a cluster map (hole)
+typedef std::function<bool(u8 *buffer, DWORD length, DWORD *bytesWrite)> NxPipeWriter;
+
+typedef struct NxPipeBuffer NxPipeBuffer;
+struct NxPipeBuffer {
+    u8 *data = nullptr;
+    DWORD length = 0;
+    u64 offset = 0;  // offset in input handle
+    int pending = 0; // crypto jobs not done yet
+    bool hole = false; // free clusters, not read
+};
+
+typedef struct NxCryptoJob NxCryptoJob;
+struct NxCryptoJob {
+    size_t index;    // buffer index
+    u32 first;       // first cluster in buffer
+    u32 count;       // number of clusters
+};
+
+// Overlapped copy engine. A reader thread fills a ring of buffers from an
+// input NxHandle while the calling thread drains them to the output, so both
+// devices stay busy. Progress & abort are handled on the calling thread.
+// When the input handle is set to ENCRYPT/DECRYPT, raw buffers are split into
+// cluster jobs processed by a pool of crypto workers (one NxCrypto each),
+// buffers are still written in order.
+// With a cluster map (one bool per CLUSTER_SIZE, true if allocated), free
+// clusters are not read and are passed to the writer as holes.
+class NxPipeline
+{
+    // Constructors
+    public:
+        explicit NxPipeline(NxHandle *input, int buff_size = 0, int buff_count = PIPELINE_BUFF_COUNT);
+        ~NxPipeline();
+
+    // Member variables
+    private:
+        NxHandle *m_input;
+        DWORD m_buff_size;
+        std::vector<NxPipeBuffer> m_buffers;
+        std::thread m_reader;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        size_t m_head = 0;   // next buffer to fill
+        size_t m_tail = 0;   // next buffer to drain
+        size_t m_filled = 0; // buffers read (maybe not processed yet)
+        DWORD m_tail_offset = 0; // bytes already pulled from tail buffer (pull mode)
+        bool b_eof = false;
+        bool b_stop = false;
+
+        // Crypto stage
+        int m_crypto = NO_CRYPTO;
+        std::vector<std::thread> m_workers;
+        std::vector<NxCrypto*> m_cryptos;
+        std::deque<NxCryptoJob> m_jobs;
+
+        // Allocated clusters (nullptr to read everything)
+        const std::vector<bool> *m_cluster_map = nullptr;
+
+        // Bytes to read from input (0 to read up to eof)
+        u64 m_limit = 0;
+        u64 m_bytesRead = 0;
+
+    // Member methods
+    private:
+        void readerLoop();
+        void cryptoLoop(NxCrypto *crypto);
+        void stop();
+        DWORD nextRun(u64 offset, bool *hole);
+
+    public:
+        DWORD buffSize() { return m_buff_size; };
+        void setClusterMap(const std::vector<bool> *cluster_map) { m_cluster_map = cluster_map; };
+        void setReadLimit(u64 limit) { m_limit = limit; };
+        int run(NxPipeWriter writer, ProgressInfo *pi, void(*updateProgress)(ProgressInfo*), bool *stopWork);
+        // Pull mode (instead of run) : copy next length bytes, read ahead by reader thread
+        bool read(u8 *buffer, DWORD length, DWORD *bytesRead);
+};
+
+// Delta restore. Output is read ahead by its own pipeline (second handle to the
+// same storage) and compared with the data to restore, only clusters that
+// differ are written. Restoring a slightly diverged storage is mostly reads.
+class NxDiffWriter
+{
+    // Constructors
+    public:
+        NxDiffWriter(NxHandle *output, NxHandle *reader);
+        ~NxDiffWriter();
+
+    // Member variables
+    private:
+        NxHandle *m_output;
+        NxPipeline m_target;
+        u8 *m_buffer = nullptr;     // current output data
+        DWORD m_buff_size = 0;
+        u64 m_offset = 0;           // offset in output handle
+        u64 m_written = 0;
+        bool b_seek = false;        // output pointer is behind (clusters skipped)
+
+    // Member methods
+    public:
+        u64 bytesWritten() { return m_written; };
+        bool write(u8 *buffer, DWORD length, DWORD *bytesWrite);
+};
+
+// Inline output verification. Each block written to the output file is read
+// back (from page cache, right after it's flushed) and hashed, so that a dump
+// can be verified without a second full read of the output
+class NxReadBack
+{
+    // Constructors
+    public:
+        NxReadBack(const char *file, int hash_algorithm);
+        ~NxReadBack();
+
+    // Member variables
+    private:
+        std::ifstream m_file;
+        NxHash m_hash;
+        u8 *m_buffer = nullptr;
+        DWORD m_buff_size = 0;
+        u64 m_bytesCount = 0;
+        u64 m_fileOffset = 0;   // offset in current file
+        bool b_error = false;
+
+    // Member methods
+    public:
+        u64 bytesCount() { return m_bytesCount; };
+        bool update(DWORD length);
+        // Continue reading back from next file (split output)
+        bool nextFile(const char *file);
+        std::string checksum();
+};
+
+#endif
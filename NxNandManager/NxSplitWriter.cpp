@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <algorithm>
+#include "NxSplitWriter.h"
+#include "NxPipeline.h"
+
+NxSplitWriter::NxSplitWriter(const char *file, u64 size, u64 split_size, bool sparse, u64 offset)
+{
+    m_size = size;
+    m_split_size = split_size ? split_size : size;
+    b_sparse = sparse;
+
+    // Single file is written as is
+    m_path = split_size ? firstPart(file) : std::string(file);
+    if (offset)
+        resume(offset);
+    else
+        openPart();
+}
+
+bool NxSplitWriter::resume(u64 offset)
+{
+    // Part holding offset (previous one if offset is a part boundary)
+    int part = (int)((offset - 1) / m_split_size);
+    std::string path = m_path;
+    for (int i(0); i < part; i++)
+        if ((path = nextPart(path)).empty())
+            return !(b_error = true);
+
+    // Parts written after offset are removed
+    for (std::string next = nextPart(path); m_split_size < m_size && is_file(next.c_str()); next = nextPart(next))
+        remove(next.c_str());
+
+    m_path = path;
+    m_part_count = part + 1;
+    m_offset = offset;
+    m_part_size = std::min(m_split_size, m_size - (u64)part * m_split_size);
+    m_part_offset = offset - (u64)part * m_split_size;
+    m_file.open(m_path, std::ofstream::binary | std::ofstream::in | std::ofstream::out);
+    if (!m_file.is_open() || !m_file.seekp(m_part_offset))
+        return !(b_error = true);
+
+    return true;
+}
+
+bool NxSplitWriter::openPart()
+{
+    // Next part name
+    if (m_part_count)
+    {
+        m_file.close();
+        m_unsynced.push_back(m_path);
+        if (m_file.fail() || (m_path = nextPart(m_path)).empty())
+            return !(b_error = true);
+    }
+
+    m_part_size = std::min(m_split_size, m_size - m_offset);
+    m_part_offset = 0;
+
+    // Never overwrite an existing part (would be seen as part of the set)
+    if (m_part_count && is_file(m_path.c_str()))
+    {
+        dbg_printf("NxSplitWriter::openPart() %s already exists\n", m_path.c_str());
+        return !(b_error = true);
+    }
+
+    // Sparse part, holes are left by seeking over
+    if (b_sparse && !create_sparse_file(m_path.c_str(), m_part_size))
+        return !(b_error = true);
+    if (b_sparse)
+        m_file.open(m_path, std::ofstream::binary | std::ofstream::in | std::ofstream::out);
+    else
+        m_file.open(m_path, std::ofstream::binary);
+    if (!m_file.is_open())
+        return !(b_error = true);
+
+    if (m_part_count && nullptr != m_read_back && !m_read_back->nextFile(m_path.c_str()))
+        return !(b_error = true);
+
+    m_part_count++;
+    return true;
+}
+
+bool NxSplitWriter::write(const u8 *buffer, DWORD length)
+{
+    while (length && !b_error)
+    {
+        // Roll over to next part
+        if (m_part_offset == m_part_size && (m_offset >= m_size || !openPart()))
+            return !(b_error = true);
+
+        DWORD chunk = (DWORD)std::min((u64)length, m_part_size - m_part_offset);
+        if (nullptr == buffer ? !m_file.seekp(chunk, std::ios::cur) : !m_file.write((char *)buffer, chunk))
+            return !(b_error = true);
+        if (nullptr != m_read_back && (!m_file.flush() || !m_read_back->update(chunk)))
+            return !(b_error = true);
+
+        if (nullptr != buffer)
+            buffer += chunk;
+        length -= chunk;
+        m_part_offset += chunk;
+        m_offset += chunk;
+    }
+    return !b_error;
+}
+
+bool NxSplitWriter::flush()
+{
+    if (!b_error && m_file.is_open() && !m_file.flush())
+        b_error = true;
+    return !b_error;
+}
+
+bool NxSplitWriter::sync()
+{
+    if (!flush())
+        return false;
+
+    // Parts are synced by path (stream has no native handle)
+    for (const std::string &part : m_unsynced)
+        if (!sync_file(part.c_str()))
+            return false;
+
+    m_unsynced.clear();
+    return sync_file(m_path.c_str());
+}
+
+bool NxSplitWriter::close()
+{
+    if (m_file.is_open())
+        m_file.close();
+    if (m_file.fail())
+        b_error = true;
+    dbg_printf("NxSplitWriter::close() %d part(s)\n", m_part_count);
+    return !b_error;
+}
+
+std::string NxSplitWriter::firstPart(const char *file)
+{
+    std::string prefix, suffix;
+    int number, digits;
+    if (parsePart(std::string(file), &prefix, &number, &digits, &suffix))
+        return std::string(file);
+
+    return std::string(file) + ".00";
+}
+
+std::string NxSplitWriter::nextPart(const std::string &part)
+{
+    std::string prefix, suffix;
+    int number, digits;
+    if (!parsePart(part, &prefix, &number, &digits, &suffix))
+        return "";
+
+    char next[16];
+    sprintf_s(next, 16, "%0*d", digits, number + 1);
+    if (strlen(next) > (size_t)digits)
+        return "";
+    return prefix + next + suffix;
+}
+
+bool NxSplitWriter::parsePart(const std::string &file, std::string *prefix, int *number, int *digits, std::string *suffix)
+{
+    // Number is looked for in extension first (rawnand.bin.00), then at the end of base name (full.00.bin, 00)
+    // Base name must end with ".NN" or be the number itself (BOOT0 is not a part)
+    size_t sep = file.find_last_of("\\/");
+    size_t name = sep == std::string::npos ? 0 : sep + 1;
+    size_t dot = file.find_last_of('.');
+    if (dot == std::string::npos || dot <= name)
+        dot = file.length();
+
+    auto countDigits = [&](size_t end) {
+        int n = 0;
+        while (n < SPLIT_MAX_DIGITS && end - n > name && isdigit((unsigned char)file[end - n - 1]))
+            n++;
+        return n;
+    };
+
+    size_t end;
+    int n;
+    if (dot < file.length() && (n = countDigits(file.length())) && file.length() - n == dot + 1)
+        end = file.length();
+    else if ((n = countDigits(dot)) && (dot - n == name || file[dot - n - 1] == '.'))
+        end = dot;
+    else
+        return false;
+
+    *prefix = file.substr(0, end - n);
+    *number = std::stoi(file.substr(end - n, n));
+    *digits = n;
+    *suffix = file.substr(end);
+    return true;
+}
+
+NxSplitReader::NxSplitReader(const char *file, u64 split_size)
+{
+    m_split_size = split_size;
+    m_path = split_size ? NxSplitWriter::firstPart(file) : std::string(file);
+    m_file.open(m_path, std::ifstream::binary);
+}
+
+bool NxSplitReader::read(u8 *buffer, DWORD length)
+{
+    while (length)
+    {
+        // Next part
+        if (m_split_size && m_part_offset == m_split_size)
+        {
+            m_file.close();
+            m_file.clear();
+            if ((m_path = NxSplitWriter::nextPart(m_path)).empty())
+                return false;
+            m_file.open(m_path, std::ifstream::binary);
+            m_part_offset = 0;
+        }
+
+        DWORD chunk = m_split_size ? (DWORD)std::min((u64)length, m_split_size - m_part_offset) : length;
+        if (!m_file.is_open() || !m_file.read((char *)buffer, chunk))
+            return false;
+
+        buffer += chunk;
+        length -= chunk;
+        m_part_offset += chunk;
+    }
+    return true;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NxSplitWriter_h__
+#define __NxSplitWriter_h__
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include "res/types.h"
+#include "res/utils.h"
+
+class NxReadBack;
+
+// Max digits in part number (same as NxHandle::detectSplittedStorage)
+#define SPLIT_MAX_DIGITS 2
+
+// Dump output, written to a single file or to several parts of split_size bytes.
+// Part names follow the number found in first part name (as detected on input) :
+// rawnand.bin.00, rawnand.bin.01... / full.00.bin, full.01.bin... / 00, 01... (emuMMC)
+// Parts are rolled over inline, a buffer may end in one part and continue in the next.
+// When resuming at offset (> 0), parts before offset are kept and following parts are removed.
+class NxSplitWriter
+{
+    // Constructors
+    public:
+        NxSplitWriter(const char *file, u64 size, u64 split_size = 0, bool sparse = false, u64 offset = 0);
+
+    // Member variables
+    private:
+        std::ofstream m_file;
+        std::string m_path;     // current part
+        int m_part_count = 0;
+        u64 m_size;
+        u64 m_split_size;
+        u64 m_part_size = 0;    // current part
+        u64 m_part_offset = 0;  // offset in current part
+        u64 m_offset = 0;
+        bool b_sparse;
+        bool b_error = false;
+        std::vector<std::string> m_unsynced;   // parts closed since last sync()
+        NxReadBack *m_read_back = nullptr;
+
+    // Member methods
+    private:
+        bool openPart();
+        bool resume(u64 offset);
+
+    public:
+        bool isOpen() { return m_file.is_open() && !b_error; };
+        int partCount() { return m_part_count; };
+        std::string path() { return m_path; };
+        // Output is read back (in every part) as it is written
+        void setReadBack(NxReadBack *read_back) { m_read_back = read_back; };
+        // Write buffer (or hole if nullptr)
+        bool write(const u8 *buffer, DWORD length);
+        // Written data is handed to the system
+        bool flush();
+        // Written data is committed to disk (every part written since last sync)
+        bool sync();
+        bool close();
+
+        // Path to first part (".00" appended if file name has no part number)
+        static std::string firstPart(const char *file);
+        // Path to part following part (empty if part has no number or if digits overflow)
+        static std::string nextPart(const std::string &part);
+        static bool parsePart(const std::string &file, std::string *prefix, int *number, int *digits, std::string *suffix);
+};
+
+// Dump read back from the start, across parts (split_size 0 for a single file)
+class NxSplitReader
+{
+    // Constructors
+    public:
+        NxSplitReader(const char *file, u64 split_size = 0);
+
+    // Member variables
+    private:
+        std::ifstream m_file;
+        std::string m_path;     // current part
+        u64 m_split_size;
+        u64 m_part_offset = 0;
+
+    // Member methods
+    public:
+        bool read(u8 *buffer, DWORD length);
+};
+
+#endif
@@ -38,6 +38,16 @@ NxStorage::NxStorage(const char *p_path)
     if (!nxHandle->exists)
         return;
 
+    // First part of a split dump (rawnand.bin.00, full.00.bin, BOOT0.00, SAFE.00, 00...) : parts are joined
+    std::string part_prefix, part_suffix;
+    int part_number, part_digits;
+    if (!nxHandle->isDrive() && NxSplitWriter::parsePart(s, &part_prefix, &part_number, &part_digits, &part_suffix)
+        && !part_number && nxHandle->detectSplittedStorage())
+    {
+        b_isSplitted = true;
+        dbg_printf("NxStorage::NxStorage() - Splitted storage detected (%d parts)\n", nxHandle->getSplitCount());
+    }
+
     // Get size from handle (will probably be overwritten later)
     m_size = nxHandle->size();
     m_freeSpace = nxHandle->getDiskFreeSpace();
@@ -342,7 +352,7 @@ NxStorage::NxStorage(const char *p_path)
     if (type == RAWNAND && !m_backupGPT && !nxHandle->isDrive()) 
     {        
         type = UNKNOWN;
-        if (nxHandle->detectSplittedStorage())
+        if (!b_isSplitted && nxHandle->detectSplittedStorage())
         {
             dbg_printf("NxStorage::NxStorage() - Splitted storage detected!\n");
 
@@ -573,25 +583,30 @@ int NxStorage::setKeys(const char* keyset)
     macAddress.empty();
     memset(serial_number, 0, strlen(serial_number));
 
+    // One key schedule per BIS key, shared by partitions using the same key
+    std::shared_ptr<NxCrypto> bis0 = std::make_shared<NxCrypto>(keys.crypt0, keys.tweak0);
+    std::shared_ptr<NxCrypto> bis1 = std::make_shared<NxCrypto>(keys.crypt1, keys.tweak1);
+    std::shared_ptr<NxCrypto> bis2 = std::make_shared<NxCrypto>(keys.crypt2, keys.tweak2);
+
     // Set and validate crypto + retrieve information from encrypted partitions
     NxPartition *cal0 = getNxPartition(PRODINFO);
-    if (nullptr != cal0 && !cal0->setCrypto(keys.crypt0, keys.tweak0))
+    if (nullptr != cal0 && !cal0->setCrypto(bis0))
         cal0->setBadCrypto(true);
 
     NxPartition *system = getNxPartition(SYSTEM);
-    if (nullptr != system && !system->setCrypto(keys.crypt2, keys.tweak2))
+    if (nullptr != system && !system->setCrypto(bis2))
         system->setBadCrypto(true);
             
     NxPartition *prodinfof = getNxPartition(PRODINFOF);
-    if (nullptr != prodinfof && !prodinfof->setCrypto(keys.crypt0, keys.tweak0))
+    if (nullptr != prodinfof && !prodinfof->setCrypto(bis0))
         prodinfof->setBadCrypto(true);
 
     NxPartition *safe = getNxPartition(SAFE);
-    if (nullptr != safe && !safe->setCrypto(keys.crypt1, keys.tweak1))
+    if (nullptr != safe && !safe->setCrypto(bis1))
        safe->setBadCrypto();
     
     NxPartition *user = getNxPartition(USER);
-    if (nullptr != user && !user->setCrypto(keys.crypt2, keys.tweak2))
+    if (nullptr != user && !user->setCrypto(bis2))
         user->setBadCrypto(true);
 
     // Retrieve information from encrypted partitions
@@ -610,7 +625,6 @@ int NxStorage::setKeys(const char* keyset)
 void NxStorage::setStorageInfo(int partition)
 {
     BYTE buff[CLUSTER_SIZE];
-    DWORD bytesRead;
 
     if (partition == PRODINFO || !partition)
     {
@@ -647,116 +661,95 @@ void NxStorage::setStorageInfo(int partition)
         {
 
             //dbg_printf("Get Storage information for SYSTEM\n");
-            std::vector<fat32::dir_entry> dir_entries;
-            unsigned char buff[CLUSTER_SIZE];
 
-            // Retrieve fw version & exFat driver from NCA in /Contents/registered
-            if (system->fat32_dir(&dir_entries, "/Contents/registered"))
+            // Retrieve fw version & exFat driver from NCA in /Contents/registered (latest fw first)
+            const NxDirectory *registered = system->fat32_getDir("/Contents/registered");
+            if (nullptr != registered)
             {
-                for (fat32::dir_entry nca : dir_entries)
+                for (NxSystemTitles title : systemTitlesArr)
                 {
-                    //dbg_printf("Found NCA %s\n", nca.filename.c_str());
-                    for (NxSystemTitles title : systemTitlesArr)
+                    if (registered->index.count(title.nca_filename))
                     {
-                        if (!nca.filename.compare(std::string(title.nca_filename)))
-                        {
-                            dbg_printf("Found NCA for fw %s\n", title.fw_version);
-                            memcpy(fw_version, title.fw_version, strlen(title.fw_version));
-                            setFirmwareVersion(&firmware_version, title.fw_version);
-                            break;
-                        }
+                        dbg_printf("Found NCA for fw %s\n", title.fw_version);
+                        memcpy(fw_version, title.fw_version, strlen(title.fw_version));
+                        setFirmwareVersion(&firmware_version, title.fw_version);
+                        break;
                     }
+                }
 
-                    for (NxSystemTitles title : exFatTitlesArr)
+                for (NxSystemTitles title : exFatTitlesArr)
+                {
+                    if (registered->index.count(title.nca_filename))
                     {
-                        if (!nca.filename.compare(std::string(title.nca_filename)))
-                        {
-                            exFat_driver = true;
-                            break;
-                        }
+                        exFat_driver = true;
+                        break;
                     }
                 }
             }
 
+            // Scan file data, chunk by chunk
+            auto scanFile = [&](const char *path, std::function<void(const std::string&)> scan) {
+                std::unique_ptr<NxFile> file = system->fat32_open(path);
+                if (nullptr == file || file->stat().is_directory)
+                    return;
+
+                std::vector<u8> chunk(DEFAULT_BUFF_SIZE);
+                DWORD bytesRead;
+                for (u64 off = 0; off < file->size() && file->read(off, chunk.data(), &bytesRead, DEFAULT_BUFF_SIZE); off += bytesRead)
+                    scan(std::string(chunk.begin(), chunk.begin() + bytesRead));
+            };
+
             // Read journal report => /save/80000000000000d1
-            if (system->fat32_dir(&dir_entries, "/save/80000000000000d1"))
-            {
-                fat32::dir_entry *journal = &dir_entries[0];
-                u64 cur_off = journal->data_offset;
-                u64 max_off = cur_off + journal->entry.file_size;
-                s8 fwv[10] = { 0 };
+            scanFile("/save/80000000000000d1", [&](const std::string &haystack) {
+                s8 fwv[11] = { 0 };
 
-                // Read all journal data --> Let's just assume file is not fragmented in SYSTEM (TODO : Scan FAT for fragmentation)
-                while (cur_off < max_off && nxHandle->read(cur_off, buff, &bytesRead, CLUSTER_SIZE))
+                // Find needles (firmware version) in haystack
+                for (std::size_t n = haystack.find("OsVersion"); n != std::string::npos && n + 10 <= haystack.size(); n = haystack.find("OsVersion", n + 1))
                 {
-                    std::string haystack(buff, buff + CLUSTER_SIZE);
-
-                    // Find needle (firmware version) in haystack
-                    std::size_t n = haystack.find("OsVersion");
-                    if (n != std::string::npos)
+                    strcpy(fwv, haystack.substr(n + 10, 10).c_str());
+                    char *buf;
+                    if ((buf = strtok(fwv, "\xb0")) != nullptr) // 0xB0 terminated value (msgpack)
                     {
-                        strcpy(fwv, haystack.substr(n + 10, 10).c_str());
-                        char *buf;
-                        if ((buf = strtok(fwv, "\xb0")) != nullptr) // 0xB0 terminated value (msgpack)
+                        firmware_version_t fwv_tmp;
+                        setFirmwareVersion(&fwv_tmp, buf);
+                        dbg_printf("Reading /save/80000000000000d1 - OsVersion %s\n", getFirmwareVersion(&fwv_tmp).c_str());
+
+                        if (fwv_cmp(fwv_tmp, firmware_version) > 0)
                         {
-                            firmware_version_t fwv_tmp;
-                            setFirmwareVersion(&fwv_tmp, buf);
-                            dbg_printf("Reading /save/80000000000000d1 - OsVersion %s\n", getFirmwareVersion(&fwv_tmp).c_str());
-
-                            if (fwv_cmp(fwv_tmp, firmware_version) > 0)
-                            {
-                                dbg_printf("%s is greater than %s\n", getFirmwareVersion(&fwv_tmp).c_str(), getFirmwareVersion().c_str());
-                                firmware_version = fwv_tmp;
-                            }
+                            dbg_printf("%s is greater than %s\n", getFirmwareVersion(&fwv_tmp).c_str(), getFirmwareVersion().c_str());
+                            firmware_version = fwv_tmp;
                         }
                     }
-
-                    // Find needle (serial number) in haystack
-                    n = haystack.find("\xACSerialNumber");
-                    if (!strlen(serial_number) && n != std::string::npos)
-                        strcpy(serial_number, haystack.substr(n + 14, 14).c_str());
-
-                    cur_off += bytesRead;
                 }
-            }
-            
-            // Read play report => /save/80000000000000a1 --> Let's just assume file is not fragmented in SYSTEM (TODO : Scan FAT for fragmentation)
-            if (system->fat32_dir(&dir_entries, "/save/80000000000000a1"))
-            {                
 
-                fat32::dir_entry *play_report = &dir_entries[0];
-                u64 cur_off = play_report->data_offset;
-                u64 max_off = cur_off + play_report->entry.file_size;
-                s8 fwv[10] = { 0 };
+                // Find needle (serial number) in haystack
+                std::size_t n = haystack.find("\xACSerialNumber");
+                if (!strlen(serial_number) && n != std::string::npos && n + 14 <= haystack.size())
+                    strcpy(serial_number, haystack.substr(n + 14, 14).c_str());
+            });
+
+            // Read play report => /save/80000000000000a1
+            scanFile("/save/80000000000000a1", [&](const std::string &haystack) {
+                s8 fwv[11] = { 0 };
 
-                //dbg_printf("FOUND %s, off %s, first lba is %I32d\n", play_report->filename.c_str(), n2hexstr(cur_off, 10).c_str(), play_report->data_first_lba); 
-                // Read all play report data
-                while (cur_off < max_off && nxHandle->read(cur_off, buff, &bytesRead, CLUSTER_SIZE))
+                // Find needles (firmware version) in haystack
+                for (std::size_t n = haystack.find("os_version"); n != std::string::npos && n + 11 <= haystack.size(); n = haystack.find("os_version", n + 1))
                 {
-                    //dbg_printf("Reading /save/80000000000000a1\n"); 
-                    std::string haystack(buff, buff + CLUSTER_SIZE);
-                    
-                    // Find needle (firmware version) in haystack
-                    std::size_t n = haystack.find("os_version");
-                    if (n != std::string::npos)
+                    strcpy(fwv, haystack.substr(n + 11, 10).c_str());
+                    char *buf;
+                    if ((buf = strtok(fwv, "\xb1")) != nullptr) // 0xB1 terminated value (msgpack)
                     {
-                        strcpy(fwv, haystack.substr(n + 11, 10).c_str());
-                        char *buf;
-                        if ((buf = strtok(fwv, "\xb1")) != nullptr) // 0xB1 terminated value (msgpack)
+                        firmware_version_t fwv_tmp;
+                        setFirmwareVersion(&fwv_tmp, buf);
+
+                        if (fwv_cmp(fwv_tmp, firmware_version) > 0)
                         {
-                            firmware_version_t fwv_tmp;
-                            setFirmwareVersion(&fwv_tmp, buf);
-
-                            if (fwv_cmp(fwv_tmp, firmware_version) > 0)
-                            {
-                                dbg_printf("%s is greater than %s\n", getFirmwareVersion(&fwv_tmp).c_str(), getFirmwareVersion().c_str());
-                                firmware_version = fwv_tmp;
-                            }
+                            dbg_printf("%s is greater than %s\n", getFirmwareVersion(&fwv_tmp).c_str(), getFirmwareVersion().c_str());
+                            firmware_version = fwv_tmp;
                         }
                     }
-                    cur_off += bytesRead;
                 }
-            }
+            });
 
             // overwrite fw version if value found in journal/play report is greater than fw version in 
             // package1ldr (trick for downgraded NAND, only works for FULL NAND)
@@ -772,16 +765,89 @@ int NxStorage::dumpToFile(const char* file, int crypto_mode, void(&updateProgres
     if (crypto_mode == DECRYPT || crypto_mode == ENCRYPT)
         return ERR_CRYPTO_RAW_COPY;
 
-    // Test if file already exists
-    std::ifstream infile(file);
-    if (infile.good())
-    {
-        infile.close();
+    // Verify output inline (read back while copying) or with a full re-read (paranoid)
+    bool full_verify = crypto_mode == MD5_HASH_FULL;
+    if (full_verify)
+        crypto_mode = MD5_HASH;
+
+    // Split output : first part name
+    u64 bytesTotal = rawnand_only && type == RAWMMC ? size() - (u64)0x4000 * NX_BLOCKSIZE : size();
+    std::string out_path = splitSize() && !compressOutput() ? NxSplitWriter::firstPart(file) : std::string(file);
+
+    // Test if file already exists (partial output when resuming)
+    std::ifstream infile(out_path);
+    bool exists = infile.good();
+    infile.close();
+    if (exists && !resumeJournal())
         return ERR_FILE_ALREADY_EXISTS;
+
+    // Checkpoint journal next to output (resume : journal must match operation)
+    std::unique_ptr<NxJournal> journal;
+    if (!compressOutput() && (journalInterval() || resumeJournal()))
+    {
+        char in_path[MAX_PATH] = { 0 };
+        wcstombs(in_path, m_path, MAX_PATH - 1);
+        NxJournalInfo info;
+        info.operation = "dump";
+        info.input = std::string(in_path);
+        info.type = std::string(getNxTypeAsStr());
+        info.size = bytesTotal;
+        info.crypto_mode = crypto_mode;
+        info.hash_algorithm = hashAlgorithm();
+        info.split_size = splitSize();
+
+        std::string journal_path = NxJournal::path(out_path.c_str());
+        if (resumeJournal())
+        {
+            journal = std::unique_ptr<NxJournal>(new NxJournal(journal_path.c_str()));
+            if (!exists || !journal->isValid())
+                return ERR_INVALID_JOURNAL;
+            if (!journal->matches(info))
+                return ERR_JOURNAL_MISMATCH;
+        }
+        else journal = std::unique_ptr<NxJournal>(new NxJournal(journal_path.c_str(), info, journalInterval()));
     }
 
-    // Open new stream for output file
-    std::ofstream out_file = std::ofstream(file, std::ofstream::binary);
+    // Compressed output is verified with a full re-read (frames are inflated by output handle)
+    // Resumed output too (input hash is fed with data read back from output)
+    if ((compressOutput() || resumeJournal()) && crypto_mode == MD5_HASH)
+        full_verify = true;
+
+    // Open new file (split in parts if needed) or compressor for output
+    std::unique_ptr<NxSplitWriter> out_file;
+    std::unique_ptr<NxZWriter> z_writer;
+    if (compressOutput())
+    {
+        z_writer = std::unique_ptr<NxZWriter>(new NxZWriter(file));
+        if (!z_writer->isOpen())
+            return ERR_OUTPUT_HANDLE;
+    }
+    // Resumed output is opened once copied data is checked
+    else if (!resumeJournal())
+    {
+        out_file = std::unique_ptr<NxSplitWriter>(new NxSplitWriter(file, bytesTotal, splitSize()));
+        if (!out_file->isOpen())
+            return ERR_OUTPUT_HANDLE;
+    }
+
+    // Read back what is written to the output
+    std::unique_ptr<NxReadBack> read_back;
+    if (crypto_mode == MD5_HASH && !full_verify)
+    {
+        read_back = std::unique_ptr<NxReadBack>(new NxReadBack(out_path.c_str(), hashAlgorithm()));
+        out_file->setReadBack(read_back.get());
+    }
+
+    // Per block hashes & partitions (sidecar manifest)
+    std::unique_ptr<NxManifest> manifest;
+    if (manifestOutput())
+    {
+        manifest = std::unique_ptr<NxManifest>(new NxManifest(getNxTypeAsStr(), bytesTotal, hashAlgorithm()));
+        u64 skip = size() - bytesTotal;
+        for (NxPartition *part : partitions)
+            if ((u64)part->lbaStart() * NX_BLOCKSIZE >= skip)
+                manifest->addPart(part->partitionName(), (u64)part->lbaStart() * NX_BLOCKSIZE - skip, part->size());
+    }
 
     // Lock volume (drive only)
     if (isDrive())
@@ -790,83 +856,171 @@ int NxStorage::dumpToFile(const char* file, int crypto_mode, void(&updateProgres
     // Init input handle
     nxHandle->initHandle(crypto_mode);
 
-    // Skip boot partitions if rawnanand_only
-    if (rawnand_only && type == RAWMMC)
-        nxHandle->setPointer((u64)0x4000 * NX_BLOCKSIZE);
+    // Resume : copied data is read back from output & checked against journal checkpoints,
+    // input hash & manifest are fed with it
+    u64 offset = 0;
+    for (u64 limit = bytesTotal; resumeJournal(); limit = offset)
+    {
+        NxSplitReader reader(out_path.c_str(), splitSize());
+        offset = journal->replay(limit, [&](u8 *buffer, DWORD length) {
+            return reader.read(buffer, length);
+        }, [&](const u8 *data, DWORD length) {
+            if (crypto_mode == MD5_HASH)
+                nxHandle->hasher()->update(data, length);
+            if (nullptr != manifest)
+                manifest->update(data, length);
+        });
+        if (journal->offset() == offset)
+            break;
 
-    // Set new buffer
-    int buff_size = nxHandle->getDefaultBuffSize();
-    BYTE* buffer = new BYTE[buff_size];
-    memset(buffer, 0, buff_size);
-    DWORD bytesRead = 0;
+        // Data past last matching checkpoint was hashed, replay again
+        nxHandle->initHandle(crypto_mode);
+        if (nullptr != manifest)
+            manifest->rewind();
+    }
+    if (resumeJournal())
+    {
+        dbg_printf("NxStorage::dumpToFile() resume at %s\n", n2hexstr(offset, 10).c_str());
+
+        // Nothing to resume from, previous output is removed
+        for (std::string part = out_path; !offset && is_file(part.c_str()); part = NxSplitWriter::nextPart(part))
+            remove(part.c_str());
+
+        out_file = std::unique_ptr<NxSplitWriter>(new NxSplitWriter(file, bytesTotal, splitSize(), false, offset));
+        if (!out_file->isOpen())
+        {
+            if (isDrive())
+                nxHandle->unlockVolume();
+            return ERR_OUTPUT_HANDLE;
+        }
+    }
+
+    // Skip boot partitions if rawnanand_only
+    if (offset || (rawnand_only && type == RAWMMC))
+        nxHandle->setPointer(size() - bytesTotal + offset);
 
     // Init progress info    
     ProgressInfo pi;
     pi.mode = COPY;
     pi.storage_name = std::string(getNxTypeAsStr());
     pi.begin_time = std::chrono::system_clock::now();
-    pi.bytesCount = 0;
-    pi.bytesTotal = rawnand_only && type == RAWMMC ? size() - (u64)0x4000 * NX_BLOCKSIZE : size();
+    pi.bytesCount = offset;
+    pi.bytesTotal = bytesTotal;
     updateProgress(&pi);
 
-    // Copy
-    while (nxHandle->read(buffer, &bytesRead, buff_size))
-    {
-        if(stopWork) return userAbort();
+    // Journal is written by its own thread
+    if (nullptr != journal)
+        journal->start();
+
+    // Copy (overlapped read/write)
+    NxPipeline pipeline(nxHandle);
+    int rc = pipeline.run([&](u8 *buffer, DWORD length, DWORD *bytesWrite) {
+        *bytesWrite = length;
+        if (nullptr != manifest)
+            manifest->update(buffer, length);
+        if (nullptr != z_writer)
+            return z_writer->write(buffer, length);
+        if (!out_file->write(buffer, length))
+            return false;
+
+        // Checkpoint every interval bytes (every written part synced first)
+        if (nullptr != journal)
+        {
+            journal->update(buffer, length);
+            if (journal->due() && out_file->sync())
+                journal->checkpoint();
+        }
+        return true;
+    }, &pi, &updateProgress, &stopWork);
+
+    // Interrupted : last checkpoint once output is synced
+    if (nullptr != journal && pi.bytesCount != pi.bytesTotal && journal->pending() && out_file->sync())
+        journal->checkpoint();
+
+    // Clean & unlock volume (compressed output : write last frame & seek table)
+    if (nullptr != z_writer && rc == SUCCESS && !z_writer->close())
+        rc = ERR_WHILE_WRITE;
+    if (nullptr != out_file && !out_file->close() && rc == SUCCESS)
+        rc = ERR_WHILE_WRITE;
+    z_writer.reset();
+    out_file.reset();
+    if (isDrive())
+        nxHandle->unlockVolume();
 
-        if (!out_file.write((char *)&buffer[0], bytesRead))
-            break;
+    // Journal is removed once copy is complete (last synced checkpoint is written otherwise)
+    if (nullptr != journal)
+        journal->close(pi.bytesCount == pi.bytesTotal);
 
-        pi.bytesCount += bytesRead;
-        updateProgress(&pi);
-    }
+    if (rc == ERR_USER_ABORT)
+        return userAbort();
 
-    // Clean & unlock volume
-    out_file.close();
-    delete[] buffer;
-    if (isDrive())
-        nxHandle->unlockVolume();
+    if (rc == ERR_WHILE_WRITE)
+        return rc;
 
     // Check completeness
     if (pi.bytesCount != pi.bytesTotal)
         return ERR_WHILE_COPY;
 
-    // Compute & compare md5 hashes
+    // Compute & compare hashes
     if (crypto_mode == MD5_HASH)
     {
         // Get checksum for input
-        HCRYPTHASH in_hash = nxHandle->md5Hash();
-        std::string in_sum = BuildChecksum(in_hash);
+        std::string in_sum = nxHandle->hasher()->checksum();
         
-        // Set new NxStorage for output
-        NxStorage out_storage = NxStorage(file);
-
-        // Init Progress Info
-        pi.mode = MD5_HASH;
-        pi.begin_time = std::chrono::system_clock::now();
-        pi.bytesCount = 0;
-        pi.bytesTotal = out_storage.size();
-        pi.elapsed_seconds = 0;
-        updateProgress(&pi);
-
-        // Hash output file
-        while (!out_storage.nxHandle->hash(&pi.bytesCount))
+        // Output was read back & hashed while copying
+        if (nullptr != read_back)
         {
-            if(stopWork) return userAbort();
+            if (read_back->bytesCount() != pi.bytesTotal || in_sum.compare(read_back->checksum()))
+                return ERR_MD5_COMPARE;
+
+            pi.mode = MD5_HASH;
             updateProgress(&pi);
         }
-        // Check completeness
-        if (pi.bytesCount != pi.bytesTotal)
-            return ERR_MD5_COMPARE;
+        // Re-read output & compare checksums
+        else if ((rc = verifyDump(out_path.c_str(), in_sum, &pi, updateProgress)) != SUCCESS)
+            return rc;
+
+        if (nullptr != manifest)
+            manifest->setDigest(in_sum);
+    }
 
-        // Get checksum for output
-        HCRYPTHASH out_hash = out_storage.nxHandle->md5Hash();
-        std::string out_sum = BuildChecksum(out_hash);
+    // Write manifest next to output (first part)
+    if (nullptr != manifest && !manifest->write(NxManifest::path(out_path.c_str()).c_str()))
+        return ERR_WHILE_WRITE;
 
-        // Compare checksums
-        if (in_sum.compare(out_sum))
-            return ERR_MD5_COMPARE;
+    return SUCCESS;
+}
+
+int NxStorage::verifyDump(const char *file, const std::string &in_sum, ProgressInfo *pi, void(*updateProgress)(ProgressInfo*), bool *stop)
+{
+    // Set new NxStorage for output
+    NxStorage out_storage = NxStorage(file);
+    out_storage.setHashAlgorithm(hashAlgorithm());
+
+    // Init Progress Info
+    pi->mode = MD5_HASH;
+    pi->begin_time = std::chrono::system_clock::now();
+    pi->bytesCount = 0;
+    pi->bytesTotal = out_storage.size();
+    pi->elapsed_seconds = 0;
+    if (nullptr != updateProgress) updateProgress(pi);
+
+    // Hash output file
+    while (!out_storage.nxHandle->hash(&pi->bytesCount))
+    {
+        if (nullptr != stop ? *stop : stopWork) return userAbort();
+        if (nullptr != updateProgress) updateProgress(pi);
     }
+    // Check completeness
+    if (pi->bytesCount != pi->bytesTotal)
+        return ERR_MD5_COMPARE;
+
+    // Get checksum for output
+    std::string out_sum = out_storage.nxHandle->hasher()->checksum();
+
+    // Compare checksums
+    if (in_sum.compare(out_sum))
+        return ERR_MD5_COMPARE;
 
     return SUCCESS;
 }
@@ -892,6 +1046,44 @@ int NxStorage::restoreFromStorage(NxStorage* input, int crypto_mode, void(&updat
     if (not_in(crypto_mode, { ENCRYPT, DECRYPT }) && !input->isEncrypted() && isEncrypted())
         return ERR_RESTORE_CRYPTO_MISSING;
 
+    // Restored data is read back & compared only on request (FULL_MD5SUM)
+    bool full_verify = crypto_mode == MD5_HASH_FULL;
+    if (full_verify)
+        crypto_mode = MD5_HASH;
+
+    // Checkpoint journal next to output file, next to input when restoring to a drive
+    std::unique_ptr<NxJournal> journal;
+    if (journalInterval() || resumeJournal())
+    {
+        char in_path[MAX_PATH] = { 0 }, journal_file[MAX_PATH] = { 0 };
+        wcstombs(in_path, input->m_path, MAX_PATH - 1);
+        wcstombs(journal_file, isDrive() ? input->m_path : m_path, MAX_PATH - 1);
+        NxJournalInfo info;
+        info.operation = "restore";
+        info.input = std::string(in_path);
+        info.type = std::string(getNxTypeAsStr());
+        info.size = input->size();
+        info.crypto_mode = crypto_mode;
+        info.hash_algorithm = hashAlgorithm();
+
+        std::string journal_path = NxJournal::path(journal_file);
+        if (resumeJournal())
+        {
+            journal = std::unique_ptr<NxJournal>(new NxJournal(journal_path.c_str()));
+            if (!journal->isValid())
+                return ERR_INVALID_JOURNAL;
+            if (!journal->matches(info))
+                return ERR_JOURNAL_MISMATCH;
+        }
+        else journal = std::unique_ptr<NxJournal>(new NxJournal(journal_path.c_str(), info, journalInterval()));
+    }
+
+    // Delta restore : output is read ahead with its own handle
+    std::unique_ptr<NxStorage> reader;
+    std::unique_ptr<NxDiffWriter> diff_writer;
+    if (deltaRestore() && nullptr == (reader = reopen()))
+        return ERR_OUTPUT_HANDLE;
+
     // Lock output volume
     if (isDrive())
         nxHandle->lockVolume();
@@ -900,6 +1092,10 @@ int NxStorage::restoreFromStorage(NxStorage* input, int crypto_mode, void(&updat
     if (input->isDrive())
         input->nxHandle->lockVolume();
 
+    // Input is hashed with output's algorithm (restore verification)
+    if (crypto_mode == MD5_HASH)
+        input->setHashAlgorithm(hashAlgorithm());
+
     // Init handles for both input & output
     input->nxHandle->initHandle(crypto_mode);
     this->nxHandle->initHandle(NO_CRYPTO);
@@ -908,46 +1104,876 @@ int NxStorage::restoreFromStorage(NxStorage* input, int crypto_mode, void(&updat
     if (type == RAWMMC && m_freeSpace && input->size() > size())
         this->nxHandle->setOffMax(m_freeSpace);
 
-    // Set new buffer
-    int buff_size = nxHandle->getDefaultBuffSize();
-    BYTE* buffer = new BYTE[buff_size];
-    memset(buffer, 0, buff_size);
-    DWORD bytesRead = 0, bytesWrite = 0;
+    // Resume : restored data is read back from output & checked against journal checkpoints,
+    // input hash is fed with it
+    u64 offset = 0;
+    for (u64 limit = input->size(); resumeJournal(); limit = offset)
+    {
+        offset = journal->replay(limit, [&](u8 *buffer, DWORD length) {
+            DWORD bytesRead = 0;
+            return nxHandle->read(buffer, &bytesRead, length) && bytesRead == length;
+        }, [&](const u8 *data, DWORD length) {
+            if (crypto_mode == MD5_HASH)
+                input->nxHandle->hasher()->update(data, length);
+        });
+        if (journal->offset() == offset)
+            break;
+
+        // Data past last matching checkpoint was hashed, replay again
+        input->nxHandle->initHandle(crypto_mode);
+        nxHandle->setPointer(0);
+    }
+    if (resumeJournal())
+        dbg_printf("NxStorage::restoreFromStorage() resume at %s\n", n2hexstr(offset, 10).c_str());
+    if (offset && (!input->nxHandle->setPointer(offset) || !nxHandle->setPointer(offset)))
+        return ERR_WHILE_COPY;
 
     // Init progress info    
     ProgressInfo pi;
     pi.mode = RESTORE;
     pi.storage_name = std::string(getNxTypeAsStr());
     pi.begin_time = std::chrono::system_clock::now();
-    pi.bytesCount = 0;
+    pi.bytesCount = offset;
     pi.bytesTotal = input->size();
     updateProgress(&pi);
 
-    while(input->nxHandle->read(buffer, &bytesRead, buff_size))
+    // Only clusters that differ from output are written (delta restore)
+    if (nullptr != reader)
     {
-        if(stopWork) return userAbort();
+        reader->nxHandle->initHandle(NO_CRYPTO);
+        reader->nxHandle->setPointer(offset);
+        diff_writer = std::unique_ptr<NxDiffWriter>(new NxDiffWriter(nxHandle, reader->nxHandle));
+    }
 
-        if (!this->nxHandle->write(buffer, &bytesWrite, bytesRead))
-            break;
+    // Journal is written by its own thread (checkpoints are synced here first)
+    if (nullptr != journal)
+        journal->start();
 
-        pi.bytesCount += bytesWrite;
-        updateProgress(&pi);
+    // Copy (overlapped read/write)
+    NxPipeline pipeline(input->nxHandle);
+    int rc = pipeline.run([&](u8 *buffer, DWORD length, DWORD *bytesWrite) {
+        if (nullptr != diff_writer ? !diff_writer->write(buffer, length, bytesWrite) : !this->nxHandle->write(buffer, bytesWrite, length))
+            return false;
+
+        // Checkpoint every interval bytes (every written split file synced first)
+        if (nullptr != journal)
+        {
+            journal->update(buffer, *bytesWrite);
+            if (journal->due() && this->nxHandle->flush())
+                journal->checkpoint();
+        }
+        return true;
+    }, &pi, &updateProgress, &stopWork);
+    if (nullptr != diff_writer)
+        dbg_printf("NxStorage::restoreFromStorage() delta restore, %s written\n", GetReadableSize(diff_writer->bytesWritten()).c_str());
+    diff_writer.reset();
+
+    // Partitions were overwritten, FAT is loaded again when needed
+    for (NxPartition *part : partitions)
+        part->fat32_invalidate();
+
+    // Journal is removed once copy is complete (last synced checkpoint is written otherwise)
+    if (nullptr != journal)
+    {
+        if (pi.bytesCount != pi.bytesTotal && journal->pending() && nxHandle->flush())
+            journal->checkpoint();
+        journal->close(pi.bytesCount == pi.bytesTotal);
     }
 
     // Clean & unlock volume
-    delete[] buffer;
     if (isDrive())
         nxHandle->unlockVolume();
     if (input->isDrive())
         input->nxHandle->unlockVolume();
 
+    if (rc == ERR_USER_ABORT)
+        return userAbort();
+
     // Check completeness
     if (pi.bytesCount != pi.bytesTotal)
         return ERR_WHILE_COPY;
 
+    // Read back restored data & compare hashes
+    if (full_verify)
+    {
+        std::string in_sum = input->nxHandle->hasher()->checksum();
+
+        // Init Progress Info
+        pi.mode = MD5_HASH;
+        pi.begin_time = std::chrono::system_clock::now();
+        pi.bytesCount = 0;
+        pi.elapsed_seconds = 0;
+        updateProgress(&pi);
+
+        // Hash output (same length as input)
+        while (!nxHandle->hash(&pi.bytesCount, pi.bytesTotal))
+        {
+            if (stopWork) return userAbort();
+            updateProgress(&pi);
+        }
+
+        // Check completeness
+        if (pi.bytesCount != pi.bytesTotal)
+            return ERR_MD5_COMPARE;
+
+        if (in_sum.compare(nxHandle->hasher()->checksum()))
+            return ERR_MD5_COMPARE;
+
+        updateProgress(&pi);
+    }
+
     return SUCCESS;
 }
 
+int NxStorage::dumpToArchive(const char *file, void(&updateProgress)(ProgressInfo*))
+{
+    if (type != RAWNAND)
+        return ERR_INVALID_INPUT;
+
+    // Test if file already exists
+    std::ifstream infile(file);
+    if (infile.good())
+    {
+        infile.close();
+        return ERR_FILE_ALREADY_EXISTS;
+    }
+
+    // Regions : partitions (ordered by offset) & areas between them
+    std::vector<NxPartition*> parts(partitions);
+    std::sort(parts.begin(), parts.end(), [](NxPartition *a, NxPartition *b) { return a->lbaStart() < b->lbaStart(); });
+    std::vector<NxArchiveRegion> regions;
+    std::vector<NxPartition*> region_parts;
+    std::vector<std::vector<bool>> maps;
+    auto addRegion = [&](NxPartition *part, u64 offset, u64 length) {
+        NxArchiveRegion region;
+        memset(&region, 0, sizeof(NxArchiveRegion));
+        region.offset = offset;
+        region.size = length;
+        region.bis_key = NXA_PLAIN;
+        std::vector<bool> map;
+        if (nullptr != part)
+        {
+            strncpy(region.name, part->partitionName().c_str(), sizeof(region.name) - 1);
+            // Free clusters are not stored for FAT32 partitions (map is only available with valid keys)
+            if (part->fat32_getClusterMap(&map))
+            {
+                region.map_size = (u32)((map.size() + 7) / 8);
+                if (part->isEncryptedPartition())
+                    region.bis_key = part->type() == SAFE ? 1 : 2;
+            }
+        }
+        regions.push_back(region);
+        region_parts.push_back(part);
+        maps.push_back(map);
+    };
+
+    u64 offset = 0;
+    for (NxPartition *part : parts)
+    {
+        u64 part_offset = (u64)part->lbaStart() * NX_BLOCKSIZE;
+        if (part_offset < offset)
+            return ERR_INVALID_INPUT;
+        if (part_offset > offset)
+            addRegion(nullptr, offset, part_offset - offset);
+        addRegion(part, part_offset, part->size());
+        offset = part_offset + part->size();
+    }
+    if (offset < size())
+        addRegion(nullptr, offset, size() - offset);
+
+    // Header & region table (data is stored in region order)
+    NxArchiveHeader header;
+    memcpy(header.magic, NXA_MAGIC, 4);
+    header.version = NXA_VERSION;
+    header.size = size();
+    header.type = (u32)type;
+    header.region_count = (u32)regions.size();
+    u64 data_offset = sizeof(NxArchiveHeader) + regions.size() * sizeof(NxArchiveRegion);
+    for (size_t i(0); i < regions.size(); i++)
+    {
+        regions[i].data_offset = data_offset;
+        data_offset += regions[i].map_size + NxArchive::storedSize(regions[i], &maps[i]);
+    }
+
+    std::ofstream out_file = std::ofstream(file, std::ofstream::binary);
+    if (!out_file.write((char *)&header, sizeof(NxArchiveHeader)) ||
+        !out_file.write((char *)&regions[0], regions.size() * sizeof(NxArchiveRegion)))
+        return ERR_WHILE_WRITE;
+
+    // Lock volume (drive only)
+    if (isDrive())
+        nxHandle->lockVolume();
+
+    // Init progress info
+    ProgressInfo pi;
+    pi.mode = COPY;
+    pi.storage_name = std::string(getNxTypeAsStr());
+    pi.begin_time = std::chrono::system_clock::now();
+    pi.bytesCount = 0;
+    pi.bytesTotal = size();
+    updateProgress(&pi);
+
+    int rc = SUCCESS;
+    for (size_t i(0); i < regions.size() && rc == SUCCESS; i++)
+    {
+        NxArchiveRegion &region = regions[i];
+        if (region.map_size)
+        {
+            std::vector<u8> bytes;
+            NxArchive::packMap(maps[i], &bytes);
+            if (!out_file.write((char *)&bytes[0], region.map_size))
+                rc = ERR_WHILE_WRITE;
+        }
+
+        // Copy area between partitions (GPT...)
+        u64 bytesCount = pi.bytesCount;
+        if (nullptr == region_parts[i])
+        {
+            nxHandle->initHandle(NO_CRYPTO);
+            BYTE buffer[CLUSTER_SIZE];
+            for (u64 off = 0; off < region.size && rc == SUCCESS; off += CLUSTER_SIZE)
+            {
+                DWORD bytesRead = 0, length = (DWORD)std::min((u64)CLUSTER_SIZE, region.size - off);
+                if (!nxHandle->read(region.offset + off, buffer, &bytesRead, length) || bytesRead != length)
+                    rc = ERR_WHILE_COPY;
+                else if (!out_file.write((char *)buffer, length))
+                    rc = ERR_WHILE_WRITE;
+                pi.bytesCount += bytesRead;
+            }
+            updateProgress(&pi);
+            continue;
+        }
+
+        // Copy partition (raw), free clusters are skipped
+        nxHandle->initHandle(NO_CRYPTO, region_parts[i]);
+        NxPipeline pipeline(nxHandle);
+        if (region.map_size)
+            pipeline.setClusterMap(&maps[i]);
+        if (rc == SUCCESS)
+            rc = pipeline.run([&](u8 *buffer, DWORD length, DWORD *bytesWrite) {
+                *bytesWrite = length;
+                return nullptr == buffer || (bool)out_file.write((char *)buffer, length);
+            }, &pi, &updateProgress, &stopWork);
+
+        if (rc == SUCCESS && pi.bytesCount != bytesCount + region.size)
+            rc = ERR_WHILE_COPY;
+    }
+
+    // Clean & unlock volume
+    out_file.close();
+    if (isDrive())
+        nxHandle->unlockVolume();
+
+    if (rc == ERR_USER_ABORT)
+        return userAbort();
+
+    return rc;
+}
+
+int NxStorage::restoreFromArchive(NxArchive *archive, void(&updateProgress)(ProgressInfo*))
+{
+    if (!archive->isValid())
+        return ERR_INVALID_INPUT;
+
+    if (archive->size() != size())
+        return ERR_IO_MISMATCH;
+
+    // Crypto used to regenerate free clusters (validated with archived boot sector)
+    std::vector<NxArchiveRegion> &regions = archive->regions();
+    std::vector<std::shared_ptr<NxCrypto>> cryptos(regions.size());
+    std::vector<bool> map;
+    BYTE *buffer = (BYTE*)malloc_aligned(DEFAULT_BUFF_SIZE);
+    if (nullptr == buffer)
+        return ERR_WHILE_COPY;
+    std::unique_ptr<BYTE, void(*)(void*)> buffer_guard(buffer, free_aligned);
+
+    for (size_t i(0); i < regions.size(); i++)
+    {
+        NxArchiveRegion &region = regions[i];
+        if (!region.map_size || region.bis_key == NXA_PLAIN)
+            continue;
+
+        if (!m_keySet_set)
+            return ERR_CRYPTO_KEY_MISSING;
+
+        cryptos[i] = bisCrypto(region.bis_key);
+
+        // Boot sector is in first cluster (always stored)
+        if (!archive->seekRegion(region, &map) || map.empty() || !map[0] || !archive->read(buffer, CLUSTER_SIZE))
+            return ERR_INVALID_INPUT;
+
+        cryptos[i]->decrypt(buffer, 0);
+        if (buffer[0x1FE] != 0x55 || buffer[0x1FF] != 0xAA)
+            return ERR_DECRYPT_CONTENT;
+    }
+
+    // Lock volume (drive only)
+    if (isDrive())
+        nxHandle->lockVolume();
+
+    nxHandle->initHandle(NO_CRYPTO);
+
+    // Init progress info
+    ProgressInfo pi;
+    pi.mode = RESTORE;
+    pi.storage_name = std::string(getNxTypeAsStr(archive->type()));
+    pi.begin_time = std::chrono::system_clock::now();
+    pi.bytesCount = 0;
+    pi.bytesTotal = size();
+    updateProgress(&pi);
+
+    int rc = SUCCESS;
+    for (size_t i(0); i < regions.size() && rc == SUCCESS; i++)
+    {
+        NxArchiveRegion &region = regions[i];
+        if (!archive->seekRegion(region, &map))
+        {
+            rc = ERR_INVALID_INPUT;
+            break;
+        }
+
+        u64 offset = 0;
+        while (offset < region.size)
+        {
+            if (stopWork)
+            {
+                rc = ERR_USER_ABORT;
+                break;
+            }
+
+            // Next run of stored (or free) clusters
+            DWORD length = (DWORD)std::min((u64)DEFAULT_BUFF_SIZE, region.size - offset);
+            bool stored = true;
+            if (!map.empty())
+            {
+                size_t first = offset / CLUSTER_SIZE, last = first;
+                stored = map[first];
+                while (last < map.size() && map[last] == stored && (last - first) * CLUSTER_SIZE < DEFAULT_BUFF_SIZE)
+                    last++;
+                length = (DWORD)std::min((u64)(last - first) * CLUSTER_SIZE, region.size - offset);
+            }
+
+            if (stored && !archive->read(buffer, length))
+            {
+                rc = ERR_INVALID_INPUT;
+                break;
+            }
+            else if (!stored)
+            {
+                // Regenerate free clusters
+                memset(buffer, 0, length);
+                if (nullptr != cryptos[i])
+                    cryptos[i]->encrypt(buffer, offset / CLUSTER_SIZE, (length + CLUSTER_SIZE - 1) / CLUSTER_SIZE);
+            }
+
+            DWORD bytesWrite = 0;
+            if (!nxHandle->write(region.offset + offset, buffer, &bytesWrite, length) || bytesWrite != length)
+            {
+                rc = ERR_WHILE_WRITE;
+                break;
+            }
+
+            offset += length;
+            pi.bytesCount += length;
+            updateProgress(&pi);
+        }
+    }
+
+    // Partitions were overwritten, FAT is loaded again when needed
+    for (NxPartition *part : partitions)
+        part->fat32_invalidate();
+
+    // Unlock volume
+    if (isDrive())
+        nxHandle->unlockVolume();
+
+    if (rc == ERR_USER_ABORT)
+        return userAbort();
+
+    return rc;
+}
+
+std::shared_ptr<NxCrypto> NxStorage::bisCrypto(int bis_key)
+{
+    switch (bis_key) {
+    case 0: return std::make_shared<NxCrypto>(keys.crypt0, keys.tweak0);
+    case 1: return std::make_shared<NxCrypto>(keys.crypt1, keys.tweak1);
+    case 2: return std::make_shared<NxCrypto>(keys.crypt2, keys.tweak2);
+    default: return std::make_shared<NxCrypto>(keys.crypt3, keys.tweak3);
+    }
+}
+
+int NxStorage::dumpToChunks(const char *file, void(&updateProgress)(ProgressInfo*))
+{
+    if (type == INVALID || type == UNKNOWN)
+        return ERR_INVALID_INPUT;
+
+    // Test if file already exists
+    std::ifstream infile(file);
+    if (infile.good())
+    {
+        infile.close();
+        return ERR_FILE_ALREADY_EXISTS;
+    }
+
+    // Chunks repository is shared by all indexes in the same directory
+    std::string repository = NxChunkIndex::repository(file);
+    if (!NxChunkWriter::createRepository(repository))
+        return ERR_OUTPUT_HANDLE;
+
+    // Regions : partitions (ordered by offset) & areas between them
+    std::vector<NxChunkRegion> regions;
+    std::vector<NxPartition*> region_parts;
+    BYTE *buffer = (BYTE*)malloc_aligned(DEFAULT_BUFF_SIZE);
+    if (nullptr == buffer)
+        return ERR_WHILE_COPY;
+    std::unique_ptr<BYTE, void(*)(void*)> buffer_guard(buffer, free_aligned);
+
+    auto addRegion = [&](NxPartition *part, u64 offset, u64 length) {
+        NxChunkRegion region;
+        memset(&region, 0, sizeof(NxChunkRegion));
+        region.offset = offset;
+        region.size = length;
+        region.bis_key = NXC_PLAIN;
+        if (nullptr != part)
+        {
+            strncpy(region.name, part->partitionName().c_str(), sizeof(region.name) - 1);
+            // Encrypted partitions are stored decrypted (if keys are set), raw cluster is kept to validate keys on restore
+            DWORD bytesRead = 0;
+            if (part->isEncryptedPartition() && nullptr != part->crypto() && !part->badCrypto())
+            {
+                nxHandle->initHandle(NO_CRYPTO, part);
+                if (nxHandle->read(buffer, &bytesRead, CLUSTER_SIZE) && bytesRead == CLUSTER_SIZE)
+                {
+                    NxChunkIndex::sha256(buffer, CLUSTER_SIZE, region.check);
+                    region.bis_key = is_in(part->type(), { PRODINFO, PRODINFOF }) ? 0 : part->type() == SAFE ? 1 : 2;
+                }
+            }
+        }
+        regions.push_back(region);
+        region_parts.push_back(part);
+    };
+
+    // RAWMMC : BOOT0 & BOOT1 (raw), GPT partitions start at user area (0x4000 sectors)
+    if (is_in(type, { RAWNAND, RAWMMC }) || isSinglePartType())
+    {
+        std::vector<NxPartition*> parts(partitions);
+        std::sort(parts.begin(), parts.end(), [](NxPartition *a, NxPartition *b) { return a->lbaStart() < b->lbaStart(); });
+        u64 offset = 0;
+        for (NxPartition *part : parts)
+        {
+            u64 part_offset = (u64)part->lbaStart() * NX_BLOCKSIZE;
+            if (part_offset < offset)
+                return ERR_INVALID_INPUT;
+            if (part_offset > offset)
+                addRegion(nullptr, offset, part_offset - offset);
+            addRegion(part, part_offset, part->size());
+            offset = part_offset + part->size();
+        }
+        if (offset < size())
+            addRegion(nullptr, offset, size() - offset);
+    }
+    else addRegion(nullptr, 0, size());
+
+    // Lock volume (drive only)
+    if (isDrive())
+        nxHandle->lockVolume();
+
+    // Init progress info
+    ProgressInfo pi;
+    pi.mode = COPY;
+    pi.storage_name = std::string(getNxTypeAsStr());
+    pi.begin_time = std::chrono::system_clock::now();
+    pi.bytesCount = 0;
+    pi.bytesTotal = size();
+    updateProgress(&pi);
+
+    // Chunks are hashed & stored by writer's workers while input is read
+    NxChunkWriter writer(repository);
+    int rc = SUCCESS;
+    for (size_t i(0); i < regions.size() && rc == SUCCESS; i++)
+    {
+        NxChunkRegion &region = regions[i];
+        u64 bytesCount = pi.bytesCount;
+
+        // Copy area between partitions (GPT...) or whole storage
+        if (nullptr == region_parts[i])
+        {
+            nxHandle->initHandle(NO_CRYPTO);
+            for (u64 off = 0; off < region.size && rc == SUCCESS; off += DEFAULT_BUFF_SIZE)
+            {
+                if (stopWork)
+                    rc = ERR_USER_ABORT;
+                DWORD bytesRead = 0, length = (DWORD)std::min((u64)DEFAULT_BUFF_SIZE, region.size - off);
+                if (rc == SUCCESS && (!nxHandle->read(region.offset + off, buffer, &bytesRead, length) || bytesRead != length))
+                    rc = ERR_WHILE_COPY;
+                else if (rc == SUCCESS && !writer.write(buffer, length))
+                    rc = ERR_WHILE_WRITE;
+                pi.bytesCount += bytesRead;
+                updateProgress(&pi);
+            }
+        }
+        // Copy partition (decrypted if possible)
+        else
+        {
+            nxHandle->initHandle(region.bis_key == NXC_PLAIN ? NO_CRYPTO : DECRYPT, region_parts[i]);
+            NxPipeline pipeline(nxHandle);
+            rc = pipeline.run([&](u8 *buffer, DWORD length, DWORD *bytesWrite) {
+                *bytesWrite = length;
+                return writer.write(buffer, length);
+            }, &pi, &updateProgress, &stopWork);
+        }
+
+        // Regions never share a chunk
+        if (rc == SUCCESS && !writer.flush())
+            rc = ERR_WHILE_WRITE;
+        if (rc == SUCCESS && pi.bytesCount != bytesCount + region.size)
+            rc = ERR_WHILE_COPY;
+    }
+
+    // Wait for workers & write index
+    if (!writer.close() && rc == SUCCESS)
+        rc = ERR_WHILE_WRITE;
+
+    NxChunkHeader header;
+    memset(&header, 0, sizeof(NxChunkHeader));
+    memcpy(header.magic, NXC_MAGIC, 4);
+    header.version = NXC_VERSION;
+    header.size = size();
+    header.type = (u32)type;
+    header.region_count = (u32)regions.size();
+    header.chunk_size = NXC_CHUNK_SIZE;
+    if (rc == SUCCESS && !NxChunkIndex::write(file, &header, regions, writer.hashes()))
+        rc = ERR_WHILE_WRITE;
+
+    dbg_printf("NxStorage::dumpToChunks() %I64d chunks, %I64d new chunks stored\n", writer.chunkCount(), writer.storedCount());
+
+    // Unlock volume
+    if (isDrive())
+        nxHandle->unlockVolume();
+
+    if (rc == ERR_USER_ABORT)
+        return userAbort();
+
+    return rc;
+}
+
+int NxStorage::restoreFromChunks(NxChunkIndex *index, void(&updateProgress)(ProgressInfo*))
+{
+    if (!index->isValid())
+        return ERR_INVALID_INPUT;
+
+    if (index->size() != size())
+        return ERR_IO_MISMATCH;
+
+    if (isNxStorage() && type != index->type())
+        return ERR_NX_TYPE_MISSMATCH;
+
+    // Buffer holds several chunks
+    u32 chunk_size = index->chunkSize();
+    size_t batch = std::max((size_t)1, (size_t)(DEFAULT_BUFF_SIZE / chunk_size));
+    BYTE *buffer = (BYTE*)malloc_aligned(batch * chunk_size);
+    if (nullptr == buffer)
+        return ERR_WHILE_COPY;
+    std::unique_ptr<BYTE, void(*)(void*)> buffer_guard(buffer, free_aligned);
+
+    // Crypto used to encrypt decrypted regions back (validated with stored cluster hash)
+    std::vector<NxChunkRegion> &regions = index->regions();
+    std::vector<std::shared_ptr<NxCrypto>> cryptos(regions.size());
+    for (size_t i(0); i < regions.size(); i++)
+    {
+        NxChunkRegion &region = regions[i];
+        if (region.bis_key == NXC_PLAIN)
+            continue;
+
+        if (!m_keySet_set)
+            return ERR_CRYPTO_KEY_MISSING;
+
+        DWORD length;
+        if (!index->readChunk(i, 0, buffer, &length) || length < CLUSTER_SIZE)
+            return ERR_MISSING_CHUNK;
+
+        u8 check[NXC_HASH_SIZE];
+        cryptos[i] = bisCrypto(region.bis_key);
+        cryptos[i]->encrypt(buffer, 0);
+        NxChunkIndex::sha256(buffer, CLUSTER_SIZE, check);
+        if (memcmp(check, region.check, NXC_HASH_SIZE))
+            return ERR_DECRYPT_CONTENT;
+    }
+
+    // Lock volume (drive only)
+    if (isDrive())
+        nxHandle->lockVolume();
+
+    nxHandle->initHandle(NO_CRYPTO);
+
+    // Init progress info
+    ProgressInfo pi;
+    pi.mode = RESTORE;
+    pi.storage_name = std::string(getNxTypeAsStr(index->type()));
+    pi.begin_time = std::chrono::system_clock::now();
+    pi.bytesCount = 0;
+    pi.bytesTotal = size();
+    updateProgress(&pi);
+
+    int rc = SUCCESS;
+    for (size_t i(0); i < regions.size() && rc == SUCCESS; i++)
+    {
+        NxChunkRegion &region = regions[i];
+        size_t chunk_count = (size_t)((region.size + chunk_size - 1) / chunk_size);
+        for (size_t n(0); n < chunk_count && rc == SUCCESS; n += batch)
+        {
+            if (stopWork)
+            {
+                rc = ERR_USER_ABORT;
+                break;
+            }
+
+            // Read (and verify) next chunks
+            DWORD length = 0;
+            for (size_t c(n); c < std::min(chunk_count, n + batch); c++)
+            {
+                DWORD chunk_length;
+                if (!index->readChunk(i, c, buffer + length, &chunk_length))
+                {
+                    rc = ERR_MISSING_CHUNK;
+                    break;
+                }
+                length += chunk_length;
+            }
+            if (rc != SUCCESS)
+                break;
+
+            u64 offset = (u64)n * chunk_size;
+            if (nullptr != cryptos[i])
+                cryptos[i]->encrypt(buffer, offset / CLUSTER_SIZE, (length + CLUSTER_SIZE - 1) / CLUSTER_SIZE);
+
+            DWORD bytesWrite = 0;
+            if (!nxHandle->write(region.offset + offset, buffer, &bytesWrite, length) || bytesWrite != length)
+            {
+                rc = ERR_WHILE_WRITE;
+                break;
+            }
+
+            pi.bytesCount += length;
+            updateProgress(&pi);
+        }
+    }
+
+    // Partitions were overwritten, FAT is loaded again when needed
+    for (NxPartition *part : partitions)
+        part->fat32_invalidate();
+
+    // Unlock volume
+    if (isDrive())
+        nxHandle->unlockVolume();
+
+    if (rc == ERR_USER_ABORT)
+        return userAbort();
+
+    return rc;
+}
+
+int NxStorage::dumpToDelta(const char *file, const char *base_path, int crypto_mode, void(&updateProgress)(ProgressInfo*))
+{
+    // Crypto check
+    if (crypto_mode == DECRYPT || crypto_mode == ENCRYPT)
+        return ERR_CRYPTO_RAW_COPY;
+
+    // Output is always verified with a full re-read (through the chain)
+    if (crypto_mode == MD5_HASH_FULL)
+        crypto_mode = MD5_HASH;
+
+    if (type == INVALID || type == UNKNOWN)
+        return ERR_INVALID_INPUT;
+
+    // Test if file already exists
+    std::ifstream infile(file);
+    if (infile.good())
+    {
+        infile.close();
+        return ERR_FILE_ALREADY_EXISTS;
+    }
+
+    // Base must be a dump of the same storage
+    NxStorage base(base_path);
+    if (!base.isNxStorage())
+        return ERR_INVALID_BASE;
+    if (base.type != type)
+        return ERR_NX_TYPE_MISSMATCH;
+    if (base.size() != size())
+        return ERR_IO_MISMATCH;
+
+    // Incremental base : blocks are compared with base hashes, otherwise base is read along
+    NxDeltaReader *base_delta = base.nxHandle->deltaReader();
+    if (nullptr != base_delta && base_delta->blockSize() != NXD_BLOCK_SIZE)
+        base_delta = nullptr;
+    BYTE *base_buffer = nullptr;
+    if (nullptr == base_delta && nullptr == (base_buffer = (BYTE*)malloc_aligned(DEFAULT_BUFF_SIZE)))
+        return ERR_WHILE_COPY;
+    std::unique_ptr<BYTE, void(*)(void*)> buffer_guard(base_buffer, free_aligned);
+    base.nxHandle->initHandle(NO_CRYPTO);
+
+    // Base in output directory is referenced by name (chain can be moved)
+    std::string base_ref(base_path), out_path(file);
+    size_t sep = out_path.find_last_of("\\/"), base_sep = base_ref.find_last_of("\\/");
+    std::string out_dir = sep == std::string::npos ? "" : out_path.substr(0, sep + 1);
+    if (out_dir == (base_sep == std::string::npos ? "" : base_ref.substr(0, base_sep + 1)))
+        base_ref = base_ref.substr(out_dir.length());
+
+    NxDeltaWriter writer(file, base_ref.c_str(), size(), type);
+    if (!writer.isOpen())
+        return ERR_OUTPUT_HANDLE;
+
+    // Lock volume (drive only)
+    if (isDrive())
+        nxHandle->lockVolume();
+
+    // Init input handle
+    nxHandle->initHandle(crypto_mode);
+
+    // Init progress info
+    ProgressInfo pi;
+    pi.mode = COPY;
+    pi.storage_name = std::string(getNxTypeAsStr());
+    pi.begin_time = std::chrono::system_clock::now();
+    pi.bytesCount = 0;
+    pi.bytesTotal = size();
+    updateProgress(&pi);
+
+    // Blocks are hashed & compared as they are read, only changed blocks are written
+    u64 offset = 0;
+    NxPipeline pipeline(nxHandle);
+    int rc = pipeline.run([&](u8 *buffer, DWORD length, DWORD *bytesWrite) {
+        *bytesWrite = length;
+        DWORD bytesRead = 0;
+        if (nullptr == base_delta && (!base.nxHandle->read(offset, base_buffer, &bytesRead, length) || bytesRead != length))
+            return false;
+
+        u8 hash[NXD_HASH_SIZE];
+        for (DWORD off = 0; off < length; off += NXD_BLOCK_SIZE)
+        {
+            DWORD len = std::min((DWORD)NXD_BLOCK_SIZE, length - off);
+            NxDeltaWriter::hash(buffer + off, len, hash);
+            bool changed = nullptr != base_delta ? memcmp(hash, base_delta->blockHash((offset + off) / NXD_BLOCK_SIZE), NXD_HASH_SIZE) != 0
+                                                 : memcmp(buffer + off, base_buffer + off, len) != 0;
+            if (!writer.addBlock(buffer + off, len, hash, changed))
+                return false;
+        }
+        offset += length;
+        return true;
+    }, &pi, &updateProgress, &stopWork);
+
+    // Write changed map & block hashes
+    if (rc == SUCCESS && !writer.close())
+        rc = ERR_WHILE_WRITE;
+    dbg_printf("NxStorage::dumpToDelta() %I64d changed blocks\n", writer.changedCount());
+
+    // Unlock volume
+    if (isDrive())
+        nxHandle->unlockVolume();
+
+    if (rc == ERR_USER_ABORT)
+        return userAbort();
+
+    if (rc != SUCCESS)
+        return rc;
+
+    // Check completeness
+    if (pi.bytesCount != pi.bytesTotal)
+        return ERR_WHILE_COPY;
+
+    // Rebuild full image from chain & compare checksums
+    if (crypto_mode == MD5_HASH)
+        return verifyDump(file, nxHandle->hasher()->checksum(), &pi, updateProgress);
+
+    return SUCCESS;
+}
+
+std::unique_ptr<NxStorage> NxStorage::reopen()
+{
+    char path[MAX_PATH] = { 0 };
+    std::wcstombs(path, m_path, MAX_PATH - 1);
+    std::unique_ptr<NxStorage> storage(new NxStorage(path));
+    if (storage->type != type || storage->size() != size())
+        storage.reset();
+    return storage;
+}
+
+int NxStorage::verifyManifest(NxManifest *manifest, const char *partition, std::vector<NxManifestPart> *damaged, void(&updateProgress)(ProgressInfo*))
+{
+    if (!manifest->isValid())
+        return ERR_INVALID_MANIFEST;
+
+    if (manifest->size() != size())
+        return ERR_IO_MISMATCH;
+
+    // Only blocks covering partition are checked
+    u64 begin = 0, end = size();
+    if (nullptr != partition)
+    {
+        NxManifestPart *part = manifest->getPart(partition);
+        if (nullptr == part || part->offset + part->size > size())
+            return ERR_IN_PART_NOT_FOUND;
+        begin = part->offset;
+        end = part->offset + part->size;
+    }
+    u64 block_size = manifest->blockSize();
+    u64 first = begin / block_size, last = (end + block_size - 1) / block_size;
+
+    nxHandle->initHandle(NO_CRYPTO);
+
+    // Init progress info
+    ProgressInfo pi;
+    pi.mode = MD5_HASH;
+    pi.storage_name = nullptr != partition ? std::string(partition) : std::string(getNxTypeAsStr());
+    pi.begin_time = std::chrono::system_clock::now();
+    pi.bytesCount = 0;
+    pi.bytesTotal = std::min(last * block_size, size()) - first * block_size;
+    updateProgress(&pi);
+
+    // Blocks are read in order & hashed by verifier workers
+    NxManifestVerifier verifier(manifest);
+    for (u64 block = first; block < last; block++)
+    {
+        if (stopWork)
+            return userAbort();
+
+        u64 offset = block * block_size;
+        DWORD length = (DWORD)std::min(block_size, size() - offset), bytesRead = 0;
+        std::vector<u8> data(length);
+        if (!nxHandle->read(offset, &data[0], &bytesRead, length) || bytesRead != length)
+            return ERR_WHILE_COPY;
+
+        verifier.submit(block, data);
+        pi.bytesCount += length;
+        updateProgress(&pi);
+    }
+
+    // Damaged blocks => ranges
+    for (u64 block : verifier.close())
+    {
+        u64 offset = block * block_size, length = std::min(block_size, size() - offset);
+        if (!damaged->empty() && damaged->back().offset + damaged->back().size == offset)
+            damaged->back().size += length;
+        else
+        {
+            NxManifestPart range;
+            range.offset = offset;
+            range.size = length;
+            damaged->push_back(range);
+        }
+    }
+
+    // Name ranges after partitions they overlap
+    for (NxManifestPart &range : *damaged)
+        for (NxManifestPart &part : manifest->parts())
+            if (part.offset < range.offset + range.size && range.offset < part.offset + part.size)
+                range.name += (range.name.empty() ? "" : ", ") + part.name;
+
+    return damaged->empty() ? SUCCESS : ERR_MD5_COMPARE;
+}
+
 int NxStorage::resizeUser(const char *file, u32 new_size, u64 *bytesCount, u64 *bytesToRead, bool format)
 {
     DWORD bytesRead = 0;
@@ -972,7 +1998,7 @@ int NxStorage::resizeUser(const char *file, u32 new_size, u64 *bytesCount, u64 *
 
         u32 new_fat_size = new_size / 0x1000;
         u32 new_total_size = new_fat_size + new_size + 32; // 32 sectors (1 cluster) reserved
-        u32 user_min_size = format ? (u32) 64 * 1024 / NX_BLOCKSIZE : (u32)((user->size() - user->freeSpace) / 0x200);
+        u32 user_min_size = format ? (u32) 64 * 1024 / NX_BLOCKSIZE : (u32)((user->size() - user->freeSpace()) / 0x200);
 
         // Adjust new_size if too small
         if (new_total_size < user_min_size)
@@ -998,7 +2024,7 @@ int NxStorage::resizeUser(const char *file, u32 new_size, u64 *bytesCount, u64 *
         // Set copy vars
         m_gpt_lba_start = type == RAWMMC ? 0x4000 : 0;
         m_user_lba_start = user->lbaStart();
-        m_user_lba_end = user->lbaEnd() - (u32)(user->freeSpace / NX_BLOCKSIZE + NX_BLOCKSIZE);
+        m_user_lba_end = user->lbaEnd() - (u32)(user->freeSpace() / NX_BLOCKSIZE + NX_BLOCKSIZE);
 
         // Init input handle & buffer
         if (isDrive() && !nxHandle->lockVolume())
@@ -1257,11 +2283,14 @@ int NxStorage::resizeUser(const char *file, u32 new_size, u64 *bytesCount, u64 *
     return ERR_WHILE_COPY;
 }
 
-const char* NxStorage::getNxTypeAsStr()
+const char* NxStorage::getNxTypeAsStr(int n_type)
 {
+    if (!n_type)
+        n_type = type;
+
     for (NxStorageType t : NxTypesArr)
     {
-        if (type == t.type)
+        if (n_type == t.type)
             return t.name;
     }
     return "UNKNOWN";
@@ -1591,28 +2620,18 @@ int NxStorage::createMmcEmuNand(NxStorage* mmc, const char* mmc_drive, void(&upd
     this->nxHandle->initHandle(NO_CRYPTO);
     if (isDrive())
         nxHandle->lockVolume();
-    // Set new buffer
-    int buff_size = nxHandle->getDefaultBuffSize();
-    BYTE* cpy_buffer = new BYTE[buff_size];
-    memset(cpy_buffer, 0, buff_size);
-    bytesRead = 0;
-    DWORD bytesWrite = 0;
-    // Copy
-    while(this->nxHandle->read(cpy_buffer, &bytesRead, buff_size))
-    {
-        if(stopWork) return userAbort();
-
-        if (!mmc->nxHandle->write(cpy_buffer, &bytesWrite, bytesRead))
-            break;
-
-        pi.bytesCount += bytesWrite;
-        updateProgress(&pi);
-    }
+    // Copy (overlapped read/write)
+    NxPipeline pipeline(this->nxHandle);
+    int rc = pipeline.run([&](u8 *cpy_buffer, DWORD length, DWORD *bytesWrite) {
+        return mmc->nxHandle->write(cpy_buffer, bytesWrite, length);
+    }, &pi, &updateProgress, &stopWork);
 
-    delete[] cpy_buffer;
     if (isDrive())
         nxHandle->unlockVolume();
 
+    if (rc == ERR_USER_ABORT)
+        return userAbort();
+
     // Check completeness
     if (pi.bytesCount != pi.bytesTotal)
         return ERR_WHILE_COPY;
@@ -1716,6 +2735,7 @@ int NxStorage::createMmcEmuNand(NxStorage* mmc, const char* mmc_drive, void(&upd
     }
     free(buff);
 
+#if defined(_WIN32)
     TCHAR Buf[MAX_PATH];
     TCHAR Drive[] = TEXT("d:\\");
     TCHAR Volume[] = TEXT("");
@@ -1793,6 +2813,7 @@ int NxStorage::createMmcEmuNand(NxStorage* mmc, const char* mmc_drive, void(&upd
         if (!fResult)
             dbg_printf("SetVolumeMountPoint failed %s\n", GetLastErrorAsString().c_str());
     }
+#endif
 
     mmc->nxHandle->unlockVolume();
     return SUCCESS;
@@ -1878,30 +2899,6 @@ int NxStorage::fwv_cmp(firmware_version_t fwv1, firmware_version_t fwv2)
     return 0;
 }
 
-std::string BuildChecksum(HCRYPTHASH hHash)
-{
-    std::string md5hash;
-    DWORD cbHash = 16;
-    BYTE rgbHash[16];
-    CHAR rgbDigits[] = "0123456789abcdef";
-    if (CryptGetHashParam(hHash, HP_HASHVAL, rgbHash, &cbHash, 0))
-    {
-        char* buf;
-        size_t sz;
-        for (DWORD i = 0; i < cbHash; i++)
-        {
-            sz = snprintf(NULL, 0, "%c%c", rgbDigits[rgbHash[i] >> 4], rgbDigits[rgbHash[i] & 0xf]);
-            buf = (char*)malloc(sz + 1);
-            snprintf(buf, sz + 1, "%c%c", rgbDigits[rgbHash[i] >> 4], rgbDigits[rgbHash[i] & 0xf]);
-            md5hash.append(buf);
-        }
-        CryptDestroyHash(hHash);
-        return md5hash;
-    }
-    CryptDestroyHash(hHash);
-    return "";
-}
-
 std::string ListPhysicalDrives()
 {
     int num_drive = 0;
@@ -1910,7 +2907,14 @@ std::string ListPhysicalDrives()
     for (int drive = 0; drive < 16; drive++)
     {
         char driveName[256];
+#if defined(_WIN32)
         sprintf_s(driveName, 256, "\\\\.\\PhysicalDrive%d", drive);
+#else
+        // Removable drives (SD card via USB reader, hekate UMS)
+        sprintf_s(driveName, 256, "/dev/sd%c", 'a' + drive);
+        if (access(driveName, F_OK))
+            continue;
+#endif
 
         NxStorage storage = NxStorage(driveName);        
         //printf("Drive %s is type %s\n", driveName, storage.getNxTypeAsStr());
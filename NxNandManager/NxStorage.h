@@ -27,6 +27,16 @@ extern bool isdebug;
 #include "NxHandle.h"
 #include "NxPartition.h"
 #include "NxCrypto.h"
+#include "NxPipeline.h"
+#include "NxHash.h"
+#include "NxArchive.h"
+#include "NxZFile.h"
+#include "NxChunkStore.h"
+#include "NxSplitWriter.h"
+#include "NxManifest.h"
+#include "NxJournal.h"
+#include "NxFile.h"
+#include "NxExtractor.h"
 
 typedef struct MagicOffsets MagicOffsets;
 struct MagicOffsets {
@@ -248,6 +258,14 @@ class NxStorage
         bool b_isSplitted = false;
         bool m_keySet_set = false;
         u64 m_freeSpace = 0;
+        int m_hash_algo = HASH_MD5;
+        bool b_sparse = false;
+        bool b_compress = false;
+        u64 m_split_size = 0;
+        bool b_manifest = false;
+        bool b_delta_restore = false;
+        u64 m_journal_interval = 0;
+        bool b_resume = false;
 
         // Specific vars to handle copy        
         std::ofstream *p_ofstream;
@@ -262,6 +280,7 @@ class NxStorage
 
         // Private member functions
         void setStorageInfo(int partition = 0);
+        std::shared_ptr<NxCrypto> bisCrypto(int bis_key);
 
     public:
         // Public member variables
@@ -296,10 +315,29 @@ class NxStorage
         bool badCrypto();
         bool isNxStorage();
         bool partitionExists(const char* partition_name);
+        int hashAlgorithm() { return m_hash_algo; };
+        bool sparseOutput() { return b_sparse; };
+        bool compressOutput() { return b_compress; };
+        u64 splitSize() { return m_split_size; };
+        bool manifestOutput() { return b_manifest; };
+        bool deltaRestore() { return b_delta_restore; };
+        u64 journalInterval() { return m_journal_interval; };
+        bool resumeJournal() { return b_resume; };
+
+        // Setters
+        void setHashAlgorithm(int algorithm) { m_hash_algo = algorithm; };
+        void setSparseOutput(bool b) { b_sparse = b; };
+        void setCompressOutput(bool b) { b_compress = b; };
+        void setSplitSize(u64 split_size) { m_split_size = split_size; };
+        void setManifestOutput(bool b) { b_manifest = b; };
+        void setDeltaRestore(bool b) { b_delta_restore = b; };
+        // Checkpoint journal every interval bytes (dump/restore), resume from journal
+        void setJournalInterval(u64 interval) { m_journal_interval = interval; };
+        void setResumeJournal(bool b) { b_resume = b; };
 
         // Public methods                
         int setKeys(const char* keyset_path);
-        const char* getNxTypeAsStr();
+        const char* getNxTypeAsStr(int n_type = 0);
         NxPartition* getNxPartition();
         NxPartition* getNxPartition(int part_type);
         NxPartition* getNxPartition(const char* part_name);
@@ -307,6 +345,16 @@ class NxStorage
         bool isSinglePartType(int type = 0);
         int dumpToFile(const char *file, int crypt_mode, void(&updateProgress)(ProgressInfo*), bool rawnand_only = false);
         int restoreFromStorage(NxStorage* input, int crypto_mode, void(&updateProgress)(ProgressInfo*));
+        // Re-read dump (all parts) & compare checksum with input's (stop is polled, own stopWork if nullptr)
+        int verifyDump(const char *file, const std::string &in_sum, ProgressInfo *pi, void(*updateProgress)(ProgressInfo*), bool *stop = nullptr);
+        int dumpToArchive(const char *file, void(&updateProgress)(ProgressInfo*));
+        int restoreFromArchive(NxArchive *archive, void(&updateProgress)(ProgressInfo*));
+        int dumpToChunks(const char *file, void(&updateProgress)(ProgressInfo*));
+        int restoreFromChunks(NxChunkIndex *index, void(&updateProgress)(ProgressInfo*));
+        int dumpToDelta(const char *file, const char *base_path, int crypto_mode, void(&updateProgress)(ProgressInfo*));
+        int verifyManifest(NxManifest *manifest, const char *partition, std::vector<NxManifestPart> *damaged, void(&updateProgress)(ProgressInfo*));
+        // New storage for the same path (own handle), nullptr if not the same storage
+        std::unique_ptr<NxStorage> reopen();
         int resizeUser(const char *file, u32 new_size, u64 *bytesCount, u64 *bytesToRead, bool format = false);
         bool setAutoRcm(bool enable);
         int applyIncognito();
@@ -318,7 +366,6 @@ class NxStorage
         int userAbort(){stopWork = false; return ERR_USER_ABORT;}
 };
 
-std::string BuildChecksum(HCRYPTHASH hHash);
 std::string ListPhysicalDrives();
 
 #endif
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <zlib.h>
+#include "NxZFile.h"
+
+NxZWriter::NxZWriter(const char *file)
+{
+    memset(&m_header, 0, sizeof(NxZHeader));
+    m_header.frame_size = NXZ_FRAME_SIZE;
+
+    // Header is written on close, an incomplete container is never valid
+    m_file.open(file, std::ofstream::binary);
+    if (!m_file.is_open() || !m_file.write((char *)&m_header, sizeof(NxZHeader)))
+    {
+        b_error = true;
+        return;
+    }
+    m_frame.reserve(NXZ_FRAME_SIZE);
+
+    // One worker per core, two frames in flight per worker
+    unsigned int workers = std::thread::hardware_concurrency();
+    if (!workers)
+        workers = 1;
+    m_max_jobs = workers * 2;
+
+    for (unsigned int i(0); i < workers; i++)
+        m_workers.push_back(std::thread(&NxZWriter::workerLoop, this));
+}
+
+NxZWriter::~NxZWriter()
+{
+    stop();
+    for (NxZJob *job : m_jobs)
+        delete job;
+}
+
+void NxZWriter::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        b_stop = true;
+    }
+    m_cv.notify_all();
+
+    for (std::thread &worker : m_workers)
+        if (worker.joinable())
+            worker.join();
+}
+
+void NxZWriter::workerLoop()
+{
+    for (;;)
+    {
+        NxZJob *job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] { return b_stop || !m_pending.empty(); });
+            if (b_stop)
+                break;
+            job = m_pending.front();
+            m_pending.pop_front();
+        }
+
+        // Frames that don't shrink are stored as is
+        uLongf length = compressBound((uLong)job->in.size());
+        job->out.resize(length);
+        if (compress2(&job->out[0], &length, &job->in[0], (uLong)job->in.size(), NXZ_LEVEL) == Z_OK
+            && length < job->in.size())
+            job->out.resize(length);
+        else
+        {
+            job->out.swap(job->in);
+            job->flags = NXZ_STORED;
+        }
+        std::vector<u8>().swap(job->in);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            job->done = true;
+        }
+        m_cv.notify_all();
+    }
+}
+
+bool NxZWriter::write(const u8 *buffer, DWORD length)
+{
+    while (length && !b_error)
+    {
+        DWORD chunk = std::min(length, (DWORD)(NXZ_FRAME_SIZE - m_frame.size()));
+        m_frame.insert(m_frame.end(), buffer, buffer + chunk);
+        m_header.size += chunk;
+        buffer += chunk;
+        length -= chunk;
+
+        if (m_frame.size() == NXZ_FRAME_SIZE)
+            submit();
+    }
+    return !b_error;
+}
+
+void NxZWriter::submit()
+{
+    NxZJob *job = new NxZJob;
+    job->in.swap(m_frame);
+    m_frame.reserve(NXZ_FRAME_SIZE);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.push_back(job);
+        m_jobs.push_back(job);
+    }
+    m_cv.notify_all();
+    flushJobs(false);
+}
+
+bool NxZWriter::flushJobs(bool wait_all)
+{
+    for (;;)
+    {
+        NxZJob *job;
+        {
+            // Write completed frames in order, wait for the oldest one if too many are in flight
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_jobs.empty())
+                break;
+            job = m_jobs.front();
+            if (!job->done && !wait_all && m_jobs.size() <= m_max_jobs)
+                break;
+            m_cv.wait(lock, [job] { return job->done; });
+            m_jobs.pop_front();
+        }
+
+        NxZFrame frame;
+        frame.offset = sizeof(NxZHeader);
+        if (!m_table.empty())
+            frame.offset = m_table.back().offset + m_table.back().length;
+        frame.length = (u32)job->out.size();
+        frame.flags = job->flags;
+        m_table.push_back(frame);
+
+        if (!m_file.write((char *)&job->out[0], job->out.size()))
+            b_error = true;
+        delete job;
+    }
+    return !b_error;
+}
+
+bool NxZWriter::close()
+{
+    if (!m_file.is_open())
+        return false;
+
+    if (!m_frame.empty())
+        submit();
+    flushJobs(true);
+    stop();
+
+    // Seek table & header
+    m_header.frame_count = (u32)m_table.size();
+    m_header.table_offset = sizeof(NxZHeader);
+    if (!m_table.empty())
+        m_header.table_offset = m_table.back().offset + m_table.back().length;
+    memcpy(m_header.magic, NXZ_MAGIC, 4);
+    m_header.version = NXZ_VERSION;
+
+    if (!b_error && ((!m_table.empty() && !m_file.write((char *)&m_table[0], sizeof(NxZFrame) * m_table.size()))
+        || !m_file.seekp(0) || !m_file.write((char *)&m_header, sizeof(NxZHeader))))
+        b_error = true;
+
+    m_file.close();
+    return !b_error;
+}
+
+NxZReader::NxZReader(NxZRawReader raw_read)
+{
+    m_raw_read = raw_read;
+    memset(&m_header, 0, sizeof(NxZHeader));
+
+    if (!m_raw_read(0, &m_header, sizeof(NxZHeader)) || memcmp(m_header.magic, NXZ_MAGIC, 4)
+        || m_header.version != NXZ_VERSION || !m_header.frame_size
+        || m_header.frame_count != (m_header.size + m_header.frame_size - 1) / m_header.frame_size)
+        return;
+
+    // Seek table
+    m_table.resize(m_header.frame_count);
+    if (m_header.frame_count && !m_raw_read(m_header.table_offset, &m_table[0], sizeof(NxZFrame) * m_header.frame_count))
+        return;
+
+    for (NxZFrame &frame : m_table)
+        if (frame.length > compressBound(m_header.frame_size))
+            return;
+
+    b_valid = true;
+}
+
+bool NxZReader::loadFrame(u32 index)
+{
+    if (b_cached && m_cache_index == index)
+        return true;
+
+    b_cached = false;
+    NxZFrame &frame = m_table[index];
+    u32 size = (u32)std::min((u64)m_header.frame_size, m_header.size - (u64)index * m_header.frame_size);
+
+    if (frame.flags & NXZ_STORED)
+    {
+        m_cache.resize(size);
+        if (frame.length != size || !m_raw_read(frame.offset, &m_cache[0], size))
+            return false;
+    }
+    else
+    {
+        m_compressed.resize(frame.length);
+        m_cache.resize(size);
+        uLongf length = size;
+        if (!frame.length || !m_raw_read(frame.offset, &m_compressed[0], frame.length)
+            || uncompress(&m_cache[0], &length, &m_compressed[0], frame.length) != Z_OK || length != size)
+        {
+            dbg_printf("NxZReader::loadFrame(%I32d) failed to inflate frame\n", index);
+            return false;
+        }
+    }
+
+    m_cache_index = index;
+    b_cached = true;
+    return true;
+}
+
+bool NxZReader::read(u64 offset, void *buffer, DWORD length, DWORD *bytesRead)
+{
+    *bytesRead = 0;
+    while (*bytesRead < length && offset < m_header.size)
+    {
+        u32 index = (u32)(offset / m_header.frame_size);
+        if (!loadFrame(index))
+            return false;
+
+        u64 frame_off = offset - (u64)index * m_header.frame_size;
+        DWORD chunk = (DWORD)std::min((u64)(length - *bytesRead), (u64)m_cache.size() - frame_off);
+        memcpy((u8*)buffer + *bytesRead, &m_cache[frame_off], chunk);
+        *bytesRead += chunk;
+        offset += chunk;
+    }
+    return true;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NxZFile_h__
+#define __NxZFile_h__
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <fstream>
+#include <vector>
+#include <deque>
+#include "res/types.h"
+#include "res/utils.h"
+
+#define NXZ_MAGIC "NXZ1"
+#define NXZ_VERSION 1
+#define NXZ_FRAME_SIZE 0x100000 // Uncompressed frame size (1 MB)
+#define NXZ_LEVEL 1             // zlib level (best speed)
+#define NXZ_STORED 1            // Frame flag, data is not compressed
+
+// Seekable compressed container (.nxz) layout :
+// header | frames | seek table (one NxZFrame per frame)
+// Each frame holds NXZ_FRAME_SIZE bytes of storage (last one may be shorter),
+// deflated independently so that any offset can be read by inflating one frame.
+typedef struct NxZHeader NxZHeader;
+struct NxZHeader {
+    char magic[4];      // NXZ_MAGIC
+    u32 version;        // NXZ_VERSION
+    u64 size;           // uncompressed size
+    u32 frame_size;
+    u32 frame_count;
+    u64 table_offset;   // seek table offset
+};
+
+typedef struct NxZFrame NxZFrame;
+struct NxZFrame {
+    u64 offset;         // frame offset in container
+    u32 length;         // compressed length
+    u32 flags;
+};
+
+// Frame being compressed by a worker
+typedef struct NxZJob NxZJob;
+struct NxZJob {
+    std::vector<u8> in;
+    std::vector<u8> out;
+    u32 flags = 0;
+    bool done = false;
+};
+
+// Container writer. Frames are compressed by a pool of workers (one per core)
+// and written in order, so compression doesn't slow sequential dumps down.
+class NxZWriter
+{
+    // Constructors
+    public:
+        explicit NxZWriter(const char *file);
+        ~NxZWriter();
+
+    // Member variables
+    private:
+        std::ofstream m_file;
+        NxZHeader m_header;
+        std::vector<NxZFrame> m_table;
+        std::vector<u8> m_frame;        // current frame (not full yet)
+        std::vector<std::thread> m_workers;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::deque<NxZJob*> m_pending;  // jobs waiting for a worker
+        std::deque<NxZJob*> m_jobs;     // jobs in output order
+        size_t m_max_jobs;
+        bool b_stop = false;
+        bool b_error = false;
+
+    // Member methods
+    private:
+        void workerLoop();
+        void submit();
+        bool flushJobs(bool wait_all);
+        void stop();
+
+    public:
+        bool isOpen() { return m_file.is_open() && !b_error; };
+        u64 size() { return m_header.size; };
+        bool write(const u8 *buffer, DWORD length);
+        bool close();
+};
+
+// Container reader, raw container bytes are read with a callback (NxHandle backend).
+// Last inflated frame is cached (small sequential/random reads).
+typedef std::function<bool(u64 offset, void *buffer, DWORD length)> NxZRawReader;
+
+class NxZReader
+{
+    // Constructors
+    public:
+        explicit NxZReader(NxZRawReader raw_read);
+
+    // Member variables
+    private:
+        NxZRawReader m_raw_read;
+        NxZHeader m_header;
+        std::vector<NxZFrame> m_table;
+        std::vector<u8> m_compressed;
+        std::vector<u8> m_cache;
+        u32 m_cache_index = 0;
+        bool b_cached = false;
+        bool b_valid = false;
+
+    // Member methods
+    private:
+        bool loadFrame(u32 index);
+
+    public:
+        bool isValid() { return b_valid; };
+        u64 size() { return m_header.size; };
+        u32 frameCount() { return m_header.frame_count; };
+        bool read(u64 offset, void *buffer, DWORD length, DWORD *bytesRead);
+};
+
+#endif
@@ -30,11 +30,24 @@ SOURCES += \
     ../res/hex_string.cpp \
     ../res/fat32.cpp \
     ../res/mbr.cpp \
+    ../res/xxh3.cpp \
+    ../res/blake3.cpp \
     ../res/utils.cpp \
     ../NxStorage.cpp \
     ../NxCrypto.cpp \
     ../NxPartition.cpp \
     ../NxHandle.cpp \
+    ../NxPipeline.cpp \
+    ../NxHash.cpp \
+    ../NxArchive.cpp \
+    ../NxZFile.cpp \
+    ../NxChunkStore.cpp \
+    ../NxDelta.cpp \
+    ../NxSplitWriter.cpp \
+    ../NxManifest.cpp \
+    ../NxJournal.cpp \
+    ../NxFile.cpp \
+    ../NxExtractor.cpp \
     keyset.cpp \
     mainwindow.cpp \
     properties.cpp \
@@ -47,7 +60,10 @@ HEADERS += \
     ../res/hex_string.h \
     ../res/fat32.h \
     ../res/mbr.h \
+    ../res/xxh3.h \
+    ../res/blake3.h \
     ../res/utils.h \
+    ../res/platform.h \
     ../res/types.h \
     ../NxStorage.h \
     ../NxCrypto.h \
@@ -57,6 +73,17 @@ HEADERS += \
     properties.h \
     ../NxPartition.h \
     ../NxHandle.h \
+    ../NxPipeline.h \
+    ../NxHash.h \
+    ../NxArchive.h \
+    ../NxZFile.h \
+    ../NxChunkStore.h \
+    ../NxDelta.h \
+    ../NxSplitWriter.h \
+    ../NxManifest.h \
+    ../NxJournal.h \
+    ../NxFile.h \
+    ../NxExtractor.h \
     mainwindow.h \
     resizeuser.h \
     worker.h \
@@ -88,14 +115,14 @@ RC_FILE = NxNandManager.rc
 ARCH = 64
 
 contains( ARCH, 32 ) {
-    win32: LIBS += -L$$PWD/../../../../../mingw32/lib/ -lcrypto
+    win32: LIBS += -L$$PWD/../../../../../mingw32/lib/ -lcrypto -lz
     INCLUDEPATH += $$PWD/../../../../../mingw32/include
     DEPENDPATH += $$PWD/../../../../../mingw32/include
     win32:!win32-g++: PRE_TARGETDEPS += $$PWD/../../../../../mingw32/lib/crypto.lib
     else:win32-g++: PRE_TARGETDEPS += $$PWD/../../../../../mingw32/lib/libcrypto.a
 }
 contains( ARCH, 64 ) {
-    win32: LIBS += -L$$PWD/../../../../../mingw64/lib/ -lcrypto
+    win32: LIBS += -L$$PWD/../../../../../mingw64/lib/ -lcrypto -lz
     INCLUDEPATH += $$PWD/../../../../../mingw64/include
     DEPENDPATH += $$PWD/../../../../../mingw64/include
     win32:!win32-g++: PRE_TARGETDEPS += $$PWD/../../../../../mingw64/lib/crypto.lib
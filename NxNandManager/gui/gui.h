@@ -2,6 +2,8 @@
 #ifndef __gui_h__
 #define __gui_h__
 
-#define ENABLE_GUI  1 // Comment this line to compile for CLI version only
+#if !defined(NO_GUI)
+#define ENABLE_GUI  1 // Comment this line (or define NO_GUI) to compile for CLI version only
+#endif
 
 #endif
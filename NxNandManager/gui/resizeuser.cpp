@@ -28,7 +28,7 @@ ResizeUser::ResizeUser(QWidget *parent, NxStorage *input) :
 
     NxPartition *user = input->getNxPartition(USER);
     u32 size = user->lbaEnd() - user->lbaStart() + 1;
-    u32 freesectors = (u32)(user->freeSpace / NX_BLOCKSIZE);
+    u32 freesectors = (u32)(user->freeSpace() / NX_BLOCKSIZE);
     u32 min = (size - freesectors) / 0x800;
     if(!min) min = 64;
 
@@ -63,7 +63,7 @@ void ResizeUser::on_checkBox_stateChanged(int arg1)
     {
         NxPartition *user = input->getNxPartition(USER);
         u32 size = user->lbaEnd() - user->lbaStart() + 1;
-        u32 freesectors = (u32)(user->freeSpace / NX_BLOCKSIZE);
+        u32 freesectors = (u32)(user->freeSpace() / NX_BLOCKSIZE);
         min = (size - freesectors) / 0x800;
         if(!min) min = 64;
     }
@@ -21,11 +21,20 @@
 
 
 BOOL BYPASS_MD5SUM = FALSE;
+BOOL FULL_MD5SUM = FALSE;
 bool isdebug = FALSE;
 
 BOOL FORCE = FALSE;
 BOOL LIST = FALSE;
 BOOL FORMAT_USER = FALSE;
+BOOL DIRECT_IO = FALSE;
+BOOL MMAP = FALSE;
+BOOL SPARSE = FALSE;
+BOOL ARCHIVE = FALSE;
+BOOL COMPRESS = FALSE;
+BOOL DEDUP = FALSE;
+BOOL MANIFEST = FALSE;
+BOOL DELTA_RESTORE = FALSE;
 int startGUI(int argc, char *argv[])
 {
 #if defined(ENABLE_GUI)
@@ -53,19 +62,23 @@ void printStorageInfo(NxStorage *storage)
     if (storage->isSplitted())
         printf(" (+%d)", storage->nxHandle->getSplitCount() - 1);
     printf("\n");
+    if (storage->nxHandle->isDelta())
+        printf("Base dump      : %s (%s changed)\n", storage->nxHandle->deltaReader()->basePath(),
+            GetReadableSize(storage->nxHandle->deltaReader()->changedCount() * storage->nxHandle->deltaReader()->blockSize()).c_str());
 
     if (storage->type == INVALID && is_dir(c_path))
         printf("File/Disk      : Directory");
     else 
-        printf("File/Disk      : %s", storage->isDrive() ? "Disk" : "File");
+        printf("File/Disk      : %s%s", storage->isDrive() ? "Disk" : "File", storage->nxHandle->isCompressed() ? " (compressed)"
+                                                                           : storage->nxHandle->isDelta() ? " (incremental)" : "");
     if (storage->type == RAWMMC)
         printf(" (0x%s - 0x%s)\n", n2hexstr((u64)storage->mmc_b0_lba_start * NX_BLOCKSIZE, 10).c_str(), n2hexstr((u64)storage->mmc_b0_lba_start * NX_BLOCKSIZE + storage->size() - 1, 10).c_str());
     else printf("\n");
     if(storage->type != INVALID) 
     {
         printf("Size           : %s", GetReadableSize(storage->size()).c_str());
-        if(storage->isSinglePartType() && storage->getNxPartition()->freeSpace)
-            printf(" (free space %s)", GetReadableSize(storage->getNxPartition()->freeSpace).c_str());
+        if(storage->isSinglePartType() && storage->getNxPartition()->freeSpace())
+            printf(" (free space %s)", GetReadableSize(storage->getNxPartition()->freeSpace()).c_str());
         printf("\n");
     }
     if (!storage->isNxStorage())
@@ -104,8 +117,8 @@ void printStorageInfo(NxStorage *storage)
     {
         printf("%s %s", !i ? "\nPartitions : \n -" : " -", part->partitionName().c_str());
         printf(" (%s", GetReadableSize(part->size()).c_str());
-        if (part->freeSpace)
-            printf(", free space %s", GetReadableSize(part->freeSpace).c_str());
+        if (part->freeSpace())
+            printf(", free space %s", GetReadableSize(part->freeSpace()).c_str());
         printf("%s)%s", part->isEncryptedPartition() ? " encrypted" : "", part->badCrypto() ? "  !!! DECRYPTION FAILED !!!" : "");
 
         dbg_printf(" [0x%s - 0x%s]", n2hexstr((u64)part->lbaStart() * NX_BLOCKSIZE, 10).c_str(), n2hexstr((u64)part->lbaStart() * NX_BLOCKSIZE + part->size()-1, 10).c_str());
@@ -138,7 +151,7 @@ void printCopyProgress(int mode, const char *storage_name, timepoint_t begin_tim
     std::chrono::duration<double> remaining_seconds = (tmp_elapsed_seconds / bytesCount) * (bytesTotal - bytesCount);
     std::string buf = GetReadableElapsedTime(remaining_seconds).c_str();
     char label[0x40];
-    if(mode == MD5_HASH) sprintf(label, "Computing MD5 hash for");
+    if(mode == MD5_HASH) sprintf(label, "Computing hash for");
     else if (mode == RESTORE) sprintf(label, "Restoring to");
     else sprintf(label, "Copying");
     printf("%s %s... %s /%s (%d%%) - Remaining time:", label, storage_name, GetReadableSize(bytesCount).c_str(), 
@@ -163,14 +176,16 @@ void printProgress(ProgressInfo* pi)
     {
         if (pi->mode == MD5_HASH) sprintf(label, "verified");
         else if (pi->mode == RESTORE) sprintf(label, "restored");
+        else if (pi->mode == EXTRACT) sprintf(label, "extracted");
         else sprintf(label, "dumped");
         printf("%s %s. %s - Elapsed time: %s                                              \n", pi->storage_name.c_str(), label,
             GetReadableSize(pi->bytesTotal).c_str(), GetReadableElapsedTime(tmp_elapsed_seconds).c_str());
     }
     else
     {
-        if (pi->mode == MD5_HASH) sprintf(label, "Computing MD5 hash for");
+        if (pi->mode == MD5_HASH) sprintf(label, "Computing hash for");
         else if (pi->mode == RESTORE) sprintf(label, "Restoring to");
+        else if (pi->mode == EXTRACT) sprintf(label, "Extracting from");
         else sprintf(label, "Copying");
         printf("%s %s... %s /%s (%d%%) - Remaining time:", label, pi->storage_name.c_str(), GetReadableSize(pi->bytesCount).c_str(),
             GetReadableSize(pi->bytesTotal).c_str(), pi->bytesCount * 100 / pi->bytesTotal);
@@ -186,8 +201,8 @@ int main(int argc, char *argv[])
     std::setlocale(LC_ALL, "");
     std::locale::global(std::locale(""));
     printf("[ NxNandManager v3.0.3 by eliboa ]\n\n");
-    const char *input = NULL, *output = NULL, *partitions = NULL, *keyset = NULL, *user_resize = NULL;
-    BOOL info = FALSE, gui = FALSE, setAutoRCM = FALSE, autoRCM = FALSE, decrypt = FALSE, encrypt = FALSE, incognito = FALSE, createEmuNAND = FALSE;
+    const char *input = NULL, *output = NULL, *partitions = NULL, *keyset = NULL, *user_resize = NULL, *hash_algo = NULL, *base = NULL, *split = NULL, *journal = NULL, *fat_path = NULL;
+    BOOL resume = FALSE, info = FALSE, gui = FALSE, setAutoRCM = FALSE, autoRCM = FALSE, decrypt = FALSE, encrypt = FALSE, incognito = FALSE, createEmuNAND = FALSE, verify = FALSE, extract = FALSE;
     int io_num = 1;
 
     // Arguments, controls & usage
@@ -210,6 +225,17 @@ int main(int argc, char *argv[])
             "                    Use FORMAT_USER flag to format partition during copy\n"
             "                    GPT and USER's FAT will be modified\n"
             "                    output (-o) must be a new file\n"
+            "  -hash=            Hash algorithm for integrity checks (dump & restore)\n"
+            "                    Possible values are md5 (default), sha256, xxh3, blake3\n"
+            "  -base=            Path to a previous dump (raw, split, compressed or incremental) of the same storage\n"
+            "                    Output is an incremental dump : only blocks that changed since base are stored\n"
+            "                    Incremental dump can then be used as input (-i) like a full dump\n"
+            "  -split=           Size in Mb of output parts (dump only), e.g. 4095 for FAT32 volumes\n"
+            "                    Parts are named after output: rawnand.bin.00, full.00.bin, 00 (emuMMC)...\n"
+            "                    \".00\" is appended if output name has no part number\n"
+            "  -journal=         Write a checkpoint journal every N Mb while dumping/restoring a full storage, e.g. 1024\n"
+            "                    Journal is written next to output (<output>.journal), next to input when restoring to a drive\n"
+            "  -path=            Path of file or directory to extract (see --extract), e.g. /Contents/registered\n"
             "=> Options:\n\n"
 #if defined(ENABLE_GUI)
             "  --gui             Start the program in graphical mode, doesn't need other argument\n"
@@ -218,6 +244,12 @@ int main(int argc, char *argv[])
             "  --info            Display information about input/output (depends on NAND type):\n"
             "                    NAND type, partitions, encryption, autoRCM status... \n"
             "                    ...more info when -keyset provided: firmware ver., S/N, device ID...\n\n"
+            "  --resume          Resume an interrupted dump/restore from its journal (see -journal=), same -i/-o as before\n"
+            "                    Data already copied is checked against journal checkpoints, copy continues from last one\n\n"
+            "  --verify          Verify input against its manifest (<input>.manifest, see MANIFEST flag)\n"
+            "                    Damaged ranges are reported, use -part= to only verify some partitions\n\n"
+            "  --extract         Extract files from a FAT32 partition (-part=SAFE, SYSTEM or USER) to output directory (-o)\n"
+            "                    Whole partition is extracted unless -path= is provided (-keyset needed if encrypted)\n\n"
             "  --incognito       Wipe all console unique id's and certificates from CAL0 (a.k.a incognito)\n"
             "                    Only applies to input type RAWNAND or PRODINFO\n\n"
             "  --enable_autoRCM  Enable auto RCM. -i must point to a valid BOOT0 file/drive\n"
@@ -226,8 +258,25 @@ int main(int argc, char *argv[])
 
         printf("=> Flags:\n\n"
             "                    \"BYPASS_MD5SUM\" to bypass MD5 integrity checks (faster but less secure)\n"
+            "                    \"FULL_MD5SUM\" to verify dumps & restores by re-reading the whole output (slower)\n"
             "                    \"FORMAT_USER\" to format USER partition (-user_resize arg mandatory)\n"
-            "                    \"FORCE\" to disable prompt for user input (no question asked)\n");
+            "                    \"FORCE\" to disable prompt for user input (no question asked)\n"
+            "                    \"SPARSE\" to skip free clusters when dumping decrypted SAFE/SYSTEM/USER (holes in output)\n"
+            "                    \"ARCHIVE\" to dump RAWNAND to a compact archive (allocated clusters only, -keyset needed)\n"
+            "                              Archive can then be restored with -i archive -o output (-keyset needed)\n"
+            "                    \"COMPRESS\" to dump BOOT0/BOOT1/RAWNAND/FULL NAND to a seekable compressed file\n"
+            "                              Compressed file can then be used as input (-i) like a raw dump\n"
+            "                    \"DEDUP\" to dump to a deduplicated backup : -o is the backup index, chunks are stored\n"
+            "                              in \"chunks\" directory next to it (shared by all indexes in this directory)\n"
+            "                              Encrypted partitions are stored decrypted if -keyset is provided\n"
+            "                              Backup can then be restored with -i index -o output (-keyset needed)\n"
+            "                    \"DELTA_RESTORE\" to only write clusters that differ from output when restoring (output is read first)\n"
+            "                    \"MANIFEST\" to write per block (4 MB) hashes & partitions next to dump (<output>.manifest)\n"
+            "                    \"MMAP\" to read input file(s) through a read-only memory mapping\n"
+#if !defined(_WIN32)
+            "                    \"DIRECT_IO\" to bypass page cache (O_DIRECT) for aligned I/O\n"
+#endif
+            );
 
         throwException(ERR_WRONG_USE);
         return -1;
@@ -264,13 +313,30 @@ int main(int argc, char *argv[])
     const char AUTORCMON_ARGUMENT[] = "--enable_autoRCM";
     const char AUTORCMOFF_ARGUMENT[] = "--disable_autoRCM";
     const char BYPASS_MD5SUM_FLAG[] = "BYPASS_MD5SUM";
+    const char FULL_MD5SUM_FLAG[] = "FULL_MD5SUM";
     const char DEBUG_MODE_FLAG[] = "DEBUG_MODE";
     const char FORCE_FLAG[] = "FORCE";
+    const char DIRECT_IO_FLAG[] = "DIRECT_IO";
+    const char MMAP_FLAG[] = "MMAP";
+    const char SPARSE_FLAG[] = "SPARSE";
+    const char ARCHIVE_FLAG[] = "ARCHIVE";
+    const char COMPRESS_FLAG[] = "COMPRESS";
+    const char DEDUP_FLAG[] = "DEDUP";
+    const char MANIFEST_FLAG[] = "MANIFEST";
+    const char DELTA_RESTORE_FLAG[] = "DELTA_RESTORE";
+    const char VERIFY_ARGUMENT[] = "--verify";
+    const char RESUME_ARGUMENT[] = "--resume";
     const char KEYSET_ARGUMENT[] = "-keyset";
     const char DECRYPT_ARGUMENT[] = "-d";
     const char ENCRYPT_ARGUMENT[] = "-e";
     const char INCOGNITO_ARGUMENT[] = "--incognito";
     const char RESIZE_USER_ARGUMENT[] = "-user_resize";
+    const char HASH_ARGUMENT[] = "-hash";
+    const char BASE_ARGUMENT[] = "-base";
+    const char SPLIT_ARGUMENT[] = "-split";
+    const char JOURNAL_ARGUMENT[] = "-journal";
+    const char PATH_ARGUMENT[] = "-path";
+    const char EXTRACT_ARGUMENT[] = "--extract";
     const char FORMAT_USER_FLAG[] = "FORMAT_USER";
     const char CREATE_EMUNAND_ARGUMENT[] = "--create_SD_emuNAND";
 
@@ -308,6 +374,46 @@ int main(int argc, char *argv[])
             else if (currArg[len] == 0 && i == argc - 1)
                 return PrintUsage();
         }
+        else if (!strncmp(currArg, HASH_ARGUMENT, array_countof(HASH_ARGUMENT) - 1))
+        {
+            u32 len = array_countof(HASH_ARGUMENT) - 1;
+            if (currArg[len] == '=')
+                hash_algo = &currArg[len + 1];
+            else if (currArg[len] == 0 && i == argc - 1)
+                return PrintUsage();
+        }
+        else if (!strncmp(currArg, BASE_ARGUMENT, array_countof(BASE_ARGUMENT) - 1))
+        {
+            u32 len = array_countof(BASE_ARGUMENT) - 1;
+            if (currArg[len] == '=')
+                base = &currArg[len + 1];
+            else if (currArg[len] == 0 && i == argc - 1)
+                return PrintUsage();
+        }
+        else if (!strncmp(currArg, SPLIT_ARGUMENT, array_countof(SPLIT_ARGUMENT) - 1))
+        {
+            u32 len = array_countof(SPLIT_ARGUMENT) - 1;
+            if (currArg[len] == '=')
+                split = &currArg[len + 1];
+            else if (currArg[len] == 0 && i == argc - 1)
+                return PrintUsage();
+        }
+        else if (!strncmp(currArg, JOURNAL_ARGUMENT, array_countof(JOURNAL_ARGUMENT) - 1))
+        {
+            u32 len = array_countof(JOURNAL_ARGUMENT) - 1;
+            if (currArg[len] == '=')
+                journal = &currArg[len + 1];
+            else if (currArg[len] == 0 && i == argc - 1)
+                return PrintUsage();
+        }
+        else if (!strncmp(currArg, PATH_ARGUMENT, array_countof(PATH_ARGUMENT) - 1))
+        {
+            u32 len = array_countof(PATH_ARGUMENT) - 1;
+            if (currArg[len] == '=')
+                fat_path = &currArg[len + 1];
+            else if (currArg[len] == 0 && i == argc - 1)
+                return PrintUsage();
+        }
         else if (!strncmp(currArg, INFO_ARGUMENT, array_countof(INFO_ARGUMENT) - 1))
             info = TRUE;
 
@@ -324,6 +430,9 @@ int main(int argc, char *argv[])
         else if (!strncmp(currArg, BYPASS_MD5SUM_FLAG, array_countof(BYPASS_MD5SUM_FLAG) - 1))
             BYPASS_MD5SUM = TRUE;
 
+        else if (!strncmp(currArg, FULL_MD5SUM_FLAG, array_countof(FULL_MD5SUM_FLAG) - 1))
+            FULL_MD5SUM = TRUE;
+
         else if (!strncmp(currArg, DEBUG_MODE_FLAG, array_countof(DEBUG_MODE_FLAG) - 1))
             isdebug = TRUE;
 
@@ -333,6 +442,39 @@ int main(int argc, char *argv[])
         else if (!strncmp(currArg, FORMAT_USER_FLAG, array_countof(FORMAT_USER_FLAG) - 1))
             FORMAT_USER = TRUE;
 
+        else if (!strncmp(currArg, DIRECT_IO_FLAG, array_countof(DIRECT_IO_FLAG) - 1))
+            DIRECT_IO = TRUE;
+
+        else if (!strncmp(currArg, MMAP_FLAG, array_countof(MMAP_FLAG) - 1))
+            MMAP = TRUE;
+
+        else if (!strncmp(currArg, SPARSE_FLAG, array_countof(SPARSE_FLAG) - 1))
+            SPARSE = TRUE;
+
+        else if (!strncmp(currArg, ARCHIVE_FLAG, array_countof(ARCHIVE_FLAG) - 1))
+            ARCHIVE = TRUE;
+
+        else if (!strncmp(currArg, COMPRESS_FLAG, array_countof(COMPRESS_FLAG) - 1))
+            COMPRESS = TRUE;
+
+        else if (!strncmp(currArg, DEDUP_FLAG, array_countof(DEDUP_FLAG) - 1))
+            DEDUP = TRUE;
+
+        else if (!strncmp(currArg, MANIFEST_FLAG, array_countof(MANIFEST_FLAG) - 1))
+            MANIFEST = TRUE;
+
+        else if (!strncmp(currArg, DELTA_RESTORE_FLAG, array_countof(DELTA_RESTORE_FLAG) - 1))
+            DELTA_RESTORE = TRUE;
+
+        else if (!strncmp(currArg, VERIFY_ARGUMENT, array_countof(VERIFY_ARGUMENT) - 1))
+            verify = TRUE;
+
+        else if (!strncmp(currArg, EXTRACT_ARGUMENT, array_countof(EXTRACT_ARGUMENT) - 1))
+            extract = TRUE;
+
+        else if (!strncmp(currArg, RESUME_ARGUMENT, array_countof(RESUME_ARGUMENT) - 1))
+            resume = TRUE;
+
         else if (!strncmp(currArg, KEYSET_ARGUMENT, array_countof(KEYSET_ARGUMENT) - 1) && i < argc)
             keyset = argv[++i];
 
@@ -371,7 +513,7 @@ int main(int argc, char *argv[])
         exit(EXIT_SUCCESS);
     }
 
-    if (nullptr == input || (nullptr == output && !info && !setAutoRCM && !incognito))
+    if (nullptr == input || (nullptr == output && !info && !setAutoRCM && !incognito && !verify))
         PrintUsage();
 
     if ((encrypt || decrypt) && nullptr == keyset)
@@ -380,6 +522,80 @@ int main(int argc, char *argv[])
         PrintUsage();
     }
 
+    int hash_algorithm = HASH_MD5;
+    if (nullptr != hash_algo && (hash_algorithm = NxHash::getAlgorithm(hash_algo)) < 0)
+    {
+        printf("-hash value is invalid\n\n");
+        PrintUsage();
+    }
+
+    u64 split_size = 0;
+    if (nullptr != split)
+    {
+        int split_mb = 0;
+        try {
+            split_mb = std::stoi(std::string(split));
+        }
+        catch (...) {}
+        if (split_mb <= 0)
+        {
+            printf("-split value is invalid\n\n");
+            PrintUsage();
+        }
+        if (ARCHIVE || DEDUP || COMPRESS || nullptr != base)
+        {
+            printf("-split cannot be used with ARCHIVE, DEDUP, COMPRESS or -base\n\n");
+            PrintUsage();
+        }
+        split_size = (u64)split_mb * 1024 * 1024;
+    }
+
+    u64 journal_interval = 0;
+    if (nullptr != journal)
+    {
+        int journal_mb = 0;
+        try {
+            journal_mb = std::stoi(std::string(journal));
+        }
+        catch (...) {}
+        if (journal_mb <= 0)
+        {
+            printf("-journal value is invalid\n\n");
+            PrintUsage();
+        }
+        journal_interval = (u64)journal_mb * 1024 * 1024;
+    }
+
+    if ((nullptr != journal || resume) && (ARCHIVE || DEDUP || COMPRESS || nullptr != base || nullptr != partitions))
+    {
+        printf("-journal & --resume cannot be used with ARCHIVE, DEDUP, COMPRESS, -base or -part\n\n");
+        PrintUsage();
+    }
+
+    if (nullptr != partitions && (ARCHIVE || DEDUP || COMPRESS || nullptr != base))
+    {
+        printf("-part cannot be used with ARCHIVE, DEDUP, COMPRESS or -base\n\n");
+        PrintUsage();
+    }
+
+    if (extract && (nullptr == output || nullptr == partitions || strchr(partitions, ',') != nullptr))
+    {
+        printf("--extract needs one partition (-part=) and an output directory (-o)\n\n");
+        PrintUsage();
+    }
+
+    if (nullptr != fat_path && !extract)
+    {
+        printf("-path can only be used with --extract\n\n");
+        PrintUsage();
+    }
+
+    if (MANIFEST && (ARCHIVE || DEDUP || nullptr != base))
+    {
+        printf("MANIFEST cannot be used with ARCHIVE, DEDUP or -base\n\n");
+        PrintUsage();
+    }
+
     if (FORCE)
         printf("Force mode activated, no questions will be asked.\n");
 
@@ -400,13 +616,29 @@ int main(int argc, char *argv[])
             throwException("Failed to open input : %s", (void*)input);
     }
 
+    nx_input.setHashAlgorithm(hash_algorithm);
+    nx_input.setSparseOutput(SPARSE);
+    nx_input.setCompressOutput(COMPRESS);
+    nx_input.setSplitSize(split_size);
+    nx_input.setManifestOutput(MANIFEST);
+    nx_input.setJournalInterval(journal_interval);
+    nx_input.setResumeJournal(resume);
+    if (DIRECT_IO)
+        nx_input.nxHandle->setDirectIO(true);
+    if (MMAP)
+        nx_input.nxHandle->setMemoryMap(true);
+
     // Set keys for input
     if (nullptr != keyset && is_in(nx_input.setKeys(keyset), { ERR_KEYSET_NOT_EXISTS, ERR_KEYSET_EMPTY }))
         throwException("Failed to get keys from %s", (void*)keyset);
 
     wchar_t input_path[MAX_PATH];
+#if defined(_WIN32)
     int nSize = MultiByteToWideChar(CP_UTF8, 0, input, -1, NULL, 0);
     MultiByteToWideChar(CP_UTF8, 0, input, -1, input_path, nSize > MAX_PATH ? MAX_PATH : nSize);
+#else
+    mbstowcs(input_path, input, MAX_PATH);
+#endif
 
     if (wcscmp(nx_input.m_path, input_path))
     {
@@ -470,10 +702,111 @@ int main(int argc, char *argv[])
         printStorageInfo(&nx_input);
     }
 
+    // Verify input against manifest (all blocks or partitions' blocks)
+    if (verify)
+    {
+        NxManifest manifest(NxManifest::path(input).c_str());
+        if (!manifest.isValid())
+            throwException(ERR_INVALID_MANIFEST);
+
+        std::vector<const char*> parts;
+        std::string l_parts(nullptr != partitions ? partitions : "");
+        char *part_name, *ch_parts = &l_parts[0];
+        while ((part_name = strtok(!parts.size() ? ch_parts : nullptr, ",")) != nullptr) parts.push_back(part_name);
+        if (!parts.size())
+            parts.push_back(nullptr);
+
+        int rc = SUCCESS;
+        for (const char *part : parts)
+        {
+            std::vector<NxManifestPart> damaged;
+            int part_rc = nx_input.verifyManifest(&manifest, part, &damaged, printProgress);
+            for (NxManifestPart &range : damaged)
+                printf("Damaged range  : 0x%s - 0x%s (%s) %s\n", n2hexstr(range.offset, 10).c_str(), n2hexstr(range.offset + range.size, 10).c_str(),
+                    GetReadableSize(range.size).c_str(), range.name.c_str());
+            if (part_rc != SUCCESS && part_rc != ERR_MD5_COMPARE)
+                throwException(part_rc);
+            if (part_rc != SUCCESS)
+                rc = part_rc;
+        }
+        if (rc != SUCCESS)
+            throwException(rc);
+
+        printf("Input matches manifest\n");
+        exit(EXIT_SUCCESS);
+    }
+
+    // Extract files from FAT32 partition
+    if (extract)
+    {
+        NxPartition *part = nx_input.getNxPartition(partitions);
+        if (nullptr == part)
+            throwException("Partition %s not found in input", (void*)partitions);
+        if (not_in(part->type(), { SAFE, SYSTEM, USER }))
+            throwException("Cannot extract files from %s (FAT32 partitions only : SAFE, SYSTEM, USER)", (void*)partitions);
+
+        if (int rc = part->extractFiles(nullptr != fat_path ? fat_path : "/", output, printProgress))
+            throwException(rc);
+
+        exit(EXIT_SUCCESS);
+    }
+
     // Exit if output is not specified
     if (nullptr == output)
         exit(EXIT_SUCCESS);
 
+    // Restore from compact archive or deduplicated backup (index)
+    bool is_archive = NxArchive::isArchive(input);
+    if (is_archive || NxChunkIndex::isIndex(input))
+    {
+        std::unique_ptr<NxArchive> archive;
+        std::unique_ptr<NxChunkIndex> index;
+        if (is_archive)
+            archive.reset(new NxArchive(input));
+        else
+            index.reset(new NxChunkIndex(input));
+        if (is_archive ? !archive->isValid() : !index->isValid())
+            throwException("Invalid %s : %s", is_archive ? (void*)"archive" : (void*)"backup index", (void*)input);
+        u64 in_size = is_archive ? archive->size() : index->size();
+
+        // New output file is created with storage size
+        printf("Accessing output...\r");
+        std::unique_ptr<NxStorage> nx_output(new NxStorage(output));
+        printf("                      \r");
+        bool new_file = nx_output->type == INVALID && !nx_output->isDrive();
+        if (new_file)
+        {
+            nx_output.reset();
+            if (!create_sparse_file(output, in_size))
+                throwException("Failed to create output file %s", (void*)output);
+            nx_output.reset(new NxStorage(output));
+        }
+        else if (!FORCE && !AskYesNoQuestion("Output will be overwritten with %s content. Are you sure you want to continue ?",
+                                             is_archive ? (void*)"archive" : (void*)"backup"))
+            throwException("Operation cancelled");
+
+        if (DIRECT_IO && nullptr != nx_output->nxHandle)
+            nx_output->nxHandle->setDirectIO(true);
+
+        // Keys are needed to regenerate free clusters (archive) or encrypt partitions back (backup)
+        if (nullptr != keyset)
+            nx_output->setKeys(keyset);
+
+        SetThreadExecutionState(ES_CONTINUOUS | ES_SYSTEM_REQUIRED | ES_AWAYMODE_REQUIRED);
+        int rc = is_archive ? nx_output->restoreFromArchive(archive.get(), printProgress)
+                            : nx_output->restoreFromChunks(index.get(), printProgress);
+        if (rc != SUCCESS)
+        {
+            nx_output.reset();
+            if (new_file)
+                remove(output);
+            throwException(rc);
+        }
+
+        SetThreadExecutionState(ES_CONTINUOUS);
+        exit(EXIT_SUCCESS);
+    }
+
     // Exit if input is not a valid NxStorage
     if (!nx_input.isNxStorage())
         throwException(ERR_INVALID_INPUT);
@@ -483,6 +816,13 @@ int main(int argc, char *argv[])
     NxStorage nx_output = NxStorage(output);
     printf("                      \r");
 
+    nx_output.setHashAlgorithm(hash_algorithm);
+    nx_output.setDeltaRestore(DELTA_RESTORE);
+    nx_output.setJournalInterval(journal_interval);
+    nx_output.setResumeJournal(resume);
+    if (DIRECT_IO && nullptr != nx_output.nxHandle)
+        nx_output.nxHandle->setDirectIO(true);
+
     // Set keys for output
     if (nullptr != keyset)
         nx_output.setKeys(keyset);
@@ -494,6 +834,10 @@ int main(int argc, char *argv[])
         printf("\n");
     }
 
+    // Compressed & incremental storages can only be used as input
+    if (nx_output.isNxStorage() && nx_output.nxHandle->isReadOnly())
+        throwException("Output is %s storage (read-only)", nx_output.nxHandle->isDelta() ? (void*)"an incremental" : (void*)"a compressed");
+
     // Output specific actions
     //
     if (createEmuNAND)
@@ -533,7 +877,7 @@ int main(int argc, char *argv[])
         
         u32 user_new_size = new_size * 0x800; // Size in sectors. 1Mb = 0x800 sectores
         u64 user_min = (u64)user_new_size * 0x200 / 1024 / 1024;
-        u32 min_size = (u32)((user->size() - user->freeSpace) / 0x200); // 0x20000 = size for 1 cluster in FAT
+        u32 min_size = (u32)((user->size() - user->freeSpace()) / 0x200); // 0x20000 = size for 1 cluster in FAT
         u64 min = FORMAT_USER ? 64 : (u64)min_size * 0x200 / 1024 / 1024;
         if (min % 64) min = (min / 64) * 64 + 64;
 
@@ -592,7 +936,7 @@ int main(int argc, char *argv[])
 
     std::vector<const char*> v_partitions;
     bool dump_rawnand = false;
-    int crypto_mode = BYPASS_MD5SUM ? NO_CRYPTO : MD5_HASH;
+    int crypto_mode = BYPASS_MD5SUM ? NO_CRYPTO : FULL_MD5SUM ? MD5_HASH_FULL : MD5_HASH;
 
     // Output is unknown disk
     if (nx_output.type == INVALID && nx_output.isDrive())
@@ -751,23 +1095,36 @@ int main(int argc, char *argv[])
     // Prevent system from going into sleep mode
     SetThreadExecutionState(ES_CONTINUOUS | ES_SYSTEM_REQUIRED | ES_AWAYMODE_REQUIRED);
     
+    // Resumed dump (partial output may be seen as NX storage)
+    bool resume_dump = false;
+    if (resume)
+    {
+        NxJournal out_journal(NxJournal::path((split_size ? NxSplitWriter::firstPart(output) : std::string(output)).c_str()).c_str());
+        resume_dump = out_journal.isValid() && out_journal.info().operation == "dump";
+    }
+
     ///
     /// Dump to new file
     ///    
-    if (!nx_output.isNxStorage())
+    if (!nx_output.isNxStorage() || resume_dump)
     {
         // Release output handle
         nx_output.nxHandle->clearHandle();
 
-        // Output file already exists
-        if (is_file(output))
+        // Output file (or first part) already exists
+        std::string out_file = split_size ? NxSplitWriter::firstPart(output) : std::string(output);
+        if (!resume && is_file(out_file.c_str()))
         {
             if (!FORCE && !AskYesNoQuestion("Output file already exists. Do you want to overwrite it ?"))
                 throwException("Operation cancelled");
 
-            remove(output);
-            if (is_file(output))
+            remove(out_file.c_str());
+            if (is_file(out_file.c_str()))
                 throwException("Failed to delete output file");
+
+            // Following parts of previous split output
+            for (std::string part = NxSplitWriter::nextPart(out_file); split_size && is_file(part.c_str()); part = NxSplitWriter::nextPart(part))
+                remove(part.c_str());
         }
 
         // Full dump
@@ -777,7 +1134,10 @@ int main(int argc, char *argv[])
             if (dump_rawnand)
                 printf("BOOT0 & BOOT1 skipped (RAWNAND only)\n");
 
-            int rc = nx_input.dumpToFile(output, crypto_mode, printProgress, dump_rawnand);
+            int rc = ARCHIVE ? nx_input.dumpToArchive(output, printProgress)
+                   : DEDUP ? nx_input.dumpToChunks(output, printProgress)
+                   : nullptr != base ? nx_input.dumpToDelta(output, base, crypto_mode, printProgress)
+                   : nx_input.dumpToFile(output, crypto_mode, printProgress, dump_rawnand);
 
             // Failure
             if (rc != SUCCESS)
@@ -794,8 +1154,10 @@ int main(int argc, char *argv[])
             {
                 char new_out[MAX_PATH];
                 strcpy(new_out, output);
-                strcat(new_out, "\\");
+                strcat(new_out, PATH_SEPARATOR);
                 strcat(new_out, part_name);
+                if (split_size)
+                    strcpy(new_out, NxSplitWriter::firstPart(new_out).c_str());
                 if (is_file(new_out))
                 {
                     if (!FORCE && !AskYesNoQuestion("The following output file already exists :\n- %s\nDo you want to overwrite it ?", (void*)new_out))
@@ -810,6 +1172,8 @@ int main(int argc, char *argv[])
                         remove(new_out);
                         if (is_file(new_out))
                             throwException("Failed to delete output file %s", new_out);
+                        for (std::string part = NxSplitWriter::nextPart(new_out); split_size && is_file(part.c_str()); part = NxSplitWriter::nextPart(part))
+                            remove(part.c_str());
                     }
                 }
                 i++;
@@ -828,12 +1192,12 @@ int main(int argc, char *argv[])
                     (decrypt && partition->isEncryptedPartition()))
                     crypto_mode = encrypt ? ENCRYPT : DECRYPT;
                 else 
-                    crypto_mode = BYPASS_MD5SUM ? NO_CRYPTO : MD5_HASH;
+                    crypto_mode = BYPASS_MD5SUM ? NO_CRYPTO : FULL_MD5SUM ? MD5_HASH_FULL : MD5_HASH;
 
                 char new_out[MAX_PATH];
                 if (is_dir(output)) {
                     strcpy(new_out, output);
-                    strcat(new_out, "\\");
+                    strcat(new_out, PATH_SEPARATOR);
                     strcat(new_out, part_name);
                 }
                 else strcpy(new_out, output);              
@@ -859,7 +1223,7 @@ int main(int argc, char *argv[])
             if (!FORCE && !AskYesNoQuestion("%s to be fully restored. Are you sure you want to continue ?", (void*)nx_output.getNxTypeAsStr()))
                 throwException("Operation cancelled");
 
-            int rc = nx_output.restoreFromStorage(&nx_input, NO_CRYPTO, printProgress);
+            int rc = nx_output.restoreFromStorage(&nx_input, FULL_MD5SUM && !BYPASS_MD5SUM ? MD5_HASH_FULL : NO_CRYPTO, printProgress);
 
             // Failure
             if (rc != SUCCESS)
@@ -885,7 +1249,7 @@ int main(int argc, char *argv[])
                     (decrypt && in_part->isEncryptedPartition()))
                     crypto_mode = encrypt ? ENCRYPT : DECRYPT;
                 else
-                    crypto_mode = BYPASS_MD5SUM ? NO_CRYPTO : MD5_HASH;
+                    crypto_mode = BYPASS_MD5SUM ? NO_CRYPTO : FULL_MD5SUM ? MD5_HASH_FULL : MD5_HASH;
 
                 int rc = out_part->restoreFromStorage(&nx_input, crypto_mode, printProgress);
 
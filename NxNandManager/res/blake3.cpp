@@ -0,0 +1,462 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "blake3.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define NX_BLAKE3_AVX2 1
+#include <immintrin.h>
+#endif
+
+// Portable implementation, after the BLAKE3 reference implementation (CC0)
+
+#define CHUNK_START 1
+#define CHUNK_END   2
+#define PARENT      4
+#define ROOT        8
+
+static const u32 IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const u8 MSG_SCHEDULE[7][16] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+    { 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+    { 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+    { 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+    { 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+    { 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+// Node whose chaining value (or root hash) isn't computed yet
+typedef struct _output {
+    u32 cv[8];
+    u8 block[BLAKE3_BLOCK_LEN];
+    u8 block_len;
+    u64 counter;
+    u8 flags;
+} output;
+
+static inline u32 rotr32(u32 w, int c)
+{
+    return (w >> c) | (w << (32 - c));
+}
+
+static inline u32 load32(const u8 *p)
+{
+    return (u32)p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static inline void store32(u8 *p, u32 w)
+{
+    p[0] = (u8)w; p[1] = (u8)(w >> 8); p[2] = (u8)(w >> 16); p[3] = (u8)(w >> 24);
+}
+
+static inline void g(u32 *state, int a, int b, int c, int d, u32 x, u32 y)
+{
+    state[a] = state[a] + state[b] + x;
+    state[d] = rotr32(state[d] ^ state[a], 16);
+    state[c] = state[c] + state[d];
+    state[b] = rotr32(state[b] ^ state[c], 12);
+    state[a] = state[a] + state[b] + y;
+    state[d] = rotr32(state[d] ^ state[a], 8);
+    state[c] = state[c] + state[d];
+    state[b] = rotr32(state[b] ^ state[c], 7);
+}
+
+static void compress(const u32 cv[8], const u8 block[BLAKE3_BLOCK_LEN], u8 block_len, u64 counter, u8 flags, u32 out[16])
+{
+    u32 m[16];
+    for (int i(0); i < 16; i++)
+        m[i] = load32(block + 4 * i);
+
+    u32 state[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        IV[0], IV[1], IV[2], IV[3], (u32)counter, (u32)(counter >> 32), (u32)block_len, (u32)flags
+    };
+
+    for (int r(0); r < 7; r++)
+    {
+        const u8 *s = MSG_SCHEDULE[r];
+        g(state, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+        g(state, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+        g(state, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+        g(state, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+        g(state, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+        g(state, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+        g(state, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+        g(state, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+
+    for (int i(0); i < 8; i++)
+    {
+        out[i] = state[i] ^ state[i + 8];
+        out[i + 8] = state[i + 8] ^ cv[i];
+    }
+}
+
+static void outputCV(const output *o, u32 cv[8])
+{
+    u32 out[16];
+    compress(o->cv, o->block, o->block_len, o->counter, o->flags, out);
+    memcpy(cv, out, 8 * sizeof(u32));
+}
+
+static void parentOutput(const u32 left[8], const u32 right[8], output *o)
+{
+    memcpy(o->cv, IV, sizeof(IV));
+    for (int i(0); i < 8; i++)
+    {
+        store32(o->block + 4 * i, left[i]);
+        store32(o->block + 32 + 4 * i, right[i]);
+    }
+    o->block_len = BLAKE3_BLOCK_LEN;
+    o->counter = 0;
+    o->flags = PARENT;
+}
+
+// Chaining value for a full (non root) chunk
+static void hashChunk(const u8 *chunk, u64 counter, u32 cv[8])
+{
+    u32 out[16];
+    memcpy(cv, IV, sizeof(IV));
+    for (int b(0); b < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; b++)
+    {
+        u8 flags = b == 0 ? CHUNK_START : b == BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN - 1 ? CHUNK_END : 0;
+        compress(cv, chunk + b * BLAKE3_BLOCK_LEN, BLAKE3_BLOCK_LEN, counter, flags, out);
+        memcpy(cv, out, 8 * sizeof(u32));
+    }
+}
+
+#if defined(NX_BLAKE3_AVX2)
+__attribute__((target("avx2")))
+static inline __m256i rot16(__m256i x)
+{
+    return _mm256_shuffle_epi8(x, _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                                                  13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i rot8(__m256i x)
+{
+    return _mm256_shuffle_epi8(x, _mm256_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1,
+                                                  12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1));
+}
+
+__attribute__((target("avx2")))
+static inline void g8(__m256i *v, int a, int b, int c, int d, __m256i x, __m256i y)
+{
+    v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), x);
+    v[d] = rot16(_mm256_xor_si256(v[d], v[a]));
+    v[c] = _mm256_add_epi32(v[c], v[d]);
+    v[b] = _mm256_xor_si256(v[b], v[c]);
+    v[b] = _mm256_or_si256(_mm256_srli_epi32(v[b], 12), _mm256_slli_epi32(v[b], 20));
+    v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), y);
+    v[d] = rot8(_mm256_xor_si256(v[d], v[a]));
+    v[c] = _mm256_add_epi32(v[c], v[d]);
+    v[b] = _mm256_xor_si256(v[b], v[c]);
+    v[b] = _mm256_or_si256(_mm256_srli_epi32(v[b], 7), _mm256_slli_epi32(v[b], 25));
+}
+
+// 8 full chunks at once, one chunk per 32-bit lane
+__attribute__((target("avx2")))
+static void hashChunks8(const u8 *input, u64 counter, u32 *cvs)
+{
+    __m256i h[8], m[16], v[16];
+    for (int i(0); i < 8; i++)
+        h[i] = _mm256_set1_epi32((int)IV[i]);
+
+    u32 ctr_lo[8], ctr_hi[8];
+    for (int j(0); j < 8; j++)
+    {
+        ctr_lo[j] = (u32)(counter + j);
+        ctr_hi[j] = (u32)((counter + j) >> 32);
+    }
+
+    for (int b(0); b < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; b++)
+    {
+        const u8 *block = input + b * BLAKE3_BLOCK_LEN;
+        for (int w(0); w < 16; w++)
+        {
+            u32 words[8];
+            for (int j(0); j < 8; j++)
+                words[j] = load32(block + j * BLAKE3_CHUNK_LEN + 4 * w);
+            m[w] = _mm256_loadu_si256((const __m256i*)words);
+        }
+
+        u8 flags = b == 0 ? CHUNK_START : b == BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN - 1 ? CHUNK_END : 0;
+        for (int i(0); i < 8; i++)
+            v[i] = h[i];
+        for (int i(0); i < 4; i++)
+            v[i + 8] = _mm256_set1_epi32((int)IV[i]);
+        v[12] = _mm256_loadu_si256((const __m256i*)ctr_lo);
+        v[13] = _mm256_loadu_si256((const __m256i*)ctr_hi);
+        v[14] = _mm256_set1_epi32(BLAKE3_BLOCK_LEN);
+        v[15] = _mm256_set1_epi32(flags);
+
+        for (int r(0); r < 7; r++)
+        {
+            const u8 *s = MSG_SCHEDULE[r];
+            g8(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+            g8(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+            g8(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+            g8(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+            g8(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+            g8(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+            g8(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+            g8(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+        }
+
+        for (int i(0); i < 8; i++)
+            h[i] = _mm256_xor_si256(v[i], v[i + 8]);
+    }
+
+    // Transpose back, one chaining value per chunk
+    for (int i(0); i < 8; i++)
+    {
+        u32 words[8];
+        _mm256_storeu_si256((__m256i*)words, h[i]);
+        for (int j(0); j < 8; j++)
+            cvs[j * 8 + i] = words[j];
+    }
+}
+
+static bool hasAVX2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+static bool b_avx2 = hasAVX2();
+#endif
+
+static void hashChunks(const u8 *input, u64 counter, size_t count, u32 *cvs)
+{
+    size_t i = 0;
+#if defined(NX_BLAKE3_AVX2)
+    if (b_avx2)
+        for (; i + 8 <= count; i += 8)
+            hashChunks8(input + i * BLAKE3_CHUNK_LEN, counter + i, cvs + 8 * i);
+#endif
+    for (; i < count; i++)
+        hashChunk(input + i * BLAKE3_CHUNK_LEN, counter + i, cvs + 8 * i);
+}
+
+void Blake3Hasher::reset()
+{
+    m_cv_stack_len = 0;
+    resetChunk(0);
+}
+
+void Blake3Hasher::resetChunk(u64 chunk_counter)
+{
+    memcpy(m_cv, IV, sizeof(IV));
+    m_chunk_counter = chunk_counter;
+    memset(m_block, 0, BLAKE3_BLOCK_LEN);
+    m_block_len = 0;
+    m_blocks_compressed = 0;
+}
+
+size_t Blake3Hasher::chunkLength()
+{
+    return (size_t)m_blocks_compressed * BLAKE3_BLOCK_LEN + m_block_len;
+}
+
+void Blake3Hasher::chunkUpdate(const u8 *input, size_t length)
+{
+    u32 out[16];
+    while (length)
+    {
+        // Compress full block (more input follows)
+        if (m_block_len == BLAKE3_BLOCK_LEN)
+        {
+            compress(m_cv, m_block, BLAKE3_BLOCK_LEN, m_chunk_counter, m_blocks_compressed ? 0 : CHUNK_START, out);
+            memcpy(m_cv, out, 8 * sizeof(u32));
+            m_blocks_compressed++;
+            memset(m_block, 0, BLAKE3_BLOCK_LEN);
+            m_block_len = 0;
+        }
+
+        size_t take = BLAKE3_BLOCK_LEN - m_block_len;
+        if (take > length)
+            take = length;
+        memcpy(m_block + m_block_len, input, take);
+        m_block_len += (u8)take;
+        input += take;
+        length -= take;
+    }
+}
+
+// Merge complete subtrees, as many as there are trailing zeros in total_chunks
+void Blake3Hasher::pushChunkCV(u32 *cv, u64 total_chunks)
+{
+    u32 new_cv[8];
+    memcpy(new_cv, cv, sizeof(new_cv));
+    while (!(total_chunks & 1))
+    {
+        output parent;
+        parentOutput(m_cv_stack[--m_cv_stack_len], new_cv, &parent);
+        outputCV(&parent, new_cv);
+        total_chunks >>= 1;
+    }
+    memcpy(m_cv_stack[m_cv_stack_len++], new_cv, sizeof(new_cv));
+}
+
+Blake3Hasher::~Blake3Hasher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        b_stop = true;
+    }
+    m_job_cv.notify_all();
+
+    for (std::thread &worker : m_workers)
+        if (worker.joinable())
+            worker.join();
+}
+
+void Blake3Hasher::workerLoop()
+{
+    for (;;)
+    {
+        Blake3Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_job_cv.wait(lock, [this] { return b_stop || !m_pending.empty(); });
+            if (b_stop)
+                break;
+            job = m_pending.front();
+            m_pending.pop_front();
+        }
+
+        hashChunks(job.input, job.counter, job.count, job.cvs);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running--;
+        }
+        m_done_cv.notify_one();
+    }
+}
+
+// Hash count full chunks (from current chunk counter), one run per worker,
+// first run is hashed by calling thread
+void Blake3Hasher::hashRuns(const u8 *input, size_t count, u32 *cvs)
+{
+    size_t workers = std::thread::hardware_concurrency();
+    if (workers > count / BLAKE3_CHUNKS_PER_THREAD)
+        workers = count / BLAKE3_CHUNKS_PER_THREAD;
+
+    if (workers < 2)
+    {
+        hashChunks(input, m_chunk_counter, count, cvs);
+        return;
+    }
+
+    // Pool is started once, calling thread is a worker too
+    if (m_workers.empty())
+        for (unsigned int i(1); i < std::thread::hardware_concurrency(); i++)
+            m_workers.push_back(std::thread(&Blake3Hasher::workerLoop, this));
+
+    size_t per_worker = (count + workers - 1) / workers;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t first(per_worker); first < count; first += per_worker)
+        {
+            size_t n = first + per_worker > count ? count - first : per_worker;
+            m_pending.push_back({ input + first * BLAKE3_CHUNK_LEN, m_chunk_counter + first, n, cvs + first * 8 });
+            m_running++;
+        }
+    }
+    m_job_cv.notify_all();
+
+    hashChunks(input, m_chunk_counter, per_worker, cvs);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done_cv.wait(lock, [this] { return !m_running; });
+}
+
+void Blake3Hasher::update(const void *data, size_t length)
+{
+    const u8 *input = (const u8 *)data;
+    while (length)
+    {
+        // Current chunk is full & more input follows
+        if (chunkLength() == BLAKE3_CHUNK_LEN)
+        {
+            output chunk;
+            memcpy(chunk.cv, m_cv, sizeof(m_cv));
+            memcpy(chunk.block, m_block, BLAKE3_BLOCK_LEN);
+            chunk.block_len = m_block_len;
+            chunk.counter = m_chunk_counter;
+            chunk.flags = (m_blocks_compressed ? 0 : CHUNK_START) | CHUNK_END;
+            u32 cv[8];
+            outputCV(&chunk, cv);
+            pushChunkCV(cv, m_chunk_counter + 1);
+            resetChunk(m_chunk_counter + 1);
+        }
+
+        // Run of full chunks (last chunk of input is kept in chunk state)
+        if (!chunkLength() && length > BLAKE3_CHUNK_LEN)
+        {
+            size_t count = (length - 1) / BLAKE3_CHUNK_LEN;
+            std::vector<u32> cvs(count * 8);
+            hashRuns(input, count, &cvs[0]);
+
+            for (size_t i(0); i < count; i++)
+                pushChunkCV(&cvs[i * 8], m_chunk_counter + i + 1);
+
+            resetChunk(m_chunk_counter + count);
+            input += count * BLAKE3_CHUNK_LEN;
+            length -= count * BLAKE3_CHUNK_LEN;
+            continue;
+        }
+
+        size_t take = BLAKE3_CHUNK_LEN - chunkLength();
+        if (take > length)
+            take = length;
+        chunkUpdate(input, take);
+        input += take;
+        length -= take;
+    }
+}
+
+void Blake3Hasher::digest(u8 *out)
+{
+    // Current chunk, then merge with all subtrees on the stack
+    output node;
+    memcpy(node.cv, m_cv, sizeof(m_cv));
+    memcpy(node.block, m_block, BLAKE3_BLOCK_LEN);
+    node.block_len = m_block_len;
+    node.counter = m_chunk_counter;
+    node.flags = (m_blocks_compressed ? 0 : CHUNK_START) | CHUNK_END;
+
+    for (int i = m_cv_stack_len - 1; i >= 0; i--)
+    {
+        u32 cv[8];
+        outputCV(&node, cv);
+        parentOutput(m_cv_stack[i], cv, &node);
+    }
+
+    u32 words[16];
+    compress(node.cv, node.block, node.block_len, node.counter, node.flags | ROOT, words);
+    for (int i(0); i < 8; i++)
+        store32(out + 4 * i, words[i]);
+}
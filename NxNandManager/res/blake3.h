@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __blake3_h__
+#define __blake3_h__
+
+#include <cstddef>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include "types.h"
+
+#define BLAKE3_OUT_LEN 32
+#define BLAKE3_BLOCK_LEN 64
+#define BLAKE3_CHUNK_LEN 1024
+#define BLAKE3_MAX_DEPTH 54
+// Minimum number of chunks for a worker thread (64 KB)
+#define BLAKE3_CHUNKS_PER_THREAD 64
+
+// Run of full chunks, hashed by a pool worker
+struct Blake3Job {
+    const u8 *input;
+    u64 counter;
+    size_t count;
+    u32 *cvs;
+};
+
+// Streaming BLAKE3 (hash mode, 256 bits output), same output as b3sum.
+// Large updates are split into runs of full chunks hashed by a pool of
+// workers (8 chunks at once with AVX2), chaining values are then merged in order.
+// Pool is started on first large update & kept until hasher is destroyed.
+class Blake3Hasher
+{
+    // Constructors
+    public:
+        Blake3Hasher() { reset(); };
+        ~Blake3Hasher();
+
+    // Member variables
+    private:
+        // Current chunk
+        u32 m_cv[8];
+        u64 m_chunk_counter;
+        u8 m_block[BLAKE3_BLOCK_LEN];
+        u8 m_block_len;
+        u8 m_blocks_compressed;
+        // Chaining values of complete subtrees
+        u32 m_cv_stack[BLAKE3_MAX_DEPTH][8];
+        u8 m_cv_stack_len;
+        // Worker pool
+        std::vector<std::thread> m_workers;
+        std::mutex m_mutex;
+        std::condition_variable m_job_cv;
+        std::condition_variable m_done_cv;
+        std::deque<Blake3Job> m_pending;    // runs waiting for a worker
+        size_t m_running = 0;               // runs not hashed yet
+        bool b_stop = false;
+
+    // Member methods
+    private:
+        void workerLoop();
+        void hashRuns(const u8 *input, size_t count, u32 *cvs);
+        size_t chunkLength();
+        void chunkUpdate(const u8 *input, size_t length);
+        void pushChunkCV(u32 *cv, u64 total_chunks);
+        void resetChunk(u64 chunk_counter);
+
+    public:
+        void reset();
+        void update(const void *data, size_t length);
+        void digest(u8 *out);
+};
+
+#endif
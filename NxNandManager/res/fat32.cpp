@@ -14,8 +14,125 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include "fat32.h"
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FAT32_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+typedef u64 (*alloc_bitmap_t)(const u32 *entries, size_t count, u64 *bitmap);
+
+static inline u64 popcount64(u64 word)
+{
+#if defined(__GNUC__)
+    return (u64)__builtin_popcountll(word);
+#else
+    u64 count = 0;
+    for (; word; word &= word - 1)
+        count++;
+    return count;
+#endif
+}
+
+// Last word (less than 64 entries)
+static u64 alloc_bitmap_tail(const u32 *entries, size_t count, u64 *bitmap)
+{
+    u64 word = 0;
+    for (size_t i = 0; i < count; i++)
+        word |= (u64)(entries[i] != 0) << i;
+    *bitmap = word;
+    return popcount64(word);
+}
+
+static u64 alloc_bitmap_u32(const u32 *entries, size_t count, u64 *bitmap)
+{
+    u64 allocated = 0;
+    size_t i = 0;
+    for (; i + 64 <= count; i += 64)
+        allocated += alloc_bitmap_tail(entries + i, 64, bitmap++);
+    if (i < count)
+        allocated += alloc_bitmap_tail(entries + i, count - i, bitmap);
+    return allocated;
+}
+
+#if defined(FAT32_X86)
+// 4 entries compared to zero at once, movemask gives one bit per entry
+#if defined(__GNUC__) && !defined(__SSE2__)
+__attribute__((target("sse2")))
+#endif
+static u64 alloc_bitmap_sse2(const u32 *entries, size_t count, u64 *bitmap)
+{
+    const __m128i zero = _mm_setzero_si128();
+    u64 allocated = 0;
+    size_t i = 0;
+    for (; i + 64 <= count; i += 64)
+    {
+        u64 word = 0;
+        for (int j = 0; j < 64; j += 4)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(entries + i + j));
+            u64 free = (u64)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, zero)));
+            word |= (~free & 0xF) << j;
+        }
+        *bitmap++ = word;
+        allocated += popcount64(word);
+    }
+    if (i < count)
+        allocated += alloc_bitmap_tail(entries + i, count - i, bitmap);
+    return allocated;
+}
+
+#if defined(__GNUC__)
+__attribute__((target("avx2")))
+static u64 alloc_bitmap_avx2(const u32 *entries, size_t count, u64 *bitmap)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    u64 allocated = 0;
+    size_t i = 0;
+    for (; i + 64 <= count; i += 64)
+    {
+        u64 word = 0;
+        for (int j = 0; j < 64; j += 8)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(entries + i + j));
+            u64 free = (u64)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, zero)));
+            word |= (~free & 0xFF) << j;
+        }
+        *bitmap++ = word;
+        allocated += popcount64(word);
+    }
+    if (i < count)
+        allocated += alloc_bitmap_tail(entries + i, count - i, bitmap);
+    return allocated;
+}
+#endif
+#endif
+
+// Runtime CPU dispatch
+static alloc_bitmap_t select_alloc_bitmap()
+{
+#if defined(FAT32_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return alloc_bitmap_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return alloc_bitmap_sse2;
+#elif defined(FAT32_X86) && defined(_M_X64)
+    return alloc_bitmap_sse2;
+#endif
+    return alloc_bitmap_u32;
+}
+
+static alloc_bitmap_t alloc_bitmap_impl = select_alloc_bitmap();
+
+u64 fat32::alloc_bitmap(const u32 *entries, size_t count, u64 *bitmap)
+{
+    return alloc_bitmap_impl(entries, count, bitmap);
+}
+
 void fat32::read_boot_sector(BYTE *cluster, fs_attr *fat32_attr)
 {
     memcpy(&fat32_attr->bytes_per_sector, &cluster[0xB], 2);
@@ -26,69 +143,125 @@ void fat32::read_boot_sector(BYTE *cluster, fs_attr *fat32_attr)
     memcpy(&fat32_attr->info_sector, &cluster[0x30], 2);
     memcpy(&fat32_attr->label, &cluster[0x47], 11);
     memcpy(&fat32_attr->sectors_count, &cluster[0x20], 4);
+    memcpy(&fat32_attr->root_cluster, &cluster[0x2C], 4);
+    if (fat32_attr->root_cluster < 2)
+        fat32_attr->root_cluster = 2;
 }
 
-void fat32::parse_dir_table(BYTE *cluster, std::vector<dir_entry> *entries)
+// Parse directory table (whole cluster chain, length bytes)
+void fat32::parse_dir_table(BYTE *cluster, std::vector<dir_entry> *entries, size_t length)
 {
     entries->clear();
     int buf_off = 0, lfn_length = 0;
-    while (buf_off < CLUSTER_SIZE)
+    for (; (size_t)buf_off + 32 <= length; buf_off += 32)
     {
         entry entry;
         memcpy(&entry, &cluster[buf_off], 32);
 
-        if (entry.filename[0] == 0x00 || entry.reserved != 0x00)
+        // End of table (reserved byte only holds lower case flags)
+        if (entry.filename[0] == 0x00 || entry.reserved & ~(FAT32_LOWER_BASE | FAT32_LOWER_EXT))
             break;
 
+        // Deleted entry
+        if ((u8)entry.filename[0] == 0xE5)
+        {
+            lfn_length = 0;
+            continue;
+        }
+
+        // Long filename entries precede their short entry
         if (entry.attributes == 0x0F)
+        {
             lfn_length++;
+            continue;
+        }
 
-        if ((entry.attributes == 0x10 && entry.filename[0] != 0x2E) || entry.attributes == 0x20 || entry.attributes == 0x30) 
+        // Volume label, "." & ".."
+        if (entry.attributes & 0x08 || entry.filename[0] == 0x2E)
         {
-            // Add new dir entry
-            dir_entry dir;
-            dir.entry = entry;
-
-            if (entry.attributes == 0x10)
-                dir.is_directory = true;
-
-            // Get filename 
-            dir.filename = entry.filename;
-            if (lfn_length > 0)
-                dir.filename = get_long_filename(cluster, buf_off, lfn_length);
-
-            entries->push_back(dir);
-
-            if (entry.attributes != 0x0F)
-                lfn_length = 0;
+            lfn_length = 0;
+            continue;
         }
-        buf_off += 32;
+
+        // Add new dir entry (archive bit may be set on directories)
+        dir_entry dir;
+        dir.entry = entry;
+        dir.is_directory = (entry.attributes & 0x10) != 0;
+        dir.filename = lfn_length > 0 ? get_long_filename(cluster, buf_off, lfn_length) : "";
+        if (dir.filename.empty())
+            dir.filename = get_short_filename(entry);
+        entries->push_back(dir);
+        lfn_length = 0;
     }
 }
 
-// Get FAT32 long filename
+// Get FAT32 short filename ("NAME.EXT")
+std::string fat32::get_short_filename(const entry &entry)
+{
+    std::string name(entry.filename, 8), ext(entry.filename + 8, 3);
+    name.erase(name.find_last_not_of(' ') + 1);
+    ext.erase(ext.find_last_not_of(' ') + 1);
+    if (!name.empty() && (u8)name[0] == 0x05)
+        name[0] = (char)0xE5;
+    if (entry.reserved & FAT32_LOWER_BASE)
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    if (entry.reserved & FAT32_LOWER_EXT)
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext.empty() ? name : name + "." + ext;
+}
+
+// Get FAT32 long filename (UTF-16 characters of preceding entries, UTF-8 encoded)
 std::string fat32::get_long_filename(BYTE *buffer, int offset, int length)
 {
-    unsigned char filename[40];
-    int x = 0;
-    for (int j = 1; j <= length; j++)
+    std::string filename;
+    for (int j = 1; j <= length && offset - j * 0x20 >= 0; j++)
     {
-        int off = offset - (j * 0x20);
         LFN lfn;
-        memcpy(&lfn, &buffer[off], 0x20);
+        memcpy(&lfn, &buffer[offset - j * 0x20], 0x20);
 
-        for (int k = 0; k < sizeof(lfn.fileName_Part1); k = k + 2) {
-            memcpy(&filename[x], &lfn.fileName_Part1[k], 1);
-            x++;
-        }
-        for (int k = 0; k < sizeof(lfn.fileName_Part2); k = k + 2) {
-            memcpy(&filename[x], &lfn.fileName_Part2[k], 1);
-            x++;
-        }
-        for (int k = 0; k < sizeof(lfn.fileName_Part3); k = k + 2) {
-            memcpy(&filename[x], &lfn.fileName_Part3[k], 1);
-            x++;
+        BYTE chars[26];
+        memcpy(&chars[0], lfn.fileName_Part1, sizeof(lfn.fileName_Part1));
+        memcpy(&chars[10], lfn.fileName_Part2, sizeof(lfn.fileName_Part2));
+        memcpy(&chars[22], lfn.fileName_Part3, sizeof(lfn.fileName_Part3));
+        for (int k = 0; k < 26; k += 2)
+        {
+            u32 c = chars[k] | chars[k + 1] << 8;
+            // Terminator & padding
+            if (c == 0x0000 || c == 0xFFFF)
+                return filename;
+
+            // Surrogate pair
+            if (c >= 0xD800 && c < 0xDC00 && k + 3 < 26)
+            {
+                u32 low = chars[k + 2] | chars[k + 3] << 8;
+                if (low >= 0xDC00 && low < 0xE000)
+                {
+                    c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                    k += 2;
+                }
+            }
+
+            if (c < 0x80)
+                filename += (char)c;
+            else if (c < 0x800)
+            {
+                filename += (char)(0xC0 | c >> 6);
+                filename += (char)(0x80 | (c & 0x3F));
+            }
+            else if (c < 0x10000)
+            {
+                filename += (char)(0xE0 | c >> 12);
+                filename += (char)(0x80 | (c >> 6 & 0x3F));
+                filename += (char)(0x80 | (c & 0x3F));
+            }
+            else
+            {
+                filename += (char)(0xF0 | c >> 18);
+                filename += (char)(0x80 | (c >> 12 & 0x3F));
+                filename += (char)(0x80 | (c >> 6 & 0x3F));
+                filename += (char)(0x80 | (c & 0x3F));
+            }
         }
     }
-    return std::string(reinterpret_cast<const char*>(filename));
+    return filename;
 }
@@ -59,6 +59,7 @@ namespace fat32 {
         unsigned int fat_size;
         unsigned int sectors_count;
         unsigned short info_sector;
+        unsigned int root_cluster;
         char label[11];
     };
 
@@ -93,12 +94,33 @@ namespace fat32 {
         std::string filename;
         bool is_directory = false;
         u64 data_offset;
-        entry entry;
+        fat32::entry entry;
     };
 
+    // FAT entry values (28 bits)
+    #define FAT32_ENTRY_MASK 0x0FFFFFFF
+    #define FAT32_EOC 0x0FFFFFF8 // end of chain (>=)
+
+    // Short entry reserved byte (lower case name/extension)
+    #define FAT32_LOWER_BASE 0x08
+    #define FAT32_LOWER_EXT 0x10
+
+    // Contiguous clusters (offset & size in partition)
+    typedef struct run run;
+    struct run {
+        u64 offset;
+        u64 size;
+    };
+
+    inline u32 first_cluster(const entry &entry) { return (u32)entry.cluster_hi << 16 | entry.first_cluster; }
+
     void read_boot_sector(BYTE *cluster, fs_attr *fat32_attr);
-    void parse_dir_table(BYTE *cluster, std::vector<dir_entry> *entries);
+    void parse_dir_table(BYTE *cluster, std::vector<dir_entry> *entries, size_t length = CLUSTER_SIZE);
+    // Allocation bitmap for count FAT entries (bit set if entry is not free, (count + 63) / 64 words)
+    // Returns allocated entries count
+    u64 alloc_bitmap(const u32 *entries, size_t count, u64 *bitmap);
     std::string get_long_filename(BYTE *buffer, int offset, int length);
+    std::string get_short_filename(const entry &entry);
 
     static u8 fat32_default_boot_sector[90] = {
     0xEB, 0x58, 0x90, 0x50, 0x4B, 0x57, 0x49, 0x4E, 0x34, 0x2E, 0x31, 0x00,
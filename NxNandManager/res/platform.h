@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Platform headers. On Windows this is the Win32 API, on POSIX systems the
+// few Win32 types & constants used by the core classes are defined here so
+// NxHandle can switch to its POSIX I/O backend (pread/pwrite).
+
+#ifndef __platform_h__
+#define __platform_h__
+
+#if defined(_WIN32)
+
+#include <windows.h>
+#include <winioctl.h>
+#include <Wincrypt.h>
+#include <tchar.h>
+#include <malloc.h>
+
+#define PATH_SEPARATOR "\\"
+
+#else
+
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <wchar.h>
+#include <limits.h>
+#include <string.h>
+
+typedef uint32_t DWORD;
+typedef int BOOL;
+typedef unsigned long ULONG;
+typedef wchar_t WCHAR;
+typedef wchar_t TCHAR;
+typedef wchar_t* LPWSTR;
+typedef unsigned char* LPBYTE;
+typedef int HANDLE;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#ifndef MAX_PATH
+#define MAX_PATH 260
+#endif
+#define _MAX_PATH MAX_PATH
+
+#define INVALID_HANDLE_VALUE -1
+#define GENERIC_READ  0x80000000
+#define GENERIC_WRITE 0x40000000
+
+#define PATH_SEPARATOR "/"
+
+#define ARRAYSIZE(a) (sizeof(a) / sizeof(a[0]))
+
+typedef union _LARGE_INTEGER {
+    struct {
+        DWORD LowPart;
+        int32_t HighPart;
+    };
+    long long QuadPart;
+} LARGE_INTEGER;
+
+typedef struct _DISK_GEOMETRY {
+    LARGE_INTEGER Cylinders;
+    int MediaType;
+    DWORD TracksPerCylinder;
+    DWORD SectorsPerTrack;
+    DWORD BytesPerSector;
+} DISK_GEOMETRY;
+
+// Power management (no-op)
+#define ES_CONTINUOUS        0x80000000
+#define ES_SYSTEM_REQUIRED   0x00000001
+#define ES_AWAYMODE_REQUIRED 0x00000040
+static inline DWORD SetThreadExecutionState(DWORD) { return 0; }
+
+static inline void Sleep(DWORD ms) { usleep((useconds_t)ms * 1000); }
+
+#endif
+
+#endif
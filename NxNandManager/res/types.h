@@ -49,6 +49,8 @@
 #define MD5_HASH  3
 #define COPY      4
 #define RESTORE   5
+#define MD5_HASH_FULL 6 // MD5_HASH + full re-read of output
+#define EXTRACT   7
 //Errors
 
 typedef unsigned char u8;
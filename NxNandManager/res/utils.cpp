@@ -1,27 +1,42 @@
 #include "utils.h"
+#if !defined(_WIN32)
+#include <fcntl.h>
+#endif
 using namespace std;
 
 wchar_t *convertCharArrayToLPCWSTR(const char* charArray)
 {
 	wchar_t* wString = new wchar_t[4096];
+#if defined(_WIN32)
 	MultiByteToWideChar(CP_UTF8, 0, charArray, -1, wString, 4096); //Fix issue #1
+#else
+	mbstowcs(wString, charArray, 4096);
+#endif
 	return wString;
 }
 
 LPWSTR convertCharArrayToLPWSTR(const char* charArray)
 {
+#if defined(_WIN32)
 	int nSize = MultiByteToWideChar(CP_UTF8, 0, charArray, -1, NULL, 0); //Fix issue #1
 	LPWSTR wString = new WCHAR[nSize];
 	MultiByteToWideChar(CP_UTF8, 0, charArray, -1, wString, 4096);
+#else
+	size_t nSize = mbstowcs(NULL, charArray, 0) + 1;
+	LPWSTR wString = new WCHAR[nSize];
+	mbstowcs(wString, charArray, nSize);
+#endif
 	return wString;
 }
 
+#if defined(_WIN32)
 u64 GetFilePointerEx (HANDLE hFile) {
 	LARGE_INTEGER liOfs={0};
 	LARGE_INTEGER liNew={0};
 	SetFilePointerEx(hFile, liOfs, &liNew, FILE_CURRENT);
 	return liNew.QuadPart;
 }
+#endif
 
 unsigned long sGetFileSize(std::string filename)
 {
@@ -32,6 +47,10 @@ unsigned long sGetFileSize(std::string filename)
 
 std::string GetLastErrorAsString()
 {
+#if !defined(_WIN32)
+	if (!errno) return std::string();
+	return std::string(strerror(errno));
+#else
 	//Get the error message, if any.
 	DWORD errorMessageID = ::GetLastError();
 	if (errorMessageID == 0) return std::string(); //No error message has been recorded
@@ -52,6 +71,7 @@ std::string GetLastErrorAsString()
 	LocalFree(messageBuffer);
 
 	return message;
+#endif
 }
 
 
@@ -293,6 +313,7 @@ char * flipAndCodeBytes(const char * str,  int pos, int flip, char * buf)
 	return buf;
 }
 
+#if defined(_WIN32)
 std::string ExePath()
 {
 	wchar_t buffer[MAX_PATH];
@@ -311,10 +332,11 @@ HMODULE GetCurrentModule()
 
 	return hModule;
 }
+#endif
 
 bool file_exists(const wchar_t * fileName)
 {
-#if defined(__MINGW32__) || defined(__MINGW64__) || defined(__MSYS__)
+#if defined(__MINGW32__) || defined(__MINGW64__) || defined(__MSYS__) || !defined(_WIN32)
 	char buffer[_MAX_PATH];
 	std::wcstombs(buffer, fileName, _MAX_PATH);
 	std::ifstream infile(buffer);
@@ -324,6 +346,66 @@ bool file_exists(const wchar_t * fileName)
 	return infile.good();
 }
 
+// Create new file with given size, unwritten ranges are left as holes (read as zeros)
+bool create_sparse_file(const char *file, u64 size)
+{
+#if defined(_WIN32)
+	HANDLE hFile = CreateFileA(file, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	// Not supported by FAT32/exFAT volumes, file is fully allocated then
+	DWORD junk;
+	DeviceIoControl(hFile, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &junk, NULL);
+
+	LARGE_INTEGER li;
+	li.QuadPart = size;
+	BOOL success = SetFilePointerEx(hFile, li, NULL, FILE_BEGIN) && SetEndOfFile(hFile);
+	CloseHandle(hFile);
+	return success;
+#else
+	int fd = open(file, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		return false;
+
+	bool success = !ftruncate(fd, (off_t)size);
+	close(fd);
+	return success;
+#endif
+}
+
+// Commit file data to disk (written through another handle or stream)
+bool sync_file(const char *file)
+{
+#if defined(_WIN32)
+	HANDLE hFile = CreateFileA(file, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	BOOL success = FlushFileBuffers(hFile);
+	CloseHandle(hFile);
+	return success;
+#else
+	int fd = open(file, O_WRONLY);
+	if (fd < 0)
+		return false;
+
+	bool success = !fsync(fd);
+	close(fd);
+	return success;
+#endif
+}
+
+// Create directory (success if it already exists)
+bool create_dir(const char *path)
+{
+#if defined(_WIN32)
+	return CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+	return !mkdir(path, 0755) || (errno == EEXIST && is_dir(path));
+#endif
+}
+
 const std::string WHITESPACE = " \n\r\t\f\v";
 
 std::string ltrim(const std::string& s)
@@ -354,13 +436,15 @@ int digit_to_int(char d)
 
 bool is_file(const char* path) {
 	struct stat buf;
-	stat(path, &buf);
+	if (stat(path, &buf))
+		return false;
 	return S_ISREG(buf.st_mode);
 }
 
 bool is_dir(const char* path) {
 	struct stat buf;
-	stat(path, &buf);
+	if (stat(path, &buf))
+		return false;
 	return S_ISDIR(buf.st_mode);
 }
 
@@ -517,3 +601,24 @@ DWORD crc32Hash(const void *data, DWORD size)
 }
 
 u32 u32_val(u8* buf) { return *(u32*)buf; }
+
+void* malloc_aligned(size_t size, size_t alignment)
+{
+#if defined(_WIN32)
+	return _aligned_malloc(size, alignment);
+#else
+	void *ptr = nullptr;
+	if (posix_memalign(&ptr, alignment, size))
+		return nullptr;
+	return ptr;
+#endif
+}
+
+void free_aligned(void* ptr)
+{
+#if defined(_WIN32)
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
@@ -5,11 +5,10 @@
 extern bool isdebug;
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <string>
 #include <sys/types.h>
-#include <windows.h>
-#include <winioctl.h>
-#include <Wincrypt.h>
+#include "platform.h"
 #include "types.h"
 #include <sys/stat.h>
 #include <iostream>
@@ -19,7 +18,6 @@ extern bool isdebug;
 #include <wchar.h>
 #include <algorithm>
 #include <sstream>
-#include <tchar.h>
 #include <locale>
 #include <codecvt>
 
@@ -39,8 +37,8 @@ struct ProgressInfo {
     int percent = 0;
 };
 
-// MinGW
-#if defined(__MINGW32__) || defined(__MINGW64__) || defined(__MSYS__)
+// MinGW & POSIX
+#if defined(__MINGW32__) || defined(__MINGW64__) || defined(__MSYS__) || !defined(_WIN32)
 #define strcpy_s strcpy
 #define sprintf_s snprintf
 #endif
@@ -67,7 +65,6 @@ struct ProgressInfo {
 #define ERR_WORK_RUNNING		   -1014
 #define ERR_WHILE_COPY			   -1015
 #define NO_MORE_BYTES_TO_COPY      -1016
-#define ERR_RESTORE_TO_SPLIT	   -1017
 #define ERR_DECRYPT_CONTENT		   -1018
 #define ERR_RESTORE_CRYPTO_MISSING -1019
 #define ERR_CRYPTO_KEY_MISSING	   -1020
@@ -90,6 +87,12 @@ struct ProgressInfo {
 #define ERR_WHILE_WRITE			   -1037
 #define ERR_PART_CREATE_FAILED	   -1038
 #define ERR_USER_ABORT             -1039
+#define ERR_MISSING_CHUNK          -1040
+#define ERR_INVALID_BASE           -1041
+#define ERR_INVALID_MANIFEST       -1042
+#define ERR_INVALID_JOURNAL        -1043
+#define ERR_JOURNAL_MISMATCH       -1044
+#define ERR_PATH_NOT_FOUND         -1045
 
 typedef struct ErrorLabel ErrorLabel;
 struct ErrorLabel {
@@ -105,7 +108,6 @@ static ErrorLabel ErrorLabelArr[] =
 	{ ERR_NO_SPACE_LEFT, "Output disk : not enough space !"},
 	{ ERR_CRYPTO_MD5, "Crypto provider error"},
 	{ ERR_MD5_COMPARE, "Data integrity error : checksums are differents.\nAn error must have occurred during the copy"},
-	{ ERR_RESTORE_TO_SPLIT, "Restore to splitted dump is not supported"},
 	{ ERR_WHILE_COPY, "An error occured during copy"},
 	{ ERR_IO_MISMATCH, "Input type/size doesn't match output size/type"},
 	{ ERR_INVALID_INPUT, "Input is not a valid NX storage"},
@@ -126,7 +128,13 @@ static ErrorLabel ErrorLabelArr[] =
 	{ ERR_OUT_DISMOUNT_VOL, "Failed to dismount volume(s) in output drive"},
 	{ ERR_WHILE_WRITE, "Failed to write to output file/disk"},
     { ERR_PART_CREATE_FAILED, "Failed to create new partition"},
-    { ERR_USER_ABORT, "Work aborted by user"}
+    { ERR_USER_ABORT, "Work aborted by user"},
+    { ERR_MISSING_CHUNK, "Backup chunk missing or corrupted in repository"},
+    { ERR_INVALID_BASE, "Base dump (-base) is not a valid NX storage"},
+    { ERR_INVALID_MANIFEST, "Manifest is missing or invalid"},
+    { ERR_INVALID_JOURNAL, "Journal is missing or invalid (nothing to resume)"},
+    { ERR_JOURNAL_MISMATCH, "Journal was written for another operation (input type/size, output, options)"},
+    { ERR_PATH_NOT_FOUND, "Path not found in partition (or broken cluster chain)"}
 };
 
 typedef struct KeySet KeySet;
@@ -146,7 +154,9 @@ void dbg_wprintf (const wchar_t *format, ...);
 
 wchar_t *convertCharArrayToLPCWSTR(const char* charArray);
 LPWSTR convertCharArrayToLPWSTR(const char* charArray);
+#if defined(_WIN32)
 u64 GetFilePointerEx (HANDLE hFile);
+#endif
 unsigned long sGetFileSize(std::string filename);
 std::string GetLastErrorAsString();
 std::string hexStr(unsigned char *data, int len);
@@ -156,9 +166,14 @@ std::string GetReadableElapsedTime(std::chrono::duration<double> elapsed_seconds
 void throwException(int rc, const char* errorStr=NULL);
 void throwException(const char* errorStr=NULL, void* p_arg1 = NULL, void* p_arg2 = NULL);
 char * flipAndCodeBytes(const char * str, int pos, int flip, char * buf);
+#if defined(_WIN32)
 std::string ExePath();
 HMODULE GetCurrentModule();
+#endif
 bool file_exists(const wchar_t *fileName);
+bool create_sparse_file(const char *file, u64 size);
+bool sync_file(const char *file);
+bool create_dir(const char *path);
 int digit_to_int(char d);
 
 static DWORD crc32table[256];
@@ -243,6 +258,10 @@ bool is_dir(const char* path);
 int parseKeySetFile(const char *keyset_file, KeySet *biskeys);
 u32 u32_val(u8* buf);
 
+// Page aligned buffers (required for O_DIRECT)
+void* malloc_aligned(size_t size, size_t alignment = 0x1000);
+void free_aligned(void* ptr);
+
 template<typename M> inline void* GetMethodPointer(M ptr)
 {
     return *reinterpret_cast<void**>(&ptr);
@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "xxh3.h"
+
+// Port of the scalar XXH3_64bits code path from xxHash (Yann Collet, BSD 2-Clause)
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME32_2 0x85EBCA77U
+#define PRIME32_3 0xC2B2AE3DU
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+#define PRIME_MX1 0x165667919E3779F9ULL
+#define PRIME_MX2 0x9FB21C651E98DF25ULL
+
+#define STRIPES_PER_BLOCK ((XXH3_SECRET_SIZE - XXH3_STRIPE_LEN) / 8)
+#define SECRET_LASTACC_START 7
+#define SECRET_MERGEACCS_START 11
+#define MIDSIZE_STARTOFFSET 3
+#define MIDSIZE_LASTOFFSET 17
+
+static const u8 kSecret[XXH3_SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static inline u32 read32(const u8 *p)
+{
+    return (u32)p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static inline u64 read64(const u8 *p)
+{
+    return (u64)read32(p) | ((u64)read32(p + 4) << 32);
+}
+
+static inline u64 rotl64(u64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline u32 swap32(u32 x)
+{
+    return ((x << 24) & 0xff000000) | ((x << 8) & 0x00ff0000) | ((x >> 8) & 0x0000ff00) | ((x >> 24) & 0x000000ff);
+}
+
+static inline u64 swap64(u64 x)
+{
+    return ((u64)swap32((u32)x) << 32) | swap32((u32)(x >> 32));
+}
+
+// 64x64 -> 128 bits multiply, folded (lo ^ hi)
+static inline u64 mul128_fold64(u64 lhs, u64 rhs)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = (unsigned __int128)lhs * rhs;
+    return (u64)product ^ (u64)(product >> 64);
+#else
+    u64 lo_lo = (lhs & 0xFFFFFFFF) * (rhs & 0xFFFFFFFF);
+    u64 hi_lo = (lhs >> 32) * (rhs & 0xFFFFFFFF);
+    u64 lo_hi = (lhs & 0xFFFFFFFF) * (rhs >> 32);
+    u64 hi_hi = (lhs >> 32) * (rhs >> 32);
+    u64 cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    u64 upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    u64 lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+    return lower ^ upper;
+#endif
+}
+
+static inline u64 xxh64_avalanche(u64 h)
+{
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline u64 avalanche(u64 h)
+{
+    h ^= h >> 37;
+    h *= PRIME_MX1;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline u64 rrmxmx(u64 h, u64 len)
+{
+    h ^= rotl64(h, 49) ^ rotl64(h, 24);
+    h *= PRIME_MX2;
+    h ^= (h >> 35) + len;
+    h *= PRIME_MX2;
+    return h ^ (h >> 28);
+}
+
+static inline u64 mix16B(const u8 *input, const u8 *secret)
+{
+    return mul128_fold64(read64(input) ^ read64(secret), read64(input + 8) ^ read64(secret + 8));
+}
+
+static u64 hash_0to16(const u8 *input, size_t len)
+{
+    if (len > 8)
+    {
+        u64 lo = read64(input) ^ (read64(kSecret + 24) ^ read64(kSecret + 32));
+        u64 hi = read64(input + len - 8) ^ (read64(kSecret + 40) ^ read64(kSecret + 48));
+        u64 acc = len + swap64(lo) + hi + mul128_fold64(lo, hi);
+        return avalanche(acc);
+    }
+    if (len >= 4)
+    {
+        u64 input64 = read32(input + len - 4) + ((u64)read32(input) << 32);
+        u64 keyed = input64 ^ (read64(kSecret + 8) ^ read64(kSecret + 16));
+        return rrmxmx(keyed, len);
+    }
+    if (len)
+    {
+        u32 combined = ((u32)input[0] << 16) | ((u32)input[len >> 1] << 24) | (u32)input[len - 1] | ((u32)len << 8);
+        u64 keyed = (u64)combined ^ (u64)(read32(kSecret) ^ read32(kSecret + 4));
+        return xxh64_avalanche(keyed);
+    }
+    return xxh64_avalanche(read64(kSecret + 56) ^ read64(kSecret + 64));
+}
+
+static u64 hash_17to128(const u8 *input, size_t len)
+{
+    u64 acc = len * PRIME64_1;
+    if (len > 32)
+    {
+        if (len > 64)
+        {
+            if (len > 96)
+            {
+                acc += mix16B(input + 48, kSecret + 96);
+                acc += mix16B(input + len - 64, kSecret + 112);
+            }
+            acc += mix16B(input + 32, kSecret + 64);
+            acc += mix16B(input + len - 48, kSecret + 80);
+        }
+        acc += mix16B(input + 16, kSecret + 32);
+        acc += mix16B(input + len - 32, kSecret + 48);
+    }
+    acc += mix16B(input, kSecret);
+    acc += mix16B(input + len - 16, kSecret + 16);
+    return avalanche(acc);
+}
+
+static u64 hash_129to240(const u8 *input, size_t len)
+{
+    u64 acc = len * PRIME64_1;
+    int rounds = (int)len / 16;
+    for (int i(0); i < 8; i++)
+        acc += mix16B(input + 16 * i, kSecret + 16 * i);
+    acc = avalanche(acc);
+    for (int i(8); i < rounds; i++)
+        acc += mix16B(input + 16 * i, kSecret + 16 * (i - 8) + MIDSIZE_STARTOFFSET);
+    acc += mix16B(input + len - 16, kSecret + 136 - MIDSIZE_LASTOFFSET);
+    return avalanche(acc);
+}
+
+static inline void accumulate_512(u64 *acc, const u8 *input, const u8 *secret)
+{
+    for (int i(0); i < 8; i++)
+    {
+        u64 data_val = read64(input + 8 * i);
+        u64 data_key = data_val ^ read64(secret + 8 * i);
+        acc[i ^ 1] += data_val;
+        acc[i] += (u64)(u32)data_key * (data_key >> 32);
+    }
+}
+
+static inline void scramble(u64 *acc, const u8 *secret)
+{
+    for (int i(0); i < 8; i++)
+    {
+        u64 a = acc[i];
+        a ^= a >> 47;
+        a ^= read64(secret + 8 * i);
+        a *= PRIME32_1;
+        acc[i] = a;
+    }
+}
+
+static u64 merge_accs(const u64 *acc, const u8 *secret, u64 start)
+{
+    u64 result = start;
+    for (int i(0); i < 4; i++)
+        result += mul128_fold64(acc[2 * i] ^ read64(secret + 16 * i), acc[2 * i + 1] ^ read64(secret + 16 * i + 8));
+    return avalanche(result);
+}
+
+void XXH3Hasher::reset()
+{
+    m_acc[0] = PRIME32_3; m_acc[1] = PRIME64_1; m_acc[2] = PRIME64_2; m_acc[3] = PRIME64_3;
+    m_acc[4] = PRIME64_4; m_acc[5] = PRIME32_2; m_acc[6] = PRIME64_5; m_acc[7] = PRIME32_1;
+    m_buff_len = 0;
+    m_stripes = 0;
+    m_total_len = 0;
+}
+
+// Stripes are only consumed when more input follows them, so a block is
+// scrambled as soon as it's complete
+void XXH3Hasher::consumeStripes(u64 *acc, size_t *stripes, const u8 *input, size_t count)
+{
+    for (size_t n(0); n < count; n++)
+    {
+        accumulate_512(acc, input + n * XXH3_STRIPE_LEN, kSecret + *stripes * 8);
+        if (++*stripes == STRIPES_PER_BLOCK)
+        {
+            scramble(acc, kSecret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN);
+            *stripes = 0;
+        }
+    }
+}
+
+void XXH3Hasher::update(const void *data, size_t length)
+{
+    const u8 *input = (const u8 *)data;
+    m_total_len += length;
+
+    // Not enough data to consume the buffer
+    if (m_buff_len + length <= XXH3_BUFF_SIZE)
+    {
+        memcpy(m_buffer + m_buff_len, input, length);
+        m_buff_len += length;
+        return;
+    }
+
+    // Complete & consume buffer (more input follows)
+    if (m_buff_len)
+    {
+        size_t fill = XXH3_BUFF_SIZE - m_buff_len;
+        memcpy(m_buffer + m_buff_len, input, fill);
+        input += fill;
+        length -= fill;
+        consumeStripes(m_acc, &m_stripes, m_buffer, XXH3_BUFF_SIZE / XXH3_STRIPE_LEN);
+        memcpy(m_last, m_buffer + XXH3_BUFF_SIZE - XXH3_STRIPE_LEN, XXH3_STRIPE_LEN);
+        m_buff_len = 0;
+    }
+
+    // Consume input directly, keep 1 to XXH3_BUFF_SIZE bytes
+    if (length > XXH3_BUFF_SIZE)
+    {
+        size_t count = (length - XXH3_BUFF_SIZE + XXH3_STRIPE_LEN - 1) / XXH3_STRIPE_LEN;
+        consumeStripes(m_acc, &m_stripes, input, count);
+        input += count * XXH3_STRIPE_LEN;
+        length -= count * XXH3_STRIPE_LEN;
+        memcpy(m_last, input - XXH3_STRIPE_LEN, XXH3_STRIPE_LEN);
+    }
+
+    memcpy(m_buffer, input, length);
+    m_buff_len = length;
+}
+
+u64 XXH3Hasher::digest()
+{
+    if (m_total_len <= 16)
+        return hash_0to16(m_buffer, (size_t)m_total_len);
+    if (m_total_len <= 128)
+        return hash_17to128(m_buffer, (size_t)m_total_len);
+    if (m_total_len <= 240)
+        return hash_129to240(m_buffer, (size_t)m_total_len);
+
+    // Long input, consume remaining stripes on a copy of the state
+    u64 acc[8];
+    size_t stripes = m_stripes;
+    memcpy(acc, m_acc, sizeof(acc));
+    consumeStripes(acc, &stripes, m_buffer, (m_buff_len - 1) / XXH3_STRIPE_LEN);
+
+    // Last stripe (may overlap already consumed input)
+    u8 last[XXH3_STRIPE_LEN];
+    const u8 *last_stripe = m_buffer + m_buff_len - XXH3_STRIPE_LEN;
+    if (m_buff_len < XXH3_STRIPE_LEN)
+    {
+        size_t catchup = XXH3_STRIPE_LEN - m_buff_len;
+        memcpy(last, m_last + XXH3_STRIPE_LEN - catchup, catchup);
+        memcpy(last + catchup, m_buffer, m_buff_len);
+        last_stripe = last;
+    }
+    accumulate_512(acc, last_stripe, kSecret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN - SECRET_LASTACC_START);
+
+    return merge_accs(acc, kSecret + SECRET_MERGEACCS_START, m_total_len * PRIME64_1);
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __xxh3_h__
+#define __xxh3_h__
+
+#include <cstddef>
+#include "types.h"
+
+#define XXH3_STRIPE_LEN 64
+#define XXH3_SECRET_SIZE 192
+#define XXH3_BUFF_SIZE 256  // must be >= 240 (short inputs are hashed in one shot)
+
+// Streaming XXH3 64 bits (seed 0, default secret), same output as xxhsum -H3
+class XXH3Hasher
+{
+    // Constructors
+    public:
+        XXH3Hasher() { reset(); };
+
+    // Member variables
+    private:
+        u64 m_acc[8];
+        u8 m_buffer[XXH3_BUFF_SIZE];
+        u8 m_last[XXH3_STRIPE_LEN]; // last stripe of consumed input
+        size_t m_buff_len;
+        size_t m_stripes;           // stripes consumed in current block
+        u64 m_total_len;
+
+    // Member methods
+    private:
+        void consumeStripes(u64 *acc, size_t *stripes, const u8 *input, size_t count);
+
+    public:
+        void reset();
+        void update(const void *data, size_t length);
+        u64 digest();
+};
+
+#endif
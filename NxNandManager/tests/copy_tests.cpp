@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <string.h>
+#include <sys/stat.h>
+#include "../NxStorage.h"
+#include "test.h"
+#include "fixtures.h"
+
+static std::vector<u8> fileRegion(const std::string &path, u64 offset, u64 length)
+{
+    std::vector<u8> data;
+    readFile(path, &data);
+    if (offset + length > data.size())
+        return std::vector<u8>();
+    return std::vector<u8>(data.begin() + (size_t)offset, data.begin() + (size_t)(offset + length));
+}
+
+// Overwrite length bytes at offset with random data
+static void damage(const std::string &path, u64 offset, size_t length, u32 seed)
+{
+    std::vector<u8> junk = randomBytes(length, seed);
+    std::fstream file(path, std::fstream::in | std::fstream::out | std::fstream::binary);
+    file.seekp((std::streamoff)offset);
+    file.write((const char *)junk.data(), (std::streamsize)junk.size());
+}
+
+TEST(copy_rawnand_dump)
+{
+    const NxtRawnand &rawnand = rawnandFixture();
+    NxStorage storage(rawnand.path.c_str());
+    REQUIRE(storage.type == RAWNAND);
+
+    for (int crypto_mode : { NO_CRYPTO, MD5_HASH })
+    {
+        std::string out = workPath(crypto_mode == MD5_HASH ? "rawnand_md5.bin" : "rawnand.bin");
+        CHECK(storage.dumpToFile(out.c_str(), crypto_mode, noProgress) == SUCCESS);
+        CHECK(sameContent(out, rawnand.path));
+    }
+}
+
+TEST(copy_rawnand_restore)
+{
+    const NxtRawnand &rawnand = rawnandFixture();
+    std::string copy = copyFixture(rawnand.path, "restore_rawnand.bin");
+    damage(copy, rawnand.safe_offset + 0x4000, 0x123456, 800);
+    damage(copy, rawnand.system_offset + 0x200000, 0x10000, 801);
+
+    NxStorage input(rawnand.path.c_str());
+    NxStorage output(copy.c_str());
+    REQUIRE(output.type == RAWNAND);
+    CHECK(output.restoreFromStorage(&input, NO_CRYPTO, noProgress) == SUCCESS);
+    CHECK(sameContent(copy, rawnand.path));
+}
+
+TEST(copy_partition_dump_restore)
+{
+    const NxtRawnand &rawnand = rawnandFixture();
+    NxStorage input(rawnand.path.c_str());
+    NxPartition *safe = input.getNxPartition(SAFE);
+    REQUIRE(nullptr != safe);
+
+    std::string out = workPath("SAFE.bin");
+    REQUIRE(safe->dumpToFile(out.c_str(), MD5_HASH) == SUCCESS);
+    std::vector<u8> dump;
+    REQUIRE(readFile(out, &dump));
+    CHECK(dump == fileRegion(rawnand.path, rawnand.safe_offset, rawnand.safe_size));
+
+    // Partition dump restored into a damaged RAWNAND
+    std::string copy = copyFixture(rawnand.path, "restore_safe.bin");
+    damage(copy, rawnand.safe_offset + 0x100000, 0x80000, 802);
+    NxStorage safe_dump(out.c_str());
+    CHECK(safe_dump.type == SAFE);
+    NxStorage output(copy.c_str());
+    REQUIRE(nullptr != output.getNxPartition(SAFE));
+    CHECK(output.getNxPartition(SAFE)->restoreFromStorage(&safe_dump, NO_CRYPTO) == SUCCESS);
+    CHECK(sameContent(copy, rawnand.path));
+}
+
+TEST(copy_partition_decrypt)
+{
+    const NxtRawnand &rawnand = rawnandFixture(), &encrypted = encryptedFixture();
+    NxStorage input(encrypted.path.c_str());
+    REQUIRE(input.setKeys(encrypted.keyset.c_str()) == SUCCESS);
+    REQUIRE(!input.badCrypto());
+
+    const struct { int type; u64 offset, size; const char *out; } parts[2] = {
+        { SAFE, rawnand.safe_offset, rawnand.safe_size, "SAFE.dec" },
+        { SYSTEM, rawnand.system_offset, rawnand.system_size, "SYSTEM.dec" }
+    };
+    for (const auto &part : parts)
+    {
+        NxPartition *partition = input.getNxPartition(part.type);
+        REQUIRE(nullptr != partition);
+        std::string out = workPath(part.out);
+        CHECK(partition->dumpToFile(out.c_str(), DECRYPT) == SUCCESS);
+        std::vector<u8> dump;
+        CHECK(readFile(out, &dump));
+        CHECK(dump == fileRegion(rawnand.path, part.offset, part.size));
+    }
+}
+
+TEST(copy_partition_encrypt)
+{
+    const NxtRawnand &rawnand = rawnandFixture(), &encrypted = encryptedFixture();
+    std::string plain = workPath("SAFE.plain");
+    REQUIRE(writeFile(plain, fileRegion(rawnand.path, rawnand.safe_offset, rawnand.safe_size)));
+    NxStorage input(plain.c_str());
+    REQUIRE(input.type == SAFE);
+    REQUIRE(input.setKeys(encrypted.keyset.c_str()) == SUCCESS);
+
+    // Partition dump
+    std::string out = workPath("SAFE.enc");
+    CHECK(input.getNxPartition(SAFE)->dumpToFile(out.c_str(), ENCRYPT) == SUCCESS);
+    std::vector<u8> dump;
+    CHECK(readFile(out, &dump));
+    CHECK(dump == fileRegion(encrypted.path, rawnand.safe_offset, rawnand.safe_size));
+
+    // Restored (encrypted) into a damaged RAWNAND
+    std::string copy = copyFixture(encrypted.path, "restore_safe.enc");
+    damage(copy, rawnand.safe_offset + 0x100000, 0x200000, 803);
+    NxStorage output(copy.c_str());
+    REQUIRE(output.setKeys(encrypted.keyset.c_str()) == SUCCESS);
+    CHECK(output.getNxPartition(SAFE)->restoreFromStorage(&input, ENCRYPT) == SUCCESS);
+    CHECK(sameContent(copy, encrypted.path));
+}
+
+TEST(copy_sparse_partition)
+{
+    // Plain partition (verified) & decrypted partition
+    const NxtRawnand &rawnand = rawnandFixture(), &encrypted = encryptedFixture();
+    const struct { const NxtRawnand *source; int crypto_mode; const char *out; } dumps[2] = {
+        { &rawnand, MD5_HASH, "SYSTEM.sparse" },
+        { &encrypted, DECRYPT, "SYSTEM.sparse.dec" }
+    };
+    for (const auto &dump : dumps)
+    {
+        NxStorage input(dump.source->path.c_str());
+        if (!dump.source->keyset.empty())
+            REQUIRE(input.setKeys(dump.source->keyset.c_str()) == SUCCESS);
+        input.setSparseOutput(true);
+        std::string out = workPath(dump.out);
+        CHECK(input.getNxPartition(SYSTEM)->dumpToFile(out.c_str(), dump.crypto_mode) == SUCCESS);
+
+        std::vector<u8> data;
+        CHECK(readFile(out, &data));
+        CHECK(data == fileRegion(rawnand.path, rawnand.system_offset, rawnand.system_size));
+#if !defined(_WIN32)
+        // Free clusters (most of SYSTEM) are holes
+        struct stat buf;
+        CHECK(!stat(out.c_str(), &buf) && (u64)buf.st_blocks * 512 < rawnand.system_size / 2);
+#endif
+    }
+}
+
+#if !defined(_WIN32)
+// Copy of a fixture, zero clusters are left as holes
+static std::string sparseCopy(const std::string &path, const std::string &name)
+{
+    std::vector<u8> data, zeros(CLUSTER_SIZE, 0);
+    readFile(path, &data);
+    std::string copy = workPath(name);
+    create_sparse_file(copy.c_str(), data.size());
+    std::fstream file(copy, std::fstream::in | std::fstream::out | std::fstream::binary);
+    for (size_t offset = 0; offset < data.size(); offset += CLUSTER_SIZE)
+    {
+        size_t length = std::min((size_t)CLUSTER_SIZE, data.size() - offset);
+        if (memcmp(&data[offset], zeros.data(), length))
+        {
+            file.seekp((std::streamoff)offset);
+            file.write((const char *)&data[offset], (std::streamsize)length);
+        }
+    }
+    return copy;
+}
+
+static u64 allocatedBytes(const std::string &path)
+{
+    struct stat buf;
+    return stat(path.c_str(), &buf) ? 0 : (u64)buf.st_blocks * 512;
+}
+
+TEST(copy_delta_restore)
+{
+    // Holes stay holes if identical (zero) clusters are not written
+    const NxtRawnand &rawnand = rawnandFixture();
+    NxStorage input(rawnand.path.c_str());
+    for (bool delta : { true, false })
+    {
+        std::string copy = sparseCopy(rawnand.path, delta ? "delta_restore.bin" : "full_restore.bin");
+        damage(copy, rawnand.safe_offset + 0x4000, 0x8000, 804);
+        damage(copy, rawnand.system_offset + 0x100000, 0x4000, 805);
+        u64 allocated = allocatedBytes(copy);
+        {
+            NxStorage output(copy.c_str());
+            output.setDeltaRestore(delta);
+            CHECK(output.restoreFromStorage(&input, NO_CRYPTO, noProgress) == SUCCESS);
+        }
+        CHECK(sameContent(copy, rawnand.path));
+        if (delta)
+            CHECK(allocatedBytes(copy) <= allocated + 0x10000);
+        else
+            CHECK(allocatedBytes(copy) >= rawnand.size);
+    }
+
+    // Partition restore
+    std::string copy = sparseCopy(rawnand.path, "delta_restore_system.bin");
+    damage(copy, rawnand.system_offset + 0x200000, 0x4000, 806);
+    u64 allocated = allocatedBytes(copy);
+    {
+        NxStorage output(copy.c_str());
+        output.setDeltaRestore(true);
+        CHECK(output.getNxPartition(SYSTEM)->restoreFromStorage(&input, NO_CRYPTO) == SUCCESS);
+    }
+    CHECK(sameContent(copy, rawnand.path));
+    CHECK(allocatedBytes(copy) <= allocated + 0x10000);
+}
+#endif
+
+TEST(copy_restore_full_verify)
+{
+    const NxtRawnand &rawnand = rawnandFixture();
+    std::string copy = copyFixture(rawnand.path, "restore_verify.bin");
+    damage(copy, rawnand.system_offset + 0x300000, 0x20000, 803);
+
+    // Restored data is read back & compared with input (FULL_MD5SUM)
+    NxStorage input(rawnand.path.c_str());
+    NxStorage output(copy.c_str());
+    REQUIRE(output.type == RAWNAND);
+    CHECK(output.restoreFromStorage(&input, MD5_HASH_FULL, noProgress) == SUCCESS);
+    CHECK(sameContent(copy, rawnand.path));
+
+    damage(copy, rawnand.safe_offset + 0x100000, 0x8000, 804);
+    NxStorage input2(rawnand.path.c_str());
+    NxStorage output2(copy.c_str());
+    REQUIRE(nullptr != output2.getNxPartition(SAFE));
+    CHECK(output2.getNxPartition(SAFE)->restoreFromStorage(&input2, MD5_HASH_FULL) == SUCCESS);
+    CHECK(sameContent(copy, rawnand.path));
+}
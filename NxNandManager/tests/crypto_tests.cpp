@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <openssl/evp.h>
+#include "../NxCrypto.h"
+#include "test.h"
+#include "fixtures.h"
+
+static char s_crypto_key[] = "000102030405060708090a0b0c0d0e0f";
+static char s_tweak_key[] = "f0e1d2c3b4a5968778695a4b3c2d1e0f";
+
+// Baseline algorithm (one cluster at a time, byte-wise tweak, 16 bytes per ECB call)
+static void referenceCrypt(bool encrypt, unsigned char *data, size_t cluster)
+{
+    std::vector<unsigned char> crypto_key = hex_string::decode(s_crypto_key);
+    std::vector<unsigned char> tweak_key = hex_string::decode(s_tweak_key);
+    unsigned char tweak[16] = { 0 };
+    int outl;
+
+    for (int i = 0; i < 8; i++)
+        tweak[15 - i] = (unsigned char)((u64)cluster >> (8 * i));
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    EVP_EncryptInit_ex(ctx, EVP_aes_128_ecb(), nullptr, tweak_key.data(), nullptr);
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    EVP_EncryptUpdate(ctx, tweak, &outl, tweak, 16);
+
+    EVP_CipherInit_ex(ctx, EVP_aes_128_ecb(), nullptr, crypto_key.data(), nullptr, encrypt ? 1 : 0);
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    for (size_t i = 0; i < CLUSTER_SIZE; i += 16)
+    {
+        for (int j = 0; j < 16; j++)
+            data[i + j] ^= tweak[j];
+        EVP_CipherUpdate(ctx, data + i, &outl, data + i, 16);
+        for (int j = 0; j < 16; j++)
+            data[i + j] ^= tweak[j];
+
+        // Multiply by x in GF(2^128)
+        bool carry = (tweak[15] & 0x80) != 0;
+        for (int j = 15; j > 0; j--)
+            tweak[j] = (unsigned char)((tweak[j] << 1) | (tweak[j - 1] >> 7));
+        tweak[0] = (unsigned char)((tweak[0] << 1) ^ (carry ? 0x87 : 0));
+    }
+    EVP_CIPHER_CTX_free(ctx);
+}
+
+TEST(crypto_batched_matches_reference)
+{
+    const size_t first = 7, count = 37;
+    std::vector<u8> plain = randomBytes(CLUSTER_SIZE * count, 1);
+    std::vector<u8> batched = plain, single = plain, reference = plain;
+
+    NxCrypto crypto(s_crypto_key, s_tweak_key);
+    crypto.encrypt(batched.data(), first, count);
+    for (size_t c = 0; c < count; c++)
+    {
+        crypto.encrypt(&single[c * CLUSTER_SIZE], first + c);
+        referenceCrypt(true, &reference[c * CLUSTER_SIZE], first + c);
+    }
+    CHECK(batched == reference);
+    CHECK(single == reference);
+
+    crypto.decrypt(batched.data(), first, count);
+    CHECK(batched == plain);
+    for (size_t c = 0; c < count; c++)
+        referenceCrypt(false, &reference[c * CLUSTER_SIZE], first + c);
+    CHECK(reference == plain);
+}
+
+TEST(crypto_copy_uses_same_keys)
+{
+    std::vector<u8> data = randomBytes(CLUSTER_SIZE * 4, 2);
+    std::vector<u8> copy_data = data;
+
+    NxCrypto crypto(s_crypto_key, s_tweak_key);
+    NxCrypto copy(crypto);
+    crypto.encrypt(data.data(), 100, 4);
+    copy.encrypt(copy_data.data(), 100, 4);
+    CHECK(data == copy_data);
+
+    // Buffers grown by a larger run must not change smaller ones
+    std::vector<u8> big = randomBytes(CLUSTER_SIZE * 64, 3);
+    copy.encrypt(big.data(), 0, 64);
+    copy.decrypt(copy_data.data(), 100, 4);
+    CHECK(copy_data == randomBytes(CLUSTER_SIZE * 4, 2));
+}
+
+// Standard XTS (key1 = crypto, key2 = tweak, IV = big endian sector number)
+static void opensslXts(bool encrypt, unsigned char *data, size_t cluster)
+{
+    std::vector<unsigned char> key = hex_string::decode(s_crypto_key);
+    std::vector<unsigned char> tweak_key = hex_string::decode(s_tweak_key);
+    key.insert(key.end(), tweak_key.begin(), tweak_key.end());
+    unsigned char iv[16] = { 0 };
+    int outl;
+
+    for (int i = 0; i < 8; i++)
+        iv[15 - i] = (unsigned char)((u64)cluster >> (8 * i));
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    EVP_CipherInit_ex(ctx, EVP_aes_128_xts(), nullptr, key.data(), iv, encrypt ? 1 : 0);
+    EVP_CipherUpdate(ctx, data, &outl, data, CLUSTER_SIZE);
+    EVP_CIPHER_CTX_free(ctx);
+}
+
+TEST(crypto_matches_openssl_xts)
+{
+    const size_t clusters[4] = { 0, 1, 0x1234, (size_t)0xFFFFFFFF + 2 };
+    NxCrypto crypto(s_crypto_key, s_tweak_key);
+
+    for (size_t cluster : clusters)
+    {
+        std::vector<u8> data = randomBytes(CLUSTER_SIZE, (u32)cluster + 10);
+        std::vector<u8> expected = data;
+        crypto.encrypt(data.data(), cluster);
+        opensslXts(true, expected.data(), cluster);
+        CHECK(data == expected);
+
+        opensslXts(false, expected.data(), cluster);
+        crypto.decrypt(data.data(), cluster);
+        CHECK(data == expected);
+    }
+}
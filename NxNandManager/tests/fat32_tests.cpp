@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include "../NxStorage.h"
+#include "../NxFile.h"
+#include "test.h"
+#include "fixtures.h"
+
+static const std::vector<u8>& systemFile(const char *path)
+{
+    return rawnandFixture().system_files.at(path);
+}
+
+TEST(fat32_cluster_runs)
+{
+    for (const NxtRawnand *source : { &rawnandFixture(), &encryptedFixture() })
+    {
+        NxStorage storage(source->path.c_str());
+        if (!source->keyset.empty())
+            REQUIRE(storage.setKeys(source->keyset.c_str()) == SUCCESS);
+        NxPartition *system = storage.getNxPartition(SYSTEM);
+        REQUIRE(nullptr != system);
+
+        std::vector<fat32::dir_entry> entries;
+        REQUIRE(system->fat32_dir(&entries, "/"));
+        auto frag = std::find_if(entries.begin(), entries.end(), [](const fat32::dir_entry &e) { return e.filename == "frag.bin"; });
+        REQUIRE(frag != entries.end());
+
+        // Fragmented file has a run per cluster
+        std::vector<fat32::run> runs;
+        CHECK(system->fat32_getRuns(*frag, &runs));
+        CHECK(runs.size() == 6);
+        u64 length = 0;
+        for (const fat32::run &run : runs)
+            length += run.size;
+        const std::vector<u8> &expected = systemFile("/frag.bin");
+        REQUIRE(length >= expected.size());
+        std::vector<u8> data((size_t)length);
+        CHECK(system->fat32_readRuns(runs, data.data()));
+        CHECK(std::equal(expected.begin(), expected.end(), data.begin()));
+
+        // Sub directory
+        CHECK(system->fat32_dir(&entries, "/Contents/registered"));
+        CHECK(entries.size() == 3);
+    }
+}
+
+TEST(fat32_root_listing)
+{
+    const NxtRawnand &rawnand = rawnandFixture();
+    NxStorage storage(rawnand.path.c_str());
+    NxPartition *system = storage.getNxPartition(SYSTEM);
+    REQUIRE(nullptr != system);
+    CHECK(!system->isEncryptedPartition());
+
+    const NxDirectory *root = system->fat32_getDir("/");
+    REQUIRE(nullptr != root);
+    std::vector<std::string> names;
+    for (const fat32::dir_entry &entry : root->entries)
+        names.push_back(entry.filename);
+    std::vector<std::string> expected = rawnand.system_root;
+    std::sort(names.begin(), names.end());
+    std::sort(expected.begin(), expected.end());
+    CHECK(names == expected);
+
+    // Deleted entry is not listed, directories are flagged
+    CHECK(nullptr == system->fat32_getEntry("/ghost file.txt"));
+    REQUIRE(nullptr != system->fat32_getEntry("/Contents"));
+    CHECK(system->fat32_getEntry("/Contents")->is_directory);
+
+    const NxDirectory *registered = system->fat32_getDir("/Contents/registered");
+    REQUIRE(nullptr != registered);
+    CHECK(registered->entries.size() == 3);
+}
+
+TEST(fat32_free_space)
+{
+    // FAT is read through the pipeline (decrypted if needed)
+    for (const NxtRawnand *source : { &rawnandFixture(), &encryptedFixture() })
+    {
+        NxStorage storage(source->path.c_str());
+        if (!source->keyset.empty())
+            REQUIRE(storage.setKeys(source->keyset.c_str()) == SUCCESS);
+        NxPartition *system = storage.getNxPartition(SYSTEM);
+        REQUIRE(nullptr != system);
+        CHECK(system->freeSpace() == rawnandFixture().system_free);
+
+        // Not computed for SAFE
+        CHECK(storage.getNxPartition(SAFE)->freeSpace() == 0);
+    }
+}
+
+TEST(fat32_file_read)
+{
+    for (const NxtRawnand *source : { &rawnandFixture(), &encryptedFixture() })
+    {
+        NxStorage storage(source->path.c_str());
+        if (!source->keyset.empty())
+            REQUIRE(storage.setKeys(source->keyset.c_str()) == SUCCESS);
+        NxPartition *system = storage.getNxPartition(SYSTEM);
+        REQUIRE(nullptr != system);
+
+        const char *paths[3] = { "/frag.bin", "/Contents/registered/c5fbb49f2e3648c8cfca758020c53ecb.nca", "/readme.txt" };
+        for (const char *path : paths)
+        {
+            const std::vector<u8> &expected = systemFile(path);
+            std::unique_ptr<NxFile> file = system->fat32_open(path);
+            REQUIRE(nullptr != file && file->isOpen());
+            CHECK(file->size() == expected.size());
+
+            // Whole file, then odd offsets & lengths (partial clusters, across clusters, past end)
+            std::vector<u8> data(expected.size() + 100);
+            DWORD bytesRead = 0;
+            CHECK(file->read(0, data.data(), &bytesRead, (DWORD)data.size()));
+            CHECK(bytesRead == expected.size());
+            CHECK(std::equal(expected.begin(), expected.end(), data.begin()));
+
+            const u64 offsets[4] = { 1, 16383, 16385, expected.size() - 7 };
+            for (u64 offset : offsets)
+            {
+                if (offset >= expected.size())
+                    continue;
+                DWORD length = (DWORD)std::min((u64)20000, expected.size() - offset + 5);
+                CHECK(file->read(offset, data.data(), &bytesRead, length));
+                CHECK(bytesRead == std::min((u64)length, expected.size() - offset));
+                CHECK(std::equal(data.begin(), data.begin() + bytesRead, expected.begin() + offset));
+            }
+        }
+    }
+}
+
+TEST(fat32_long_names)
+{
+    NxStorage storage(rawnandFixture().path.c_str());
+    NxPartition *system = storage.getNxPartition(SYSTEM);
+    REQUIRE(nullptr != system);
+
+    // Multi entry, UTF-8 (2 & 4 bytes), exactly 13 chars, short name with lower case flags
+    CHECK(nullptr != system->fat32_getEntry("/A long file name, with spaces & punctuation - more than 26 chars.txt"));
+    CHECK(nullptr != system->fat32_getEntry("/caf\xC3\xA9 \xC3\xBC.dat"));
+    CHECK(nullptr != system->fat32_getEntry("/emoji \xF0\x9F\x98\x80.bin"));
+    CHECK(nullptr != system->fat32_getEntry("/thirteen_char"));
+    CHECK(nullptr != system->fat32_getEntry("/readme.txt"));
+    CHECK(nullptr != system->fat32_getEntry("/Contents/registered/c5fbb49f2e3648c8cfca758020c53ecb.nca"));
+}
+
+TEST(fat32_extract_files)
+{
+    // Encrypted partition is decrypted by the extractor workers
+    const NxtRawnand &rawnand = rawnandFixture();
+    for (const NxtRawnand *source : { &rawnand, &encryptedFixture() })
+    {
+        NxStorage storage(source->path.c_str());
+        if (!source->keyset.empty())
+            REQUIRE(storage.setKeys(source->keyset.c_str()) == SUCCESS);
+        NxPartition *system = storage.getNxPartition(SYSTEM);
+        REQUIRE(nullptr != system);
+
+        std::string dir = workPath(source->keyset.empty() ? "extract" : "extract_enc");
+        REQUIRE(system->extractFiles("/", dir.c_str()) == SUCCESS);
+        for (const auto &file : rawnand.system_files)
+        {
+            std::vector<u8> data;
+            CHECK(readFile(dir + file.first, &data));
+            CHECK(data == file.second);
+        }
+
+        // Concatenation file is extracted as a single file (parts joined)
+        CHECK(is_file((dir + "/big.nca").c_str()));
+        std::vector<u8> joined;
+        for (const std::vector<u8> &part : rawnand.concat_parts)
+            joined.insert(joined.end(), part.begin(), part.end());
+        CHECK(systemFile("/big.nca") == joined);
+
+        // Single file, output already exists
+        std::string single = dir + "_single";
+        REQUIRE(system->extractFiles("/big.nca", single.c_str()) == SUCCESS);
+        CHECK(sameContent(single + "/big.nca", dir + "/big.nca"));
+        CHECK(system->extractFiles("/big.nca", single.c_str()) == ERR_FILE_ALREADY_EXISTS);
+    }
+}
+
+TEST(fat32_extract_unsafe_names)
+{
+    NxStorage storage(rawnandFixture().path.c_str());
+    NxPartition *safe = storage.getNxPartition(SAFE);
+    REQUIRE(nullptr != safe);
+
+    REQUIRE(makeDir(workPath("unsafe")));
+    const char *dirs[3] = { "/evil1", "/evil2", "/evil3" };
+    for (const char *path : dirs)
+    {
+        std::string out = workPath(std::string("unsafe") + path);
+        CHECK(safe->extractFiles(path, out.c_str()) == ERR_INVALID_OUTPUT);
+    }
+    CHECK(!is_file(workPath("unsafe/evil1/evil1/..").c_str()));
+    CHECK(!is_file(workPath("unsafe/evil2/evil2/a\\b").c_str()));
+    CHECK(!is_dir(workPath("unsafe/evil3/evil3/x").c_str()));
+
+    std::string out = workPath("safe_ok");
+    CHECK(safe->extractFiles("/ok.bin", out.c_str()) == SUCCESS);
+    CHECK(is_file((out + "/ok.bin").c_str()));
+}
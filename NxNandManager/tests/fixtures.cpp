@@ -0,0 +1,543 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <direct.h>
+#endif
+#include <openssl/evp.h>
+#include "../NxStorage.h"
+#include "fixtures.h"
+
+std::string workPath(const std::string &name)
+{
+    return std::string(NXT_WORK_DIR) + "/" + name;
+}
+
+// S_IFREG, S_IFDIR or 0 if path doesn't exist
+static int pathType(const std::string &path)
+{
+    struct stat buf;
+    return stat(path.c_str(), &buf) ? 0 : buf.st_mode & S_IFMT;
+}
+
+bool makeDir(const std::string &path)
+{
+#if defined(_WIN32)
+    return !_mkdir(path.c_str()) || pathType(path) == S_IFDIR;
+#else
+    return !mkdir(path.c_str(), 0755) || pathType(path) == S_IFDIR;
+#endif
+}
+
+bool removeTree(const std::string &path)
+{
+    if (pathType(path) != S_IFDIR)
+        return !remove(path.c_str()) || !pathType(path);
+
+    DIR *dir = opendir(path.c_str());
+    if (nullptr != dir)
+    {
+        for (struct dirent *ent; nullptr != (ent = readdir(dir)); )
+        {
+            std::string name(ent->d_name);
+            if (name != "." && name != "..")
+                removeTree(path + "/" + name);
+        }
+        closedir(dir);
+    }
+    return !rmdir(path.c_str());
+}
+
+size_t countFiles(const std::string &dir)
+{
+    size_t count = 0;
+    DIR *handle = opendir(dir.c_str());
+    if (nullptr == handle)
+        return 0;
+
+    for (struct dirent *ent; nullptr != (ent = readdir(handle)); )
+    {
+        std::string name(ent->d_name), path = dir + "/" + name;
+        if (name == "." || name == "..")
+            continue;
+        count += pathType(path) == S_IFDIR ? countFiles(path) : 1;
+    }
+    closedir(handle);
+    return count;
+}
+
+// xorshift32, same seed gives same content
+std::vector<u8> randomBytes(size_t length, u32 seed)
+{
+    std::vector<u8> data(length);
+    u32 x = seed ? seed : 1;
+    for (size_t i = 0; i < length; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        data[i] = (u8)x;
+    }
+    return data;
+}
+
+bool writeFile(const std::string &path, const std::vector<u8> &data)
+{
+    std::ofstream out_file(path, std::ofstream::binary);
+    out_file.write((const char *)data.data(), (std::streamsize)data.size());
+    return out_file.good();
+}
+
+bool readFile(const std::string &path, std::vector<u8> *data)
+{
+    std::ifstream in_file(path, std::ifstream::binary | std::ifstream::ate);
+    if (!in_file.good())
+        return false;
+
+    data->resize((size_t)in_file.tellg());
+    in_file.seekg(0);
+    return data->empty() || (bool)in_file.read((char *)data->data(), (std::streamsize)data->size());
+}
+
+std::string copyFixture(const std::string &path, const std::string &name)
+{
+    std::vector<u8> data;
+    readFile(path, &data);
+    std::string copy = workPath(name);
+    writeFile(copy, data);
+    return copy;
+}
+
+bool readParts(const std::string &first_part, std::vector<u8> *data)
+{
+    data->clear();
+    std::string part = first_part;
+    for (std::vector<u8> part_data; !part.empty() && pathType(part) == S_IFREG; part = NxSplitWriter::nextPart(part))
+    {
+        if (!readFile(part, &part_data))
+            return false;
+        data->insert(data->end(), part_data.begin(), part_data.end());
+    }
+    return !data->empty();
+}
+
+bool sameContent(const std::string &file_a, const std::string &file_b)
+{
+    std::vector<u8> a, b;
+    return readFile(file_a, &a) && readFile(file_b, &b) && a == b;
+}
+
+void noProgress(ProgressInfo *pi)
+{
+}
+
+static void put16(u8 *p, u16 value) { memcpy(p, &value, 2); }
+static void put32(u8 *p, u32 value) { memcpy(p, &value, 4); }
+
+// UTF-8 to UTF-16 (surrogate pairs above U+FFFF)
+static std::vector<u16> utf16(const std::string &str)
+{
+    std::vector<u16> units;
+    for (size_t i = 0; i < str.size(); )
+    {
+        u8 c = (u8)str[i];
+        int length = c < 0x80 ? 1 : (c >> 5) == 6 ? 2 : (c >> 4) == 14 ? 3 : 4;
+        u32 code = length == 1 ? c : length == 2 ? c & 0x1F : length == 3 ? c & 0x0F : c & 0x07;
+        for (int k = 1; k < length && i + k < str.size(); k++)
+            code = code << 6 | ((u8)str[i + k] & 0x3F);
+        i += length;
+
+        if (code >= 0x10000)
+        {
+            code -= 0x10000;
+            units.push_back((u16)(0xD800 | code >> 10));
+            units.push_back((u16)(0xDC00 | (code & 0x3FF)));
+        }
+        else units.push_back((u16)code);
+    }
+    return units;
+}
+
+FatImage::FatImage(u32 sectors, u8 sectors_per_cluster)
+{
+    m_spc = sectors_per_cluster;
+
+    // FAT must address every data cluster
+    m_fat_size = 1;
+    for (;;)
+    {
+        m_clusters = (sectors - m_reserved - 2 * m_fat_size) / m_spc;
+        u32 needed = (u32)(((m_clusters + 2) * 4 + NX_BLOCKSIZE - 1) / NX_BLOCKSIZE);
+        if (needed <= m_fat_size)
+            break;
+        m_fat_size = needed;
+    }
+
+    m_image.assign((size_t)sectors * NX_BLOCKSIZE, 0);
+    m_fat.assign((size_t)m_clusters + 2, 0);
+    m_fat[0] = 0x0FFFFFF8;
+    m_fat[1] = 0x0FFFFFFF;
+    m_fat[2] = 0x0FFFFFFF;      // root dir (one cluster)
+    m_dir_used[root()] = 0;
+
+    u8 *bs = m_image.data();
+    memcpy(bs, "\xEB\x58\x90MSWIN4.1", 11);
+    put16(bs + 0x0B, NX_BLOCKSIZE);
+    bs[0x0D] = (u8)m_spc;
+    put16(bs + 0x0E, (u16)m_reserved);
+    bs[0x10] = 2;
+    bs[0x15] = 0xF8;
+    put32(bs + 0x20, sectors);
+    put32(bs + 0x24, m_fat_size);
+    put32(bs + 0x2C, root());
+    put16(bs + 0x30, 1);
+    put16(bs + 0x32, 6);
+    bs[0x42] = 0x29;
+    memcpy(bs + 0x47, "NO NAME    FAT32   ", 19);
+    bs[0x1FE] = 0x55;
+    bs[0x1FF] = 0xAA;
+}
+
+u64 FatImage::clusterOffset(u32 cluster)
+{
+    return (u64)(m_reserved + 2 * m_fat_size) * NX_BLOCKSIZE + (u64)(cluster - 2) * clusterSize();
+}
+
+std::vector<u32> FatImage::allocate(u64 count, bool fragmented)
+{
+    std::vector<u32> chain;
+    for (u64 i = 0; i < count && m_next < m_fat.size(); i++)
+    {
+        chain.push_back(m_next);
+        m_next += fragmented ? 2 : 1;
+    }
+    for (size_t i = 0; i < chain.size(); i++)
+        m_fat[chain[i]] = i + 1 < chain.size() ? chain[i + 1] : 0x0FFFFFFF;
+    return chain;
+}
+
+u8* FatImage::newEntry(u32 dir)
+{
+    u32 &used = m_dir_used[dir];
+    u8 *entry = &m_image[(size_t)clusterOffset(dir) + used];
+    used += 32;
+    return entry;
+}
+
+void FatImage::addEntry(u32 dir, const std::string &long_name, const char *short_name, u8 attributes, u8 reserved, u32 cluster, u32 size, bool deleted)
+{
+    char name[12];
+    if (nullptr == short_name)
+        sprintf(name, "N%07u   ", ++m_short_count);
+    else
+        memcpy(name, short_name, 11);
+
+    // Long name entries, last part first
+    if (!long_name.empty())
+    {
+        u8 checksum = 0;
+        for (int i = 0; i < 11; i++)
+            checksum = (u8)(((checksum & 1) << 7) + (checksum >> 1) + (u8)name[i]);
+
+        std::vector<u16> units = utf16(long_name);
+        int count = (int)(units.size() + 12) / 13;
+        static const int char_offsets[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+        for (int n = count; n > 0; n--)
+        {
+            u8 *lfn = newEntry(dir);
+            lfn[0] = deleted ? 0xE5 : (u8)(n | (n == count ? 0x40 : 0));
+            lfn[11] = 0x0F;
+            lfn[13] = checksum;
+            for (int k = 0; k < 13; k++)
+            {
+                size_t pos = (size_t)(n - 1) * 13 + k;
+                put16(lfn + char_offsets[k], pos < units.size() ? units[pos] : pos == units.size() ? 0x0000 : 0xFFFF);
+            }
+        }
+    }
+
+    u8 *entry = newEntry(dir);
+    memcpy(entry, name, 11);
+    if (deleted)
+        entry[0] = 0xE5;
+    entry[11] = attributes;
+    entry[12] = reserved;
+    put16(entry + 20, (u16)(cluster >> 16));
+    put16(entry + 26, (u16)cluster);
+    put32(entry + 28, size);
+}
+
+u32 FatImage::addDir(u32 parent, const std::string &name, u8 attributes)
+{
+    u32 cluster = allocate(1, false)[0];
+    addEntry(parent, name, nullptr, attributes, 0, cluster, 0);
+
+    // Dot entries (skipped by parser)
+    m_dir_used[cluster] = 0;
+    addEntry(cluster, "", ".          ", 0x10, 0, cluster, 0);
+    addEntry(cluster, "", "..         ", 0x10, 0, parent == root() ? 0 : parent, 0);
+    return cluster;
+}
+
+void FatImage::addFile(u32 parent, const std::string &name, const std::vector<u8> &data, bool fragmented)
+{
+    std::vector<u32> chain = allocate((data.size() + clusterSize() - 1) / clusterSize(), fragmented);
+    for (size_t i = 0; i < chain.size(); i++)
+    {
+        size_t offset = i * (size_t)clusterSize();
+        memcpy(&m_image[(size_t)clusterOffset(chain[i])], &data[offset], std::min(data.size() - offset, (size_t)clusterSize()));
+    }
+    addEntry(parent, name, nullptr, 0x20, 0, chain.empty() ? 0 : chain[0], (u32)data.size());
+}
+
+void FatImage::addShortFile(u32 parent, const char *short_name, u8 reserved, const std::vector<u8> &data)
+{
+    std::vector<u32> chain = allocate((data.size() + clusterSize() - 1) / clusterSize(), false);
+    for (size_t i = 0; i < chain.size(); i++)
+    {
+        size_t offset = i * (size_t)clusterSize();
+        memcpy(&m_image[(size_t)clusterOffset(chain[i])], &data[offset], std::min(data.size() - offset, (size_t)clusterSize()));
+    }
+    addEntry(parent, "", short_name, 0x20, reserved, chain.empty() ? 0 : chain[0], (u32)data.size());
+}
+
+void FatImage::addDeleted(u32 parent, const std::string &name)
+{
+    addEntry(parent, name, nullptr, 0x20, 0, 0, 0, true);
+}
+
+u64 FatImage::freeClusters()
+{
+    u64 count = 0;
+    for (size_t i = 2; i < m_fat.size(); i++)
+        count += m_fat[i] == 0;
+    return count;
+}
+
+const std::vector<u8>& FatImage::image()
+{
+    for (u32 f = 0; f < 2; f++)
+        memcpy(&m_image[(size_t)(m_reserved + f * m_fat_size) * NX_BLOCKSIZE], m_fat.data(), m_fat.size() * 4);
+    return m_image;
+}
+
+std::string boot0Fixture()
+{
+    std::string path = workPath("fixture_boot0.bin");
+    if (pathType(path) == S_IFREG)
+        return path;
+
+    static const u8 boot_data_version[12] = { 0x01, 0x00, 0x21, 0x00, 0x0E, 0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00 };
+    std::vector<u8> data = randomBytes(0x400000, 0xB0070);
+    memcpy(&data[0x530], boot_data_version, sizeof(boot_data_version));
+    writeFile(path, data);
+    return path;
+}
+
+// Sectors
+#define NXT_PRODINFO_START  34
+#define NXT_SAFE_START      0x800
+#define NXT_SAFE_SECTORS    0x20000     // SAFE size (64 MB)
+#define NXT_SYSTEM_START    (NXT_SAFE_START + NXT_SAFE_SECTORS)
+#define NXT_SYSTEM_SECTORS  0x8000
+#define NXT_BACKUP_ENTRIES  (NXT_SYSTEM_START + NXT_SYSTEM_SECTORS)
+#define NXT_BACKUP_GPT      (NXT_BACKUP_ENTRIES + 32)
+
+static void gptEntry(GptEntry *entry, const char *name, u64 lba_start, u64 lba_end)
+{
+    memset(entry, 0, sizeof(GptEntry));
+    entry->type_guid[0] = 1;
+    entry->part_guid[0] = (u8)lba_start;
+    entry->lba_start = lba_start;
+    entry->lba_end = lba_end;
+    for (int i = 0; name[i] && i < 36; i++)
+        entry->name[i] = (u16)name[i];
+}
+
+static void gptHeader(GptHeader *hdr, u64 my_lba, u64 alt_lba, u64 part_ent_lba)
+{
+    memset(hdr, 0, sizeof(GptHeader));
+    memcpy(&hdr->signature, "EFI PART", 8);
+    hdr->revision = 0x10000;
+    hdr->size = 92;
+    hdr->my_lba = my_lba;
+    hdr->alt_lba = alt_lba;
+    hdr->first_use_lba = NXT_PRODINFO_START;
+    hdr->last_use_lba = NXT_BACKUP_ENTRIES - 1;
+    hdr->part_ent_lba = part_ent_lba;
+    hdr->num_part_ents = 3;
+    hdr->part_ent_size = sizeof(GptEntry);
+}
+
+const NxtRawnand& rawnandFixture()
+{
+    static NxtRawnand fixture;
+    if (!fixture.path.empty())
+        return fixture;
+
+    // SYSTEM : long names (several entries, UTF-8, surrogate pair), short name only,
+    // deleted entry, fragmented file & concatenation file
+    FatImage system(NXT_SYSTEM_SECTORS);
+    u32 contents = system.addDir(system.root(), "Contents");
+    u32 registered = system.addDir(contents, "registered");
+    const char *ncas[3] = { "0a1b2c3d4e5f60718293a4b5c6d7e8f9.nca", "c5fbb49f2e3648c8cfca758020c53ecb.nca", "ffffffff000000001111111122222222.nca" };
+    const size_t nca_sizes[3] = { 20000, 70000, 0 };
+    for (int i = 0; i < 3; i++)
+    {
+        std::vector<u8> data = randomBytes(nca_sizes[i], 100 + i);
+        system.addFile(registered, ncas[i], data);
+        fixture.system_files[std::string("/Contents/registered/") + ncas[i]] = data;
+    }
+
+    auto addRootFile = [&](const std::string &name, const std::vector<u8> &data, bool fragmented) {
+        system.addFile(system.root(), name, data, fragmented);
+        fixture.system_files["/" + name] = data;
+        fixture.system_root.push_back(name);
+    };
+    fixture.system_root.push_back("Contents");
+    system.addDeleted(system.root(), "ghost file.txt");
+    addRootFile("A long file name, with spaces & punctuation - more than 26 chars.txt", randomBytes(1234, 200), false);
+    addRootFile("caf\xC3\xA9 \xC3\xBC.dat", randomBytes(16384, 201), false);
+    addRootFile("emoji \xF0\x9F\x98\x80.bin", randomBytes(100, 202), false);
+    addRootFile("thirteen_char", randomBytes(10, 203), false);
+    addRootFile("frag.bin", randomBytes(5 * 16384 + 4321, 204), true);
+
+    std::vector<u8> readme = randomBytes(300, 205);
+    system.addShortFile(system.root(), "README  TXT", 0x08 | 0x10 /* lower case name & ext */, readme);
+    fixture.system_files["/readme.txt"] = readme;
+    fixture.system_root.push_back("readme.txt");
+
+    u32 big = system.addDir(system.root(), "big.nca", 0x30);
+    fixture.system_root.push_back("big.nca");
+    const size_t part_sizes[3] = { 3 * 16384 + 100, 20000, 777 };
+    std::vector<u8> concatenated;
+    for (int i = 0; i < 3; i++)
+    {
+        char name[3];
+        sprintf(name, "%02d", i);
+        fixture.concat_parts.push_back(randomBytes(part_sizes[i], 300 + i));
+        system.addFile(big, name, fixture.concat_parts.back());
+        concatenated.insert(concatenated.end(), fixture.concat_parts.back().begin(), fixture.concat_parts.back().end());
+    }
+    fixture.system_files["/big.nca"] = concatenated;
+    fixture.system_free = system.freeClusters() * system.clusterSize();
+
+    // SAFE : names that must never reach a host path
+    FatImage safe(NXT_SAFE_SECTORS);
+    safe.addFile(safe.root(), "ok.bin", randomBytes(5000, 400));
+    safe.addFile(safe.addDir(safe.root(), "evil1"), "..", randomBytes(10, 401));
+    safe.addFile(safe.addDir(safe.root(), "evil2"), "a\\b", randomBytes(10, 402));
+    safe.addFile(safe.addDir(safe.root(), "evil3"), "x/y", randomBytes(10, 403));
+
+    // GPT (PRODINFO first) & backup GPT at last sector
+    GptEntry entries[3];
+    gptEntry(&entries[0], "PRODINFO", NXT_PRODINFO_START, NXT_SAFE_START - 1);
+    gptEntry(&entries[1], "SAFE", NXT_SAFE_START, NXT_SYSTEM_START - 1);
+    gptEntry(&entries[2], "SYSTEM", NXT_SYSTEM_START, NXT_BACKUP_ENTRIES - 1);
+    GptHeader primary, backup;
+    gptHeader(&primary, 1, NXT_BACKUP_GPT, 2);
+    gptHeader(&backup, NXT_BACKUP_GPT, 1, NXT_BACKUP_ENTRIES);
+
+    std::vector<u8> prodinfo = randomBytes((size_t)(NXT_SAFE_START - NXT_PRODINFO_START) * NX_BLOCKSIZE, 500);
+    memcpy(prodinfo.data(), "CAL0", 4);
+
+    fixture.path = workPath("fixture_rawnand.bin");
+    fixture.size = (u64)(NXT_BACKUP_GPT + 1) * NX_BLOCKSIZE;
+    fixture.safe_offset = (u64)NXT_SAFE_START * NX_BLOCKSIZE;
+    fixture.safe_size = (u64)NXT_SAFE_SECTORS * NX_BLOCKSIZE;
+    fixture.system_offset = (u64)NXT_SYSTEM_START * NX_BLOCKSIZE;
+    fixture.system_size = (u64)NXT_SYSTEM_SECTORS * NX_BLOCKSIZE;
+    std::ofstream out_file(fixture.path, std::ofstream::binary);
+    auto put = [&](u64 sector, const void *data, size_t length) {
+        out_file.seekp((std::streamoff)(sector * NX_BLOCKSIZE));
+        out_file.write((const char *)data, (std::streamsize)length);
+    };
+    std::vector<u8> zeros(NX_BLOCKSIZE, 0);
+    put(0, zeros.data(), zeros.size());
+    put(1, &primary, sizeof(GptHeader));
+    put(2, entries, sizeof(entries));
+    put(NXT_PRODINFO_START, prodinfo.data(), prodinfo.size());
+    put(NXT_SAFE_START, safe.image().data(), safe.image().size());
+    put(NXT_SYSTEM_START, system.image().data(), system.image().size());
+    put(NXT_BACKUP_ENTRIES, entries, sizeof(entries));
+    memcpy(zeros.data(), &backup, sizeof(GptHeader));
+    put(NXT_BACKUP_GPT, zeros.data(), zeros.size());
+    out_file.close();
+    return fixture;
+}
+
+static const char *s_bis_keys[3][2] = {
+    { "00112233445566778899aabbccddeeff", "0f1e2d3c4b5a69788796a5b4c3d2e1f0" },
+    { "112233445566778899aabbccddeeff00", "1e2d3c4b5a69788796a5b4c3d2e1f00f" },
+    { "2233445566778899aabbccddeeff0011", "2d3c4b5a69788796a5b4c3d2e1f00f1e" }
+};
+
+void xtsCrypt(bool encrypt, int bis_key, u8 *data, u64 first_cluster, u64 count)
+{
+    std::vector<u8> key = hex_string::decode((char *)s_bis_keys[bis_key][0]);
+    std::vector<u8> tweak_key = hex_string::decode((char *)s_bis_keys[bis_key][1]);
+    key.insert(key.end(), tweak_key.begin(), tweak_key.end());
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    for (u64 c = 0; c < count; c++)
+    {
+        // IV is the big endian cluster index
+        u8 iv[16] = { 0 };
+        for (int i = 0; i < 8; i++)
+            iv[15 - i] = (u8)((first_cluster + c) >> (8 * i));
+
+        int outl;
+        u8 *cluster = data + c * CLUSTER_SIZE;
+        EVP_CipherInit_ex(ctx, EVP_aes_128_xts(), nullptr, key.data(), iv, encrypt ? 1 : 0);
+        EVP_CipherUpdate(ctx, cluster, &outl, cluster, CLUSTER_SIZE);
+    }
+    EVP_CIPHER_CTX_free(ctx);
+}
+
+const NxtRawnand& encryptedFixture()
+{
+    static NxtRawnand fixture;
+    if (!fixture.path.empty())
+        return fixture;
+
+    fixture = rawnandFixture();
+    std::vector<u8> data;
+    readFile(fixture.path, &data);
+
+    const u64 parts[3][2] = {
+        { (u64)NXT_PRODINFO_START * NX_BLOCKSIZE, (u64)(NXT_SAFE_START - NXT_PRODINFO_START) * NX_BLOCKSIZE },
+        { fixture.safe_offset, fixture.safe_size },
+        { fixture.system_offset, fixture.system_size }
+    };
+    for (int bis_key = 0; bis_key < 3; bis_key++)
+        xtsCrypt(true, bis_key, &data[(size_t)parts[bis_key][0]], 0, parts[bis_key][1] / CLUSTER_SIZE);
+
+    fixture.path = workPath("fixture_rawnand_enc.bin");
+    writeFile(fixture.path, data);
+
+    fixture.keyset = workPath("fixture_keys.txt");
+    std::ofstream keyset(fixture.keyset);
+    for (int bis_key = 0; bis_key < 3; bis_key++)
+        keyset << "BIS KEY " << bis_key << " (crypt): " << s_bis_keys[bis_key][0] << "\n"
+               << "BIS KEY " << bis_key << " (tweak): " << s_bis_keys[bis_key][1] << "\n";
+    return fixture;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __nxtest_fixtures_h__
+#define __nxtest_fixtures_h__
+
+#include <map>
+#include <string>
+#include <vector>
+#include "../res/types.h"
+#include "../res/utils.h"
+
+// Every file is written under the work directory (created by the runner, removed once tests ran)
+#define NXT_WORK_DIR "nxtests.tmp"
+
+std::string workPath(const std::string &name);
+bool makeDir(const std::string &path);
+bool removeTree(const std::string &path);
+// Regular files in directory (recursive)
+size_t countFiles(const std::string &dir);
+std::vector<u8> randomBytes(size_t length, u32 seed);
+bool writeFile(const std::string &path, const std::vector<u8> &data);
+bool readFile(const std::string &path, std::vector<u8> *data);
+// Copy of a fixture, for tests writing to storage
+std::string copyFixture(const std::string &path, const std::string &name);
+// Content of every part of a split dump, joined
+bool readParts(const std::string &first_part, std::vector<u8> *data);
+bool sameContent(const std::string &file_a, const std::string &file_b);
+void noProgress(ProgressInfo *pi);
+
+// FAT32 image built in memory. Every directory holds one cluster, names are stored as
+// long names (short names are generated), except for addShortFile()
+class FatImage
+{
+    // Constructors
+    public:
+        FatImage(u32 sectors, u8 sectors_per_cluster = 32);
+
+    // Member variables
+    private:
+        std::vector<u8> m_image;
+        std::vector<u32> m_fat;
+        u32 m_spc;
+        u32 m_reserved = 32;
+        u32 m_fat_size;
+        u64 m_clusters;
+        u32 m_next = 3;                 // next free cluster (root is #2)
+        u32 m_short_count = 0;
+        std::map<u32, u32> m_dir_used;  // directory cluster => bytes used
+
+    // Member methods
+    private:
+        u64 clusterOffset(u32 cluster);
+        std::vector<u32> allocate(u64 count, bool fragmented);
+        u8* newEntry(u32 dir);
+        void addEntry(u32 dir, const std::string &long_name, const char *short_name, u8 attributes, u8 reserved, u32 cluster, u32 size, bool deleted = false);
+
+    public:
+        u32 root() { return 2; };
+        // Archive bit is added for concatenation files (0x30)
+        u32 addDir(u32 parent, const std::string &name, u8 attributes = 0x10);
+        // Clusters are interleaved with free ones if fragmented
+        void addFile(u32 parent, const std::string &name, const std::vector<u8> &data, bool fragmented = false);
+        // Short name (11 chars, space padded) only, reserved holds lower case flags
+        void addShortFile(u32 parent, const char *short_name, u8 reserved, const std::vector<u8> &data);
+        // Long name & short entries marked as deleted
+        void addDeleted(u32 parent, const std::string &name);
+        u64 clusterSize() { return (u64)m_spc * NX_BLOCKSIZE; };
+        u64 freeClusters();
+        // Image with both FATs written
+        const std::vector<u8>& image();
+};
+
+// BOOT0 dump (4 MB of random data, boot data version at 0x530)
+std::string boot0Fixture();
+
+// Decrypted RAWNAND (GPT & backup GPT, PRODINFO, SAFE & SYSTEM FAT32 partitions), built once
+typedef struct NxtRawnand NxtRawnand;
+struct NxtRawnand {
+    std::string path;
+    u64 size;
+    std::map<std::string, std::vector<u8>> system_files;   // extracted path ("/" separated) => content
+    std::vector<std::string> system_root;                   // names listed in SYSTEM root
+    std::vector<std::vector<u8>> concat_parts;              // parts of /big.nca
+    u64 system_free;                                        // free bytes in SYSTEM
+    u64 safe_offset, safe_size;
+    u64 system_offset, system_size;
+    std::string keyset;                                     // BIS keys (encrypted fixture)
+};
+const NxtRawnand& rawnandFixture();
+// Same RAWNAND, PRODINFO, SAFE & SYSTEM encrypted with BIS keys 0, 1 & 2
+const NxtRawnand& encryptedFixture();
+// XTS-AES with OpenSSL (cluster index from partition start)
+void xtsCrypt(bool encrypt, int bis_key, u8 *data, u64 first_cluster, u64 count);
+
+#endif
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../NxStorage.h"
+#include "test.h"
+#include "fixtures.h"
+
+TEST(nxa_archive_round_trip)
+{
+    const NxtRawnand &rawnand = rawnandFixture();
+    std::string nxa = workPath("rawnand.nxa"), restored = workPath("rawnand_from_nxa.bin");
+    {
+        NxStorage input(rawnand.path.c_str());
+        REQUIRE(input.type == RAWNAND);
+        REQUIRE(input.dumpToArchive(nxa.c_str(), noProgress) == SUCCESS);
+    }
+
+    NxArchive archive(nxa.c_str());
+    REQUIRE(archive.isValid());
+    CHECK(archive.type() == RAWNAND);
+    REQUIRE(archive.size() == rawnand.size);
+    REQUIRE(create_sparse_file(restored.c_str(), archive.size()));
+    {
+        NxStorage output(restored.c_str());
+        REQUIRE(output.restoreFromArchive(&archive, noProgress) == SUCCESS);
+    }
+    CHECK(sameContent(restored, rawnand.path));
+}
+
+TEST(nxa_archive_encrypted)
+{
+    const NxtRawnand &encrypted = encryptedFixture();
+    std::string nxa = workPath("rawnand_enc.nxa"), restored = workPath("rawnand_enc_from_nxa.bin");
+    {
+        // Keys are needed to read the FATs
+        NxStorage input(encrypted.path.c_str());
+        REQUIRE(input.setKeys(encrypted.keyset.c_str()) == SUCCESS);
+        REQUIRE(input.dumpToArchive(nxa.c_str(), noProgress) == SUCCESS);
+    }
+    std::vector<u8> data;
+    REQUIRE(readFile(nxa, &data));
+    CHECK(data.size() < encrypted.size / 4);
+
+    // Free clusters are regenerated as encrypted zeros
+    NxArchive archive(nxa.c_str());
+    REQUIRE(archive.isValid());
+    REQUIRE(create_sparse_file(restored.c_str(), archive.size()));
+    {
+        NxStorage output(restored.c_str());
+        CHECK(output.restoreFromArchive(&archive, noProgress) == ERR_CRYPTO_KEY_MISSING);
+        output.setKeys(encrypted.keyset.c_str());
+        REQUIRE(output.restoreFromArchive(&archive, noProgress) == SUCCESS);
+    }
+    CHECK(sameContent(restored, encrypted.path));
+}
+
+TEST(nxz_dump_round_trip)
+{
+    std::string boot0 = boot0Fixture(), nxz = workPath("boot0.nxz"), raw = workPath("boot0_from_nxz.bin");
+    {
+        NxStorage input(boot0.c_str());
+        REQUIRE(input.type == BOOT0);
+        input.setCompressOutput(true);
+        REQUIRE(input.dumpToFile(nxz.c_str(), MD5_HASH, noProgress) == SUCCESS);
+    }
+
+    NxStorage compressed(nxz.c_str());
+    CHECK(compressed.type == BOOT0);
+    CHECK(compressed.size() == 0x400000);
+    REQUIRE(nullptr != compressed.nxHandle && compressed.nxHandle->isCompressed());
+    REQUIRE(compressed.dumpToFile(raw.c_str(), NO_CRYPTO, noProgress) == SUCCESS);
+    CHECK(sameContent(raw, boot0));
+}
+
+TEST(nxi_dedup_round_trip)
+{
+    const NxtRawnand &rawnand = rawnandFixture();
+    std::string nxi = workPath("dedup/rawnand.nxi"), nxi2 = workPath("dedup/rawnand2.nxi");
+    std::string restored = workPath("rawnand_from_nxi.bin");
+    REQUIRE(makeDir(workPath("dedup")));
+    {
+        NxStorage input(rawnand.path.c_str());
+        REQUIRE(input.dumpToChunks(nxi.c_str(), noProgress) == SUCCESS);
+    }
+
+    NxChunkIndex index(nxi.c_str());
+    REQUIRE(index.isValid());
+    CHECK(index.type() == RAWNAND);
+    REQUIRE(index.size() == rawnand.size);
+    REQUIRE(create_sparse_file(restored.c_str(), index.size()));
+    {
+        NxStorage output(restored.c_str());
+        REQUIRE(output.restoreFromChunks(&index, noProgress) == SUCCESS);
+    }
+    CHECK(sameContent(restored, rawnand.path));
+
+    // Same content again : every chunk is already in the repository
+    size_t chunk_files = countFiles(NxChunkIndex::repository(nxi.c_str()));
+    CHECK(chunk_files > 0);
+    {
+        NxStorage input(rawnand.path.c_str());
+        REQUIRE(input.dumpToChunks(nxi2.c_str(), noProgress) == SUCCESS);
+    }
+    CHECK(countFiles(NxChunkIndex::repository(nxi.c_str())) == chunk_files);
+}
+
+TEST(nxd_delta_round_trip)
+{
+    std::string boot0 = boot0Fixture(), modified = workPath("boot0_modified.bin");
+    std::string nxd = workPath("boot0.nxd"), raw = workPath("boot0_from_nxd.bin");
+
+    std::vector<u8> data;
+    REQUIRE(readFile(boot0, &data));
+    data[0x10] ^= 0xFF;
+    data[0x200000] ^= 0x55;
+    data[data.size() - 1] ^= 0x01;
+    REQUIRE(writeFile(modified, data));
+    {
+        NxStorage input(modified.c_str());
+        REQUIRE(input.type == BOOT0);
+        REQUIRE(input.dumpToDelta(nxd.c_str(), boot0.c_str(), MD5_HASH, noProgress) == SUCCESS);
+    }
+
+    std::vector<u8> delta;
+    REQUIRE(readFile(nxd, &delta));
+    CHECK(delta.size() < data.size() / 4);
+
+    NxStorage incremental(nxd.c_str());
+    CHECK(incremental.type == BOOT0);
+    REQUIRE(nullptr != incremental.nxHandle && incremental.nxHandle->isDelta());
+    REQUIRE(incremental.dumpToFile(raw.c_str(), NO_CRYPTO, noProgress) == SUCCESS);
+    CHECK(sameContent(raw, modified));
+}
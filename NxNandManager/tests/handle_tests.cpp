@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include "../NxStorage.h"
+#include "test.h"
+#include "fixtures.h"
+
+TEST(handle_open_boot0)
+{
+    std::string boot0 = boot0Fixture();
+    NxStorage storage(boot0.c_str());
+    CHECK(storage.type == BOOT0);
+    CHECK(storage.size() == 0x400000);
+    REQUIRE(nullptr != storage.nxHandle);
+    CHECK(!storage.isDrive());
+}
+
+TEST(handle_read_offsets)
+{
+    const NxtRawnand &rawnand = rawnandFixture();
+    std::vector<u8> expected;
+    REQUIRE(readFile(rawnand.path, &expected));
+
+    NxStorage storage(rawnand.path.c_str());
+    REQUIRE(storage.type == RAWNAND);
+    CHECK(storage.size() == rawnand.size);
+    CHECK(storage.partitions.size() == 3);
+
+    // Unaligned offsets & lengths, last bytes of storage
+    storage.nxHandle->initHandle(NO_CRYPTO);
+    const u64 offsets[4] = { 0, 0x200, 0x12345, rawnand.size - 0x1000 };
+    std::vector<u8> buffer(0x10000);
+    for (u64 offset : offsets)
+    {
+        DWORD length = (DWORD)std::min((u64)0x10000, rawnand.size - offset), bytesRead = 0;
+        CHECK(storage.nxHandle->read(offset, buffer.data(), &bytesRead, length));
+        CHECK(bytesRead == length);
+        CHECK(std::equal(buffer.begin(), buffer.begin() + length, expected.begin() + offset));
+    }
+}
+
+TEST(handle_write_offsets)
+{
+    const NxtRawnand &rawnand = rawnandFixture();
+    std::string copy = copyFixture(rawnand.path, "handle_write.bin");
+    std::vector<u8> expected, patch = randomBytes(0x3000, 20);
+    REQUIRE(readFile(copy, &expected));
+    {
+        NxStorage storage(copy.c_str());
+        REQUIRE(storage.type == RAWNAND);
+        storage.nxHandle->initHandle(NO_CRYPTO);
+        DWORD bytesWrite = 0;
+        CHECK(storage.nxHandle->write((u64)0x100200, patch.data(), &bytesWrite, (DWORD)patch.size()));
+        CHECK(bytesWrite == patch.size());
+    }
+    std::copy(patch.begin(), patch.end(), expected.begin() + 0x100200);
+
+    std::vector<u8> data;
+    REQUIRE(readFile(copy, &data));
+    CHECK(data == expected);
+}
+
+TEST(handle_crypto_clusters)
+{
+    const NxtRawnand &rawnand = rawnandFixture(), &encrypted = encryptedFixture();
+    std::vector<u8> plain;
+    REQUIRE(readFile(rawnand.path, &plain));
+    std::string copy = copyFixture(encrypted.path, "handle_crypto.bin");
+    {
+        NxStorage storage(copy.c_str());
+        REQUIRE(storage.setKeys(encrypted.keyset.c_str()) == SUCCESS);
+        NxPartition *system = storage.getNxPartition(SYSTEM);
+        REQUIRE(nullptr != system);
+
+        // Several clusters in a single read, each decrypted with its own index
+        std::vector<u8> buffer(5 * CLUSTER_SIZE);
+        DWORD bytes = 0;
+        storage.nxHandle->initHandle(DECRYPT, system);
+        CHECK(storage.nxHandle->read((u64)3 * CLUSTER_SIZE, buffer.data(), &bytes, (DWORD)buffer.size()));
+        CHECK(bytes == buffer.size());
+        CHECK(std::equal(buffer.begin(), buffer.end(), plain.begin() + (size_t)(rawnand.system_offset + 3 * CLUSTER_SIZE)));
+
+        // Same for a write
+        buffer = randomBytes(buffer.size(), 900);
+        storage.nxHandle->initHandle(ENCRYPT, system);
+        CHECK(storage.nxHandle->write((u64)7 * CLUSTER_SIZE, buffer.data(), &bytes, (DWORD)buffer.size()));
+        CHECK(bytes == buffer.size());
+    }
+
+    std::vector<u8> written, expected = randomBytes(5 * CLUSTER_SIZE, 900);
+    REQUIRE(readFile(copy, &written));
+    u8 *clusters = &written[(size_t)(rawnand.system_offset + 7 * CLUSTER_SIZE)];
+    xtsCrypt(false, 2, clusters, 7, 5);
+    CHECK(std::equal(expected.begin(), expected.end(), clusters));
+}
+
+// Hand split copy of a fixture, part names are built from a printf format
+static std::vector<std::string> splitFixture(const std::string &path, const char *format, const std::vector<u64> &sizes)
+{
+    std::vector<u8> data;
+    readFile(path, &data);
+    std::vector<std::string> parts;
+    u64 offset = 0;
+    for (size_t i = 0; offset < data.size(); i++)
+    {
+        char name[64];
+        sprintf(name, format, (int)i);
+        u64 size = i < sizes.size() ? sizes[i] : data.size() - offset;
+        parts.push_back(workPath(name));
+        writeFile(parts.back(), std::vector<u8>(data.begin() + (size_t)offset, data.begin() + (size_t)(offset + size)));
+        offset += size;
+    }
+    return parts;
+}
+
+TEST(handle_split_parts)
+{
+    const NxtRawnand &rawnand = rawnandFixture();
+    std::vector<u8> expected;
+    REQUIRE(readFile(rawnand.path, &expected));
+
+    // Both naming schemes, parts of different sizes
+    const char *formats[2] = { "hand_split.bin.%02d", "hand_split%02d.bin" };
+    for (const char *format : formats)
+    {
+        std::vector<std::string> parts = splitFixture(rawnand.path, format, { 0x2000000, 0x1004000, 0x400000 });
+        NxStorage storage(parts[0].c_str());
+        CHECK(storage.type == RAWNAND);
+        CHECK(storage.isSplitted());
+        CHECK(storage.nxHandle->getSplitCount() == (int)parts.size());
+        CHECK(storage.size() == rawnand.size);
+
+        // First & last bytes of every part (in any order)
+        storage.nxHandle->initHandle(NO_CRYPTO);
+        const u64 offsets[6] = { 0x3404000 - 0x1000, 0, 0x2000000, rawnand.size - 0x1000, 0x2000000 - 0x1000, 0x3004000 };
+        std::vector<u8> buffer(0x1000);
+        for (u64 offset : offsets)
+        {
+            DWORD bytesRead = 0;
+            CHECK(storage.nxHandle->read(offset, buffer.data(), &bytesRead, (DWORD)buffer.size()));
+            CHECK(bytesRead == buffer.size());
+            CHECK(std::equal(buffer.begin(), buffer.end(), expected.begin() + (size_t)offset));
+        }
+    }
+}
+
+TEST(handle_split_boundaries)
+{
+    const NxtRawnand &rawnand = rawnandFixture();
+    std::vector<u8> expected;
+    REQUIRE(readFile(rawnand.path, &expected));
+    std::vector<std::string> parts = splitFixture(rawnand.path, "span.bin.%02d", { 0x2000000, 0x1004000 });
+    std::vector<u8> patch = randomBytes(0x20000, 21);
+    {
+        NxStorage storage(parts[0].c_str());
+        REQUIRE(storage.isSplitted());
+        storage.nxHandle->initHandle(NO_CRYPTO);
+
+        // A single read across both boundaries
+        std::vector<u8> buffer(0x1010000);
+        DWORD bytes = 0;
+        CHECK(storage.nxHandle->read((u64)0x1FF8000, buffer.data(), &bytes, (DWORD)buffer.size()));
+        CHECK(bytes == buffer.size());
+        CHECK(std::equal(buffer.begin(), buffer.end(), expected.begin() + 0x1FF8000));
+
+        // Same for a write
+        CHECK(storage.nxHandle->write((u64)0x1FF0000, patch.data(), &bytes, (DWORD)patch.size()));
+        CHECK(bytes == patch.size());
+    }
+    std::copy(patch.begin(), patch.end(), expected.begin() + 0x1FF0000);
+
+    // Parts are written in place, never extended
+    std::vector<u8> joined, part;
+    for (const std::string &path : parts)
+    {
+        REQUIRE(readFile(path, &part));
+        joined.insert(joined.end(), part.begin(), part.end());
+    }
+    CHECK(joined.size() == rawnand.size);
+    CHECK(joined == expected);
+}
+
+TEST(handle_split_restore_partition)
+{
+    // SAFE spans the first two parts
+    const NxtRawnand &rawnand = rawnandFixture();
+    std::vector<u8> damaged;
+    REQUIRE(readFile(rawnand.path, &damaged));
+    std::vector<u8> junk = randomBytes(0x400000, 22);
+    std::copy(junk.begin(), junk.end(), damaged.begin() + 0x1E00000);
+    std::string copy = workPath("restore_split.bin");
+    REQUIRE(writeFile(copy, damaged));
+    std::vector<std::string> parts = splitFixture(copy, "restore_split.bin.%02d", { 0x2000000, 0x1004000 });
+
+    NxStorage input(rawnand.path.c_str());
+    {
+        NxStorage output(parts[0].c_str());
+        REQUIRE(output.isSplitted());
+        REQUIRE(nullptr != output.getNxPartition(SAFE));
+        CHECK(output.getNxPartition(SAFE)->restoreFromStorage(&input, NO_CRYPTO) == SUCCESS);
+    }
+
+    std::vector<u8> joined, part;
+    for (const std::string &path : parts)
+    {
+        REQUIRE(readFile(path, &part));
+        joined.insert(joined.end(), part.begin(), part.end());
+    }
+    CHECK(joined.size() == rawnand.size);
+    std::vector<u8> expected;
+    REQUIRE(readFile(rawnand.path, &expected));
+    CHECK(joined == expected);
+}
+
+TEST(handle_memory_map)
+{
+    const NxtRawnand &rawnand = rawnandFixture(), &encrypted = encryptedFixture();
+    std::vector<u8> expected, buffer(0x10000);
+    REQUIRE(readFile(rawnand.path, &expected));
+    DWORD bytes = 0;
+
+    // Single file & split parts
+    std::vector<std::string> parts = splitFixture(rawnand.path, "mmap.bin.%02d", { 0x2000000 });
+    for (const std::string &path : { rawnand.path, parts[0] })
+    {
+        NxStorage storage(path.c_str());
+        storage.nxHandle->setMemoryMap(true);
+        CHECK(storage.nxHandle->memoryMap());
+        storage.nxHandle->initHandle(NO_CRYPTO);
+        for (u64 offset : { (u64)0x12345, (u64)0x1FF8000, rawnand.size - 0x10000 })
+        {
+            CHECK(storage.nxHandle->read(offset, buffer.data(), &bytes, (DWORD)buffer.size()));
+            CHECK(bytes == buffer.size());
+            CHECK(std::equal(buffer.begin(), buffer.end(), expected.begin() + (size_t)offset));
+        }
+    }
+
+    // Decrypted in place
+    {
+        NxStorage storage(encrypted.path.c_str());
+        REQUIRE(storage.setKeys(encrypted.keyset.c_str()) == SUCCESS);
+        storage.nxHandle->setMemoryMap(true);
+        storage.nxHandle->initHandle(DECRYPT, storage.getNxPartition(SYSTEM));
+        CHECK(storage.nxHandle->read((u64)2 * CLUSTER_SIZE, buffer.data(), &bytes, 3 * CLUSTER_SIZE));
+        CHECK(std::equal(buffer.begin(), buffer.begin() + 3 * CLUSTER_SIZE, expected.begin() + (size_t)(rawnand.system_offset + 2 * CLUSTER_SIZE)));
+    }
+
+    // Dump
+    {
+        NxStorage input(rawnand.path.c_str());
+        input.nxHandle->setMemoryMap(true);
+        std::string out = workPath("mmap_dump.bin");
+        CHECK(input.dumpToFile(out.c_str(), MD5_HASH, noProgress) == SUCCESS);
+        CHECK(sameContent(out, rawnand.path));
+    }
+
+    // Mapping stays coherent with writes to the same file
+    std::string copy = copyFixture(rawnand.path, "mmap_write.bin");
+    NxStorage storage(copy.c_str());
+    storage.nxHandle->setMemoryMap(true);
+    storage.nxHandle->initHandle(NO_CRYPTO);
+    CHECK(storage.nxHandle->read((u64)0x200000, buffer.data(), &bytes, (DWORD)buffer.size()));
+    std::vector<u8> patch = randomBytes(buffer.size(), 23);
+    CHECK(storage.nxHandle->write((u64)0x200000, patch.data(), &bytes, (DWORD)patch.size()));
+    CHECK(storage.nxHandle->read((u64)0x200000, buffer.data(), &bytes, (DWORD)buffer.size()));
+    CHECK(buffer == patch);
+}
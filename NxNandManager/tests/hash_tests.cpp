@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include "../NxHash.h"
+#include "test.h"
+#include "fixtures.h"
+
+// Known answers (input byte i is i % 251, as in BLAKE3 official test vectors),
+// xxh3 digest is the canonical (big endian) form. Last length spans several worker threads
+typedef struct HashVector HashVector;
+struct HashVector {
+    size_t length;
+    const char *sums[4];  // indexed by algorithm
+};
+static const HashVector s_vectors[] = {
+    { 0, { "d41d8cd98f00b204e9800998ecf8427e",
+      "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+      "2d06800538d394c2", "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262" } },
+    { 1, { "93b885adfe0da089cdf634904fd59f71",
+      "6e340b9cffb37a989ca544e6bb780a2c78901d3fb33738768511a30617afa01d",
+      "c44bdff4074eecdb", "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213" } },
+    { 63, { "48a6295221902e8e0938f773a7185e72",
+      "29af2686fd53374a36b0846694cc342177e428d1647515f078784d69cdb9e488",
+      "aaa5f0fb98a36ae8", "e9bc37a594daad83be9470df7f7b3798297c3d834ce80ba85d6e207627b7db7b" } },
+    { 64, { "b2d3f56bc197fd985d5965079b5e7148",
+      "fdeab9acf3710362bd2658cdc9a29e8f9c757fcf9811603a8c447cd1d9151108",
+      "6187eb9089b0ed55", "4eed7141ea4a5cd4b788606bd23f46e212af9cacebacdc7d1f4c6dc7f2511b98" } },
+    { 65, { "8bd7053801c768420faf816fadba971c",
+      "4bfd2c8b6f1eec7a2afeb48b934ee4b2694182027e6d0fc075074f2fabb31781",
+      "6928c76ce90422d0", "de1e5fa0be70df6d2be8fffd0e99ceaa8eb6e8c93a63f2d8d1c30ecb6b263dee" } },
+    { 1023, { "7437d7a881387db7c41cf6930ab5e35d",
+      "1c5e88a585b61754df6137d66632a7348557a88358afc401b0a0a4fc427104a9",
+      "d3d91d80ac495685", "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11" } },
+    { 1024, { "9ee0a0e0c0bc0f1ff29d663d1fdf0743",
+      "2bce1ba628720664be4b9fdd77aae0678e5f0f3f02fc6ff641ec879094f6a404",
+      "e5d78bafa45b2aa5", "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7" } },
+    { 1025, { "3f3789452b88cb32b8cbfbafe715e29a",
+      "bc0b6b10b89b9487a12fda2a8cc13194e7091c217aabf8b92846274026f4bcd0",
+      "e95c42288f28186e", "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444" } },
+    { 2048, { "1544ef7a46131a30cf328f55979db73d",
+      "b2a8170614e23194ae2951423d601987f518ce2f11205d7b0b708080103b9f76",
+      "25339063db861586", "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a" } },
+    { 8192, { "5756928d3feb9c830c61f92b56416d95",
+      "25df2449b2e5a35fea14e02a7158e283801a1069c9f84631b9a9dacb2f809a7f",
+      "40a71c16bbe37322", "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63" } },
+    { 102400, { "1a0f81547e5ba2e9c4a4b94a74731993",
+      "74588b7f0bcc354ac14d9cf199fa3a20c05f0c7293b9075b2f2e146e718de800",
+      "1428e17f1cac2837", "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085" } },
+    { 4194307, { "4eb3cb40b29217875872fde6b100e432",
+      "895f5c8bffde3e96961ff7f1ba6f5fe37eb2efb049cbf5f86a4305c0a1689c3d",
+      "7f0b1996e3a1d5dc", "739c6c1bdbad3d0e5ce6b2e51abf0cfa37b015dc956a9990b3a7cd59f76e7432" } },
+};
+
+static std::vector<u8> vectorInput(size_t length)
+{
+    std::vector<u8> input(length);
+    for (size_t i = 0; i < length; i++)
+        input[i] = (u8)(i % 251);
+    return input;
+}
+
+TEST(hash_known_answers)
+{
+    for (const HashVector &vector : s_vectors)
+    {
+        std::vector<u8> input = vectorInput(vector.length);
+        for (int algorithm = HASH_MD5; algorithm <= HASH_BLAKE3; algorithm++)
+        {
+            NxHash hash(algorithm);
+            hash.update(input.data(), input.size());
+            std::string sum = hash.checksum();
+            if (sum != vector.sums[algorithm])
+                printf("    %s, %d bytes : %s\n", NxHash::getAlgorithmName(algorithm), (int)vector.length, sum.c_str());
+            CHECK(sum == vector.sums[algorithm]);
+        }
+    }
+}
+
+TEST(hash_incremental)
+{
+    // Updates not aligned on blocks, chunks or thread runs
+    const HashVector &vector = s_vectors[sizeof(s_vectors) / sizeof(s_vectors[0]) - 1];
+    std::vector<u8> input = vectorInput(vector.length);
+    const size_t pieces[6] = { 1, 63, 1000, 0x10000 + 5, 0x200000 - 1, 0 };
+    for (int algorithm = HASH_MD5; algorithm <= HASH_BLAKE3; algorithm++)
+    {
+        NxHash hash(algorithm);
+        size_t offset = 0;
+        for (int i = 0; offset < input.size(); i = (i + 1) % 6)
+        {
+            size_t length = pieces[i] ? std::min(pieces[i], input.size() - offset) : input.size() - offset;
+            hash.update(&input[offset], length);
+            offset += length;
+        }
+        CHECK(hash.checksum() == vector.sums[algorithm]);
+    }
+}
+
+TEST(hash_algorithm_names)
+{
+    const char *names[4] = { "md5", "sha256", "xxh3", "blake3" };
+    for (int algorithm = HASH_MD5; algorithm <= HASH_BLAKE3; algorithm++)
+    {
+        CHECK(NxHash::getAlgorithm(names[algorithm]) == algorithm);
+        CHECK(!strcmp(NxHash::getAlgorithmName(algorithm), names[algorithm]));
+    }
+    CHECK(NxHash::getAlgorithm("XXH3") == HASH_XXH3);
+    CHECK(NxHash::getAlgorithm("crc32") == -1);
+}
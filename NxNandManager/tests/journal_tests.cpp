@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fstream>
+#include "../NxStorage.h"
+#include "../NxJournal.h"
+#include "test.h"
+#include "fixtures.h"
+
+#define NXT_JOURNAL_INTERVAL 0x100000
+
+static NxJournalInfo journalInfo()
+{
+    NxJournalInfo info;
+    info.operation = "dump";
+    info.input = "/dev/mmcblk1";
+    info.type = "FULL NAND";
+    info.size = 0x480000;
+    info.crypto_mode = MD5_HASH;
+    info.split_size = 0x200000;
+    return info;
+}
+
+// Journal with a checkpoint every MB for data (interrupted before last byte)
+static std::string writeJournal(const std::vector<u8> &data)
+{
+    std::string path = NxJournal::path(workPath("journal.bin").c_str());
+    NxJournal journal(path.c_str(), journalInfo(), NXT_JOURNAL_INTERVAL);
+    journal.start();
+    for (size_t offset = 0; offset < data.size(); offset += 0x40000)
+    {
+        journal.update(&data[offset], 0x40000);
+        if (journal.due())
+            journal.checkpoint();
+    }
+    if (journal.pending())
+        journal.checkpoint();
+    journal.close(false);
+    return path;
+}
+
+static u64 replay(NxJournal &journal, const std::vector<u8> &data, u64 limit, std::vector<u8> *consumed)
+{
+    size_t pos = 0;
+    return journal.replay(limit, [&](u8 *buffer, DWORD length) {
+        if (pos + length > data.size())
+            return false;
+        memcpy(buffer, &data[pos], length);
+        pos += length;
+        return true;
+    }, [&](const u8 *buffer, DWORD length) {
+        consumed->insert(consumed->end(), buffer, buffer + length);
+    });
+}
+
+static void rewriteJournal(const std::string &path, const std::string &from, const std::string &to)
+{
+    std::ifstream in_file(path);
+    std::string content((std::istreambuf_iterator<char>(in_file)), std::istreambuf_iterator<char>());
+    in_file.close();
+    size_t pos = content.find(from);
+    if (pos != std::string::npos)
+        content.replace(pos, from.length(), to);
+    std::ofstream(path) << content;
+}
+
+TEST(journal_replay)
+{
+    std::vector<u8> data = randomBytes(0x480000, 11), consumed;
+    std::string path = writeJournal(data);
+
+    // Every checkpoint (last one at end of data)
+    NxJournal journal(path.c_str());
+    REQUIRE(journal.isValid());
+    CHECK(replay(journal, data, data.size(), &consumed) == data.size());
+    CHECK(consumed == data);
+
+    // Limited to what is on output
+    NxJournal limited(path.c_str());
+    consumed.clear();
+    CHECK(replay(limited, data, 0x280000, &consumed) == 0x200000);
+    CHECK(limited.offset() == 0x200000);
+    CHECK(consumed.size() == 0x200000);
+
+    // Output doesn't match from 2.5 MB : resume at 2 MB
+    std::vector<u8> corrupted = data;
+    corrupted[0x280000] ^= 0x01;
+    NxJournal damaged(path.c_str());
+    consumed.clear();
+    CHECK(replay(damaged, corrupted, corrupted.size(), &consumed) == 0x200000);
+
+    // Output is shorter than journal
+    std::vector<u8> truncated(data.begin(), data.begin() + 0x180000);
+    NxJournal short_output(path.c_str());
+    consumed.clear();
+    CHECK(replay(short_output, truncated, data.size(), &consumed) == 0x100000);
+}
+
+TEST(journal_corruption_detected)
+{
+    std::vector<u8> data = randomBytes(0x480000, 12);
+    std::string path = writeJournal(data);
+    {
+        NxJournal journal(path.c_str());
+        REQUIRE(journal.isValid());
+    }
+
+    // Unordered checkpoints
+    rewriteJournal(path, "checkpoint 2097152", "checkpoint 1048575");
+    NxJournal unordered(path.c_str());
+    CHECK(!unordered.isValid());
+
+    // Checkpoint past size
+    path = writeJournal(data);
+    rewriteJournal(path, "checkpoint 2097152", "checkpoint 99999999999");
+    NxJournal past_size(path.c_str());
+    CHECK(!past_size.isValid());
+
+    // Bad magic, missing interval
+    path = writeJournal(data);
+    rewriteJournal(path, "NXJOURNAL", "NXJOURNAX");
+    NxJournal bad_magic(path.c_str());
+    CHECK(!bad_magic.isValid());
+    path = writeJournal(data);
+    rewriteJournal(path, "interval", "#");
+    NxJournal no_interval(path.c_str());
+    CHECK(!no_interval.isValid());
+
+    // Bad digest : journal is valid but no checkpoint matches past it
+    path = writeJournal(data);
+    rewriteJournal(path, "checkpoint 1048576 ", "checkpoint 1048576 0");
+    NxJournal bad_digest(path.c_str());
+    REQUIRE(bad_digest.isValid());
+    std::vector<u8> consumed;
+    CHECK(replay(bad_digest, data, data.size(), &consumed) == 0);
+}
+
+TEST(journal_removed_when_done)
+{
+    std::string path = NxJournal::path(workPath("done.bin").c_str());
+    NxJournal journal(path.c_str(), journalInfo(), NXT_JOURNAL_INTERVAL);
+    journal.start();
+    std::vector<u8> data = randomBytes(NXT_JOURNAL_INTERVAL, 13);
+    journal.update(data.data(), (DWORD)data.size());
+    journal.checkpoint();
+    journal.close(true);
+    CHECK(!is_file(path.c_str()));
+}
+
+static NxStorage *s_interrupted;
+static void stopAt40MB(ProgressInfo *pi)
+{
+    if (pi->bytesCount >= 0x2800000)
+        s_interrupted->stopWork = true;
+}
+
+TEST(journal_resume_split_dump)
+{
+    const NxtRawnand &rawnand = rawnandFixture();
+    std::string out = workPath("resume.bin"), first_part = NxSplitWriter::firstPart(out.c_str());
+    std::string journal_path = NxJournal::path(first_part.c_str());
+    {
+        NxStorage input(rawnand.path.c_str());
+        input.setSplitSize(0x2000000);
+        input.setJournalInterval(0x800000);
+        s_interrupted = &input;
+        CHECK(input.dumpToFile(out.c_str(), MD5_HASH, stopAt40MB) == ERR_USER_ABORT);
+    }
+
+    NxJournal journal(journal_path.c_str());
+    REQUIRE(journal.isValid());
+    CHECK(journal.info().type == "RAWNAND");
+    {
+        NxStorage input(rawnand.path.c_str());
+        input.setSplitSize(0x2000000);
+        input.setJournalInterval(0x800000);
+        input.setResumeJournal(true);
+        REQUIRE(input.dumpToFile(out.c_str(), MD5_HASH, noProgress) == SUCCESS);
+    }
+    CHECK(!is_file(journal_path.c_str()));
+
+    std::vector<u8> joined, expected;
+    REQUIRE(readParts(first_part, &joined));
+    REQUIRE(readFile(rawnand.path, &expected));
+    CHECK(joined == expected);
+}
+
+TEST(journal_reload_matches)
+{
+    std::vector<u8> data = randomBytes(0x480000, 10);
+    std::string path = writeJournal(data);
+
+    NxJournal journal(path.c_str());
+    REQUIRE(journal.isValid());
+    CHECK(journal.info().type == "FULL NAND");
+    CHECK(journal.info().input == "/dev/mmcblk1");
+    CHECK(journal.matches(journalInfo()));
+
+    NxJournalInfo other = journalInfo();
+    other.split_size = 0;
+    CHECK(!journal.matches(other));
+    other = journalInfo();
+    other.type = "RAWNAND";
+    CHECK(!journal.matches(other));
+}
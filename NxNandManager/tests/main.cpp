@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "../res/utils.h"
+#include "test.h"
+#include "fixtures.h"
+
+bool isdebug = false;
+
+static int s_failures;
+
+std::vector<NxTestCase>& nxTests()
+{
+    static std::vector<NxTestCase> tests;
+    return tests;
+}
+
+void nxTestFail(const char *file, int line, const char *expr)
+{
+    printf("    %s:%d: CHECK failed: %s\n", file, line, expr);
+    s_failures++;
+}
+
+// Usage : nxtests [name filter]
+int main(int argc, char *argv[])
+{
+    removeTree(NXT_WORK_DIR);
+    makeDir(NXT_WORK_DIR);
+
+    int run = 0, failed = 0;
+    for (NxTestCase &test : nxTests())
+    {
+        if (argc > 1 && nullptr == strstr(test.name, argv[1]))
+            continue;
+
+        int failures = s_failures;
+        test.func();
+        run++;
+        bool passed = failures == s_failures;
+        failed += !passed;
+        printf("%s %s\n", passed ? "[ OK ]" : "[FAIL]", test.name);
+        fflush(stdout);
+    }
+
+    removeTree(NXT_WORK_DIR);
+    printf("%d test(s), %d failed\n", run, failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include "../NxStorage.h"
+#include "../NxSplitWriter.h"
+#include "test.h"
+#include "fixtures.h"
+
+TEST(split_part_names)
+{
+    CHECK(NxSplitWriter::firstPart("BOOT0") == "BOOT0.00");
+    CHECK(NxSplitWriter::firstPart("dir.v2/BOOT0") == "dir.v2/BOOT0.00");
+    CHECK(NxSplitWriter::firstPart("rawnand.bin") == "rawnand.bin.00");
+    CHECK(NxSplitWriter::firstPart("rawnand.bin.00") == "rawnand.bin.00");
+    CHECK(NxSplitWriter::firstPart("full.00.bin") == "full.00.bin");
+    CHECK(NxSplitWriter::firstPart("00") == "00");
+
+    CHECK(NxSplitWriter::nextPart("BOOT0.00") == "BOOT0.01");
+    CHECK(NxSplitWriter::nextPart("rawnand.bin.09") == "rawnand.bin.10");
+    CHECK(NxSplitWriter::nextPart("full.00.bin") == "full.01.bin");
+    CHECK(NxSplitWriter::nextPart("dir/07") == "dir/08");
+    CHECK(NxSplitWriter::nextPart("rawnand.bin.99") == "");
+    CHECK(NxSplitWriter::nextPart("BOOT0") == "");
+    CHECK(NxSplitWriter::nextPart("rawnand.bin") == "");
+
+    std::string prefix, suffix;
+    int number, digits;
+    REQUIRE(NxSplitWriter::parsePart("full.12.bin", &prefix, &number, &digits, &suffix));
+    CHECK(prefix == "full.");
+    CHECK(number == 12);
+    CHECK(digits == 2);
+    CHECK(suffix == ".bin");
+}
+
+TEST(split_rawnand_dump)
+{
+    const NxtRawnand &rawnand = rawnandFixture();
+    NxStorage input(rawnand.path.c_str());
+    input.setSplitSize(0x1000000);
+    std::string out = workPath("split_rawnand.bin");
+    REQUIRE(input.dumpToFile(out.c_str(), MD5_HASH, noProgress) == SUCCESS);
+
+    // Every part is full but the last one
+    std::string part = NxSplitWriter::firstPart(out.c_str());
+    std::vector<u8> data, joined;
+    for (u64 count = 0; is_file(part.c_str()); part = NxSplitWriter::nextPart(part), count++)
+    {
+        REQUIRE(readFile(part, &data));
+        CHECK(data.size() == std::min((u64)0x1000000, rawnand.size - count * 0x1000000));
+    }
+    CHECK(readParts(NxSplitWriter::firstPart(out.c_str()), &joined));
+    std::vector<u8> expected;
+    REQUIRE(readFile(rawnand.path, &expected));
+    CHECK(joined == expected);
+}
+
+// Split dump is reopened from its first part, as a whole
+static void splitThenReopen(const std::string &input_path, NxStorage &input, const char *out_name, u64 split_size, int type, u64 size)
+{
+    std::string out = workPath(out_name), first_part = NxSplitWriter::firstPart(out.c_str());
+    input.setSplitSize(split_size);
+    REQUIRE(input.dumpToFile(out.c_str(), MD5_HASH_FULL, noProgress) == SUCCESS);
+    CHECK(is_file(NxSplitWriter::nextPart(first_part).c_str()));
+
+    NxStorage split(first_part.c_str());
+    CHECK(split.type == type);
+    CHECK(split.isSplitted());
+    CHECK(split.size() == size);
+
+    std::vector<u8> joined, expected;
+    REQUIRE(readParts(first_part, &joined));
+    REQUIRE(readFile(input_path, &expected));
+    CHECK(joined == expected);
+
+    // Dump of the split storage is the original
+    std::string raw = out + ".joined";
+    REQUIRE(split.dumpToFile(raw.c_str(), MD5_HASH, noProgress) == SUCCESS);
+    CHECK(sameContent(raw, input_path));
+}
+
+TEST(split_boot0_reopen)
+{
+    std::string boot0 = boot0Fixture();
+    NxStorage input(boot0.c_str());
+    REQUIRE(input.type == BOOT0);
+    splitThenReopen(boot0, input, "BOOT0", 0x100000, BOOT0, 0x400000);
+}
+
+TEST(split_rawnand_reopen)
+{
+    const NxtRawnand &rawnand = rawnandFixture();
+    NxStorage input(rawnand.path.c_str());
+    REQUIRE(input.type == RAWNAND);
+    splitThenReopen(rawnand.path, input, "full.00.bin", 0x2000000, RAWNAND, rawnand.size);
+
+    NxStorage split(workPath("full.00.bin").c_str());
+    CHECK(split.partitions.size() == 3);
+    CHECK(nullptr != split.getNxPartition(SYSTEM));
+}
+
+TEST(split_partition_reopen)
+{
+    const NxtRawnand &rawnand = rawnandFixture();
+    NxStorage input(rawnand.path.c_str());
+    NxPartition *safe = input.getNxPartition(SAFE);
+    REQUIRE(nullptr != safe);
+
+    std::string out = workPath("SAFE"), first_part = NxSplitWriter::firstPart(out.c_str());
+    input.setSplitSize(0x1000000);
+    REQUIRE(safe->dumpToFile(out.c_str(), MD5_HASH_FULL) == SUCCESS);
+
+    NxStorage split(first_part.c_str());
+    CHECK(split.type == SAFE);
+    CHECK(split.isSplitted());
+    CHECK(split.size() == 0x4000000);
+    REQUIRE(nullptr != split.getNxPartition(SAFE));
+    CHECK(nullptr != split.getNxPartition(SAFE)->fat32_getEntry("/ok.bin"));
+}
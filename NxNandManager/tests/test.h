@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __nxtest_h__
+#define __nxtest_h__
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Minimal test harness : TEST() registers a case, CHECK() records a failure and goes on,
+// REQUIRE() records a failure and leaves the case
+typedef struct NxTestCase NxTestCase;
+struct NxTestCase {
+    const char *name;
+    void (*func)();
+};
+
+std::vector<NxTestCase>& nxTests();
+void nxTestFail(const char *file, int line, const char *expr);
+
+struct NxTestRegistrar {
+    NxTestRegistrar(const char *name, void (*func)()) { nxTests().push_back({ name, func }); }
+};
+
+#define TEST(name) \
+    static void name(); \
+    static NxTestRegistrar name##_registrar(#name, name); \
+    static void name()
+
+#define CHECK(expr) do { if (!(expr)) nxTestFail(__FILE__, __LINE__, #expr); } while (0)
+#define REQUIRE(expr) do { if (!(expr)) { nxTestFail(__FILE__, __LINE__, #expr); return; } } while (0)
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2019 eliboa
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fstream>
+#include "../NxStorage.h"
+#include "test.h"
+#include "fixtures.h"
+
+static std::string hashOf(const std::vector<u8> &data, int algorithm = HASH_MD5)
+{
+    NxHash hash(algorithm);
+    hash.update(data.data(), data.size());
+    return hash.checksum();
+}
+
+TEST(verify_read_back)
+{
+    std::vector<u8> data = randomBytes(0x300000, 700);
+    std::string path = workPath("read_back.bin");
+    REQUIRE(writeFile(path, data));
+
+    // Block by block, as a dump writes the output
+    for (int algorithm : { HASH_MD5, HASH_XXH3 })
+    {
+        NxReadBack read_back(path.c_str(), algorithm);
+        for (int i = 0; i < 3; i++)
+            CHECK(read_back.update(0x100000));
+        CHECK(read_back.bytesCount() == data.size());
+        CHECK(read_back.checksum() == hashOf(data, algorithm));
+    }
+}
+
+TEST(verify_read_back_mismatch)
+{
+    std::vector<u8> data = randomBytes(0x300000, 701);
+    std::string path = workPath("read_back_bad.bin");
+    REQUIRE(writeFile(path, data));
+
+    NxReadBack read_back(path.c_str(), HASH_MD5);
+    CHECK(read_back.update(0x100000));
+
+    // One byte of the next block doesn't reach the output as written
+    std::fstream out(path, std::fstream::in | std::fstream::out | std::fstream::binary);
+    out.seekp(0x180000);
+    out.put((char)~data[0x180000]);
+    out.close();
+
+    CHECK(read_back.update(0x100000));
+    CHECK(read_back.update(0x100000));
+    CHECK(read_back.checksum() != hashOf(data));
+
+    // Nothing to read back past the end of output
+    NxReadBack short_output(path.c_str(), HASH_MD5);
+    CHECK(short_output.update(0x300000));
+    CHECK(!short_output.update(0x1000));
+    CHECK(short_output.checksum().empty());
+}
+
+TEST(verify_manifest_damaged_ranges)
+{
+    const NxtRawnand &rawnand = rawnandFixture();
+    std::string out = workPath("manifest_rawnand.bin");
+    {
+        NxStorage input(rawnand.path.c_str());
+        input.setManifestOutput(true);
+        REQUIRE(input.dumpToFile(out.c_str(), MD5_HASH, noProgress) == SUCCESS);
+    }
+
+    NxManifest manifest(NxManifest::path(out.c_str()).c_str());
+    REQUIRE(manifest.isValid());
+    CHECK(manifest.size() == rawnand.size);
+    CHECK(manifest.blockCount() == (rawnand.size + NXM_BLOCK_SIZE - 1) / NXM_BLOCK_SIZE);
+    REQUIRE(nullptr != manifest.getPart("SYSTEM"));
+    CHECK(manifest.getPart("SYSTEM")->offset == rawnand.system_offset);
+    CHECK(manifest.getPart("SYSTEM")->size == rawnand.system_size);
+
+    std::vector<NxManifestPart> damaged;
+    {
+        NxStorage dump(out.c_str());
+        CHECK(dump.verifyManifest(&manifest, nullptr, &damaged, noProgress) == SUCCESS);
+        CHECK(damaged.empty());
+    }
+
+    // One byte in SAFE, one in the block shared by SAFE & SYSTEM, ranges are whole blocks
+    std::fstream file(out, std::fstream::in | std::fstream::out | std::fstream::binary);
+    for (u64 offset : { rawnand.safe_offset + 0x500000, rawnand.system_offset + 0x10 })
+    {
+        file.seekg((std::streamoff)offset);
+        char c = (char)file.get();
+        file.seekp((std::streamoff)offset);
+        file.put((char)~c);
+    }
+    file.close();
+
+    NxStorage dump(out.c_str());
+    CHECK(dump.verifyManifest(&manifest, nullptr, &damaged, noProgress) == ERR_MD5_COMPARE);
+    REQUIRE(damaged.size() == 2);
+    CHECK(damaged[0].offset == 0x400000 && damaged[0].size == NXM_BLOCK_SIZE);
+    CHECK(damaged[0].name == "SAFE");
+    CHECK(damaged[1].offset == rawnand.system_offset / NXM_BLOCK_SIZE * NXM_BLOCK_SIZE && damaged[1].size == NXM_BLOCK_SIZE);
+    CHECK(damaged[1].name == "SAFE, SYSTEM");
+
+    // Partition only
+    damaged.clear();
+    CHECK(dump.verifyManifest(&manifest, "SYSTEM", &damaged, noProgress) == ERR_MD5_COMPARE);
+    REQUIRE(damaged.size() == 1);
+    CHECK(damaged[0].name == "SAFE, SYSTEM");
+}
+
+TEST(verify_manifest_type)
+{
+    // Type may contain spaces
+    std::string out = workPath("manifest_type.nxm");
+    NxManifest manifest("FULL NAND", NXM_BLOCK_SIZE + 0x200, HASH_XXH3);
+    manifest.addPart("BOOT0", 0, 0x200);
+    manifest.update(nullptr, NXM_BLOCK_SIZE + 0x200);
+    REQUIRE(manifest.write(out.c_str()));
+
+    NxManifest reloaded(out.c_str());
+    REQUIRE(reloaded.isValid());
+    CHECK(reloaded.type() == "FULL NAND");
+    CHECK(reloaded.size() == NXM_BLOCK_SIZE + 0x200);
+    CHECK(reloaded.blockCount() == 2);
+    CHECK(reloaded.blockHash(1) == manifest.blockHash(1));
+}